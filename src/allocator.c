@@ -0,0 +1,275 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file allocator.c
+
+	@brief Pluggable memory allocation functions
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+
+static void * heap_allocate(void * user, size_t size) {
+	(void) user;
+	return malloc(size);
+}
+
+
+static void * heap_reallocate(void * user, void * ptr, size_t size) {
+	(void) user;
+	return realloc(ptr, size);
+}
+
+
+static void heap_release(void * user, void * ptr) {
+	(void) user;
+	free(ptr);
+}
+
+
+/// Default allocator, using malloc(), realloc(), and free()
+const tdp_allocator tdp_heap_allocator = {
+	heap_allocate,
+	heap_reallocate,
+	heap_release,
+	NULL
+};
+
+
+/// Allocate memory (a NULL allocator uses the heap)
+void * tdp_malloc(const tdp_allocator * a, size_t size) {
+	if (a == NULL) {
+		return malloc(size);
+	}
+
+	return a->allocate(a->user, size);
+}
+
+
+/// Resize memory (a NULL allocator uses the heap)
+void * tdp_realloc(const tdp_allocator * a, void * ptr, size_t size) {
+	if (a == NULL) {
+		return realloc(ptr, size);
+	}
+
+	return a->reallocate(a->user, ptr, size);
+}
+
+
+/// Free memory (a NULL allocator uses the heap)
+void tdp_free(const tdp_allocator * a, void * ptr) {
+	if (ptr == NULL) {
+		return;
+	}
+
+	if (a == NULL) {
+		free(ptr);
+	} else {
+		a->release(a->user, ptr);
+	}
+}
+
+
+/* Arena */
+
+#define kArenaAlignment 16				//!< Alignment for memory returned by an arena
+
+/// Each allocation is preceded by a header recording its size
+#define kArenaHeaderSize kArenaAlignment
+
+
+/// Round up to arena alignment
+#define arena_align(x) (((x) + kArenaAlignment - 1) & ~((size_t)kArenaAlignment - 1))
+
+/// Size of an allocation from an arena
+#define arena_allocation_size(ptr) (*(size_t *)((char *)(ptr) - kArenaHeaderSize))
+
+
+static void * arena_allocate(void * user, size_t size) {
+	tdp_arena * arena = user;
+	size_t needed = kArenaHeaderSize + arena_align(size);
+
+	if (arena->used + needed > arena->size) {
+		// Remember how much more memory we would need.  A larger arena
+		// would hold this request as well as every later one, and the most
+		// recent allocation would no longer be resized or reclaimed in place.
+		arena->shortfall += needed;
+		arena->last = NULL;
+		return NULL;
+	}
+
+	char * header = arena->buffer + arena->used;
+	*(size_t *)header = size;
+	arena->used += needed;
+
+	arena->last = header + kArenaHeaderSize;
+	return arena->last;
+}
+
+
+static void * arena_reallocate(void * user, void * ptr, size_t size) {
+	tdp_arena * arena = user;
+
+	if (ptr == NULL) {
+		return arena_allocate(user, size);
+	}
+
+	size_t old_size = arena_allocation_size(ptr);
+
+	if (ptr == arena->last) {
+		// Resize most recent allocation in place
+		size_t start = (char *)ptr - arena->buffer;
+
+		if (start + arena_align(size) <= arena->size) {
+			arena_allocation_size(ptr) = size;
+			arena->used = start + arena_align(size);
+			return ptr;
+		}
+	}
+
+	void * result = arena_allocate(user, size);
+
+	if (result) {
+		memcpy(result, ptr, (old_size < size) ? old_size : size);
+	}
+
+	return result;
+}
+
+
+static void arena_release(void * user, void * ptr) {
+	tdp_arena * arena = user;
+
+	if (ptr == arena->last) {
+		// Most recent allocation can be reclaimed
+		arena->used = (char *)ptr - kArenaHeaderSize - arena->buffer;
+		arena->last = NULL;
+	}
+}
+
+
+/// Number of bytes of an arena used by a request for `size` bytes
+size_t tdp_arena_cost(size_t size) {
+	return kArenaHeaderSize + arena_align(size);
+}
+
+
+/// Size of buffer that would have met every request made of `arena`,
+/// including room to align it
+size_t tdp_arena_needed(const tdp_arena * arena) {
+	return arena->size + arena->shortfall + kArenaAlignment - 1;
+}
+
+
+/// Initialize arena to allocate from `buffer`.  Use `&arena->allocator`
+/// wherever an allocator is needed.
+void tdp_arena_init(tdp_arena * arena, void * buffer, size_t size) {
+	// Start at an aligned address
+	size_t offset = arena_align((size_t)buffer) - (size_t)buffer;
+
+	if (offset > size) {
+		offset = size;
+	}
+
+	arena->buffer = (char *)buffer + offset;
+	arena->size = size - offset;
+	arena->used = 0;
+	arena->last = NULL;
+	arena->shortfall = 0;
+
+	arena->allocator.allocate = arena_allocate;
+	arena->allocator.reallocate = arena_reallocate;
+	arena->allocator.release = arena_release;
+	arena->allocator.user = arena;
+}
+
+
+#ifdef TEST
+void Test_tdp_arena(CuTest * tc) {
+	char buffer[256];
+	tdp_arena arena;
+	tdp_arena_init(&arena, buffer, sizeof(buffer));
+	const tdp_allocator * a = &arena.allocator;
+
+	char * first = tdp_malloc(a, 10);
+	CuAssertPtrNotNull(tc, first);
+	CuAssertIntEquals(tc, 0, (size_t)first % kArenaAlignment);
+	strcpy(first, "foo");
+
+	// Most recent allocation grows in place
+	CuAssertPtrEquals(tc, first, tdp_realloc(a, first, 40));
+
+	// Otherwise we get a copy
+	char * second = tdp_malloc(a, 10);
+	char * copy = tdp_realloc(a, first, 50);
+	CuAssertTrue(tc, copy != first);
+	CuAssertStrEquals(tc, "foo", copy);
+
+	// Most recent allocation can be released
+	size_t used = arena.used;
+	tdp_free(a, copy);
+	CuAssertTrue(tc, arena.used < used);
+
+	// Too large
+	CuAssertPtrEquals(tc, NULL, tdp_malloc(a, 1000));
+	CuAssertIntEquals(tc, tdp_arena_cost(1000), arena.shortfall);
+	CuAssertPtrNotNull(tc, second);
+
+	// Every failed request is counted
+	CuAssertPtrEquals(tc, NULL, tdp_malloc(a, 500));
+	CuAssertIntEquals(tc, tdp_arena_cost(1000) + tdp_arena_cost(500), arena.shortfall);
+}
+#endif
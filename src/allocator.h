@@ -0,0 +1,141 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file allocator.h
+
+	@brief Pluggable memory allocation functions
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#ifndef ALLOCATOR_TDP_PARSER_H
+#define ALLOCATOR_TDP_PARSER_H
+
+#include <stddef.h>
+
+
+/// Memory allocation functions used by libTDP.  Each function receives
+/// the `user` pointer, so that memory can be routed to an arena, pool,
+/// or accounting scheme.  The structure must remain valid for as long as
+/// anything allocated with it is in use.
+struct tdp_allocator {
+	void *	(*allocate)(void * user, size_t size);					//!< Equivalent of malloc()
+	void *	(*reallocate)(void * user, void * ptr, size_t size);	//!< Equivalent of realloc()
+	void	(*release)(void * user, void * ptr);					//!< Equivalent of free()
+	void *	user;													//!< Passed to each function
+};
+
+typedef struct tdp_allocator tdp_allocator;
+
+
+/// Default allocator, using malloc(), realloc(), and free()
+extern const tdp_allocator tdp_heap_allocator;
+
+
+/// Allocator that hands out memory from a fixed buffer provided by the
+/// caller, so that no heap memory is used.  Memory is only reclaimed when
+/// the arena is initialized again (except for the most recent allocation).
+struct tdp_arena {
+	char *			buffer;				//!< Memory to allocate from
+	size_t			size;				//!< Size of buffer
+	size_t			used;				//!< Number of bytes used so far
+	void *			last;				//!< Most recent allocation (can be resized in place)
+	size_t			shortfall;			//!< Total size of requests that could not be met
+
+	tdp_allocator	allocator;			//!< Allocator interface for this arena
+};
+
+typedef struct tdp_arena tdp_arena;
+
+
+/// Initialize arena to allocate from `buffer`.  Use `&arena->allocator`
+/// wherever an allocator is needed.
+void tdp_arena_init(
+	tdp_arena * arena,					//!< Arena to initialize
+	void * buffer,						//!< Memory to allocate from
+	size_t size							//!< Size of buffer
+);
+
+
+/// Size of buffer that would have met every request made of `arena`,
+/// including room to align it
+size_t tdp_arena_needed(
+	const tdp_arena * arena				//!< Arena to examine
+);
+
+
+/// Number of bytes of an arena used by a request for `size` bytes,
+/// including its header and alignment
+size_t tdp_arena_cost(
+	size_t size							//!< Size of request
+);
+
+
+/// Allocate memory (a NULL allocator uses the heap)
+void * tdp_malloc(
+	const tdp_allocator * a,			//!< Allocator to use
+	size_t size							//!< Number of bytes to allocate
+);
+
+
+/// Resize memory (a NULL allocator uses the heap)
+void * tdp_realloc(
+	const tdp_allocator * a,			//!< Allocator to use
+	void * ptr,							//!< Memory to resize
+	size_t size							//!< New size in bytes
+);
+
+
+/// Free memory (a NULL allocator uses the heap)
+void tdp_free(
+	const tdp_allocator * a,			//!< Allocator to use
+	void * ptr							//!< Memory to free
+);
+
+
+#endif
@@ -0,0 +1,781 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file arrow.c
+
+	@brief Write Apache Arrow IPC streams and files, without depending on
+	the Arrow or flatbuffers libraries.  Message metadata is a small
+	flatbuffer, built front to back: each table is preceded by its vtable,
+	and followed by the strings, vectors, and tables it refers to.
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+
+#include <string.h>
+
+#include "arrow.h"
+#include "libTDP.h"
+#include "parquet.h"
+
+
+// Values from the Arrow format (Schema.fbs, Message.fbs, File.fbs)
+#define kArrowMetadataV5		4
+#define kArrowHeaderSchema		1
+#define kArrowHeaderRecordBatch	3
+#define kArrowTypeInt			2
+#define kArrowTypeFloatingPoint	3
+#define kArrowTypeUtf8			5
+#define kArrowTypeBool			6
+#define kArrowPrecisionDouble	2
+
+#define kArrowAlignment			8		//!< Alignment of messages and buffers
+
+
+static const char zeros[32] = {0};
+
+
+/// Append `bytes` bytes of `value`, little-endian
+static void append_le(DString * s, uint64_t value, int bytes) {
+	char buffer[8];
+
+	for (int i = 0; i < bytes; ++i) {
+		buffer[i] = (char) (value & 0xff);
+		value >>= 8;
+	}
+
+	d_string_append_c_array(s, buffer, bytes);
+}
+
+
+/// Store `bytes` bytes of `value` at `pos`, little-endian
+static void store_le(DString * s, size_t pos, uint64_t value, int bytes) {
+	for (int i = 0; i < bytes; ++i) {
+		s->str[pos + i] = (char) (value & 0xff);
+		value >>= 8;
+	}
+}
+
+
+/// Pad with zeros to a multiple of `align`
+static void pad(DString * s, size_t align) {
+	size_t extra = s->currentStringLength % align;
+
+	if (extra) {
+		d_string_append_c_array(s, zeros, align - extra);
+	}
+}
+
+
+/// Round up to a multiple of kArrowAlignment
+static inline size_t padded(size_t len) {
+	return (len + kArrowAlignment - 1) & ~((size_t) kArrowAlignment - 1);
+}
+
+
+/// Append a bit to a bitmap holding `index` bits
+static void append_bit(DString * s, size_t index, bool value) {
+	if (index % 8 == 0) {
+		d_string_append_c_array(s, zeros, 1);
+	}
+
+	if (value) {
+		s->str[s->currentStringLength - 1] |= (char) (1 << (index % 8));
+	}
+}
+
+
+/// Write a table, preceded by its vtable of `slots` field offsets (0 if
+/// absent).  The `size` bytes of table data are zeroed.  Returns position
+/// of table.
+static size_t fb_table(DString * b, int slots, const uint16_t * fields, size_t size) {
+	size_t vtable = b->currentStringLength;
+	size_t table;
+
+	append_le(b, 4 + 2 * slots, 2);
+	append_le(b, size, 2);
+
+	for (int i = 0; i < slots; ++i) {
+		append_le(b, fields[i], 2);
+	}
+
+	// Tables are 8 byte aligned, so that 64-bit fields are too
+	pad(b, 8);
+	table = b->currentStringLength;
+
+	append_le(b, table - vtable, 4);
+	d_string_append_c_array(b, zeros, size - 4);
+
+	return table;
+}
+
+
+/// Set offset field at `pos` to point to `target`
+static void fb_point(DString * b, size_t pos, size_t target) {
+	store_le(b, pos, target - pos, 4);
+}
+
+
+/// Set offset field at `pos` to point to the next object written
+static void fb_link(DString * b, size_t pos) {
+	pad(b, 4);
+	fb_point(b, pos, b->currentStringLength);
+}
+
+
+/// Write string, pointed to from `pos`
+static void fb_string(DString * b, size_t pos, const char * text, size_t len) {
+	fb_link(b, pos);
+	append_le(b, len, 4);
+	d_string_append_c_array(b, text, len);
+	d_string_append_c_array(b, zeros, 1);
+}
+
+
+/// Start a vector of `count` table offsets, pointed to from `pos`.
+/// Returns position of first offset.
+static size_t fb_offset_vector(DString * b, size_t pos, size_t count) {
+	fb_link(b, pos);
+	append_le(b, count, 4);
+
+	size_t first = b->currentStringLength;
+
+	for (size_t i = 0; i < count; ++i) {
+		append_le(b, 0, 4);
+	}
+
+	return first;
+}
+
+
+/// Start a vector of `count` structs containing 64-bit fields, pointed to
+/// from `pos`.  The caller appends the structs.
+static void fb_struct_vector(DString * b, size_t pos, size_t count) {
+	// Length precedes first struct, which is 8 byte aligned
+	pad(b, 4);
+
+	if (b->currentStringLength % 8 == 0) {
+		append_le(b, 0, 4);
+	}
+
+	fb_link(b, pos);
+	append_le(b, count, 4);
+}
+
+
+/// Write type table for a column, pointed to from `pos`.  Returns type id.
+static uint8_t fb_type(DString * b, size_t pos, short type) {
+	static const uint16_t int_fields[] = {4, 8};			// bitWidth, is_signed
+	static const uint16_t float_fields[] = {4};			// precision
+	size_t table;
+
+	switch (type) {
+		case TDP_TYPE_INT:
+			table = fb_table(b, 2, int_fields, 12);
+			store_le(b, table + 4, 64, 4);
+			store_le(b, table + 8, 1, 1);
+			fb_point(b, pos, table);
+			return kArrowTypeInt;
+
+		case TDP_TYPE_FLOAT:
+			table = fb_table(b, 1, float_fields, 8);
+			store_le(b, table + 4, kArrowPrecisionDouble, 2);
+			fb_point(b, pos, table);
+			return kArrowTypeFloatingPoint;
+
+		case TDP_TYPE_BOOL:
+			fb_point(b, pos, fb_table(b, 0, NULL, 4));
+			return kArrowTypeBool;
+
+		default:
+			fb_point(b, pos, fb_table(b, 0, NULL, 4));
+			return kArrowTypeUtf8;
+	}
+}
+
+
+/// Write Schema table, pointed to from `pos`
+static void fb_schema(arrow_writer * w, DString * b, size_t pos) {
+	static const uint16_t schema_fields[] = {8, 4};		// endianness, fields
+	static const uint16_t field_fields[] = {4, 16, 17, 8, 0, 12};	// name, nullable, type_type, type, dictionary, children
+
+	size_t schema = fb_table(b, 2, schema_fields, 12);
+	fb_point(b, pos, schema);
+
+	size_t vector = fb_offset_vector(b, schema + 4, w->count);
+
+	for (size_t i = 0; i < w->count; ++i) {
+		arrow_column * c = &w->columns[i];
+		size_t field = fb_table(b, 6, field_fields, 20);
+
+		fb_point(b, vector + 4 * i, field);
+		store_le(b, field + 16, 1, 1);
+		store_le(b, field + 17, fb_type(b, field + 8, c->type), 1);
+		fb_string(b, field + 4, c->name, c->name_len);
+
+		// No children
+		fb_link(b, field + 12);
+		append_le(b, 0, 4);
+	}
+}
+
+
+/// Start a new Message in w->metadata.  Returns position of the header
+/// field.
+static size_t fb_message(DString * b, uint8_t header_type, size_t body_length) {
+	static const uint16_t message_fields[] = {16, 18, 4, 8};	// version, header_type, header, bodyLength
+
+	d_string_erase(b, 0, -1);
+
+	// Root offset
+	append_le(b, 0, 4);
+
+	size_t message = fb_table(b, 4, message_fields, 20);
+	fb_point(b, 0, message);
+
+	store_le(b, message + 16, kArrowMetadataV5, 2);
+	store_le(b, message + 18, header_type, 1);
+	store_le(b, message + 8, body_length, 8);
+
+	return message + 4;
+}
+
+
+/// Write w->metadata as an encapsulated message (continuation marker,
+/// length, and padded metadata).  Returns number of bytes written.
+static size_t write_message(arrow_writer * w) {
+	char prefix[8] = { '\xff', '\xff', '\xff', '\xff' };
+	size_t len;
+
+	pad(w->metadata, kArrowAlignment);
+	len = w->metadata->currentStringLength;
+
+	for (int i = 0; i < 4; ++i) {
+		prefix[4 + i] = (char) ((len >> (8 * i)) & 0xff);
+	}
+
+	sink_write(w->out, prefix, 8);
+	sink_write(w->out, w->metadata->str, len);
+
+	return len + 8;
+}
+
+
+/// Write a buffer of the message body, padded
+static void write_buffer(arrow_writer * w, DString * buffer) {
+	sink_write(w->out, buffer->str, buffer->currentStringLength);
+	sink_write(w->out, zeros, padded(buffer->currentStringLength) - buffer->currentStringLength);
+}
+
+
+/// Add Buffer struct describing `buffer` to metadata
+static void describe_buffer(DString * b, DString * buffer, size_t * offset) {
+	append_le(b, *offset, 8);
+	append_le(b, buffer->currentStringLength, 8);
+	*offset += padded(buffer->currentStringLength);
+}
+
+
+/// Clear column buffers for next batch
+static void reset_columns(arrow_writer * w) {
+	for (size_t i = 0; i < w->count; ++i) {
+		arrow_column * c = &w->columns[i];
+
+		c->rows = 0;
+		c->null_count = 0;
+		d_string_erase(c->validity, 0, -1);
+		d_string_erase(c->values, 0, -1);
+
+		if (c->offsets) {
+			d_string_erase(c->offsets, 0, -1);
+			append_le(c->offsets, 0, 4);
+		}
+	}
+
+	w->rows = 0;
+}
+
+
+/// Write current rows as a record batch
+static void write_batch(arrow_writer * w) {
+	static const uint16_t batch_fields[] = {8, 4, 16};	// length, nodes, buffers
+
+	DString * b = w->metadata;
+	size_t body = 0;
+	size_t buffers = 0;
+	size_t offset = 0;
+	arrow_column * c;
+
+	for (size_t i = 0; i < w->count; ++i) {
+		c = &w->columns[i];
+		buffers += c->offsets ? 3 : 2;
+		body += padded(c->validity->currentStringLength) + padded(c->values->currentStringLength);
+
+		if (c->offsets) {
+			body += padded(c->offsets->currentStringLength);
+		}
+	}
+
+	size_t header = fb_message(b, kArrowHeaderRecordBatch, body);
+	size_t batch = fb_table(b, 3, batch_fields, 20);
+
+	fb_point(b, header, batch);
+	store_le(b, batch + 8, w->rows, 8);
+
+	// FieldNode for each column
+	fb_struct_vector(b, batch + 4, w->count);
+
+	for (size_t i = 0; i < w->count; ++i) {
+		append_le(b, w->rows, 8);
+		append_le(b, w->columns[i].null_count, 8);
+	}
+
+	// Buffer for each validity bitmap, offsets, and values
+	fb_struct_vector(b, batch + 16, buffers);
+
+	for (size_t i = 0; i < w->count; ++i) {
+		c = &w->columns[i];
+		describe_buffer(b, c->validity, &offset);
+
+		if (c->offsets) {
+			describe_buffer(b, c->offsets, &offset);
+		}
+
+		describe_buffer(b, c->values, &offset);
+	}
+
+	size_t start = w->out->total;
+	size_t metadata = write_message(w);
+
+	for (size_t i = 0; i < w->count; ++i) {
+		c = &w->columns[i];
+		write_buffer(w, c->validity);
+
+		if (c->offsets) {
+			write_buffer(w, c->offsets);
+		}
+
+		write_buffer(w, c->values);
+	}
+
+	if (w->format == TDP_OUTPUT_ARROW) {
+		// Block struct for footer
+		append_le(w->blocks, start, 8);
+		append_le(w->blocks, metadata, 4);
+		append_le(w->blocks, 0, 4);
+		append_le(w->blocks, body, 8);
+		w->block_count++;
+	}
+}
+
+
+/// Create a writer
+arrow_writer * arrow_writer_new(const tdp_allocator * allocator, sink * out, short format, size_t batch_size) {
+	arrow_writer * w = tdp_malloc(allocator, sizeof(arrow_writer));
+
+	if (w) {
+		w->allocator = allocator;
+		w->out = out;
+		w->format = format;
+		w->compression = TDP_COMPRESSION_NONE;
+		w->batch_size = batch_size ? batch_size : kArrowBatchSize;
+		w->rows = 0;
+		w->total_rows = 0;
+
+		w->columns = NULL;
+		w->count = 0;
+		w->capacity = 0;
+
+		w->metadata = d_string_new_with_allocator(allocator, "");
+		w->blocks = d_string_new_with_allocator(allocator, "");
+		w->block_count = 0;
+		w->page = d_string_new_with_allocator(allocator, "");
+		w->compressed = NULL;				// Created when needed
+		w->codec = NULL;
+		w->compressed_size = 0;
+
+		if (!w->metadata || !w->blocks || !w->page) {
+			arrow_writer_free(w);
+			return NULL;
+		}
+	}
+
+	return w;
+}
+
+
+/// Free writer
+void arrow_writer_free(arrow_writer * w) {
+	if (w) {
+		for (size_t i = 0; i < w->count; ++i) {
+			tdp_free(w->allocator, w->columns[i].name);
+			d_string_free(w->columns[i].validity, true);
+			d_string_free(w->columns[i].offsets, true);
+			d_string_free(w->columns[i].values, true);
+		}
+
+		tdp_free(w->allocator, w->columns);
+		d_string_free(w->metadata, true);
+		d_string_free(w->blocks, true);
+		d_string_free(w->page, true);
+		tdp_free(w->allocator, w->compressed);
+		block_compressor_free(w->codec);
+		tdp_free(w->allocator, w);
+	}
+}
+
+
+/// Add a column
+bool arrow_writer_add_column(arrow_writer * w, const char * name, size_t len, short type) {
+	if (w->count == w->capacity) {
+		size_t capacity = w->capacity ? w->capacity * 2 : 16;
+		arrow_column * columns = tdp_realloc(w->allocator, w->columns, capacity * sizeof(arrow_column));
+
+		if (!columns) {
+			return false;
+		}
+
+		w->columns = columns;
+		w->capacity = capacity;
+	}
+
+	arrow_column * c = &w->columns[w->count];
+
+	switch (type) {
+		case TDP_TYPE_INT:
+		case TDP_TYPE_FLOAT:
+		case TDP_TYPE_BOOL:
+			c->type = type;
+			break;
+
+		default:
+			c->type = TDP_TYPE_STRING;
+			break;
+	}
+
+	c->name = tdp_malloc(w->allocator, len + 1);
+	c->name_len = len;
+	c->rows = 0;
+	c->null_count = 0;
+	c->validity = d_string_new_with_allocator(w->allocator, "");
+	c->values = d_string_new_with_allocator(w->allocator, "");
+	c->offsets = (c->type == TDP_TYPE_STRING) ? d_string_new_with_allocator(w->allocator, "") : NULL;
+
+	// Count column first so that it is freed if incomplete
+	w->count++;
+
+	if (!c->name || !c->validity || !c->values || (c->type == TDP_TYPE_STRING && !c->offsets)) {
+		return false;
+	}
+
+	memcpy(c->name, name, len);
+	c->name[len] = '\0';
+
+	return true;
+}
+
+
+/// Write the schema
+void arrow_writer_begin(arrow_writer * w) {
+	switch (w->format) {
+		case TDP_OUTPUT_PARQUET:
+			parquet_begin(w);
+			break;
+
+		case TDP_OUTPUT_ARROW:
+			sink_write(w->out, "ARROW1\0\0", 8);
+
+		// fall through -- followed by stream
+		default:
+			fb_schema(w, w->metadata, fb_message(w->metadata, kArrowHeaderSchema, 0));
+			write_message(w);
+			break;
+	}
+
+	reset_columns(w);
+}
+
+
+/// Write current rows as a record batch or row group
+static void flush_rows(arrow_writer * w) {
+	if (w->format == TDP_OUTPUT_PARQUET) {
+		parquet_write_row_group(w);
+	} else {
+		write_batch(w);
+	}
+
+	w->total_rows += w->rows;
+	reset_columns(w);
+}
+
+
+/// Record validity of the next value in `column`
+static arrow_column * next_value(arrow_writer * w, size_t column, bool valid) {
+	arrow_column * c = &w->columns[column];
+
+	append_bit(c->validity, c->rows, valid);
+
+	if (!valid) {
+		c->null_count++;
+	}
+
+	c->rows++;
+	return c;
+}
+
+
+/// Append null
+void arrow_append_null(arrow_writer * w, size_t column) {
+	arrow_column * c = next_value(w, column, false);
+
+	switch (c->type) {
+		case TDP_TYPE_INT:
+		case TDP_TYPE_FLOAT:
+			d_string_append_c_array(c->values, zeros, 8);
+			break;
+
+		case TDP_TYPE_BOOL:
+			append_bit(c->values, c->rows - 1, false);
+			break;
+	}
+}
+
+
+/// Append integer
+void arrow_append_int(arrow_writer * w, size_t column, int64_t value) {
+	arrow_column * c = next_value(w, column, true);
+
+	append_le(c->values, (uint64_t) value, 8);
+}
+
+
+/// Append double
+void arrow_append_double(arrow_writer * w, size_t column, double value) {
+	arrow_column * c = next_value(w, column, true);
+	uint64_t bits;
+
+	memcpy(&bits, &value, sizeof(double));
+	append_le(c->values, bits, 8);
+}
+
+
+/// Append boolean
+void arrow_append_bool(arrow_writer * w, size_t column, bool value) {
+	arrow_column * c = next_value(w, column, true);
+
+	append_bit(c->values, c->rows - 1, value);
+}
+
+
+/// Append string
+sink * arrow_append_string(arrow_writer * w, size_t column) {
+	arrow_column * c = next_value(w, column, true);
+
+	sink_init_string(&w->string, c->values);
+	return &w->string;
+}
+
+
+/// Finish current row
+void arrow_writer_end_row(arrow_writer * w) {
+	for (size_t i = 0; i < w->count; ++i) {
+		arrow_column * c = &w->columns[i];
+
+		if (c->rows == w->rows) {
+			arrow_append_null(w, i);
+		}
+
+		if (c->offsets) {
+			append_le(c->offsets, c->values->currentStringLength, 4);
+		}
+	}
+
+	w->rows++;
+
+	if (w->rows == w->batch_size) {
+		flush_rows(w);
+	}
+}
+
+
+/// Did any buffer fail to grow?  Dropped values leave the output incomplete.
+static bool writer_failed(const arrow_writer * w) {
+	if (w->metadata->failed || w->blocks->failed || w->page->failed) {
+		return true;
+	}
+
+	for (size_t i = 0; i < w->count; ++i) {
+		const arrow_column * c = &w->columns[i];
+
+		if (c->validity->failed || c->values->failed || (c->offsets && c->offsets->failed)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/// Write the final record batch, end of stream, and footer
+bool arrow_writer_finish(arrow_writer * w) {
+	static const uint16_t footer_fields[] = {16, 4, 8, 12};	// version, schema, dictionaries, recordBatches
+
+	if (w->rows) {
+		flush_rows(w);
+	}
+
+	if (w->format == TDP_OUTPUT_PARQUET) {
+		parquet_finish(w);
+		return !writer_failed(w);
+	}
+
+	// End of stream
+	sink_write(w->out, "\xff\xff\xff\xff\0\0\0\0", 8);
+
+	if (w->format == TDP_OUTPUT_ARROW) {
+		DString * b = w->metadata;
+
+		d_string_erase(b, 0, -1);
+		append_le(b, 0, 4);
+
+		size_t footer = fb_table(b, 4, footer_fields, 20);
+		fb_point(b, 0, footer);
+		store_le(b, footer + 16, kArrowMetadataV5, 2);
+
+		fb_schema(w, b, footer + 4);
+
+		// No dictionaries
+		fb_link(b, footer + 8);
+		append_le(b, 0, 4);
+
+		fb_struct_vector(b, footer + 12, w->block_count);
+		d_string_append_c_array(b, w->blocks->str, w->blocks->currentStringLength);
+
+		sink_write(w->out, b->str, b->currentStringLength);
+
+		char size[4];
+
+		for (int i = 0; i < 4; ++i) {
+			size[i] = (char) ((b->currentStringLength >> (8 * i)) & 0xff);
+		}
+
+		sink_write(w->out, size, 4);
+		sink_write(w->out, "ARROW1", 6);
+	}
+
+	return !writer_failed(w);
+}
+
+
+#ifdef TEST
+/// Read little-endian 32-bit value
+static uint32_t read_u32(const char * p) {
+	const unsigned char * u = (const unsigned char *) p;
+
+	return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32_t) u[3] << 24);
+}
+
+
+void Test_arrow_writer(CuTest * tc) {
+	DString * out = d_string_new("");
+	arrow_writer * w;
+	size_t pos;
+	sink s;
+
+	sink_init_string(&s, out);
+	w = arrow_writer_new(NULL, &s, TDP_OUTPUT_ARROW, 2);
+
+	CuAssertTrue(tc, arrow_writer_add_column(w, "n", 1, TDP_TYPE_INT));
+	CuAssertTrue(tc, arrow_writer_add_column(w, "name", 4, TDP_TYPE_NULL));
+	CuAssertIntEquals(tc, TDP_TYPE_STRING, w->columns[1].type);
+
+	arrow_writer_begin(w);
+	CuAssertTrue(tc, memcmp(out->str, "ARROW1\0\0\xff\xff\xff\xff", 12) == 0);
+
+	// Schema message is padded to 8 bytes
+	pos = 8 + 8 + read_u32(out->str + 12);
+	CuAssertIntEquals(tc, 0, pos % 8);
+	CuAssertIntEquals(tc, pos, out->currentStringLength);
+
+	arrow_append_int(w, 0, 42);
+	sink_write(arrow_append_string(w, 1), "abc", 3);
+	arrow_writer_end_row(w);
+
+	// Missing value is null
+	arrow_append_int(w, 0, -1);
+	arrow_writer_end_row(w);
+
+	// Batch was written
+	CuAssertIntEquals(tc, 1, w->block_count);
+	CuAssertIntEquals(tc, 0, w->rows);
+	CuAssertTrue(tc, out->currentStringLength > pos);
+
+	// Body buffers: validity, values for `n`, then validity, offsets, and
+	// values for `name`, each padded to 8 bytes
+	const char body[] = "\x03\0\0\0\0\0\0\0"
+						"\x2a\0\0\0\0\0\0\0" "\xff\xff\xff\xff\xff\xff\xff\xff"
+						"\x01\0\0\0\0\0\0\0"
+						"\0\0\0\0\x03\0\0\0\x03\0\0\0\0\0\0\0"
+						"abc\0\0\0\0\0";
+	CuAssertTrue(tc, memcmp(out->str + out->currentStringLength - (sizeof(body) - 1), body, sizeof(body) - 1) == 0);
+
+	arrow_append_int(w, 0, 7);
+	arrow_writer_end_row(w);
+	CuAssertTrue(tc, arrow_writer_finish(w));
+	CuAssertIntEquals(tc, 2, w->block_count);
+
+	// Footer and trailing magic
+	CuAssertTrue(tc, memcmp(out->str + out->currentStringLength - 6, "ARROW1", 6) == 0);
+
+	size_t footer = read_u32(out->str + out->currentStringLength - 10);
+	CuAssertTrue(tc, memcmp(out->str + out->currentStringLength - 10 - footer - 8, "\xff\xff\xff\xff\0\0\0\0", 8) == 0);
+
+	arrow_writer_free(w);
+	d_string_free(out, true);
+}
+#endif
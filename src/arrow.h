@@ -0,0 +1,207 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file arrow.h
+
+	@brief Write Apache Arrow IPC streams and files.  The same column buffers
+	are used to write Parquet row groups (see parquet.c).
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#ifndef ARROW_TDP_PARSER_H
+#define ARROW_TDP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+#include "allocator.h"
+#include "compress.h"
+#include "d_string.h"
+#include "sink.h"
+
+
+#define kArrowBatchSize 65536			//!< Default number of records per record batch
+
+
+/// Values for one column of the current record batch
+struct arrow_column {
+	char		*	name;				//!< Column name (UTF-8)
+	size_t			name_len;			//!< Length of name
+	short			type;				//!< TDP_TYPE_INT, TDP_TYPE_FLOAT, TDP_TYPE_BOOL, or TDP_TYPE_STRING
+
+	size_t			rows;				//!< Number of values in current batch
+	size_t			null_count;			//!< Number of null values in current batch
+	DString		*	validity;			//!< Validity bitmap
+	DString		*	offsets;			//!< Offsets into values (strings only)
+	DString		*	values;				//!< Values
+};
+
+typedef struct arrow_column arrow_column;
+
+
+/// Converts rows of values into typed column buffers, and writes them as
+/// Arrow record batches or Parquet row groups
+struct arrow_writer {
+	const tdp_allocator	*	allocator;	//!< Allocator used for all storage
+	sink		*	out;				//!< Destination
+	short			format;				//!< TDP_OUTPUT_ARROW, TDP_OUTPUT_ARROW_STREAM, or TDP_OUTPUT_PARQUET
+	short			compression;		//!< Parquet page compression (tdp_compression)
+	size_t			batch_size;			//!< Records per batch
+	size_t			rows;				//!< Completed rows in current batch
+	size_t			total_rows;			//!< Rows in previous batches
+
+	arrow_column	*	columns;		//!< Columns
+	size_t			count;				//!< Number of columns
+	size_t			capacity;			//!< Size of columns array
+
+	DString		*	metadata;			//!< Flatbuffer being built
+	DString		*	blocks;				//!< Location of each record batch (Arrow file), or row group metadata (Parquet)
+	size_t			block_count;		//!< Number of record batches or row groups
+	DString		*	page;				//!< Page being built (Parquet)
+	char		*	compressed;			//!< Buffer for compressed pages (Parquet)
+	block_compressor	*	codec;		//!< gzip or zstd state (Parquet, created when needed)
+	size_t			compressed_size;	//!< Size of compressed buffer
+	sink			string;				//!< Destination for current string value
+};
+
+typedef struct arrow_writer arrow_writer;
+
+
+/// Create a writer.  Columns must be added before arrow_writer_begin().
+arrow_writer * arrow_writer_new(
+	const tdp_allocator * allocator,	//!< Allocator to use (NULL to use heap)
+	sink * out,							//!< Destination
+	short format,						//!< TDP_OUTPUT_ARROW, TDP_OUTPUT_ARROW_STREAM, or TDP_OUTPUT_PARQUET
+	size_t batch_size					//!< Records (or Parquet row group size) per batch (0 for kArrowBatchSize)
+);
+
+
+/// Free writer
+void arrow_writer_free(
+	arrow_writer * w					//!< Writer to be freed
+);
+
+
+/// Add a column.  Types other than TDP_TYPE_INT, TDP_TYPE_FLOAT, and
+/// TDP_TYPE_BOOL are written as UTF-8 strings.  Returns false if memory
+/// could not be allocated.
+bool arrow_writer_add_column(
+	arrow_writer * w,					//!< Writer
+	const char * name,					//!< Column name (UTF-8)
+	size_t len,							//!< Length of name
+	short type							//!< Column type (tdp_column_type)
+);
+
+
+/// Write the schema (or Parquet file header)
+void arrow_writer_begin(
+	arrow_writer * w					//!< Writer
+);
+
+
+/// Append null to `column` for the current row
+void arrow_append_null(
+	arrow_writer * w,					//!< Writer
+	size_t column						//!< Column index
+);
+
+
+/// Append integer to a TDP_TYPE_INT column
+void arrow_append_int(
+	arrow_writer * w,					//!< Writer
+	size_t column,						//!< Column index
+	int64_t value						//!< Value
+);
+
+
+/// Append double to a TDP_TYPE_FLOAT column
+void arrow_append_double(
+	arrow_writer * w,					//!< Writer
+	size_t column,						//!< Column index
+	double value						//!< Value
+);
+
+
+/// Append boolean to a TDP_TYPE_BOOL column
+void arrow_append_bool(
+	arrow_writer * w,					//!< Writer
+	size_t column,						//!< Column index
+	bool value							//!< Value
+);
+
+
+/// Append a string to a string column.  The returned sink receives the
+/// UTF-8 bytes of the value, and is valid until the next call.
+sink * arrow_append_string(
+	arrow_writer * w,					//!< Writer
+	size_t column						//!< Column index
+);
+
+
+/// Finish current row.  Columns without a value are null.  A record batch
+/// (or row group) is written after every `batch_size` rows.
+void arrow_writer_end_row(
+	arrow_writer * w					//!< Writer
+);
+
+
+/// Write the final record batch, end of stream marker, and (for files)
+/// the footer.  For Parquet, write the final row group and file metadata.
+/// Returns false if memory could not be allocated for any of the values.
+bool arrow_writer_finish(
+	arrow_writer * w					//!< Writer
+);
+
+
+#endif
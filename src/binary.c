@@ -0,0 +1,338 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file binary.c
+
+	@brief Encode values as MessagePack or CBOR (RFC 8949).  Multi-byte
+	values are big-endian in both formats.
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include "binary.h"
+#include "libTDP.h"
+
+#ifdef TEST
+	#include "d_string.h"
+#endif
+
+
+// MessagePack type bytes
+#define kMsgpackNil			0xc0
+#define kMsgpackFalse		0xc2
+#define kMsgpackTrue		0xc3
+#define kMsgpackFloat64		0xcb
+#define kMsgpackUint8		0xcc
+#define kMsgpackUint16		0xcd
+#define kMsgpackUint32		0xce
+#define kMsgpackUint64		0xcf
+#define kMsgpackInt8		0xd0
+#define kMsgpackInt16		0xd1
+#define kMsgpackInt32		0xd2
+#define kMsgpackInt64		0xd3
+#define kMsgpackStr8		0xd9
+#define kMsgpackStr16		0xda
+#define kMsgpackStr32		0xdb
+#define kMsgpackArray16		0xdc
+#define kMsgpackArray32		0xdd
+#define kMsgpackMap16		0xde
+#define kMsgpackMap32		0xdf
+
+// CBOR major types (high 3 bits of initial byte)
+#define kCborUnsigned		0x00
+#define kCborNegative		0x20
+#define kCborText			0x60
+#define kCborArray			0x80
+#define kCborMap			0xa0
+
+// CBOR simple values
+#define kCborFalse			0xf4
+#define kCborTrue			0xf5
+#define kCborNull			0xf6
+#define kCborFloat64		0xfb
+
+
+/// Write `type` followed by the low `bytes` bytes of `value`, big-endian
+static void write_head(sink * out, uint8_t type, uint64_t value, int bytes) {
+	char head[9];
+
+	head[0] = (char) type;
+
+	for (int i = bytes; i > 0; --i) {
+		head[i] = (char) (value & 0xff);
+		value >>= 8;
+	}
+
+	sink_write(out, head, bytes + 1);
+}
+
+
+/// Write CBOR initial byte for `major` type with argument `value`
+static void cbor_head(sink * out, uint8_t major, uint64_t value) {
+	if (value < 24) {
+		write_head(out, major | (uint8_t) value, 0, 0);
+	} else if (value <= 0xff) {
+		write_head(out, major | 24, value, 1);
+	} else if (value <= 0xffff) {
+		write_head(out, major | 25, value, 2);
+	} else if (value <= 0xffffffff) {
+		write_head(out, major | 26, value, 4);
+	} else {
+		write_head(out, major | 27, value, 8);
+	}
+}
+
+
+/// Write MessagePack header for a collection or string, using the `fixed`
+/// form (with `fixed_limit` values) when possible, then 8 (if `type8`
+/// isn't 0), 16, or 32-bit lengths
+static void msgpack_head(sink * out, uint8_t fixed, size_t fixed_limit, uint8_t type8, uint8_t type16, uint8_t type32, size_t count) {
+	if (count < fixed_limit) {
+		write_head(out, fixed | (uint8_t) count, 0, 0);
+	} else if (type8 && count <= 0xff) {
+		write_head(out, type8, count, 1);
+	} else if (count <= 0xffff) {
+		write_head(out, type16, count, 2);
+	} else {
+		write_head(out, type32, count, 4);
+	}
+}
+
+
+/// Start an array
+void binary_write_array(sink * out, short format, size_t count) {
+	if (format == TDP_OUTPUT_CBOR) {
+		cbor_head(out, kCborArray, count);
+	} else {
+		msgpack_head(out, 0x90, 16, 0, kMsgpackArray16, kMsgpackArray32, count);
+	}
+}
+
+
+/// Start a map
+void binary_write_map(sink * out, short format, size_t count) {
+	if (format == TDP_OUTPUT_CBOR) {
+		cbor_head(out, kCborMap, count);
+	} else {
+		msgpack_head(out, 0x80, 16, 0, kMsgpackMap16, kMsgpackMap32, count);
+	}
+}
+
+
+/// Start a string
+void binary_write_string_header(sink * out, short format, size_t len) {
+	if (format == TDP_OUTPUT_CBOR) {
+		cbor_head(out, kCborText, len);
+	} else {
+		msgpack_head(out, 0xa0, 32, kMsgpackStr8, kMsgpackStr16, kMsgpackStr32, len);
+	}
+}
+
+
+/// Write a complete string
+void binary_write_string(sink * out, short format, const char * text, size_t len) {
+	binary_write_string_header(out, format, len);
+	sink_write(out, text, len);
+}
+
+
+/// Write null
+void binary_write_nil(sink * out, short format) {
+	write_head(out, (format == TDP_OUTPUT_CBOR) ? kCborNull : kMsgpackNil, 0, 0);
+}
+
+
+/// Write boolean
+void binary_write_bool(sink * out, short format, bool value) {
+	if (format == TDP_OUTPUT_CBOR) {
+		write_head(out, value ? kCborTrue : kCborFalse, 0, 0);
+	} else {
+		write_head(out, value ? kMsgpackTrue : kMsgpackFalse, 0, 0);
+	}
+}
+
+
+/// Write integer
+void binary_write_int(sink * out, short format, int64_t value) {
+	if (format == TDP_OUTPUT_CBOR) {
+		if (value < 0) {
+			// Encoded as -1 - n
+			cbor_head(out, kCborNegative, (uint64_t) (-(value + 1)));
+		} else {
+			cbor_head(out, kCborUnsigned, (uint64_t) value);
+		}
+
+		return;
+	}
+
+	if (value >= 0) {
+		if (value < 128) {
+			// Positive fixint
+			write_head(out, (uint8_t) value, 0, 0);
+		} else if (value <= 0xff) {
+			write_head(out, kMsgpackUint8, value, 1);
+		} else if (value <= 0xffff) {
+			write_head(out, kMsgpackUint16, value, 2);
+		} else if (value <= 0xffffffff) {
+			write_head(out, kMsgpackUint32, value, 4);
+		} else {
+			write_head(out, kMsgpackUint64, value, 8);
+		}
+	} else if (value >= -32) {
+		// Negative fixint
+		write_head(out, (uint8_t) value, 0, 0);
+	} else if (value >= INT8_MIN) {
+		write_head(out, kMsgpackInt8, (uint64_t) value, 1);
+	} else if (value >= INT16_MIN) {
+		write_head(out, kMsgpackInt16, (uint64_t) value, 2);
+	} else if (value >= INT32_MIN) {
+		write_head(out, kMsgpackInt32, (uint64_t) value, 4);
+	} else {
+		write_head(out, kMsgpackInt64, (uint64_t) value, 8);
+	}
+}
+
+
+/// Write 64-bit float
+void binary_write_double(sink * out, short format, double value) {
+	uint64_t bits;
+
+	memcpy(&bits, &value, sizeof(double));
+	write_head(out, (format == TDP_OUTPUT_CBOR) ? kCborFloat64 : kMsgpackFloat64, bits, 8);
+}
+
+
+#ifdef TEST
+/// Compare encoded bytes in `buffer` with `expected`, then clear it
+static void check_encoding(CuTest * tc, DString * buffer, const char * expected, size_t len) {
+	CuAssertIntEquals(tc, (int) len, (int) buffer->currentStringLength);
+	CuAssertTrue(tc, memcmp(buffer->str, expected, len) == 0);
+	d_string_erase(buffer, 0, -1);
+}
+
+
+void Test_binary_encode(CuTest * tc) {
+	DString * buffer = d_string_new("");
+	char text[70000];
+	sink out;
+
+	sink_init_string(&out, buffer);
+	memset(text, 'x', sizeof(text));
+
+	// MessagePack
+	binary_write_nil(&out, TDP_OUTPUT_MSGPACK);
+	binary_write_bool(&out, TDP_OUTPUT_MSGPACK, true);
+	binary_write_bool(&out, TDP_OUTPUT_MSGPACK, false);
+	check_encoding(tc, buffer, "\xc0\xc3\xc2", 3);
+
+	binary_write_int(&out, TDP_OUTPUT_MSGPACK, 0);
+	binary_write_int(&out, TDP_OUTPUT_MSGPACK, 127);
+	binary_write_int(&out, TDP_OUTPUT_MSGPACK, 128);
+	binary_write_int(&out, TDP_OUTPUT_MSGPACK, 65536);
+	check_encoding(tc, buffer, "\x00\x7f\xcc\x80\xce\x00\x01\x00\x00", 9);
+
+	binary_write_int(&out, TDP_OUTPUT_MSGPACK, -1);
+	binary_write_int(&out, TDP_OUTPUT_MSGPACK, -32);
+	binary_write_int(&out, TDP_OUTPUT_MSGPACK, -33);
+	binary_write_int(&out, TDP_OUTPUT_MSGPACK, -129);
+	check_encoding(tc, buffer, "\xff\xe0\xd0\xdf\xd1\xff\x7f", 7);
+
+	binary_write_int(&out, TDP_OUTPUT_MSGPACK, INT64_MIN);
+	binary_write_int(&out, TDP_OUTPUT_MSGPACK, 5000000000LL);
+	check_encoding(tc, buffer, "\xd3\x80\x00\x00\x00\x00\x00\x00\x00\xcf\x00\x00\x00\x01\x2a\x05\xf2\x00", 18);
+
+	binary_write_double(&out, TDP_OUTPUT_MSGPACK, 1.5);
+	check_encoding(tc, buffer, "\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00", 9);
+
+	binary_write_string(&out, TDP_OUTPUT_MSGPACK, "abc", 3);
+	binary_write_array(&out, TDP_OUTPUT_MSGPACK, 2);
+	binary_write_map(&out, TDP_OUTPUT_MSGPACK, 15);
+	binary_write_map(&out, TDP_OUTPUT_MSGPACK, 16);
+	check_encoding(tc, buffer, "\xa3" "abc" "\x92\x8f\xde\x00\x10", 9);
+
+	binary_write_string_header(&out, TDP_OUTPUT_MSGPACK, 32);
+	binary_write_string_header(&out, TDP_OUTPUT_MSGPACK, 256);
+	binary_write_array(&out, TDP_OUTPUT_MSGPACK, 70000);
+	check_encoding(tc, buffer, "\xd9\x20\xda\x01\x00\xdd\x00\x01\x11\x70", 10);
+
+	binary_write_string(&out, TDP_OUTPUT_MSGPACK, text, sizeof(text));
+	CuAssertIntEquals(tc, sizeof(text) + 5, buffer->currentStringLength);
+	CuAssertTrue(tc, memcmp(buffer->str, "\xdb\x00\x01\x11\x70xxx", 8) == 0);
+	d_string_erase(buffer, 0, -1);
+
+	// CBOR
+	binary_write_nil(&out, TDP_OUTPUT_CBOR);
+	binary_write_bool(&out, TDP_OUTPUT_CBOR, true);
+	binary_write_bool(&out, TDP_OUTPUT_CBOR, false);
+	check_encoding(tc, buffer, "\xf6\xf5\xf4", 3);
+
+	binary_write_int(&out, TDP_OUTPUT_CBOR, 10);
+	binary_write_int(&out, TDP_OUTPUT_CBOR, 24);
+	binary_write_int(&out, TDP_OUTPUT_CBOR, 1000);
+	binary_write_int(&out, TDP_OUTPUT_CBOR, -1);
+	binary_write_int(&out, TDP_OUTPUT_CBOR, -1000);
+	check_encoding(tc, buffer, "\x0a\x18\x18\x19\x03\xe8\x20\x39\x03\xe7", 10);
+
+	binary_write_int(&out, TDP_OUTPUT_CBOR, INT64_MIN);
+	check_encoding(tc, buffer, "\x3b\x7f\xff\xff\xff\xff\xff\xff\xff", 9);
+
+	binary_write_double(&out, TDP_OUTPUT_CBOR, 1.1);
+	check_encoding(tc, buffer, "\xfb\x3f\xf1\x99\x99\x99\x99\x99\x9a", 9);
+
+	binary_write_string(&out, TDP_OUTPUT_CBOR, "IETF", 4);
+	binary_write_array(&out, TDP_OUTPUT_CBOR, 3);
+	binary_write_map(&out, TDP_OUTPUT_CBOR, 25);
+	check_encoding(tc, buffer, "\x64" "IETF" "\x83\xb8\x19", 8);
+
+	d_string_free(buffer, true);
+}
+#endif
@@ -0,0 +1,138 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file binary.h
+
+	@brief Encode values as MessagePack or CBOR
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#ifndef BINARY_TDP_PARSER_H
+#define BINARY_TDP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+#include "sink.h"
+
+
+// Each function writes one item in `format` (TDP_OUTPUT_MSGPACK or
+// TDP_OUTPUT_CBOR), using the shortest encoding available.
+
+
+/// Start an array of `count` items
+void binary_write_array(
+	sink * out,							//!< Destination
+	short format,						//!< Output format
+	size_t count						//!< Number of items that follow
+);
+
+
+/// Start a map of `count` key/value pairs
+void binary_write_map(
+	sink * out,							//!< Destination
+	short format,						//!< Output format
+	size_t count						//!< Number of pairs that follow
+);
+
+
+/// Start a UTF-8 string of `len` bytes (the caller writes the bytes)
+void binary_write_string_header(
+	sink * out,							//!< Destination
+	short format,						//!< Output format
+	size_t len							//!< Length of string in bytes
+);
+
+
+/// Write a complete string
+void binary_write_string(
+	sink * out,							//!< Destination
+	short format,						//!< Output format
+	const char * text,					//!< String
+	size_t len							//!< Length of string in bytes
+);
+
+
+/// Write null
+void binary_write_nil(
+	sink * out,							//!< Destination
+	short format						//!< Output format
+);
+
+
+/// Write boolean
+void binary_write_bool(
+	sink * out,							//!< Destination
+	short format,						//!< Output format
+	bool value							//!< Value
+);
+
+
+/// Write integer
+void binary_write_int(
+	sink * out,							//!< Destination
+	short format,						//!< Output format
+	int64_t value						//!< Value
+);
+
+
+/// Write 64-bit float
+void binary_write_double(
+	sink * out,							//!< Destination
+	short format,						//!< Output format
+	double value						//!< Value
+);
+
+
+#endif
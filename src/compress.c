@@ -0,0 +1,801 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file compress.c
+
+	@brief gzip and zstd compression.  Concatenated gzip members and zstd
+	frames are valid streams, so each block can be compressed on its own.
+	The producer fills a ring of job slots; worker threads compress them
+	in any order, and the producer writes finished slots in sequence.
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD
+	#include <pthread.h>
+	#include <unistd.h>
+#endif
+
+#ifdef HAVE_ZLIB
+	#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+	#define ZSTD_STATIC_LINKING_ONLY		// For ZSTD_createCCtx_advanced()
+	#include <zstd.h>
+#endif
+
+#include "compress.h"
+#include "libTDP.h"
+
+
+#define kCompressSlotsPerThread 2		//!< Blocks in flight for each thread
+#define kCompressMaxThreads 64			//!< Upper limit on compression threads
+
+
+/// Per-thread compression state
+struct block_compressor {
+	const tdp_allocator	*	allocator;	//!< Allocator for this state
+	short			codec;				//!< TDP_COMPRESSION_GZIP or TDP_COMPRESSION_ZSTD
+
+#ifdef HAVE_ZLIB
+	z_stream		zlib;				//!< Reused deflate stream
+	bool			zlib_ready;			//!< deflateInit2() succeeded
+#endif
+
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx	*	zstd;				//!< Reused zstd context
+#endif
+};
+
+
+/// One block of the stream
+struct compress_job {
+	char		*	input;				//!< Uncompressed data
+	size_t			input_len;			//!< Bytes of input
+	char		*	output;				//!< Compressed data
+	size_t			output_len;			//!< Bytes of output (0 on error)
+	bool			done;				//!< Compressed, and ready to be written
+};
+
+typedef struct compress_job compress_job;
+
+
+/// One worker thread
+struct compress_worker {
+	compressor	*	owner;				//!< Compressor this thread works for
+	block_compressor	*	state;		//!< Compression state for this thread
+
+#ifdef HAVE_PTHREAD
+	pthread_t		thread;				//!< Thread
+#endif
+};
+
+typedef struct compress_worker compress_worker;
+
+
+/// Compresses a stream on a pool of threads
+struct compressor {
+	const tdp_allocator	*	allocator;	//!< Allocator for jobs and state
+	short			codec;				//!< TDP_COMPRESSION_GZIP or TDP_COMPRESSION_ZSTD
+	sink_flush_callback	write;			//!< Receives compressed output
+	void		*	user;				//!< Passed to `write`
+	size_t			bound;				//!< Size of each job output buffer
+
+	compress_job	*	jobs;			//!< Ring of job slots
+	size_t			slots;				//!< Number of job slots
+	size_t			submitted;			//!< Jobs handed to workers
+	size_t			taken;				//!< Jobs taken by workers
+	size_t			written;			//!< Jobs written to output
+
+	compress_worker	*	workers;		//!< Worker threads
+	size_t			thread_count;		//!< Number of worker threads (0 to compress in place)
+	block_compressor	*	local;		//!< Compression state when there are no threads
+	bool			stop;				//!< Workers should exit once all jobs are taken
+	bool			joined;				//!< Workers have exited
+	bool			failed;				//!< Compression or output failed
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t	lock;				//!< Protects job state and counters
+	pthread_cond_t	work;				//!< Signalled when a job is submitted (or stopping)
+	pthread_cond_t	finished;			//!< Signalled when a job is compressed
+#endif
+};
+
+
+/// Was libTDP built with support for `codec`?
+bool compress_available(short codec) {
+	switch (codec) {
+#ifdef HAVE_ZLIB
+
+		case TDP_COMPRESSION_GZIP:
+			return true;
+#endif
+#ifdef HAVE_ZSTD
+
+		case TDP_COMPRESSION_ZSTD:
+			return true;
+#endif
+
+		default:
+			return false;
+	}
+}
+
+
+#ifdef HAVE_ZLIB
+/// zlib allocation callback, using the allocator in `opaque`
+static voidpf zlib_allocate(voidpf opaque, uInt items, uInt size) {
+	return tdp_malloc(opaque, (size_t) items * size);
+}
+
+
+/// zlib release callback
+static void zlib_release(voidpf opaque, voidpf address) {
+	tdp_free(opaque, address);
+}
+#endif
+
+
+#ifdef HAVE_ZSTD
+/// zstd allocation callback, using the allocator in `opaque`
+static void * zstd_allocate(void * opaque, size_t size) {
+	return tdp_malloc(opaque, size);
+}
+
+
+/// zstd release callback
+static void zstd_release(void * opaque, void * address) {
+	tdp_free(opaque, address);
+}
+#endif
+
+
+/// Create codec state with the compressor's allocator
+static bool block_compressor_init(block_compressor * c) {
+	switch (c->codec) {
+#ifdef HAVE_ZLIB
+
+		case TDP_COMPRESSION_GZIP:
+			c->zlib.zalloc = zlib_allocate;
+			c->zlib.zfree = zlib_release;
+			c->zlib.opaque = (voidpf) c->allocator;
+
+			// 15 + 16: largest window, with gzip header and trailer
+			c->zlib_ready = (deflateInit2(&c->zlib, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+			return c->zlib_ready;
+#endif
+#ifdef HAVE_ZSTD
+
+		case TDP_COMPRESSION_ZSTD: {
+			ZSTD_customMem memory = { zstd_allocate, zstd_release, (void *) c->allocator };
+
+			c->zstd = ZSTD_createCCtx_advanced(memory);
+			return (c->zstd != NULL);
+		}
+#endif
+
+		default:
+			return false;
+	}
+}
+
+
+/// Create compression state for one thread.  The codec state is created
+/// here, on the calling thread, rather than by the thread that uses it.
+block_compressor * block_compressor_new(const tdp_allocator * allocator, short codec) {
+	if (!compress_available(codec)) {
+		return NULL;
+	}
+
+	block_compressor * c = tdp_malloc(allocator, sizeof(block_compressor));
+
+	if (c) {
+		memset(c, 0, sizeof(block_compressor));
+		c->allocator = allocator;
+		c->codec = codec;
+
+		if (!block_compressor_init(c)) {
+			block_compressor_free(c);
+			return NULL;
+		}
+	}
+
+	return c;
+}
+
+
+/// Free compression state
+void block_compressor_free(block_compressor * c) {
+	if (c) {
+#ifdef HAVE_ZLIB
+
+		if (c->zlib_ready) {
+			deflateEnd(&c->zlib);
+		}
+
+#endif
+#ifdef HAVE_ZSTD
+		ZSTD_freeCCtx(c->zstd);
+#endif
+		tdp_free(c->allocator, c);
+	}
+}
+
+
+/// Largest possible compressed size for `len` bytes of input
+size_t block_compress_bound(short codec, size_t len) {
+	switch (codec) {
+#ifdef HAVE_ZLIB
+
+		case TDP_COMPRESSION_GZIP:
+			// deflate bound, plus gzip header and trailer
+			return (size_t) compressBound((uLong) len) + 18;
+#endif
+#ifdef HAVE_ZSTD
+
+		case TDP_COMPRESSION_ZSTD:
+			return ZSTD_compressBound(len);
+#endif
+
+		default:
+			return len;
+	}
+}
+
+
+/// Compress one block
+size_t block_compress(block_compressor * c, const char * in, size_t len, char * out, size_t capacity) {
+	switch (c->codec) {
+#ifdef HAVE_ZLIB
+
+		case TDP_COMPRESSION_GZIP:
+			if (deflateReset(&c->zlib) != Z_OK) {
+				return 0;
+			}
+
+			c->zlib.next_in = (Bytef *) in;
+			c->zlib.avail_in = (uInt) len;
+			c->zlib.next_out = (Bytef *) out;
+			c->zlib.avail_out = (uInt) capacity;
+
+			if (deflate(&c->zlib, Z_FINISH) != Z_STREAM_END) {
+				return 0;
+			}
+
+			return capacity - c->zlib.avail_out;
+#endif
+#ifdef HAVE_ZSTD
+
+		case TDP_COMPRESSION_ZSTD:
+			len = ZSTD_compressCCtx(c->zstd, out, capacity, in, len, ZSTD_CLEVEL_DEFAULT);
+			return ZSTD_isError(len) ? 0 : len;
+#endif
+
+		default:
+			return 0;
+	}
+}
+
+
+#ifdef HAVE_PTHREAD
+/// Worker thread -- compress jobs until the compressor stops
+static void * compress_worker_run(void * arg) {
+	compress_worker * w = arg;
+	compressor * z = w->owner;
+	compress_job * job;
+
+	pthread_mutex_lock(&z->lock);
+
+	for (;;) {
+		while (!z->stop && (z->taken == z->submitted)) {
+			pthread_cond_wait(&z->work, &z->lock);
+		}
+
+		if (z->taken == z->submitted) {
+			// Stopping, and nothing left to do
+			break;
+		}
+
+		job = &z->jobs[z->taken++ % z->slots];
+		pthread_mutex_unlock(&z->lock);
+
+		job->output_len = block_compress(w->state, job->input, job->input_len, job->output, z->bound);
+
+		pthread_mutex_lock(&z->lock);
+		job->done = true;
+		pthread_cond_broadcast(&z->finished);
+	}
+
+	pthread_mutex_unlock(&z->lock);
+	return NULL;
+}
+#endif
+
+
+/// Stop and join worker threads
+static void stop_workers(compressor * z) {
+#ifdef HAVE_PTHREAD
+
+	if (z->thread_count && !z->joined) {
+		pthread_mutex_lock(&z->lock);
+		z->stop = true;
+		pthread_cond_broadcast(&z->work);
+		pthread_mutex_unlock(&z->lock);
+
+		for (size_t i = 0; i < z->thread_count; ++i) {
+			pthread_join(z->workers[i].thread, NULL);
+		}
+
+		z->joined = true;
+	}
+
+#endif
+}
+
+
+/// Create a stream compressor
+compressor * compressor_new(const tdp_allocator * allocator, short codec, size_t threads, sink_flush_callback write, void * user) {
+	if (!compress_available(codec)) {
+		return NULL;
+	}
+
+	compressor * z = tdp_malloc(allocator, sizeof(compressor));
+
+	if (z == NULL) {
+		return NULL;
+	}
+
+	memset(z, 0, sizeof(compressor));
+	z->allocator = allocator;
+
+#ifdef HAVE_PTHREAD
+
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cpus > 0) ? (size_t) cpus : 1;
+	}
+
+#else
+	threads = 1;
+#endif
+
+	if (threads > kCompressMaxThreads) {
+		threads = kCompressMaxThreads;
+	}
+
+	z->codec = codec;
+	z->write = write;
+	z->user = user;
+	z->bound = block_compress_bound(codec, kCompressBlockSize);
+	z->slots = (threads > 1) ? threads * kCompressSlotsPerThread : 1;
+	z->jobs = tdp_malloc(allocator, z->slots * sizeof(compress_job));
+
+	if (z->jobs == NULL) {
+		goto fail;
+	}
+
+	memset(z->jobs, 0, z->slots * sizeof(compress_job));
+
+	for (size_t i = 0; i < z->slots; ++i) {
+		z->jobs[i].input = tdp_malloc(allocator, kCompressBlockSize);
+		z->jobs[i].output = tdp_malloc(allocator, z->bound);
+
+		if (!z->jobs[i].input || !z->jobs[i].output) {
+			goto fail;
+		}
+	}
+
+	if (threads <= 1) {
+		z->local = block_compressor_new(allocator, codec);
+
+		if (z->local == NULL) {
+			goto fail;
+		}
+
+		return z;
+	}
+
+#ifdef HAVE_PTHREAD
+	z->workers = tdp_malloc(allocator, threads * sizeof(compress_worker));
+
+	if (z->workers == NULL) {
+		goto fail;
+	}
+
+	memset(z->workers, 0, threads * sizeof(compress_worker));
+
+	pthread_mutex_init(&z->lock, NULL);
+	pthread_cond_init(&z->work, NULL);
+	pthread_cond_init(&z->finished, NULL);
+
+	for (size_t i = 0; i < threads; ++i) {
+		z->workers[i].owner = z;
+		z->workers[i].state = block_compressor_new(allocator, codec);
+
+		if (!z->workers[i].state || (pthread_create(&z->workers[i].thread, NULL, compress_worker_run, &z->workers[i]) != 0)) {
+			block_compressor_free(z->workers[i].state);
+			z->workers[i].state = NULL;
+			break;
+		}
+
+		z->thread_count++;
+	}
+
+	if (z->thread_count == 0) {
+		goto fail;
+	}
+#endif
+
+	return z;
+
+fail:
+	compressor_free(z);
+	return NULL;
+}
+
+
+/// Write compressed job to output
+static void write_job(compressor * z, compress_job * job) {
+	if (job->output_len == 0) {
+		z->failed = true;
+	}
+
+	if (!z->failed && !z->write(job->output, job->output_len, z->user)) {
+		z->failed = true;
+	}
+
+	job->input_len = 0;
+}
+
+
+/// Write finished jobs in order.  If `wait`, wait until every submitted
+/// job is written; otherwise stop at the first job that is not done.
+static void write_finished_jobs(compressor * z, bool wait) {
+#ifdef HAVE_PTHREAD
+	compress_job * job;
+
+	pthread_mutex_lock(&z->lock);
+
+	while (z->written < z->submitted) {
+		job = &z->jobs[z->written % z->slots];
+
+		if (!job->done) {
+			if (!wait) {
+				break;
+			}
+
+			pthread_cond_wait(&z->finished, &z->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&z->lock);
+		write_job(z, job);
+		pthread_mutex_lock(&z->lock);
+
+		z->written++;
+	}
+
+	pthread_mutex_unlock(&z->lock);
+#endif
+}
+
+
+/// Hand the job being filled to the workers (or compress it in place)
+static void submit_job(compressor * z) {
+	compress_job * job = &z->jobs[z->submitted % z->slots];
+
+	if (z->thread_count == 0) {
+		job->output_len = block_compress(z->local, job->input, job->input_len, job->output, z->bound);
+		write_job(z, job);
+		z->submitted++;
+		z->written++;
+		return;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&z->lock);
+	job->done = false;
+	z->submitted++;
+	pthread_cond_signal(&z->work);
+	pthread_mutex_unlock(&z->lock);
+
+	// Keep output flowing, without waiting
+	write_finished_jobs(z, false);
+#endif
+}
+
+
+/// Make sure the next job slot is free, writing the oldest job if needed
+static void wait_for_slot(compressor * z) {
+#ifdef HAVE_PTHREAD
+	compress_job * job;
+
+	if (z->thread_count && (z->submitted - z->written == z->slots)) {
+		job = &z->jobs[z->written % z->slots];
+
+		pthread_mutex_lock(&z->lock);
+
+		while (!job->done) {
+			pthread_cond_wait(&z->finished, &z->lock);
+		}
+
+		pthread_mutex_unlock(&z->lock);
+
+		write_job(z, job);
+		z->written++;
+	}
+
+#endif
+}
+
+
+/// Add data to the stream
+bool compressor_write(const char * data, size_t len, void * user) {
+	compressor * z = user;
+	compress_job * job;
+	size_t room;
+
+	while (len && !z->failed) {
+		wait_for_slot(z);
+
+		job = &z->jobs[z->submitted % z->slots];
+		room = kCompressBlockSize - job->input_len;
+
+		if (room > len) {
+			room = len;
+		}
+
+		memcpy(job->input + job->input_len, data, room);
+		job->input_len += room;
+		data += room;
+		len -= room;
+
+		if (job->input_len == kCompressBlockSize) {
+			submit_job(z);
+		}
+	}
+
+	return !z->failed;
+}
+
+
+/// Compress and write the rest of the stream
+bool compressor_finish(compressor * z) {
+	// An empty stream still has one (empty) member or frame
+	if ((z->jobs[z->submitted % z->slots].input_len > 0) || (z->submitted == 0)) {
+		wait_for_slot(z);
+		submit_job(z);
+	}
+
+	write_finished_jobs(z, true);
+	stop_workers(z);
+
+	return !z->failed;
+}
+
+
+/// Free stream compressor
+void compressor_free(compressor * z) {
+	if (z) {
+		stop_workers(z);
+
+		for (size_t i = 0; i < z->thread_count; ++i) {
+			block_compressor_free(z->workers[i].state);
+		}
+
+#ifdef HAVE_PTHREAD
+
+		if (z->workers) {
+			pthread_mutex_destroy(&z->lock);
+			pthread_cond_destroy(&z->work);
+			pthread_cond_destroy(&z->finished);
+		}
+
+#endif
+
+		for (size_t i = 0; z->jobs && (i < z->slots); ++i) {
+			tdp_free(z->allocator, z->jobs[i].input);
+			tdp_free(z->allocator, z->jobs[i].output);
+		}
+
+		tdp_free(z->allocator, z->jobs);
+		tdp_free(z->allocator, z->workers);
+		block_compressor_free(z->local);
+		tdp_free(z->allocator, z);
+	}
+}
+
+
+#ifdef TEST
+#include "d_string.h"
+
+static bool append_block(const char * data, size_t len, void * user) {
+	d_string_append_c_array(user, data, len);
+	return true;
+}
+
+
+#ifdef HAVE_ZLIB
+/// Decompress concatenated gzip members
+static DString * gunzip(DString * in) {
+	DString * out = d_string_new("");
+	char buffer[65536];
+	z_stream z;
+	int status = Z_OK;
+
+	memset(&z, 0, sizeof(z_stream));
+	inflateInit2(&z, 15 + 16);
+
+	z.next_in = (Bytef *) in->str;
+	z.avail_in = (uInt) in->currentStringLength;
+
+	while (z.avail_in && (status == Z_OK || status == Z_STREAM_END)) {
+		if (status == Z_STREAM_END) {
+			// Next member
+			inflateReset(&z);
+		}
+
+		z.next_out = (Bytef *) buffer;
+		z.avail_out = sizeof(buffer);
+		status = inflate(&z, Z_NO_FLUSH);
+		d_string_append_c_array(out, buffer, sizeof(buffer) - z.avail_out);
+	}
+
+	inflateEnd(&z);
+	return out;
+}
+#endif
+
+
+/// Compress `source` in uneven pieces
+static DString * compress_stream(short codec, size_t threads, DString * source) {
+	DString * out = d_string_new("");
+	compressor * z = compressor_new(NULL, codec, threads, append_block, out);
+	size_t len;
+
+	for (size_t i = 0; i < source->currentStringLength; i += len) {
+		len = (i % 7919) + 1;
+
+		if (len > source->currentStringLength - i) {
+			len = source->currentStringLength - i;
+		}
+
+		compressor_write(source->str + i, len, z);
+	}
+
+	if (!compressor_finish(z)) {
+		d_string_erase(out, 0, -1);
+	}
+
+	compressor_free(z);
+	return out;
+}
+
+
+void Test_compress(CuTest * tc) {
+	DString * source = d_string_new("");
+	DString * out;
+
+	// Several blocks
+	for (int i = 0; i < 200000; ++i) {
+		d_string_append_printf(source, "%d,value %d\n", i, i * 7);
+	}
+
+	CuAssertTrue(tc, source->currentStringLength > 2 * kCompressBlockSize);
+	CuAssertTrue(tc, !compress_available(TDP_COMPRESSION_NONE));
+	CuAssertTrue(tc, !compress_available(TDP_COMPRESSION_SNAPPY));
+
+#ifdef HAVE_ZLIB
+
+	for (size_t threads = 1; threads <= 4; threads += 3) {
+		out = compress_stream(TDP_COMPRESSION_GZIP, threads, source);
+		CuAssertTrue(tc, out->currentStringLength > 0);
+		CuAssertTrue(tc, out->currentStringLength < source->currentStringLength / 2);
+
+		DString * result = gunzip(out);
+		CuAssertIntEquals(tc, source->currentStringLength, result->currentStringLength);
+		CuAssertTrue(tc, memcmp(source->str, result->str, source->currentStringLength) == 0);
+
+		d_string_free(result, true);
+		d_string_free(out, true);
+	}
+
+	// An empty stream is one empty member
+	d_string_erase(source, 0, -1);
+	out = compress_stream(TDP_COMPRESSION_GZIP, 2, source);
+	CuAssertIntEquals(tc, 20, out->currentStringLength);
+	d_string_free(out, true);
+#endif
+
+#ifdef HAVE_ZSTD
+	d_string_erase(source, 0, -1);
+
+	for (int i = 0; i < 200000; ++i) {
+		d_string_append_printf(source, "%d,value %d\n", i, i * 7);
+	}
+
+	out = compress_stream(TDP_COMPRESSION_ZSTD, 3, source);
+	char * result = malloc(source->currentStringLength);
+
+	CuAssertIntEquals(tc, source->currentStringLength, ZSTD_decompress(result, source->currentStringLength, out->str, out->currentStringLength));
+	CuAssertTrue(tc, memcmp(source->str, result, source->currentStringLength) == 0);
+
+	free(result);
+	d_string_free(out, true);
+#endif
+
+	d_string_free(source, true);
+}
+
+
+void Test_block_compressor_allocator(CuTest * tc) {
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+	// Codec state is requested from the allocator when it is created, so
+	// an arena that is too small for it is caught up front
+	static char scratch[4096];
+	tdp_arena arena;
+#endif
+
+#ifdef HAVE_ZLIB
+	tdp_arena_init(&arena, scratch, sizeof(scratch));
+	CuAssertPtrEquals(tc, NULL, block_compressor_new(&arena.allocator, TDP_COMPRESSION_GZIP));
+	CuAssertTrue(tc, arena.shortfall > 0);
+#endif
+
+#ifdef HAVE_ZSTD
+	tdp_arena_init(&arena, scratch, sizeof(scratch));
+	CuAssertPtrEquals(tc, NULL, block_compressor_new(&arena.allocator, TDP_COMPRESSION_ZSTD));
+	CuAssertTrue(tc, arena.shortfall > 0);
+#endif
+}
+#endif
@@ -0,0 +1,159 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file compress.h
+
+	@brief gzip and zstd compression.  Output streams are split into
+	independent blocks (gzip members or zstd frames), which are compressed
+	by a pool of threads and written in order.
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#ifndef COMPRESS_TDP_PARSER_H
+#define COMPRESS_TDP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+#include "allocator.h"
+#include "sink.h"
+
+
+#define kCompressBlockSize (1024 * 1024)	//!< Bytes of output in each independently compressed block
+
+
+/// Per-thread compression state
+typedef struct block_compressor block_compressor;
+
+/// Compresses a stream on a pool of threads
+typedef struct compressor compressor;
+
+
+/// Was libTDP built with support for `codec` (TDP_COMPRESSION_GZIP or
+/// TDP_COMPRESSION_ZSTD)?
+bool compress_available(
+	short codec							//!< Compression (tdp_compression)
+);
+
+
+/// Create compression state for one thread, or NULL if `codec` is not
+/// available
+block_compressor * block_compressor_new(
+	const tdp_allocator * allocator,	//!< Allocator to use (NULL to use heap)
+	short codec							//!< TDP_COMPRESSION_GZIP or TDP_COMPRESSION_ZSTD
+);
+
+
+/// Free compression state
+void block_compressor_free(
+	block_compressor * c				//!< State to be freed
+);
+
+
+/// Largest possible compressed size for `len` bytes of input
+size_t block_compress_bound(
+	short codec,						//!< TDP_COMPRESSION_GZIP or TDP_COMPRESSION_ZSTD
+	size_t len							//!< Number of bytes to compress
+);
+
+
+/// Compress `len` bytes from `in` into `out` as one complete gzip member
+/// or zstd frame.  Returns compressed size, or 0 on error.
+size_t block_compress(
+	block_compressor * c,				//!< Compression state
+	const char * in,					//!< Data to compress
+	size_t len,							//!< Number of bytes
+	char * out,							//!< Destination
+	size_t capacity						//!< Size of destination
+);
+
+
+/// Create a stream compressor.  Compressed blocks are passed to `write`
+/// in order.  With 1 thread, blocks are compressed as they fill, without
+/// starting any threads.
+/// Returns NULL if `codec` is not available, or memory could not be
+/// allocated.
+compressor * compressor_new(
+	const tdp_allocator * allocator,	//!< Allocator for blocks and state (NULL to use heap)
+	short codec,						//!< TDP_COMPRESSION_GZIP or TDP_COMPRESSION_ZSTD
+	size_t threads,						//!< Number of compression threads (0 for one per CPU)
+	sink_flush_callback write,			//!< Receives compressed output
+	void * user							//!< Passed to `write`
+);
+
+
+/// Add `len` bytes to the stream (`user` is the compressor).  Has the same
+/// signature as sink_flush_callback, so that a sink can flush into it.
+/// Returns false if compression or output failed.
+bool compressor_write(
+	const char * data,					//!< Data to compress
+	size_t len,							//!< Number of bytes
+	void * user							//!< Compressor
+);
+
+
+/// Compress and write the rest of the stream, and wait for all threads.
+/// Returns false if compression or output failed.
+bool compressor_finish(
+	compressor * z						//!< Compressor
+);
+
+
+/// Free stream compressor.  Threads are stopped, but unfinished output
+/// is discarded.
+void compressor_free(
+	compressor * z						//!< Compressor to be freed
+);
+
+
+#endif
@@ -0,0 +1,656 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file context.c
+
+	@brief Reusable state for converting many documents
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#include <stdlib.h>
+
+#if !defined(__WIN32)
+	#include <sys/uio.h>
+#endif
+
+#include "allocator.h"
+#include "arrow.h"
+#include "compress.h"
+#include "context.h"
+#include "d_string.h"
+#include "libTDP.h"
+#include "simple_token.h"
+#include "sink.h"
+#include "stack.h"
+
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+
+// Basic parser function declarations
+size_t TDPParseSize(void);
+void TDPParseInit(void * p);
+void TDPParseFinalize(void * p);
+
+
+#define kHeaderStackSize 32				//!< Initial capacity for header stack
+#define kColumnTypesSize 32				//!< Initial capacity for column types
+
+
+/// Create a new conversion context
+tdp_context * tdp_context_new(void) {
+	return tdp_context_new_with_allocator(NULL);
+}
+
+
+/// Create a new conversion context, using the specified allocator for all
+/// storage (including the output)
+tdp_context * tdp_context_new_with_allocator(const tdp_allocator * allocator) {
+	// Every part is requested even if an earlier one fails, so that an
+	// arena that is too small learns the size of the whole context
+	void * parser = tdp_malloc(allocator, TDPParseSize());
+	token_pool * pool = token_pool_new(allocator);
+	stack * header = stack_new_with_allocator(allocator, kHeaderStackSize);
+	tdp_context * context = tdp_malloc(allocator, sizeof(tdp_context));
+
+	if (context == NULL) {
+		stack_free(header);
+		token_pool_free(pool);
+		tdp_free(allocator, parser);
+		return NULL;
+	}
+
+	context->allocator = allocator;
+	context->parser = parser;
+
+	if (context->parser) {
+		TDPParseInit(context->parser);
+	}
+
+	context->root = NULL;
+	context->pool = pool;
+	context->header = header;
+	context->failed = false;
+	context->out = NULL;				// Created when needed
+	context->flush_buffer = NULL;
+	context->vectors = NULL;
+	context->style = TDP_JSON_PRETTY;
+	context->output_format = TDP_OUTPUT_JSON;
+	context->batch_size = kArrowBatchSize;
+	context->compression = TDP_COMPRESSION_NONE;
+	context->threads = 0;
+	context->ascii_only = false;
+
+	context->type_sample = TDP_SAMPLE_ALL;
+	context->schema = NULL;
+	context->mustache = NULL;
+	context->index = NULL;
+	context->column_types = NULL;
+	context->column_plan = NULL;
+	context->column_count = 0;
+	context->column_capacity = 0;
+
+	if (!context->parser || !context->pool || !context->header) {
+		tdp_context_free(context);
+		return NULL;
+	}
+
+	return context;
+}
+
+
+/// Free header strings for current document
+static void free_header(tdp_context * context) {
+	while (context->header->size) {
+		tdp_free(context->allocator, stack_pop(context->header));
+	}
+}
+
+
+/// Release document specific data, keeping buffers for the next document
+void tdp_context_reset(tdp_context * context) {
+	if (context) {
+		free_header(context);
+
+		token_pool_drain(context->pool);
+		context->root = NULL;
+		context->failed = false;
+		context->column_count = 0;
+
+		if (context->out) {
+			d_string_erase(context->out, 0, -1);
+			context->out->failed = false;
+		}
+	}
+}
+
+
+/// Free conversion context
+void tdp_context_free(tdp_context * context) {
+	if (context) {
+		if (context->header) {
+			free_header(context);
+			stack_free(context->header);
+		}
+
+		if (context->parser) {
+			TDPParseFinalize(context->parser);
+			tdp_free(context->allocator, context->parser);
+		}
+
+		token_pool_free(context->pool);
+		d_string_free(context->out, true);
+		tdp_free(context->allocator, context->flush_buffer);
+		tdp_free(context->allocator, context->vectors);
+		record_index_free(context->index);
+		tdp_free(context->allocator, context->column_types);
+		tdp_free(context->allocator, context->column_plan);
+
+		tdp_free(context->allocator, context);
+	}
+}
+
+
+/// Choose JSON output style
+void tdp_context_set_json_style(tdp_context * context, short style) {
+	context->style = style;
+}
+
+
+/// Choose output format
+void tdp_context_set_output_format(tdp_context * context, short format) {
+	context->output_format = format;
+}
+
+
+/// Choose compression
+bool tdp_context_set_compression(tdp_context * context, short compression) {
+	if ((compression == TDP_COMPRESSION_GZIP || compression == TDP_COMPRESSION_ZSTD) && !compress_available(compression)) {
+		return false;
+	}
+
+	if ((compression == TDP_COMPRESSION_SNAPPY) && (context->output_format != TDP_OUTPUT_PARQUET)) {
+		// Snappy is only used for Parquet pages
+		return false;
+	}
+
+	context->compression = compression;
+	return true;
+}
+
+
+/// Choose number of compression threads
+void tdp_context_set_threads(tdp_context * context, size_t threads) {
+	context->threads = threads;
+}
+
+
+/// Choose the number of records in each Arrow record batch, Parquet row
+/// group, or SQLite transaction
+void tdp_context_set_batch_size(tdp_context * context, size_t records) {
+	context->batch_size = records ? records : kArrowBatchSize;
+}
+
+
+/// Choose whether non-ASCII characters are escaped as \uXXXX
+void tdp_context_set_ascii_only(tdp_context * context, bool ascii_only) {
+	context->ascii_only = ascii_only;
+}
+
+
+/// Choose how many records are used to infer column types
+void tdp_context_set_type_sample(tdp_context * context, size_t records) {
+	context->type_sample = records;
+}
+
+
+/// Use schema to convert named columns
+void tdp_context_set_schema(tdp_context * context, const tdp_schema * schema) {
+	context->schema = schema;
+}
+
+
+/// Use template for TDP_OUTPUT_MUSTACHE
+void tdp_context_set_template(tdp_context * context, const tdp_template * view) {
+	context->mustache = view;
+}
+
+
+/// Write an index of record offsets
+bool tdp_context_set_index(tdp_context * context, size_t stride, sink_flush_callback write, void * user) {
+	record_index_free(context->index);
+	context->index = NULL;
+
+	if (write) {
+		context->index = record_index_new(context->allocator, stride, write, user);
+		return context->index != NULL;
+	}
+
+	return true;
+}
+
+
+/// Grow column types and plans to hold `capacity` columns.  Both are
+/// requested even if the first fails, so that an arena that is too small
+/// counts both.
+static bool resize_columns(tdp_context * context, size_t capacity) {
+	short * types = tdp_realloc(context->allocator, context->column_types, capacity * sizeof(short));
+
+	if (types) {
+		context->column_types = types;
+	}
+
+	const tdp_schema_column ** plan = tdp_realloc(context->allocator, context->column_plan, capacity * sizeof(tdp_schema_column *));
+
+	if (plan) {
+		context->column_plan = plan;
+	}
+
+	if (types == NULL || plan == NULL) {
+		return false;
+	}
+
+	context->column_capacity = capacity;
+	return true;
+}
+
+
+/// Add another column to the inferred types
+bool tdp_context_add_column(tdp_context * context) {
+	if (context->column_count == context->column_capacity) {
+		if (!resize_columns(context, context->column_capacity ? context->column_capacity * 2 : kColumnTypesSize)) {
+			return false;
+		}
+	}
+
+	context->column_types[context->column_count] = TDP_TYPE_NULL;
+	context->column_plan[context->column_count] = NULL;
+	context->column_count++;
+	return true;
+}
+
+
+/// Make room for `count` columns, and as many header keys, up front
+bool tdp_context_reserve_columns(tdp_context * context, size_t count) {
+	bool result = stack_reserve(context->header, count);
+
+	if (count > context->column_capacity) {
+		result = resize_columns(context, count) && result;
+	}
+
+	return result;
+}
+
+
+/// Get buffer used for streaming output
+char * tdp_context_flush_buffer(tdp_context * context) {
+	if (context->flush_buffer == NULL) {
+		context->flush_buffer = tdp_malloc(context->allocator, kFlushBufferSize);
+	}
+
+	return context->flush_buffer;
+}
+
+
+/// Get scatter-gather list used for streaming output
+struct iovec * tdp_context_gather_vectors(tdp_context * context) {
+#if !defined(__WIN32)
+
+	if (context->vectors == NULL) {
+		context->vectors = tdp_malloc(context->allocator, kSinkGatherVectors * sizeof(struct iovec));
+	}
+
+#endif
+
+	return context->vectors;
+}
+
+
+/// Take ownership of the output buffer (the context will create a new
+/// one when needed)
+DString * tdp_context_take_output(tdp_context * context) {
+	DString * out = NULL;
+
+	if (context) {
+		out = context->out;
+		context->out = NULL;
+	}
+
+	return out;
+}
+
+
+#ifdef TEST
+struct counting_allocator {
+	size_t		allocations;
+	size_t		outstanding;
+	size_t		bytes;							//!< Bytes currently allocated
+	size_t		peak;							//!< Largest value of `bytes`
+	size_t		limit;							//!< Fail requests that would exceed this many bytes (0 for no limit)
+};
+
+
+/// Each block is preceded by its size, so that bytes in use can be tracked
+#define kCountingHeaderSize 16
+
+
+static void counting_add(struct counting_allocator * c, size_t size) {
+	c->bytes += size;
+
+	if (c->bytes > c->peak) {
+		c->peak = c->bytes;
+	}
+}
+
+
+static void * counting_allocate(void * user, size_t size) {
+	struct counting_allocator * c = user;
+
+	if (c->limit && c->bytes + size > c->limit) {
+		return NULL;
+	}
+
+	char * block = malloc(kCountingHeaderSize + size);
+
+	if (!block) {
+		return NULL;
+	}
+
+	*(size_t *)block = size;
+	c->allocations++;
+	c->outstanding++;
+	counting_add(c, size);
+	return block + kCountingHeaderSize;
+}
+
+
+static void * counting_reallocate(void * user, void * ptr, size_t size) {
+	struct counting_allocator * c = user;
+
+	if (ptr == NULL) {
+		return counting_allocate(user, size);
+	}
+
+	char * block = (char *)ptr - kCountingHeaderSize;
+	size_t old_size = *(size_t *)block;
+
+	if (c->limit && c->bytes - old_size + size > c->limit) {
+		return NULL;
+	}
+
+	block = realloc(block, kCountingHeaderSize + size);
+
+	if (!block) {
+		return NULL;
+	}
+
+	*(size_t *)block = size;
+	c->bytes -= old_size;
+	counting_add(c, size);
+	return block + kCountingHeaderSize;
+}
+
+
+static void counting_release(void * user, void * ptr) {
+	struct counting_allocator * c = user;
+
+	if (ptr) {
+		char * block = (char *)ptr - kCountingHeaderSize;
+		c->outstanding--;
+		c->bytes -= *(size_t *)block;
+		free(block);
+	}
+}
+
+
+void Test_tdp_context_allocator(CuTest * tc) {
+	struct counting_allocator count = { 0 };
+	tdp_allocator a = { counting_allocate, counting_reallocate, counting_release, &count };
+
+	tdp_context * c = tdp_context_new_with_allocator(&a);
+	DString * test = d_string_new("foo,bar\none,\"two\"");
+
+	size_t start = count.allocations;
+	CuAssertTrue(tc, start > 0);
+
+	DString * out = tdp_context_to_json(c, test, FORMAT_CSV, true);
+	CuAssertStrEquals(tc, "[\n\t[\n\t\t\"foo\",\n\t\t\"bar\"\n\t],\n\t[\n\t\t\"one\",\n\t\t\"two\"\n\t]\n]\n", out->str);
+
+	// Header strings came from our allocator
+	CuAssertTrue(tc, count.allocations > start);
+
+#ifdef HAVE_ZLIB
+	// So did the compressor's blocks and state
+	start = count.allocations;
+	CuAssertTrue(tc, tdp_context_set_compression(c, TDP_COMPRESSION_GZIP));
+	tdp_context_set_threads(c, 2);
+	CuAssertTrue(tc, tdp_context_to_json(c, test, FORMAT_CSV, true) != NULL);
+	CuAssertTrue(tc, count.allocations > start + 4);
+#endif
+
+	tdp_context_free(c);
+	CuAssertIntEquals(tc, 0, count.outstanding);
+
+	// Schemas and templates can use it too
+	start = count.allocations;
+	tdp_schema * schema = tdp_schema_parse_with_allocator(&a, "foo string default=x\nbar int", 28);
+	tdp_template * view = tdp_template_parse_with_allocator(&a, "{{#records}}{{foo}}{{/records}}", 31);
+	CuAssertTrue(tc, schema && view);
+	CuAssertTrue(tc, count.allocations > start + 4);
+
+	tdp_schema_free(schema);
+	tdp_template_free(view);
+	CuAssertIntEquals(tc, 0, count.outstanding);
+
+	d_string_free(test, true);
+}
+
+
+static bool discard_output(const char * data, size_t len, void * user) {
+	(void) data;
+	*(size_t *) user += len;
+	return true;
+}
+
+
+void Test_tdp_context_allocation_failure(CuTest * tc) {
+	struct counting_allocator count = { 0 };
+	tdp_allocator a = { counting_allocate, counting_reallocate, counting_release, &count };
+	DString * test = d_string_new("id,name,city\n");
+	size_t written = 0;
+
+	for (int i = 0; i < 20000; ++i) {
+		d_string_append_printf(test, "%d,name %d,Springfield\n", i, i);
+	}
+
+	// Tokens do not fit in 200 KB
+	count.limit = 200 * 1024;
+	tdp_context * c = tdp_context_new_with_allocator(&a);
+	CuAssertTrue(tc, c != NULL);
+
+	CuAssertTrue(tc, tdp_context_to_json(c, test, FORMAT_CSV, false) == NULL);
+	CuAssertTrue(tc, !tdp_context_write_json(c, test, FORMAT_CSV, false, discard_output, &written));
+
+	// Tokens fit, but the output does not
+	count.limit = 0;
+	CuAssertTrue(tc, tdp_context_write_json(c, test, FORMAT_CSV, false, discard_output, &written));
+	CuAssertTrue(tc, written > 20000 * 30);
+
+	count.limit = count.bytes + 200 * 1024;
+	CuAssertTrue(tc, tdp_context_to_json(c, test, FORMAT_CSV, false) == NULL);
+	CuAssertTrue(tc, tdp_context_to_rope(c, test, FORMAT_CSV, false) == NULL);
+
+	// Context is still usable
+	count.limit = 0;
+	tdp_context_reset(c);
+	CuAssertTrue(tc, tdp_context_to_json(c, test, FORMAT_CSV, false) != NULL);
+
+	// Everything but the header keys is kept for the next document, so
+	// only the keys are missing
+	tdp_context_reset(c);
+	count.limit = count.bytes;
+	CuAssertTrue(tc, tdp_context_to_json(c, test, FORMAT_CSV, false) == NULL);
+	CuAssertTrue(tc, !tdp_context_write_json(c, test, FORMAT_CSV, false, discard_output, &written));
+	CuAssertIntEquals(tc, 0, c->header->size);
+
+	count.limit = 0;
+	CuAssertTrue(tc, tdp_context_to_json(c, test, FORMAT_CSV, false) != NULL);
+
+	tdp_context_free(c);
+	CuAssertIntEquals(tc, 0, count.outstanding);
+
+	// A DString keeps its contents when it can't grow
+	count.limit = 2048;
+	DString * s = d_string_new_with_allocator(&a, "abc");
+	CuAssertTrue(tc, s != NULL);
+	CuAssertTrue(tc, !d_string_reserve(s, 4096));
+	d_string_append(s, "def");
+	CuAssertStrEquals(tc, "abcdef", s->str);
+	CuAssertTrue(tc, !s->failed);
+
+	for (int i = 0; i < 1000; ++i) {
+		d_string_append(s, "ghi");
+	}
+
+	CuAssertTrue(tc, s->failed);
+	CuAssertTrue(tc, s->currentStringLength < 2048);
+	CuAssertTrue(tc, s->str[s->currentStringLength] == '\0');
+	d_string_free(s, true);
+
+	CuAssertIntEquals(tc, 0, count.outstanding);
+	d_string_free(test, true);
+}
+
+
+void Test_tdp_context_compression(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("foo,bar\none,two\n");
+
+	// Snappy only compresses Parquet pages
+	CuAssertTrue(tc, !tdp_context_set_compression(c, TDP_COMPRESSION_SNAPPY));
+	tdp_context_set_output_format(c, TDP_OUTPUT_PARQUET);
+	CuAssertTrue(tc, tdp_context_set_compression(c, TDP_COMPRESSION_SNAPPY));
+
+	// Changing the output format afterwards does not silently drop it
+	tdp_context_set_output_format(c, TDP_OUTPUT_JSON);
+	CuAssertTrue(tc, tdp_context_to_json(c, test, FORMAT_CSV, false) == NULL);
+
+	CuAssertTrue(tc, tdp_context_set_compression(c, TDP_COMPRESSION_NONE));
+	CuAssertTrue(tc, tdp_context_to_json(c, test, FORMAT_CSV, false) != NULL);
+
+	d_string_free(test, true);
+	tdp_context_free(c);
+}
+
+
+/// Number of times the memory test converts its corpus -- enough to see
+/// buffers stop growing.  Configure with cmake
+/// -DMEMORY_TEST_ITERATIONS=1000000 for a full soak test.
+#ifndef kMemoryTestIterations
+	#define kMemoryTestIterations 10
+#endif
+
+
+void Test_tdp_context_memory(CuTest * tc) {
+	struct counting_allocator reused = { 0 };
+	struct counting_allocator temporary = { 0 };
+	tdp_allocator a = { counting_allocate, counting_reallocate, counting_release, &reused };
+	tdp_allocator b = { counting_allocate, counting_reallocate, counting_release, &temporary };
+
+	const char * corpus[] = {
+		"first,last,address,city,zip\nJohn,Doe,120 any st.,\"Anytown, WW\",08123",
+		"a,b,c\n1,\"\",\"\"\n2,3,4",
+		"a,b\n1,\"ha \"\"ha\"\" ha\"\n3,4",
+		"a,b,c\r\n1,2,3\r\n\"Once upon \r\na time\",5,6\r\n7,8,9\r\n",
+		"foo,\"",
+	};
+	size_t corpus_size = sizeof(corpus) / sizeof(corpus[0]);
+
+	tdp_context * c = tdp_context_new_with_allocator(&a);
+	DString * source = d_string_new("");
+	size_t bytes = 0;
+	size_t peak = 0;
+
+	for (size_t i = 0; i < kMemoryTestIterations; ++i) {
+		for (size_t j = 0; j < corpus_size; ++j) {
+			d_string_erase(source, 0, -1);
+			d_string_append(source, corpus[j]);
+
+			// Long lived context
+			tdp_context_to_json(c, source, (j % 2) ? FORMAT_TSV : FORMAT_CSV, i % 2);
+
+			// Temporary context that takes ownership of output
+			tdp_context * t = tdp_context_new_with_allocator(&b);
+			tdp_context_to_json(t, source, FORMAT_CSV, false);
+			d_string_free(tdp_context_take_output(t), true);
+			tdp_context_free(t);
+
+			CuAssertIntEquals(tc, 0, temporary.outstanding);
+		}
+
+		tdp_context_reset(c);
+
+		if (i == 1) {
+			// Buffers have reached their working size
+			bytes = reused.bytes;
+			peak = reused.peak;
+		} else if (i > 1 && (reused.bytes != bytes || reused.peak != peak)) {
+			CuFail(tc, "Memory use grew during repeated conversions");
+		}
+	}
+
+	CuAssertIntEquals(tc, 0, temporary.bytes);
+
+	tdp_context_free(c);
+	CuAssertIntEquals(tc, 0, reused.outstanding);
+	CuAssertIntEquals(tc, 0, reused.bytes);
+
+	d_string_free(source, true);
+}
+#endif
@@ -0,0 +1,255 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file context.h
+
+	@brief Reusable state for converting many documents
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#ifndef CONTEXT_TDP_PARSER_H
+#define CONTEXT_TDP_PARSER_H
+
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+#include "allocator.h"
+#include "d_string.h"
+#include "mustache.h"
+#include "record_index.h"
+#include "schema.h"
+#include "simple_token.h"
+#include "stack.h"
+
+/// From sys/uio.h:
+struct iovec;
+
+
+/// Everything needed to convert a document.  A context can be reused
+/// for multiple documents, so that the parser, token storage, and
+/// output buffers only need to be allocated once.
+struct tdp_context {
+	const tdp_allocator	*	allocator;	//!< Allocator used for all storage (NULL to use heap)
+
+	void		*	parser;				//!< Lemon parser
+	simple_token	*	root;				//!< Result of the most recent parse
+	token_pool	*	pool;				//!< Storage for tokens
+
+	stack		*	header;				//!< Header strings for current document
+	bool			failed;				//!< Memory for the current document could not be allocated
+	DString		*	out;				//!< Output buffer (created when needed)
+	char		*	flush_buffer;		//!< Buffer for streaming output (created when needed)
+	struct iovec	*	vectors;		//!< Scatter-gather list for writing output (created when needed)
+
+	short			style;				//!< JSON output style (tdp_json_style)
+	short			output_format;		//!< Output format (tdp_output_format)
+	size_t			batch_size;			//!< Records per Arrow record batch, Parquet row group, or SQLite transaction
+	short			compression;		//!< Compression (tdp_compression)
+	size_t			threads;			//!< Threads for output compression (0 for one per CPU)
+	bool			ascii_only;			//!< Escape non-ASCII characters as \uXXXX
+
+	size_t			type_sample;		//!< Number of records used to infer column types (0 to type each value separately)
+	const tdp_schema	*	schema;		//!< Forced column types (if not NULL)
+	const tdp_template	*	mustache;	//!< Template for TDP_OUTPUT_MUSTACHE (if not NULL)
+	record_index	*	index;			//!< Record offsets are written here (if not NULL)
+
+	short		*	column_types;		//!< Inferred type for each column (tdp_column_type)
+	const tdp_schema_column	**	column_plan;	//!< Schema plan for each column (or NULL)
+	size_t			column_count;		//!< Number of columns with inferred types
+	size_t			column_capacity;	//!< Size of column_types array
+};
+
+typedef struct tdp_context tdp_context;
+
+
+#define kFlushBufferSize 65536			//!< Size of buffer used for streaming output
+
+
+/// Create a new conversion context
+tdp_context * tdp_context_new(void);
+
+
+/// Create a new conversion context, using the specified allocator for all
+/// storage (including the output)
+tdp_context * tdp_context_new_with_allocator(
+	const tdp_allocator * allocator		//!< Allocator to use (NULL to use heap)
+);
+
+
+/// Release document specific data, keeping buffers for the next document
+void tdp_context_reset(
+	tdp_context * context				//!< Context to be reset
+);
+
+
+/// Free conversion context
+void tdp_context_free(
+	tdp_context * context				//!< Context to be freed
+);
+
+
+/// Choose whether non-ASCII characters are escaped as \uXXXX
+void tdp_context_set_ascii_only(
+	tdp_context * context,				//!< Context to configure
+	bool ascii_only						//!< Escape non-ASCII characters
+);
+
+
+/// Choose how many records are used to infer column types
+void tdp_context_set_type_sample(
+	tdp_context * context,				//!< Context to configure
+	size_t records						//!< Number of records (TDP_SAMPLE_ALL for all, 0 to type each value separately)
+);
+
+
+/// Use `schema` (which must outlive the context) to convert named columns,
+/// instead of inferring their types
+void tdp_context_set_schema(
+	tdp_context * context,				//!< Context to configure
+	const tdp_schema * schema			//!< Schema to use (or NULL)
+);
+
+
+/// Render `view` (which must outlive the context) for TDP_OUTPUT_MUSTACHE
+void tdp_context_set_template(
+	tdp_context * context,				//!< Context to configure
+	const tdp_template * view			//!< Template to use (or NULL)
+);
+
+
+/// Write an index of record offsets to `write` (see record_index.h), for
+/// every `stride`th record.  Use a NULL callback to stop indexing.
+/// Returns false if memory could not be allocated.
+bool tdp_context_set_index(
+	tdp_context * context,				//!< Context to configure
+	size_t stride,						//!< Index every `stride`th record (0 for every record)
+	sink_flush_callback write,			//!< Receives index (or NULL)
+	void * user							//!< Passed to `write`
+);
+
+
+/// Add another column (with type TDP_TYPE_NULL and no schema plan).
+/// Returns false if memory could not be allocated.
+bool tdp_context_add_column(
+	tdp_context * context				//!< Context to use
+);
+
+
+/// Make room for `count` columns (and as many header keys) at once, rather
+/// than growing as they are added.  Returns false if memory could not be
+/// allocated.
+bool tdp_context_reserve_columns(
+	tdp_context * context,				//!< Context to use
+	size_t count						//!< Number of columns expected
+);
+
+
+/// Get buffer used for streaming output (kFlushBufferSize bytes), or
+/// NULL if it could not be allocated
+char * tdp_context_flush_buffer(
+	tdp_context * context				//!< Context to use
+);
+
+
+/// Get scatter-gather list used for streaming output (kSinkGatherVectors
+/// entries), or NULL if it could not be allocated (or `writev()` is not
+/// available)
+struct iovec * tdp_context_gather_vectors(
+	tdp_context * context				//!< Context to use
+);
+
+
+/// Choose JSON output style (TDP_JSON_PRETTY, TDP_JSON_COMPACT,
+/// TDP_JSON_LINES, or TDP_JSON_COLUMNS)
+void tdp_context_set_json_style(
+	tdp_context * context,				//!< Context to configure
+	short style							//!< Output style
+);
+
+
+/// Choose output format (TDP_OUTPUT_JSON, TDP_OUTPUT_MSGPACK, or
+/// TDP_OUTPUT_CBOR)
+void tdp_context_set_output_format(
+	tdp_context * context,				//!< Context to configure
+	short format						//!< Output format
+);
+
+
+/// Choose the number of records in each Arrow record batch, Parquet row
+/// group, or SQLite transaction
+void tdp_context_set_batch_size(
+	tdp_context * context,				//!< Context to configure
+	size_t records						//!< Records per batch (0 for default)
+);
+
+
+/// Choose compression (tdp_compression).  Returns false if libTDP was
+/// built without support for `compression`.
+bool tdp_context_set_compression(
+	tdp_context * context,				//!< Context to configure
+	short compression					//!< Compression
+);
+
+
+/// Choose the number of threads used to compress output
+void tdp_context_set_threads(
+	tdp_context * context,				//!< Context to configure
+	size_t threads						//!< Number of threads (0 for one per CPU)
+);
+
+
+/// Take ownership of the output buffer (the context will create a new
+/// one when needed)
+DString * tdp_context_take_output(
+	tdp_context * context				//!< Context that created output
+);
+
+
+#endif
@@ -108,16 +108,45 @@ int vasprintf(char ** strp, const char * fmt, va_list ap) {
 }
 
 
+// Same as vasprintf(), but using the specified allocator
+static int d_string_vasprintf(const tdp_allocator * allocator, char ** strp, const char * fmt, va_list ap) {
+	va_list ap2;
+	va_copy(ap2, ap);
+
+	int size = vsnprintf(NULL, 0, fmt, ap2);
+	va_end(ap2);
+
+	if (size < 0) {
+		return size;
+	}
+
+	size += 1;
+	*strp = (char *)tdp_malloc(allocator, size * sizeof(char));
+
+	if (*strp == NULL) {
+		return -1;
+	}
+
+	return vsnprintf(*strp, size, fmt, ap);
+}
+
+
 /* DString */
 
 #define kStringBufferStartingSize 1024					//!< Default size of string buffer capacity
 #define kStringBufferGrowthMultiplier 2					//!< Multiply capacity by this factor when more space is needed
-#define kStringBufferMaxIncrement 1024 * 1024 * 100		//!< Maximum growth increment when resizing (to limit exponential growth)
+#define kStringBufferLargeSize (1024 * 1024 * 64)		//!< Larger buffers grow by half instead (still geometric, but with less unused space)
 
 
 /// Create a new dynamic string
 DString * d_string_new(const char * startingString) {
-	DString * newString = malloc(sizeof(DString));
+	return d_string_new_with_allocator(NULL, startingString);
+}
+
+
+/// Create a new dynamic string using the specified allocator
+DString * d_string_new_with_allocator(const tdp_allocator * allocator, const char * startingString) {
+	DString * newString = tdp_malloc(allocator, sizeof(DString));
 
 	if (!newString) {
 		return NULL;
@@ -134,13 +163,16 @@ DString * d_string_new(const char * startingString) {
 		startingBufferSize *= kStringBufferGrowthMultiplier;
 	}
 
-	newString->str = malloc(startingBufferSize);
+	newString->str = tdp_malloc(allocator, startingBufferSize);
 
 	if (!newString->str) {
-		free(newString);
+		tdp_free(allocator, newString);
 		return NULL;
 	}
 
+	newString->allocator = allocator;
+	newString->failed = false;
+
 	newString->currentStringBufferSize = startingBufferSize;
 	strncpy(newString->str, startingString, startingStringSize);
 	newString->str[startingStringSize] = '\0';
@@ -185,20 +217,39 @@ char * d_string_free(DString * ripString, bool freeCharacterData) {
 
 	if (freeCharacterData) {
 		if (ripString->str != NULL) {
-			free(ripString->str);
+			tdp_free(ripString->allocator, ripString->str);
 		}
 
 		returnedString = NULL;
 	}
 
-	free(ripString);
+	tdp_free(ripString->allocator, ripString);
 
 	return returnedString;
 }
 
 
-/// Ensure that dynamic string has specified capacity
-static void ensureStringBufferCanHold(DString * baseString, size_t newStringSize) {
+/// Change capacity of dynamic string.  If memory can not be allocated, the
+/// string is left as it was.
+static bool resizeStringBuffer(DString * baseString, size_t newBufferSize) {
+	char * temp;
+	temp = tdp_realloc(baseString->allocator, baseString->str, newBufferSize);
+
+	if (temp == NULL) {
+		/* realloc failed */
+		return false;
+	}
+
+	baseString->str = temp;
+	baseString->currentStringBufferSize = newBufferSize;
+	return true;
+}
+
+
+/// Ensure that dynamic string has specified capacity.  Capacity grows
+/// geometrically, so that appending is linear overall however large the
+/// string gets.
+static bool ensureStringBufferCanHold(DString * baseString, size_t newStringSize) {
 	if (baseString) {
 		size_t newBufferSizeNeeded = newStringSize + 1;
 
@@ -206,27 +257,35 @@ static void ensureStringBufferCanHold(DString * baseString, size_t newStringSize
 			size_t newBufferSize = baseString->currentStringBufferSize;
 
 			while (newBufferSizeNeeded > newBufferSize) {
-				if (newBufferSize > kStringBufferMaxIncrement) {
-					newBufferSize += kStringBufferMaxIncrement;
+				if (newBufferSize >= kStringBufferLargeSize) {
+					newBufferSize += newBufferSize / 2;
 				} else {
 					newBufferSize *= kStringBufferGrowthMultiplier;
 				}
 			}
 
-			char * temp;
-			temp = realloc(baseString->str, newBufferSize);
+			if (!resizeStringBuffer(baseString, newBufferSize)) {
+				// Change will be dropped
+				baseString->failed = true;
+				return false;
+			}
+		}
 
-			if (temp == NULL) {
-				/* realloc failed */
-				fprintf(stderr, "Error reallocating memory for d_string. Current buffer size %lu.\n", baseString->currentStringBufferSize);
+		return true;
+	}
 
-				exit(1);
-			}
+	return false;
+}
 
-			baseString->str = temp;
-			baseString->currentStringBufferSize = newBufferSize;
-		}
+
+/// Ensure that dynamic string can hold `bytes` characters without being
+/// reallocated
+bool d_string_reserve(DString * baseString, size_t bytes) {
+	if (baseString && (bytes + 1 > baseString->currentStringBufferSize)) {
+		return resizeStringBuffer(baseString, bytes + 1);
 	}
+
+	return (baseString != NULL);
 }
 
 
@@ -254,6 +313,36 @@ void Test_ensureStringBufferCanHold(CuTest * tc) {
 
 	ensureStringBufferCanHold(NULL, 1024);
 
+	// Large buffers keep growing geometrically
+	d_string_reserve(result, kStringBufferLargeSize - 1);
+	CuAssertIntEquals(tc, kStringBufferLargeSize, result->currentStringBufferSize);
+	ensureStringBufferCanHold(result, kStringBufferLargeSize);
+	CuAssertIntEquals(tc, kStringBufferLargeSize + kStringBufferLargeSize / 2, result->currentStringBufferSize);
+
+	d_string_free(result, true);
+}
+
+
+void Test_d_string_reserve(CuTest * tc) {
+	DString * result = d_string_new("foo");
+
+	// Exact size
+	d_string_reserve(result, 5000);
+	CuAssertIntEquals(tc, 5001, result->currentStringBufferSize);
+	CuAssertStrEquals(tc, "foo", result->str);
+
+	// Never shrinks
+	d_string_reserve(result, 10);
+	CuAssertIntEquals(tc, 5001, result->currentStringBufferSize);
+
+	for (int i = 0; i < 4997; ++i) {
+		d_string_append_c(result, 'x');
+	}
+
+	CuAssertIntEquals(tc, 5000, result->currentStringLength);
+	CuAssertIntEquals(tc, 5001, result->currentStringBufferSize);
+
+	d_string_reserve(NULL, 10);
 	d_string_free(result, true);
 }
 #endif
@@ -266,7 +355,9 @@ void d_string_append(DString * baseString, const char * appendedString) {
 
 		if (appendedStringLength > 0) {
 			size_t newStringLength = baseString->currentStringLength + appendedStringLength;
-			ensureStringBufferCanHold(baseString, newStringLength);
+			if (!ensureStringBufferCanHold(baseString, newStringLength)) {
+				return;
+			}
 
 			/* We already know where the current string ends, so pass that as the starting address for strncat */
 			strncat(baseString->str + baseString->currentStringLength, appendedString, appendedStringLength);
@@ -302,7 +393,9 @@ void Test_d_string_append(CuTest * tc) {
 void d_string_append_c(DString * baseString, char appendedCharacter) {
 	if (baseString && appendedCharacter) {
 		size_t newSizeNeeded = baseString->currentStringLength + 1;
-		ensureStringBufferCanHold(baseString, newSizeNeeded);
+		if (!ensureStringBufferCanHold(baseString, newSizeNeeded)) {
+			return;
+		}
 
 		baseString->str[baseString->currentStringLength] = appendedCharacter;
 		baseString->currentStringLength++;
@@ -341,7 +434,9 @@ void d_string_append_c_array(DString * baseString, const char * appendedChars, s
 		} else {
 			if (appendedChars) {
 				size_t newSizeNeeded = baseString->currentStringLength + bytes;
-				ensureStringBufferCanHold(baseString, newSizeNeeded);
+				if (!ensureStringBufferCanHold(baseString, newSizeNeeded)) {
+					return;
+				}
 
 				memcpy((void *)baseString->str + baseString->currentStringLength, appendedChars, bytes);
 
@@ -389,11 +484,13 @@ void d_string_append_printf(DString * baseString, const char * format, ...) {
 		va_start(args, format);
 
 		char * formattedString = NULL;
-		vasprintf(&formattedString, format, args);
+		d_string_vasprintf(baseString->allocator, &formattedString, format, args);
 
 		if (formattedString != NULL) {
 			d_string_append(baseString, formattedString);
-			free(formattedString);
+			tdp_free(baseString->allocator, formattedString);
+		} else {
+			baseString->failed = true;
 		}
 
 		va_end(args);
@@ -433,7 +530,9 @@ void d_string_prepend(DString * baseString, const char * prependedString) {
 
 		if (prependedStringLength > 0) {
 			size_t newStringLength = baseString->currentStringLength + prependedStringLength;
-			ensureStringBufferCanHold(baseString, newStringLength);
+			if (!ensureStringBufferCanHold(baseString, newStringLength)) {
+				return;
+			}
 
 			memmove(baseString->str + prependedStringLength, baseString->str, baseString->currentStringLength);
 			strncpy(baseString->str, prependedString, prependedStringLength);
@@ -476,7 +575,9 @@ void d_string_insert(DString * baseString, size_t pos, const char * insertedStri
 			}
 
 			size_t newStringLength = baseString->currentStringLength + insertedStringLength;
-			ensureStringBufferCanHold(baseString, newStringLength);
+			if (!ensureStringBufferCanHold(baseString, newStringLength)) {
+				return;
+			}
 
 			/* Shift following string to 'right' */
 			memmove(baseString->str + pos + insertedStringLength, baseString->str + pos, baseString->currentStringLength - pos);
@@ -521,7 +622,9 @@ void d_string_insert_c(DString * baseString, size_t pos, char insertedCharacter)
 		}
 
 		size_t newSizeNeeded = baseString->currentStringLength + 1;
-		ensureStringBufferCanHold(baseString, newSizeNeeded);
+		if (!ensureStringBufferCanHold(baseString, newSizeNeeded)) {
+			return;
+		}
 
 		/* Shift following string to 'right' */
 		memmove(baseString->str + pos + 1, baseString->str + pos, baseString->currentStringLength - pos);
@@ -570,7 +673,9 @@ void d_string_insert_c_array(DString * baseString, size_t pos, const char * inse
 			}
 
 			size_t newSizeNeeded = baseString->currentStringLength + bytes;
-			ensureStringBufferCanHold(baseString, newSizeNeeded);
+			if (!ensureStringBufferCanHold(baseString, newSizeNeeded)) {
+				return;
+			}
 
 			/* Shift following string to 'right' */
 			memmove(baseString->str + pos + bytes, baseString->str + pos, baseString->currentStringLength - pos);
@@ -614,11 +719,13 @@ void d_string_insert_printf(DString * baseString, size_t pos, const char * forma
 		va_start(args, format);
 
 		char * formattedString = NULL;
-		vasprintf(&formattedString, format, args);
+		d_string_vasprintf(baseString->allocator, &formattedString, format, args);
 
 		if (formattedString != NULL) {
 			d_string_insert(baseString, pos, formattedString);
-			free(formattedString);
+			tdp_free(baseString->allocator, formattedString);
+		} else {
+			baseString->failed = true;
 		}
 
 		va_end(args);
@@ -715,9 +822,12 @@ char * d_string_copy_substring(DString * d, size_t start, size_t len) {
 			return NULL;
 		}
 
-		result = malloc(len + 1);
-		strncpy(result, &d->str[start], len);
-		result[len] = '\0';
+		result = tdp_malloc(d->allocator, len + 1);
+
+		if (result) {
+			strncpy(result, &d->str[start], len);
+			result[len] = '\0';
+		}
 
 		return result;
 	} else {
@@ -787,9 +897,15 @@ long d_string_replace_text_in_range(DString * d, size_t pos, size_t len, const c
 
 		while (match && (match - d->str < stop)) {
 			pos = match - d->str;
+			size_t expected = d->currentStringLength + change;
 			d_string_erase(d, match - d->str, len_o);
 			d_string_insert(d, match - d->str, replace);
 
+			if (d->currentStringLength != expected) {
+				// Out of memory
+				break;
+			}
+
 			delta += change;
 			stop += change;
 			match = strstr(d->str + pos + len_r, original);
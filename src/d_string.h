@@ -64,6 +64,8 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+#include "allocator.h"
+
 /* WE implement minimal mirror implementations of GLib's GString
  * sufficient to cover the functionality required by MultiMarkdown.
  *
@@ -72,11 +74,15 @@
  */
 
 
-/// Structure for dynamic string
+/// Structure for dynamic string.  If memory can not be allocated for a
+/// change, the change is dropped and `failed` stays set, so that callers
+/// can check once when they are done.
 struct DString {
 	char * str;                             //!< Pointer to UTF-8 byte stream for string
 	unsigned long currentStringBufferSize;  //!< Size of buffer currently allocated
 	unsigned long currentStringLength;      //!< Size of current string
+	const tdp_allocator * allocator;        //!< Allocator for this string (NULL to use heap)
+	bool failed;                            //!< Memory could not be allocated, so a change was dropped
 };
 
 typedef struct DString DString;
@@ -88,13 +94,31 @@ DString * d_string_new(
 );
 
 
-/// Free dynamic string
+/// Create a new dynamic string using the specified allocator
+DString * d_string_new_with_allocator(
+	const tdp_allocator * allocator,        //!< Allocator to use (NULL to use heap)
+	const char * startingString             //!< Initial contents for string
+);
+
+
+/// Free dynamic string.  If the underlying str is kept, it must later be
+/// freed with the same allocator that was used to create the string.
 char * d_string_free(
 	DString * ripString,                    //!< DString to be freed
 	bool freeCharacterData                  //!< Should the underlying str be freed as well?
 );
 
 
+/// Make sure that dynamic string can hold `bytes` characters (not counting
+/// the null terminator) without being reallocated, e.g. before appending
+/// output of a known size.  Returns false if memory could not be allocated
+/// (the string is unchanged, and is not marked as failed).
+bool d_string_reserve(
+	DString * baseString,                   //!< DString to be resized
+	size_t bytes                            //!< Number of characters to make room for
+);
+
+
 /// Append null-terminated string to end of dynamic string
 void d_string_append(
 	DString * baseString,                   //!< DString to be appended
@@ -0,0 +1,339 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file escape.c
+
+	@brief Escape text for JSON strings.  Clean runs of text are found
+	16 bytes at a time (SSE2 or NEON where available), and copied in bulk.
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	#include <arm_neon.h>
+#endif
+
+#include "escape.h"
+#include "sink.h"
+
+#ifdef TEST
+	#include "d_string.h"
+#endif
+
+
+static const char hex_digits[] = "0123456789abcdef";
+
+
+/// Does this byte need to be escaped?
+#define needs_escape(c, ascii_only) (((c) < 0x20) || ((c) == '"') || ((c) == '\\') || ((ascii_only) && ((c) >= 0x80)))
+
+
+/// Return number of bytes at the start of `p` that can be copied unchanged
+static size_t clean_run(const unsigned char * p, size_t len, bool ascii_only) {
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1F);
+
+	while (i + 16 <= len) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+
+		// Unsigned v <= 0x1F is equivalent to max(v, 0x1F) == 0x1F
+		__m128i special = _mm_or_si128(
+							  _mm_cmpeq_epi8(_mm_max_epu8(v, control), control),
+							  _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+
+		int mask = _mm_movemask_epi8(special);
+
+		if (ascii_only) {
+			// High bit set for non-ASCII bytes
+			mask |= _mm_movemask_epi8(v);
+		}
+
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+
+		i += 16;
+	}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const uint8x16_t quote = vdupq_n_u8('"');
+	const uint8x16_t backslash = vdupq_n_u8('\\');
+	const uint8x16_t space = vdupq_n_u8(0x20);
+	const uint8x16_t high = vdupq_n_u8(0x80);
+
+	while (i + 16 <= len) {
+		uint8x16_t v = vld1q_u8(p + i);
+		uint8x16_t special = vorrq_u8(vcltq_u8(v, space),
+									  vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)));
+
+		if (ascii_only) {
+			special = vorrq_u8(special, vcgeq_u8(v, high));
+		}
+
+		if (vmaxvq_u8(special)) {
+			// Find exact position below
+			break;
+		}
+
+		i += 16;
+	}
+
+#endif
+
+	while (i < len && !needs_escape(p[i], ascii_only)) {
+		i++;
+	}
+
+	return i;
+}
+
+
+/// Write `\uXXXX` for a UTF-16 code unit
+static void escape_code_unit(sink * out, unsigned int u) {
+	char buffer[6] = {
+		'\\', 'u',
+		hex_digits[(u >> 12) & 0xF],
+		hex_digits[(u >> 8) & 0xF],
+		hex_digits[(u >> 4) & 0xF],
+		hex_digits[u & 0xF]
+	};
+
+	sink_write(out, buffer, 6);
+}
+
+
+/// Write escape sequence for an ASCII character
+static void escape_ascii(sink * out, unsigned char c) {
+	switch (c) {
+		case '"':
+			sink_write(out, "\\\"", 2);
+			break;
+
+		case '\\':
+			sink_write(out, "\\\\", 2);
+			break;
+
+		case '\b':
+			sink_write(out, "\\b", 2);
+			break;
+
+		case '\f':
+			sink_write(out, "\\f", 2);
+			break;
+
+		case '\n':
+			sink_write(out, "\\n", 2);
+			break;
+
+		case '\r':
+			sink_write(out, "\\r", 2);
+			break;
+
+		case '\t':
+			sink_write(out, "\\t", 2);
+			break;
+
+		default:
+			escape_code_unit(out, c);
+			break;
+	}
+}
+
+
+/// Decode one UTF-8 character, returning the number of bytes used.
+/// Invalid sequences decode as U+FFFD, one byte at a time.
+static size_t decode_utf8(const unsigned char * p, size_t len, unsigned int * code_point) {
+	size_t needed;
+	unsigned int c;
+	unsigned int min;
+
+	if (p[0] < 0x80) {
+		*code_point = p[0];
+		return 1;
+	} else if ((p[0] & 0xE0) == 0xC0) {
+		needed = 2;
+		c = p[0] & 0x1F;
+		min = 0x80;
+	} else if ((p[0] & 0xF0) == 0xE0) {
+		needed = 3;
+		c = p[0] & 0x0F;
+		min = 0x800;
+	} else if ((p[0] & 0xF8) == 0xF0) {
+		needed = 4;
+		c = p[0] & 0x07;
+		min = 0x10000;
+	} else {
+		*code_point = 0xFFFD;
+		return 1;
+	}
+
+	if (needed > len) {
+		*code_point = 0xFFFD;
+		return 1;
+	}
+
+	for (size_t i = 1; i < needed; ++i) {
+		if ((p[i] & 0xC0) != 0x80) {
+			*code_point = 0xFFFD;
+			return 1;
+		}
+
+		c = (c << 6) | (p[i] & 0x3F);
+	}
+
+	if ((c < min) || (c > 0x10FFFF) || (c >= 0xD800 && c <= 0xDFFF)) {
+		// Overlong, out of range, or surrogate
+		*code_point = 0xFFFD;
+		return 1;
+	}
+
+	*code_point = c;
+	return needed;
+}
+
+
+/// Write text escaped for use inside a JSON string
+void json_escape(sink * out, const char * text, size_t len, bool ascii_only) {
+	const unsigned char * p = (const unsigned char *)text;
+	unsigned int code_point;
+	size_t run;
+
+	while (len) {
+		run = clean_run(p, len, ascii_only);
+
+		if (run) {
+			sink_write_ref(out, (const char *)p, run);
+			p += run;
+			len -= run;
+
+			if (len == 0) {
+				break;
+			}
+		}
+
+		if (*p < 0x80) {
+			escape_ascii(out, *p);
+			p++;
+			len--;
+		} else {
+			run = decode_utf8(p, len, &code_point);
+
+			if (code_point > 0xFFFF) {
+				code_point -= 0x10000;
+				escape_code_unit(out, 0xD800 + (code_point >> 10));
+				escape_code_unit(out, 0xDC00 + (code_point & 0x3FF));
+			} else {
+				escape_code_unit(out, code_point);
+			}
+
+			p += run;
+			len -= run;
+		}
+	}
+}
+
+
+#ifdef TEST
+static void check_escape(CuTest * tc, const char * text, bool ascii_only, const char * expected) {
+	DString * d = d_string_new("");
+	sink s;
+
+	sink_init_string(&s, d);
+	json_escape(&s, text, strlen(text), ascii_only);
+	CuAssertStrEquals(tc, expected, d->str);
+
+	d_string_free(d, true);
+}
+
+
+void Test_json_escape(CuTest * tc) {
+	check_escape(tc, "", false, "");
+	check_escape(tc, "plain text", false, "plain text");
+	check_escape(tc, "a \"quote\" and \\ backslash", false, "a \\\"quote\\\" and \\\\ backslash");
+	check_escape(tc, "\x01\b\f\n\r\t\x1f", false, "\\u0001\\b\\f\\n\\r\\t\\u001f");
+
+	// Long runs are scanned in blocks -- check every position in a block
+	for (int i = 0; i < 40; ++i) {
+		char text[48];
+		char expected[64];
+
+		memset(text, 'x', 40);
+		text[40] = '\0';
+		text[i] = '\x02';
+
+		memset(expected, 'x', i);
+		strcpy(&expected[i], "\\u0002");
+		memset(&expected[i + 6], 'x', 39 - i);
+		expected[45] = '\0';
+
+		check_escape(tc, text, false, expected);
+	}
+
+	// UTF-8 is copied by default
+	check_escape(tc, "caf\xc3\xa9 \xca\xa4", false, "caf\xc3\xa9 \xca\xa4");
+
+	// Or escaped
+	check_escape(tc, "caf\xc3\xa9 \xca\xa4", true, "caf\\u00e9 \\u02a4");
+	check_escape(tc, "\xe2\x82\xac", true, "\\u20ac");
+	check_escape(tc, "\xf0\x9f\x98\x80", true, "\\ud83d\\ude00");
+
+	// Invalid UTF-8
+	check_escape(tc, "a\xffz", true, "a\\ufffdz");
+	check_escape(tc, "\xc0\xaf", true, "\\ufffd\\ufffd");
+	check_escape(tc, "\xe2\x82", true, "\\ufffd\\ufffd");
+}
+#endif
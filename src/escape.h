@@ -0,0 +1,84 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file escape.h
+
+	@brief Escape text for JSON strings
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#ifndef ESCAPE_TDP_PARSER_H
+#define ESCAPE_TDP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+#include "sink.h"
+
+
+/// Write `len` bytes of UTF-8 text to `out`, escaped for use inside a JSON
+/// string.  Quotes, backslashes, and all control characters below 0x20 are
+/// escaped.  If `ascii_only` is true, non-ASCII characters are written as
+/// `\uXXXX` (using surrogate pairs where needed), and invalid UTF-8 is
+/// replaced with U+FFFD.  Runs of text that need no escaping may be
+/// referenced rather than copied, so `text` must remain valid until `out`
+/// is finished.
+void json_escape(
+	sink * out,							//!< Destination
+	const char * text,					//!< Text to escape
+	size_t len,							//!< Number of bytes
+	bool ascii_only						//!< Escape non-ASCII characters
+);
+
+
+#endif
@@ -105,6 +105,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "d_string.h"
 #include "file.h"
@@ -113,7 +114,44 @@
 	#include <windows.h>
 #endif
 
-#define kBUFFERSIZE 4096	// How many bytes to read at a time
+#define kBUFFERSIZE 4096	// Smallest read when the file size is not known
+
+
+/// Read the rest of `file` into `buffer`.  If the file size is known, the
+/// buffer is sized once and filled by a single read; otherwise it grows
+/// geometrically.  Stops early if the buffer can not grow (see
+/// `buffer->failed`).
+static void read_file(DString * buffer, FILE * file) {
+	struct stat info;
+	size_t bytes;
+	size_t room;
+
+	if ((fstat(fileno(file), &info) == 0) && S_ISREG(info.st_mode) && (info.st_size > 0)) {
+		// Leave room to find the end of the file without growing again
+		d_string_reserve(buffer, buffer->currentStringLength + info.st_size + kBUFFERSIZE);
+	}
+
+	while (true) {
+		room = buffer->currentStringBufferSize - buffer->currentStringLength - 1;
+
+		if (room < kBUFFERSIZE) {
+			if (!d_string_reserve(buffer, buffer->currentStringBufferSize * 2)) {
+				return;
+			}
+
+			room = buffer->currentStringBufferSize - buffer->currentStringLength - 1;
+		}
+
+		bytes = fread(buffer->str + buffer->currentStringLength, 1, room, file);
+
+		if (bytes == 0) {
+			break;
+		}
+
+		buffer->currentStringLength += bytes;
+		buffer->str[buffer->currentStringLength] = '\0';
+	}
+}
 
 
 /// Scan file into a DString
@@ -121,7 +159,7 @@ DString * scan_file(const char * fname) {
 	/* Read from stdin and return a DString *
 		`buffer` will need to be freed elsewhere */
 
-	char chunk[kBUFFERSIZE];
+	char bom[3];
 	size_t bytes;
 
 	FILE * file;
@@ -142,19 +180,28 @@ DString * scan_file(const char * fname) {
 
 	DString * buffer = d_string_new("");
 
-	while ((bytes = fread(chunk, 1, kBUFFERSIZE, file)) > 0) {
-		d_string_append_c_array(buffer, chunk, bytes);
+	if (buffer == NULL) {
+		fclose(file);
+		return NULL;
+	}
+
+	// Strip BOM
+	bytes = fread(bom, 1, 3, file);
 
-		if (buffer->currentStringLength < kBUFFERSIZE) {
-			// Strip BOM
-			if (strncmp(buffer->str, "\xef\xbb\xbf", 3) == 0) {
-				d_string_erase(buffer, 0, 3);
-			}
-		}
+	if ((bytes < 3) || (strncmp(bom, "\xef\xbb\xbf", 3) != 0)) {
+		d_string_append_c_array(buffer, bom, bytes);
 	}
 
+	read_file(buffer, file);
+
 	fclose(file);
 
+	if (buffer->failed) {
+		// Out of memory
+		d_string_free(buffer, true);
+		return NULL;
+	}
+
 	return buffer;
 }
 
@@ -164,13 +211,16 @@ DString * stdin_buffer() {
 	/* Read from stdin and return a GString *
 		`buffer` will need to be freed elsewhere */
 
-	char chunk[kBUFFERSIZE];
-	size_t bytes;
-
 	DString * buffer = d_string_new("");
 
-	while ((bytes = fread(chunk, 1, kBUFFERSIZE, stdin)) > 0) {
-		d_string_append_c_array(buffer, chunk, bytes);
+	if (buffer) {
+		read_file(buffer, stdin);
+
+		if (buffer->failed) {
+			// Out of memory
+			d_string_free(buffer, true);
+			buffer = NULL;
+		}
 	}
 
 	fclose(stdin);
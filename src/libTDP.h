@@ -58,6 +58,8 @@
 
 #include <stdbool.h>
 
+#include "allocator.h"
+
 
 /// typedefs for internal data structures.  If you intend to work with these structures
 /// in your own code, you may need to import additional header files.
@@ -65,6 +67,25 @@
 /// From d_string.h:
 typedef struct DString DString;
 
+/// From context.h:
+typedef struct tdp_context tdp_context;
+
+/// From schema.h:
+typedef struct tdp_schema tdp_schema;
+
+/// From mustache.h:
+typedef struct tdp_template tdp_template;
+
+/// From rope.h:
+typedef struct tdp_rope tdp_rope;
+
+/// From sqlite3.h:
+typedef struct sqlite3 sqlite3;
+
+
+/// Receives streamed output.  Return false to report a write error.
+typedef bool (*tdp_write_callback)(const char * data, size_t len, void * user);
+
 
 // Input formats
 enum parser_formats {
@@ -73,6 +94,59 @@ enum parser_formats {
 };
 
 
+// JSON output styles
+enum tdp_json_style {
+	TDP_JSON_PRETTY,					//!< Indented, one value per line (default)
+	TDP_JSON_COMPACT,					//!< No indentation or newlines
+	TDP_JSON_LINES,						//!< One compact record per line (NDJSON)
+	TDP_JSON_COLUMNS					//!< Object of arrays, one array of values per column
+};
+
+
+// Output formats
+enum tdp_output_format {
+	TDP_OUTPUT_JSON,					//!< JSON text (default)
+	TDP_OUTPUT_MSGPACK,					//!< MessagePack
+	TDP_OUTPUT_CBOR,					//!< CBOR (RFC 8949)
+	TDP_OUTPUT_ARROW,					//!< Apache Arrow IPC file
+	TDP_OUTPUT_ARROW_STREAM,			//!< Apache Arrow IPC stream
+	TDP_OUTPUT_PARQUET,					//!< Apache Parquet file
+	TDP_OUTPUT_MUSTACHE					//!< Text rendered from a Mustache template
+};
+
+
+// Compression
+enum tdp_compression {
+	TDP_COMPRESSION_NONE,				//!< Not compressed (default)
+	TDP_COMPRESSION_SNAPPY,				//!< Snappy (Parquet pages)
+	TDP_COMPRESSION_GZIP,				//!< gzip (if built with zlib)
+	TDP_COMPRESSION_ZSTD				//!< Zstandard (if built with libzstd)
+};
+
+
+// Column types
+enum tdp_column_type {
+	TDP_TYPE_NULL,						//!< Empty (or no values seen yet)
+	TDP_TYPE_BOOL,						//!< `true` or `false`
+	TDP_TYPE_INT,						//!< Valid JSON number without fraction or exponent
+	TDP_TYPE_FLOAT,						//!< Valid JSON number
+	TDP_TYPE_STRING						//!< Anything else
+};
+
+
+/// Infer column types from every record
+#define TDP_SAMPLE_ALL ((size_t) -1)
+
+
+// Result of converting into caller provided buffers
+enum tdp_status {
+	TDP_SUCCESS = 0,					//!< Conversion complete
+	TDP_OUTPUT_TOO_SMALL,				//!< Output buffer too small (see `needed`)
+	TDP_SCRATCH_TOO_SMALL,				//!< Scratch buffer too small for parser and tokens
+	TDP_INVALID_FORMAT					//!< Unknown input format
+};
+
+
 /// Convert CSV to JSON
 DString * csv_to_json(DString * source, bool array_out);
 
@@ -81,4 +155,271 @@ DString * csv_to_json(DString * source, bool array_out);
 DString * tsv_to_json(DString * source, bool array_out);
 
 
+/// Create a context that can be reused to convert many documents,
+/// without allocating a new parser and buffers each time
+tdp_context * tdp_context_new(void);
+
+
+/// Create a reusable context that routes every allocation (including the
+/// output DString) through `allocator`, which must outlive the context
+/// and anything it returns
+tdp_context * tdp_context_new_with_allocator(const tdp_allocator * allocator);
+
+
+/// Release document specific data, keeping buffers for the next document
+void tdp_context_reset(tdp_context * context);
+
+
+/// Free conversion context
+void tdp_context_free(tdp_context * context);
+
+
+/// Choose JSON output style (TDP_JSON_PRETTY, TDP_JSON_COMPACT,
+/// TDP_JSON_LINES, or TDP_JSON_COLUMNS) for conversions using `context`.
+///
+/// TDP_JSON_COLUMNS writes each column once, as `"name": [values...]`
+/// (or, if `array_out` is true, an array of columns that each start with
+/// the header name).  Columns are buffered separately, spilling to a
+/// temporary file, so memory used for them does not grow with the number
+/// of records.
+void tdp_context_set_json_style(tdp_context * context, short style);
+
+
+/// Choose output format (tdp_output_format) for conversions using
+/// `context`.  Binary formats are written by the same functions as JSON,
+/// and are not null-terminated -- use the length of the DString, or the
+/// number of bytes written.
+///
+/// MessagePack and CBOR have the same structure as JSON: an array of
+/// records, each a map from header name to value (or an array of values,
+/// including the header row, if `array_out` is true).  Numbers and
+/// booleans are written as native ints, floats, and booleans.  With
+/// TDP_JSON_LINES, records are written one after another, without an
+/// enclosing array.
+///
+/// Arrow and Parquet output have one column per header name, typed as
+/// int64, double, bool, or utf8 by the schema or type inference (all utf8
+/// if the type sample is 0).  Empty values, and values that don't match
+/// the column type, are null.  String columns in Parquet files are
+/// dictionary encoded when their values repeat.
+void tdp_context_set_output_format(tdp_context * context, short format);
+
+
+/// Choose the number of records in each Arrow record batch, Parquet row
+/// group, or SQLite transaction (default 65536).  Memory use for column data is bounded by
+/// the size of a batch.
+void tdp_context_set_batch_size(tdp_context * context, size_t records);
+
+
+/// Choose compression (tdp_compression).  Parquet files compress each
+/// page (with any codec).  Other output is compressed as a whole with gzip
+/// or zstd, as a series of independent 1 MiB blocks (concatenated gzip
+/// members or zstd frames, which standard tools decompress as one stream)
+/// that are compressed on a pool of threads while output is still being
+/// produced.  Returns false if libTDP was built without support for
+/// `compression`, or the output format can not use it (Snappy is only for
+/// Parquet, so set the output format first).
+bool tdp_context_set_compression(tdp_context * context, short compression);
+
+
+/// Choose the number of threads used to compress output (default 0, for
+/// one per CPU).  Each thread's gzip or zstd state is created from the
+/// context's allocator before the threads start, but zstd sizes its
+/// workspace on first use -- from the compressing thread.
+void tdp_context_set_threads(tdp_context * context, size_t threads);
+
+
+/// Write a binary index of where records start to `write`, alongside the
+/// output of each conversion (until called again with a NULL callback), so
+/// that readers can seek to a record without parsing the output before it.
+/// Every `stride`th record is indexed (0 or 1 for every record).  The
+/// index has a 16 byte header -- "TDPI", a 32-bit version (1), and the
+/// stride -- followed by the output and input byte offsets of records 0,
+/// stride, 2 * stride, ..., then the output length, input length, and
+/// number of records.  All numbers are 64-bit little-endian unless noted.
+/// Offsets are into uncompressed output.  Records are only indexed for
+/// JSON (pretty, compact, and lines), MessagePack, and CBOR output.
+/// Returns false if memory could not be allocated.
+bool tdp_context_set_index(tdp_context * context, size_t stride, tdp_write_callback write, void * user);
+
+
+/// Escape non-ASCII characters as \uXXXX for conversions using `context`,
+/// so that output is plain ASCII
+void tdp_context_set_ascii_only(tdp_context * context, bool ascii_only);
+
+
+/// Infer a type for each column from the first `records` records (default
+/// TDP_SAMPLE_ALL).  Values are written consistently for their column,
+/// e.g. a column of zip codes such as `08123` is always written as strings.
+/// Use 0 to type each value separately.  Numbers that are not valid JSON
+/// are always written as strings.
+void tdp_context_set_type_sample(tdp_context * context, size_t records);
+
+
+/// Parse a column schema.  Each line gives a column name (as it appears in
+/// the header row), its type (`string`, `int`, `float`, or `bool`), and
+/// optionally `nullable` and `default=VALUE`, e.g.:
+///
+///	zip     string
+///	amount  float   nullable
+///	count   int     default=0
+///
+/// Returns NULL if the schema is invalid.
+tdp_schema * tdp_schema_parse(const char * text, size_t len);
+
+
+/// Parse schema text like tdp_schema_parse(), allocating the schema with
+/// `allocator`, which must outlive it
+tdp_schema * tdp_schema_parse_with_allocator(const tdp_allocator * allocator, const char * text, size_t len);
+
+
+/// Free schema
+void tdp_schema_free(tdp_schema * schema);
+
+
+/// Convert named columns using `schema` (which must outlive the context)
+/// rather than inferring their types.  Empty or invalid values are written
+/// as the column default, null if nullable, or else "", 0, or false.
+void tdp_context_set_schema(tdp_context * context, const tdp_schema * schema);
+
+
+/// Parse a Mustache template for TDP_OUTPUT_MUSTACHE.  Tag names are
+/// header names, and `{{#records}}...{{/records}}` loops over the records;
+/// a template without a `records` section is rendered once per record,
+/// e.g. for a mail merge:
+///
+///	Dear {{name}},
+///	{{#overdue}}Your payment of {{amount}} is overdue.{{/overdue}}
+///
+/// `{{name}}` is HTML escaped, `{{{name}}}` and `{{& name}}` are not.
+/// Sections are skipped for empty, null, and false values (inverted
+/// sections, `{{^name}}`, only for those).  Partials and delimiter
+/// changes are not supported.  Returns NULL if the template is invalid.
+tdp_template * tdp_template_parse(const char * text, size_t len);
+
+
+/// Parse template text like tdp_template_parse(), allocating the
+/// template with `allocator`, which must outlive it
+tdp_template * tdp_template_parse_with_allocator(const tdp_allocator * allocator, const char * text, size_t len);
+
+
+/// Free template
+void tdp_template_free(tdp_template * view);
+
+
+/// Render `view` (which must outlive the context) for conversions using
+/// TDP_OUTPUT_MUSTACHE.  Records are rendered straight from the parsed
+/// fields, without converting them to JSON first, and output is streamed
+/// record by record by tdp_context_write_json() and
+/// tdp_context_write_json_fd().
+void tdp_context_set_template(tdp_context * context, const tdp_template * view);
+
+
+/// Convert tabular data (FORMAT_CSV or FORMAT_TSV) to JSON using a reusable
+/// context.  The resulting DString belongs to the context and is only valid
+/// until the next conversion -- copy it if you need to keep it.
+DString * tdp_context_to_json(tdp_context * context, DString * source, short format, bool array_out);
+
+
+/// Convert tabular data to JSON in a rope -- a list of fixed size pages --
+/// rather than one contiguous DString, for documents too large to keep
+/// reallocating (or to hold twice over while growing).  The rope belongs
+/// to the caller, and must be freed with tdp_rope_free().  Returns NULL if
+/// the source could not be converted.
+tdp_rope * tdp_context_to_rope(tdp_context * context, DString * source, short format, bool array_out);
+
+
+/// Create an empty rope with pages of `page_size` bytes (0 for 1 MiB).
+/// tdp_rope_write() can be passed to tdp_context_write_json() to collect
+/// output in it.
+tdp_rope * tdp_rope_new(size_t page_size);
+
+
+/// Free rope
+void tdp_rope_free(tdp_rope * rope);
+
+
+/// Append `len` bytes to `rope` (a tdp_write_callback)
+bool tdp_rope_write(const char * data, size_t len, void * rope);
+
+
+/// From now on, write each page of `rope` to `fd` as soon as it fills,
+/// so that only one page is kept in memory.  Full pages already in the
+/// rope are written immediately.  Returns false if a write failed.
+bool tdp_rope_stream_fd(tdp_rope * rope, int fd);
+
+
+/// Write the pages still in `rope` to `fd` in one writev() call where
+/// possible.  Returns false if a write failed.
+bool tdp_rope_write_fd(const tdp_rope * rope, int fd);
+
+
+/// Pass each page of `rope` to `write` in order, freeing it as soon as
+/// `write` returns, so that the output is never held twice over.  The
+/// rope is left empty.  Returns false if `write` failed.
+bool tdp_rope_drain(tdp_rope * rope, tdp_write_callback write, void * user);
+
+
+/// Total number of bytes appended to `rope`
+size_t tdp_rope_length(const tdp_rope * rope);
+
+
+/// Number of pages in `rope`
+size_t tdp_rope_page_count(const tdp_rope * rope);
+
+
+/// Get page `index` of `rope`, and its length (every page except the last
+/// is full).  Returns NULL if there is no such page.
+const char * tdp_rope_page(const tdp_rope * rope, size_t index, size_t * len);
+
+
+/// Convert tabular data to JSON, passing output to `write` in chunks as
+/// it is produced rather than building the whole document in memory.
+/// Returns false if the source could not be converted, or a write failed.
+bool tdp_context_write_json(tdp_context * context, DString * source, short format, bool array_out,
+	tdp_write_callback write, void * user);
+
+
+/// Convert tabular data to JSON, writing output to file descriptor `fd`
+/// as it is produced
+bool tdp_context_write_json_fd(tdp_context * context, DString * source, short format, bool array_out, int fd);
+
+
+/// Convert tabular data to JSON split across `count` file descriptors, so
+/// that the shards can be loaded in parallel.  Each shard is a complete
+/// JSON array (or JSON Lines file) in the context's style -- not
+/// TDP_JSON_COLUMNS, and not compressed -- with its own output buffer.
+/// Records are dealt out to the shards in turn or, if `key` is not NULL,
+/// by a hash of the value in the column named `key`, so that records with
+/// the same key are in the same shard.  If `array_out` is true, every
+/// shard starts with the header row.  Returns false if the output style
+/// can not be sharded, `key` is not a column, or a write failed.
+bool tdp_context_write_json_shards(tdp_context * context, DString * source, short format, bool array_out,
+	const int * fds, size_t count, const char * key);
+
+
+/// Load tabular data into `table` of SQLite database `db`, without
+/// converting it to JSON.  If the table does not exist, it is created
+/// from the header row, with INTEGER, REAL, or TEXT columns as inferred
+/// (or given by the schema).  Records are inserted by one prepared
+/// statement, in transactions of `batch_size` records -- or in the
+/// caller's transaction, if one is open.  Returns false if the source
+/// could not be parsed, or SQLite reported an error (see sqlite3_errmsg()).
+/// After an error, records since the last commit are rolled back, unless
+/// they are part of the caller's transaction.  Always returns false
+/// unless libTDP was built with SQLite.
+bool tdp_context_load_sqlite(tdp_context * context, DString * source, short format, sqlite3 * db, const char * table);
+
+
+/// Convert `len` bytes of tabular data to JSON without using the heap.
+/// Parser state, tokens, and headers are kept in `scratch`, and the
+/// null-terminated JSON is written to `out`.  If `out` is too small,
+/// TDP_OUTPUT_TOO_SMALL is returned and `needed` (if not NULL) is set to
+/// the required output size.  If `scratch` is too small, `needed` is set
+/// to a scratch size that is large enough (counted exactly if there was
+/// room for the tokens, and estimated generously if not).
+enum tdp_status tdp_to_json_buffer(const char * source, size_t len, short format, bool array_out,
+	char * out, size_t out_size, void * scratch, size_t scratch_size, size_t * needed);
+
+
 #endif
@@ -30,32 +30,84 @@
 #include "file.h"
 #include "libTDP.h"
 
+#ifdef HAVE_SQLITE3
+	#include <sqlite3.h>
+#endif
+
 // argtable structs
-struct arg_lit * a_help, *a_array;
-struct arg_str * a_format;
+struct arg_lit * a_help, *a_array, *a_compact, *a_lines, *a_columns, *a_ascii;
+struct arg_str * a_format, *a_to, *a_compress, *a_shard_key, *a_shard_prefix;
 struct arg_end * a_end;
-struct arg_file * a_file;
+struct arg_file * a_file, *a_schema, *a_template, *a_index;
+struct arg_int * a_sample, *a_batch, *a_threads, *a_shards, *a_index_every;
 
-void convert_buffer(DString * buffer, short format, bool array_out) {
-	if (buffer) {
-		DString * out = d_string_new("");
+FILE ** shard_files = NULL;
+int * shard_fds = NULL;
+size_t shard_count = 0;
+const char * shard_key = NULL;
 
-		switch (format) {
-			case FORMAT_CSV:
-				out = csv_to_json(buffer, array_out);
-				break;
+FILE * index_file = NULL;
 
-			case FORMAT_TSV:
-				out = tsv_to_json(buffer, array_out);
-				break;
+#ifdef HAVE_SQLITE3
+struct arg_file * a_sqlite;
+struct arg_str * a_table;
+
+sqlite3 * database = NULL;
+const char * table = "data";
+#endif
+
+/// Write record index to `index_file`
+bool write_index(const char * data, size_t len, void * user) {
+	return fwrite(data, 1, len, user) == len;
+}
+
+
+/// Set `name` to the file name of shard `index`
+void shard_name(DString * name, const char * prefix, size_t index, bool lines) {
+	d_string_erase(name, 0, -1);
+	d_string_append_printf(name, "%s-%zu.%s", prefix, index, lines ? "ndjson" : "json");
+}
+
+
+/// Convert `buffer` to the chosen output.  Returns false (after printing
+/// an error) if it could not be converted or written.
+bool convert_buffer(tdp_context * context, DString * buffer, short format, bool array_out) {
+#ifdef HAVE_SQLITE3
+	if (buffer && database) {
+		if (!tdp_context_load_sqlite(context, buffer, format, database, table)) {
+			fprintf(stderr, "Error loading table '%s': %s\n", table, sqlite3_errmsg(database));
+			return false;
 		}
 
-		if (out) {
-			fwrite(out->str, out->currentStringLength, 1, stdout);
+		return true;
+	}
+#endif
+
+	if (buffer && shard_count) {
+		if (!tdp_context_write_json_shards(context, buffer, format, array_out, shard_fds, shard_count, shard_key)) {
+			if (shard_key) {
+				fprintf(stderr, "Error writing shards (is '%s' a column?)\n", shard_key);
+			} else {
+				fprintf(stderr, "Error writing shards\n");
+			}
+
+			return false;
 		}
 
-		d_string_free(out, true);
+		return true;
+	}
+
+	if (buffer) {
+		// Output is streamed as it is produced
+		fflush(stdout);
+
+		if (!tdp_context_write_json_fd(context, buffer, format, array_out, fileno(stdout))) {
+			fprintf(stderr, "Error writing output\n");
+			return false;
+		}
 	}
+
+	return true;
 }
 
 
@@ -64,13 +116,37 @@ int main( int argc, char ** argv ) {
 	short format = FORMAT_CSV;
 	int exitcode = EXIT_SUCCESS;
 	bool array_out = false;
+	tdp_context * context = NULL;
+	tdp_schema * schema = NULL;
+	tdp_template * view = NULL;
 
 	void * argtable[] = {
 		a_help			= arg_lit0(NULL, "help", "display this help and exit"),
 
 		a_array			= arg_lit0("a", "array", "output as array of arrays"),
+		a_compact		= arg_lit0("c", "compact", "output compact JSON (no indentation or newlines)"),
+		a_lines			= arg_lit0("l", "lines", "output one JSON record per line (NDJSON)"),
+		a_columns		= arg_lit0(NULL, "columns", "output one JSON array per column (object of arrays)"),
+		a_ascii			= arg_lit0(NULL, "ascii", "escape non-ASCII characters as \\uXXXX"),
+		a_sample		= arg_int0(NULL, "sample", "N", "infer column types from first N records (default all, 0 to type each value)"),
+		a_schema		= arg_file0(NULL, "schema", "FILE", "column types (lines of: name type [nullable] [default=VALUE])"),
 
 		a_format		= arg_str0("f", "from", "FORMAT", "convert from tabular data format (default CSV), FORMAT = csv|tsv"),
+		a_to			= arg_str0("t", "to", "FORMAT", "output format (default JSON), FORMAT = json|msgpack|cbor|arrow|arrow-stream|parquet"),
+		a_batch			= arg_int0(NULL, "batch", "N", "records per Arrow record batch, Parquet row group, or SQLite transaction (default 65536)"),
+		a_compress		= arg_str0(NULL, "compress", "CODEC", "compress output (or Parquet pages), CODEC = none|gzip|zstd|snappy (Parquet only)"),
+		a_threads		= arg_int0(NULL, "threads", "N", "compress output on N threads (default one per CPU)"),
+		a_template		= arg_file0(NULL, "template", "FILE", "render Mustache template FILE for each record (or `records` section)"),
+		a_shards		= arg_int0(NULL, "shards", "N", "split JSON output into N files, dealing out records in turn"),
+		a_shard_key		= arg_str0(NULL, "shard-key", "COLUMN", "choose each record's shard by a hash of COLUMN instead"),
+		a_shard_prefix	= arg_str0(NULL, "shard-prefix", "PREFIX", "name shards PREFIX-0.json, PREFIX-1.json, ... (default shard)"),
+		a_index			= arg_file0(NULL, "index", "FILE", "write byte offsets of records in the output (and input) to FILE"),
+		a_index_every	= arg_int0(NULL, "index-every", "N", "index every Nth record (default 1)"),
+
+#ifdef HAVE_SQLITE3
+		a_sqlite		= arg_file0(NULL, "sqlite", "FILE", "load records into SQLite database FILE instead of writing output"),
+		a_table			= arg_str0(NULL, "table", "NAME", "SQLite table to create or append to (default data)"),
+#endif
 
 		a_file 			= arg_filen(NULL, NULL, "<FILE>", 0, argc + 2, "read input from file(s) -- use stdin if no files given"),
 
@@ -111,12 +187,256 @@ int main( int argc, char ** argv ) {
 		}
 	}
 
+	if ((a_compact->count > 0) + (a_lines->count > 0) + (a_columns->count > 0) > 1) {
+		fprintf(stderr, "%s: Only one of --compact, --lines, and --columns can be used\n", binname);
+		exitcode = 1;
+		goto exit;
+	}
+
 	DString * buffer;
 
+	// One context is reused for every file
+	context = tdp_context_new();
+
+	if (a_compact->count > 0) {
+		tdp_context_set_json_style(context, TDP_JSON_COMPACT);
+	}
+
+	if (a_lines->count > 0) {
+		tdp_context_set_json_style(context, TDP_JSON_LINES);
+	}
+
+	if (a_columns->count > 0) {
+		tdp_context_set_json_style(context, TDP_JSON_COLUMNS);
+	}
+
+	if (a_to->count > 0) {
+		if (strcmp(a_to->sval[0], "json") == 0) {
+			tdp_context_set_output_format(context, TDP_OUTPUT_JSON);
+		} else if (strcmp(a_to->sval[0], "msgpack") == 0) {
+			tdp_context_set_output_format(context, TDP_OUTPUT_MSGPACK);
+		} else if (strcmp(a_to->sval[0], "cbor") == 0) {
+			tdp_context_set_output_format(context, TDP_OUTPUT_CBOR);
+		} else if (strcmp(a_to->sval[0], "arrow") == 0) {
+			tdp_context_set_output_format(context, TDP_OUTPUT_ARROW);
+		} else if (strcmp(a_to->sval[0], "arrow-stream") == 0) {
+			tdp_context_set_output_format(context, TDP_OUTPUT_ARROW_STREAM);
+		} else if (strcmp(a_to->sval[0], "parquet") == 0) {
+			tdp_context_set_output_format(context, TDP_OUTPUT_PARQUET);
+		} else {
+			fprintf(stderr, "%s: Unknown output format '%s'\n", binname, a_to->sval[0]);
+			exitcode = 1;
+			goto exit;
+		}
+	}
+
+	if (a_compress->count > 0) {
+		short compression;
+
+		if (strcmp(a_compress->sval[0], "none") == 0) {
+			compression = TDP_COMPRESSION_NONE;
+		} else if (strcmp(a_compress->sval[0], "snappy") == 0) {
+			compression = TDP_COMPRESSION_SNAPPY;
+		} else if (strcmp(a_compress->sval[0], "gzip") == 0) {
+			compression = TDP_COMPRESSION_GZIP;
+		} else if (strcmp(a_compress->sval[0], "zstd") == 0) {
+			compression = TDP_COMPRESSION_ZSTD;
+		} else {
+			fprintf(stderr, "%s: Unknown compression '%s'\n", binname, a_compress->sval[0]);
+			exitcode = 1;
+			goto exit;
+		}
+
+		if ((compression == TDP_COMPRESSION_SNAPPY) && !tdp_context_set_compression(context, compression)) {
+			fprintf(stderr, "%s: Compression 'snappy' is only available for Parquet output\n", binname);
+			exitcode = 1;
+			goto exit;
+		}
+
+		if (!tdp_context_set_compression(context, compression)) {
+			fprintf(stderr, "%s: Compression '%s' is not available in this build\n", binname, a_compress->sval[0]);
+			exitcode = 1;
+			goto exit;
+		}
+	}
+
+	if (a_threads->count > 0) {
+		if (a_threads->ival[0] <= 0) {
+			fprintf(stderr, "%s: Invalid number of threads '%d'\n", binname, a_threads->ival[0]);
+			exitcode = 1;
+			goto exit;
+		}
+
+		tdp_context_set_threads(context, a_threads->ival[0]);
+	}
+
+	if (a_batch->count > 0) {
+		if (a_batch->ival[0] <= 0) {
+			fprintf(stderr, "%s: Invalid batch size '%d'\n", binname, a_batch->ival[0]);
+			exitcode = 1;
+			goto exit;
+		}
+
+		tdp_context_set_batch_size(context, a_batch->ival[0]);
+	}
+
+	if (a_ascii->count > 0) {
+		tdp_context_set_ascii_only(context, true);
+	}
+
+	if (a_sample->count > 0) {
+		if (a_sample->ival[0] < 0) {
+			fprintf(stderr, "%s: Invalid sample size '%d'\n", binname, a_sample->ival[0]);
+			exitcode = 1;
+			goto exit;
+		}
+
+		tdp_context_set_type_sample(context, a_sample->ival[0]);
+	}
+
+	if (a_schema->count > 0) {
+		buffer = scan_file(a_schema->filename[0]);
+
+		if (buffer) {
+			schema = tdp_schema_parse(buffer->str, buffer->currentStringLength);
+			d_string_free(buffer, true);
+		}
+
+		if (schema == NULL) {
+			fprintf(stderr, "Error reading schema '%s'\n", a_schema->filename[0]);
+			exitcode = 1;
+			goto exit;
+		}
+
+		tdp_context_set_schema(context, schema);
+	}
+
+	if (a_template->count > 0) {
+		buffer = scan_file(a_template->filename[0]);
+
+		if (buffer) {
+			view = tdp_template_parse(buffer->str, buffer->currentStringLength);
+			d_string_free(buffer, true);
+		}
+
+		if (view == NULL) {
+			fprintf(stderr, "Error reading template '%s'\n", a_template->filename[0]);
+			exitcode = 1;
+			goto exit;
+		}
+
+		tdp_context_set_template(context, view);
+		tdp_context_set_output_format(context, TDP_OUTPUT_MUSTACHE);
+	}
+
+	if (a_shards->count > 0) {
+		const char * prefix = (a_shard_prefix->count > 0) ? a_shard_prefix->sval[0] : "shard";
+
+		if (a_shards->ival[0] <= 0) {
+			fprintf(stderr, "%s: Invalid number of shards '%d'\n", binname, a_shards->ival[0]);
+			exitcode = 1;
+			goto exit;
+		}
+
+		if ((a_to->count > 0 && strcmp(a_to->sval[0], "json") != 0) || (a_columns->count > 0) || (a_template->count > 0) ||
+				(a_compress->count > 0 && strcmp(a_compress->sval[0], "none") != 0)) {
+			fprintf(stderr, "%s: Only uncompressed JSON output (not --columns) can be sharded\n", binname);
+			exitcode = 1;
+			goto exit;
+		}
+
+		if (a_file->count > 1) {
+			// Each input would append another array to every shard
+			fprintf(stderr, "%s: --shards requires a single input\n", binname);
+			exitcode = 1;
+			goto exit;
+		}
+
+		shard_files = calloc(a_shards->ival[0], sizeof(FILE *));
+		shard_fds = calloc(a_shards->ival[0], sizeof(int));
+		shard_key = (a_shard_key->count > 0) ? a_shard_key->sval[0] : NULL;
+
+		DString * name = d_string_new("");
+
+		for (shard_count = 0; shard_files && shard_fds && (shard_count < (size_t) a_shards->ival[0]); ++shard_count) {
+			shard_name(name, prefix, shard_count, a_lines->count > 0);
+
+			if ((shard_files[shard_count] = fopen(name->str, "wb")) == NULL) {
+				fprintf(stderr, "Error opening shard '%s'\n", name->str);
+				exitcode = 1;
+				break;
+			}
+
+			shard_fds[shard_count] = fileno(shard_files[shard_count]);
+		}
+
+		d_string_free(name, true);
+
+		if (exitcode || !shard_files || !shard_fds) {
+			exitcode = 1;
+			goto exit;
+		}
+	}
+
+	if (a_index->count > 0) {
+		if ((a_index_every->count > 0) && (a_index_every->ival[0] <= 0)) {
+			fprintf(stderr, "%s: Invalid index interval '%d'\n", binname, a_index_every->ival[0]);
+			exitcode = 1;
+			goto exit;
+		}
+
+		// Offsets are into uncompressed output, so they would be no use
+		// for a compressed file
+		if ((a_file->count > 1) || (a_shards->count > 0) || (a_columns->count > 0) || (a_template->count > 0) ||
+				(a_to->count > 0 && strncmp(a_to->sval[0], "arrow", 5) == 0) || (a_to->count > 0 && strcmp(a_to->sval[0], "parquet") == 0) ||
+				(a_compress->count > 0 && strcmp(a_compress->sval[0], "none") != 0)) {
+			fprintf(stderr, "%s: --index requires a single input, and uncompressed JSON, MessagePack, or CBOR records\n", binname);
+			exitcode = 1;
+			goto exit;
+		}
+
+#ifdef HAVE_SQLITE3
+		if (a_sqlite->count > 0) {
+			fprintf(stderr, "%s: --index can not be used with --sqlite\n", binname);
+			exitcode = 1;
+			goto exit;
+		}
+#endif
+
+		if ((index_file = fopen(a_index->filename[0], "wb")) == NULL) {
+			fprintf(stderr, "Error opening index '%s'\n", a_index->filename[0]);
+			exitcode = 1;
+			goto exit;
+		}
+
+		tdp_context_set_index(context, (a_index_every->count > 0) ? a_index_every->ival[0] : 1, write_index, index_file);
+	}
+
+#ifdef HAVE_SQLITE3
+	if (a_table->count > 0) {
+		table = a_table->sval[0];
+	}
+
+	if (a_sqlite->count > 0) {
+		if (sqlite3_open(a_sqlite->filename[0], &database) != SQLITE_OK) {
+			fprintf(stderr, "Error opening database '%s': %s\n", a_sqlite->filename[0], sqlite3_errmsg(database));
+			exitcode = 1;
+			goto exit;
+		}
+	}
+#endif
+
 	if (a_file->count == 0) {
 		// Read from stdin
 		buffer = stdin_buffer();
-		convert_buffer(buffer, format, array_out);
+
+		if (buffer == NULL) {
+			fprintf(stderr, "Error reading stdin\n");
+			exitcode = 1;
+		} else if (!convert_buffer(context, buffer, format, array_out)) {
+			exitcode = 1;
+		}
+
 		d_string_free(buffer, true);
 	} else {
 		// Read from files
@@ -129,12 +449,49 @@ int main( int argc, char ** argv ) {
 				goto exit;
 			}
 
-			convert_buffer(buffer, format, array_out);
+			if (!convert_buffer(context, buffer, format, array_out)) {
+				exitcode = 1;
+			}
+
 			d_string_free(buffer, true);
+
+			if (exitcode) {
+				goto exit;
+			}
 		}
 	}
 
 exit:
+	if (shard_count) {
+		DString * name = d_string_new("");
+
+		for (size_t i = 0; i < shard_count; ++i) {
+			fclose(shard_files[i]);
+
+			if (exitcode) {
+				// Don't leave incomplete shards behind
+				shard_name(name, (a_shard_prefix->count > 0) ? a_shard_prefix->sval[0] : "shard", i, a_lines->count > 0);
+				remove(name->str);
+			}
+		}
+
+		d_string_free(name, true);
+	}
+
+	free(shard_files);
+	free(shard_fds);
+
+	if (index_file) {
+		fclose(index_file);
+	}
+
+#ifdef HAVE_SQLITE3
+	sqlite3_close(database);
+#endif
+
+	tdp_context_free(context);
+	tdp_schema_free(schema);
+	tdp_template_free(view);
 	arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
 
 	return exitcode;
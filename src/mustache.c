@@ -0,0 +1,423 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file mustache.c
+
+	@brief Mustache templates -- compiled into a flat list of nodes, which
+	reader.c renders against parsed records without going through JSON
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "d_string.h"
+#include "mustache.h"
+
+
+#define kTemplateStartingSize 32		//!< Initial capacity for template nodes
+
+#define kTagClose -1					//!< `{{/name}}` (while parsing)
+#define kTagComment -2					//!< `{{! comment}}` (while parsing)
+
+
+/// Find `marker` in text between `p` and `stop`, or NULL
+static const char * find_marker(const char * p, const char * stop, const char * marker, size_t len) {
+	while (stop - p >= (ptrdiff_t) len) {
+		p = memchr(p, marker[0], stop - p - len + 1);
+
+		if (p == NULL) {
+			return NULL;
+		}
+
+		if (memcmp(p, marker, len) == 0) {
+			return p;
+		}
+
+		p++;
+	}
+
+	return NULL;
+}
+
+
+/// Line number of `p` in template text, for error messages
+static size_t line_number(const char * text, const char * p) {
+	size_t line = 1;
+
+	for (; text < p; ++text) {
+		if (*text == '\n') {
+			line++;
+		}
+	}
+
+	return line;
+}
+
+
+/// Add a node.  Returns false if memory could not be allocated.
+static bool add_node(tdp_template * t, short type, const char * text, size_t len) {
+	if (t->count == t->capacity) {
+		size_t capacity = t->capacity ? t->capacity * 2 : kTemplateStartingSize;
+		tdp_template_node * nodes = tdp_realloc(t->allocator, t->nodes, capacity * sizeof(tdp_template_node));
+
+		if (!nodes) {
+			return false;
+		}
+
+		t->nodes = nodes;
+		t->capacity = capacity;
+	}
+
+	tdp_template_node * n = &t->nodes[t->count++];
+
+	n->type = type;
+	n->text = text;
+	n->len = len;
+	n->end = t->count;
+
+	return true;
+}
+
+
+/// Parse template text
+tdp_template * tdp_template_parse(const char * text, size_t len) {
+	return tdp_template_parse_with_allocator(NULL, text, len);
+}
+
+
+/// Parse template text, allocating the template with `allocator`
+tdp_template * tdp_template_parse_with_allocator(const tdp_allocator * allocator, const char * text, size_t len) {
+	tdp_template * t = tdp_malloc(allocator, sizeof(tdp_template));
+	size_t open[kTemplateMaxDepth];
+	size_t depth = 0;
+	const char * error = NULL;
+	const char * tag = NULL;
+
+	if (!t) {
+		return NULL;
+	}
+
+	memset(t, 0, sizeof(tdp_template));
+	t->allocator = allocator;
+
+	if (!(t->text = tdp_malloc(allocator, len + 1))) {
+		tdp_template_free(t);
+		return NULL;
+	}
+
+	memcpy(t->text, text, len);
+	t->text[len] = '\0';
+
+	const char * stop = t->text + len;
+	const char * literal = t->text;
+
+	while ((tag = find_marker(literal, stop, "{{", 2))) {
+		const char * name = tag + 2;
+		const char * close = "}}";
+		short type = TEMPLATE_VARIABLE;
+		bool block = true;
+
+		switch ((name < stop) ? *name : '\0') {
+			case '{':
+				close = "}}}";
+
+			// fall through
+			case '&':
+				type = TEMPLATE_RAW;
+				block = false;
+				name++;
+				break;
+
+			case '#':
+				type = TEMPLATE_SECTION;
+				name++;
+				break;
+
+			case '^':
+				type = TEMPLATE_INVERTED;
+				name++;
+				break;
+
+			case '/':
+				type = kTagClose;
+				name++;
+				break;
+
+			case '!':
+				type = kTagComment;
+				name++;
+				break;
+
+			case '>':
+			case '=':
+				error = "partials and delimiter changes are not supported";
+				goto fail;
+
+			default:
+				block = false;
+				break;
+		}
+
+		const char * name_end = find_marker(name, stop, close, strlen(close));
+
+		if (name_end == NULL) {
+			error = "unclosed tag";
+			goto fail;
+		}
+
+		const char * after = name_end + strlen(close);
+		const char * literal_end = tag;
+
+		if (type != kTagComment) {
+			while (name < name_end && (*name == ' ' || *name == '\t')) {
+				name++;
+			}
+
+			while (name_end > name && (name_end[-1] == ' ' || name_end[-1] == '\t')) {
+				name_end--;
+			}
+
+			if (name == name_end) {
+				error = "missing tag name";
+				goto fail;
+			}
+		}
+
+		if (block) {
+			// A tag alone on its line removes the whole line
+			const char * a = tag;
+			const char * b = after;
+
+			while (a > literal && (a[-1] == ' ' || a[-1] == '\t')) {
+				a--;
+			}
+
+			while (b < stop && (*b == ' ' || *b == '\t')) {
+				b++;
+			}
+
+			if ((a == t->text) || (a[-1] == '\n')) {
+				if (b == stop) {
+					literal_end = a;
+					after = b;
+				} else if (*b == '\n') {
+					literal_end = a;
+					after = b + 1;
+				} else if ((*b == '\r') && (b + 1 < stop) && (b[1] == '\n')) {
+					literal_end = a;
+					after = b + 2;
+				}
+			}
+		}
+
+		if ((literal_end > literal) && !add_node(t, TEMPLATE_TEXT, literal, literal_end - literal)) {
+			goto fail;
+		}
+
+		switch (type) {
+			case kTagClose:
+				if ((depth == 0) || (t->nodes[open[depth - 1]].len != (size_t)(name_end - name)) ||
+						(memcmp(t->nodes[open[depth - 1]].text, name, name_end - name) != 0)) {
+					error = "unexpected closing tag";
+					goto fail;
+				}
+
+				depth--;
+				t->nodes[open[depth]].end = t->count;
+				break;
+
+			case kTagComment:
+				break;
+
+			case TEMPLATE_SECTION:
+			case TEMPLATE_INVERTED:
+				if (depth == kTemplateMaxDepth) {
+					error = "sections nested too deeply";
+					goto fail;
+				}
+
+				open[depth++] = t->count;
+
+			// fall through
+			default:
+				if (!add_node(t, type, name, name_end - name)) {
+					goto fail;
+				}
+
+				if ((type == TEMPLATE_SECTION || type == TEMPLATE_INVERTED) && tdp_template_node_is(&t->nodes[t->count - 1], "records")) {
+					t->has_records = true;
+				}
+
+				break;
+		}
+
+		literal = after;
+	}
+
+	if (depth) {
+		tag = t->nodes[open[depth - 1]].text;
+		error = "unclosed section";
+		goto fail;
+	}
+
+	if ((stop > literal) && !add_node(t, TEMPLATE_TEXT, literal, stop - literal)) {
+		goto fail;
+	}
+
+	return t;
+
+fail:
+
+	if (error) {
+		fprintf(stderr, "ERROR.  Invalid template on line %zu: %s.\n", line_number(t->text, tag), error);
+	}
+
+	tdp_template_free(t);
+	return NULL;
+}
+
+
+/// Free template
+void tdp_template_free(tdp_template * t) {
+	if (t) {
+		tdp_free(t->allocator, t->text);
+		tdp_free(t->allocator, t->nodes);
+		tdp_free(t->allocator, t);
+	}
+}
+
+
+/// Does node have tag name `name`?
+bool tdp_template_node_is(const tdp_template_node * n, const char * name) {
+	return (n->len == strlen(name)) && (memcmp(n->text, name, n->len) == 0);
+}
+
+
+/// Write text with HTML special characters escaped
+void template_write_escaped(sink * out, const char * text, size_t len) {
+	const char * stop = text + len;
+	const char * run = text;
+
+	for (const char * p = text; p < stop; ++p) {
+		const char * entity;
+
+		switch (*p) {
+			case '&':
+				entity = "&amp;";
+				break;
+
+			case '<':
+				entity = "&lt;";
+				break;
+
+			case '>':
+				entity = "&gt;";
+				break;
+
+			case '"':
+				entity = "&quot;";
+				break;
+
+			default:
+				continue;
+		}
+
+		sink_write(out, run, p - run);
+		sink_write_string(out, entity);
+		run = p + 1;
+	}
+
+	sink_write(out, run, stop - run);
+}
+
+
+#ifdef TEST
+void Test_template_parse(CuTest * tc) {
+	const char * text = "Dear {{ name }},\n{{! comment }}\n{{#records}}\n  - {{{html}}} {{&html}}\n  {{/records}}\n{{^records}}none{{/records}}";
+	tdp_template * t = tdp_template_parse(text, strlen(text));
+
+	CuAssertPtrNotNull(tc, t);
+	CuAssertTrue(tc, t->has_records);
+	CuAssertIntEquals(tc, 11, t->count);
+
+	CuAssertIntEquals(tc, TEMPLATE_TEXT, t->nodes[0].type);
+	CuAssertIntEquals(tc, TEMPLATE_VARIABLE, t->nodes[1].type);
+	CuAssertTrue(tc, tdp_template_node_is(&t->nodes[1], "name"));
+
+	// Standalone comment line is removed
+	CuAssertIntEquals(tc, 2, t->nodes[2].len);
+
+	CuAssertIntEquals(tc, TEMPLATE_SECTION, t->nodes[3].type);
+	CuAssertIntEquals(tc, 9, t->nodes[3].end);
+	CuAssertIntEquals(tc, 4, t->nodes[4].len);
+	CuAssertIntEquals(tc, TEMPLATE_RAW, t->nodes[5].type);
+	CuAssertIntEquals(tc, TEMPLATE_RAW, t->nodes[7].type);
+	CuAssertIntEquals(tc, 1, t->nodes[8].len);
+
+	CuAssertIntEquals(tc, TEMPLATE_INVERTED, t->nodes[9].type);
+	CuAssertIntEquals(tc, 11, t->nodes[9].end);
+	tdp_template_free(t);
+
+	// Errors
+	CuAssertPtrEquals(tc, NULL, tdp_template_parse("{{#a}}x", 7));
+	CuAssertPtrEquals(tc, NULL, tdp_template_parse("{{#a}}x{{/b}}", 13));
+	CuAssertPtrEquals(tc, NULL, tdp_template_parse("x{{/b}}", 7));
+	CuAssertPtrEquals(tc, NULL, tdp_template_parse("{{a", 3));
+	CuAssertPtrEquals(tc, NULL, tdp_template_parse("{{> partial}}", 13));
+
+	DString * out = d_string_new("");
+	sink s;
+	sink_init_string(&s, out);
+	template_write_escaped(&s, "a < b && \"c\" > d", 16);
+	CuAssertStrEquals(tc, "a &lt; b &amp;&amp; &quot;c&quot; &gt; d", out->str);
+	d_string_free(out, true);
+}
+#endif
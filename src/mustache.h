@@ -0,0 +1,146 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file mustache.h
+
+	@brief Mustache templates, rendered directly from parsed records
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#ifndef MUSTACHE_TDP_PARSER_H
+#define MUSTACHE_TDP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+#include "allocator.h"
+#include "sink.h"
+
+
+#define kTemplateMaxDepth 32			//!< Maximum nesting of sections
+
+
+/// Kinds of template node
+enum tdp_template_node_types {
+	TEMPLATE_TEXT,						//!< Literal text
+	TEMPLATE_VARIABLE,					//!< `{{name}}` -- HTML escaped value
+	TEMPLATE_RAW,						//!< `{{{name}}}` or `{{& name}}` -- unescaped value
+	TEMPLATE_SECTION,					//!< `{{#name}}...{{/name}}`
+	TEMPLATE_INVERTED					//!< `{{^name}}...{{/name}}`
+};
+
+
+/// One piece of a compiled template
+struct tdp_template_node {
+	short			type;				//!< Node type (tdp_template_node_types)
+	const char	*	text;				//!< Literal text, or tag name
+	size_t			len;				//!< Length of text
+	size_t			end;				//!< Sections: index of first node after the section
+};
+
+typedef struct tdp_template_node tdp_template_node;
+
+
+/// Compiled template
+struct tdp_template {
+	const tdp_allocator	*	allocator;	//!< Allocator for text and nodes
+	char		*	text;				//!< Copy of template text (nodes point into it)
+	tdp_template_node	*	nodes;		//!< Nodes, in order (section contents follow the section)
+	size_t			count;				//!< Number of nodes
+	size_t			capacity;			//!< Size of nodes array
+	bool			has_records;		//!< Template loops over `records` itself
+};
+
+typedef struct tdp_template tdp_template;
+
+
+/// Parse Mustache template text.  Variables, sections, inverted sections,
+/// and comments are supported, and standalone section and comment tags
+/// do not leave blank lines.  Partials and delimiter changes are not.
+/// Returns NULL on error.
+tdp_template * tdp_template_parse(
+	const char * text,					//!< Template text
+	size_t len							//!< Number of bytes
+);
+
+
+/// Parse Mustache template text, allocating the template with `allocator`
+tdp_template * tdp_template_parse_with_allocator(
+	const tdp_allocator * allocator,	//!< Allocator to use (NULL to use heap)
+	const char * text,					//!< Template text
+	size_t len							//!< Number of bytes
+);
+
+
+/// Free template
+void tdp_template_free(
+	tdp_template * t					//!< Template to be freed
+);
+
+
+/// Does node `n` of template `t` have tag name `name`?
+bool tdp_template_node_is(
+	const tdp_template_node * n,		//!< Node to check
+	const char * name					//!< Null-terminated name
+);
+
+
+/// Write text with HTML special characters (`&<>"`) escaped
+void template_write_escaped(
+	sink * out,							//!< Destination
+	const char * text,					//!< Text to write
+	size_t len							//!< Number of bytes
+);
+
+
+#endif
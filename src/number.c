@@ -0,0 +1,661 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file number.c
+
+	@brief Validate and classify numeric text against the JSON grammar
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libTDP.h"
+#include "number.h"
+#include "powers_of_ten.h"
+
+
+/// Are all 8 bytes in `x` ASCII digits?
+#define swar_all_digits(x) ((((x) & 0xF0F0F0F0F0F0F0F0ULL) | (((x) + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4) == 0x3333333333333333ULL)
+
+
+/// Count leading ASCII digits
+size_t count_digits(const char * text, size_t len) {
+	size_t i = 0;
+	uint64_t block;
+
+	// Check 8 bytes at a time
+	while (i + 8 <= len) {
+		memcpy(&block, text + i, 8);
+
+		if (!swar_all_digits(block)) {
+			break;
+		}
+
+		i += 8;
+	}
+
+	while (i < len && text[i] >= '0' && text[i] <= '9') {
+		i++;
+	}
+
+	return i;
+}
+
+
+/// Classify numeric text according to the JSON number grammar:
+///
+///	-? (0 | [1-9][0-9]*) (\.[0-9]+)? ([eE][+-]?[0-9]+)?
+short classify_number(const char * text, size_t len) {
+	size_t i = 0;
+	size_t digits;
+	int64_t value;
+	short type = TDP_TYPE_INT;
+
+	if ((len == 4) && (memcmp(text, "true", 4) == 0)) {
+		return TDP_TYPE_BOOL;
+	}
+
+	if ((len == 5) && (memcmp(text, "false", 5) == 0)) {
+		return TDP_TYPE_BOOL;
+	}
+
+	if (i < len && text[i] == '-') {
+		i++;
+	}
+
+	// Integer part -- no leading zeros
+	digits = count_digits(text + i, len - i);
+
+	if ((digits == 0) || (digits > 1 && text[i] == '0')) {
+		return TDP_TYPE_STRING;
+	}
+
+	i += digits;
+
+	// Fraction
+	if (i < len && text[i] == '.') {
+		i++;
+		digits = count_digits(text + i, len - i);
+
+		if (digits == 0) {
+			return TDP_TYPE_STRING;
+		}
+
+		i += digits;
+		type = TDP_TYPE_FLOAT;
+	}
+
+	// Exponent
+	if (i < len && (text[i] == 'e' || text[i] == 'E')) {
+		i++;
+
+		if (i < len && (text[i] == '+' || text[i] == '-')) {
+			i++;
+		}
+
+		digits = count_digits(text + i, len - i);
+
+		if (digits == 0) {
+			return TDP_TYPE_STRING;
+		}
+
+		i += digits;
+		type = TDP_TYPE_FLOAT;
+	}
+
+	if (i != len) {
+		return TDP_TYPE_STRING;
+	}
+
+	// Integers too large for int64 can only be stored as doubles
+	if ((type == TDP_TYPE_INT) && (len >= 19) && !parse_int64(text, len, &value)) {
+		return TDP_TYPE_FLOAT;
+	}
+
+	return type;
+}
+
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+	#define SWAR_LITTLE_ENDIAN 1
+#elif defined(_WIN32)
+	#define SWAR_LITTLE_ENDIAN 1
+#endif
+
+
+/// Convert 8 ASCII digits to their value
+static inline uint64_t parse_eight_digits(const char * text) {
+#ifdef SWAR_LITTLE_ENDIAN
+	uint64_t val;
+	memcpy(&val, text, 8);
+
+	// Combine pairs of digits, then pairs of pairs, then pairs of those
+	val = (val & 0x0F0F0F0F0F0F0F0FULL) * 2561 >> 8;
+	val = (val & 0x00FF00FF00FF00FFULL) * 6553601 >> 16;
+	return (val & 0x0000FFFF0000FFFFULL) * 42949672960001ULL >> 32;
+#else
+	uint64_t val = 0;
+
+	for (int i = 0; i < 8; ++i) {
+		val = val * 10 + (text[i] - '0');
+	}
+
+	return val;
+#endif
+}
+
+
+/// Accumulate `count` digits (known to be valid) into `value`
+static inline uint64_t accumulate_digits(uint64_t value, const char * text, size_t count) {
+	while (count >= 8) {
+		value = value * 100000000 + parse_eight_digits(text);
+		text += 8;
+		count -= 8;
+	}
+
+	while (count--) {
+		value = value * 10 + (*text++ - '0');
+	}
+
+	return value;
+}
+
+
+/// Parse a JSON integer
+bool parse_int64(const char * text, size_t len, int64_t * value) {
+	bool negative = false;
+	size_t digits;
+	uint64_t result;
+
+	if (len && text[0] == '-') {
+		negative = true;
+		text++;
+		len--;
+	}
+
+	digits = count_digits(text, len);
+
+	if ((digits != len) || (digits == 0) || (digits > 1 && text[0] == '0')) {
+		return false;
+	}
+
+	if (digits > 19) {
+		// Overflow
+		return false;
+	}
+
+	result = accumulate_digits(0, text, digits);
+
+	if (negative) {
+		if (result > (uint64_t)INT64_MAX + 1) {
+			return false;
+		}
+
+		*value = (result == (uint64_t)INT64_MAX + 1) ? INT64_MIN : -(int64_t)result;
+	} else {
+		if (result > INT64_MAX) {
+			return false;
+		}
+
+		*value = (int64_t)result;
+	}
+
+	return true;
+}
+
+
+/// Parse an integer that classify_number() has already found to be a
+/// valid TDP_TYPE_INT (so it fits in 64 bits)
+int64_t parse_int64_unchecked(const char * text, size_t len) {
+	uint64_t result;
+
+	if (*text == '-') {
+		result = accumulate_digits(0, text + 1, len - 1);
+
+		// Negate as unsigned, so that INT64_MIN does not overflow
+		return (int64_t)(0 - result);
+	}
+
+	result = accumulate_digits(0, text, len);
+	return (int64_t)result;
+}
+
+
+/// Multiply two 64-bit numbers, returning the 128-bit result as two halves
+static inline void multiply_64(uint64_t a, uint64_t b, uint64_t * high, uint64_t * low) {
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t)a * b;
+	*high = (uint64_t)(r >> 64);
+	*low = (uint64_t)r;
+#else
+	uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+	uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+	uint64_t p0 = a_lo * b_lo;
+	uint64_t p1 = a_lo * b_hi;
+	uint64_t p2 = a_hi * b_lo;
+	uint64_t p3 = a_hi * b_hi;
+	uint64_t middle = (p0 >> 32) + (uint32_t)p1 + (uint32_t)p2;
+
+	*low = (middle << 32) | (uint32_t)p0;
+	*high = p3 + (p1 >> 32) + (p2 >> 32) + (middle >> 32);
+#endif
+}
+
+
+/// Count leading zero bits (mantissa is never 0)
+static inline int leading_zeros_64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_clzll(x);
+#else
+	int n = 0;
+
+	while (!(x & 0x8000000000000000ULL)) {
+		x <<= 1;
+		n++;
+	}
+
+	return n;
+#endif
+}
+
+
+/// Eisel-Lemire algorithm -- compute correctly rounded `mantissa * 10^exp10`.
+/// Returns false if the result can't be determined this way (rare), or is
+/// subnormal or out of range.
+static bool eisel_lemire(uint64_t mantissa, int exp10, bool negative, double * value) {
+	uint64_t bits;
+
+	if (mantissa == 0) {
+		bits = negative ? 0x8000000000000000ULL : 0;
+		memcpy(value, &bits, sizeof(double));
+		return true;
+	}
+
+	if (exp10 < kPowersOfTenMinExp10 || exp10 > kPowersOfTenMaxExp10) {
+		return false;
+	}
+
+	// Normalize
+	int clz = leading_zeros_64(mantissa);
+	mantissa <<= clz;
+
+	// floor(log2(10) * exp10) + 64 + bias, less the normalization shift
+	uint64_t exp2 = (uint64_t)(((217706 * exp10) >> 16) + 64 + 1023) - (uint64_t)clz;
+
+	const uint64_t * power = powers_of_ten[exp10 - kPowersOfTenMinExp10];
+	uint64_t x_hi, x_lo;
+	multiply_64(mantissa, power[1], &x_hi, &x_lo);
+
+	// Use wider approximation if the low bits are ambiguous
+	if ((x_hi & 0x1FF) == 0x1FF && x_lo + mantissa < mantissa) {
+		uint64_t y_hi, y_lo;
+		multiply_64(mantissa, power[0], &y_hi, &y_lo);
+
+		uint64_t merged_hi = x_hi;
+		uint64_t merged_lo = x_lo + y_hi;
+
+		if (merged_lo < x_lo) {
+			merged_hi++;
+		}
+
+		if ((merged_hi & 0x1FF) == 0x1FF && merged_lo + 1 == 0 && y_lo + mantissa < mantissa) {
+			return false;
+		}
+
+		x_hi = merged_hi;
+		x_lo = merged_lo;
+	}
+
+	// Shift to 54 bits
+	uint64_t msb = x_hi >> 63;
+	uint64_t result = x_hi >> (msb + 9);
+	exp2 -= 1 ^ msb;
+
+	// Exactly half way between two doubles
+	if (x_lo == 0 && (x_hi & 0x1FF) == 0 && (result & 3) == 1) {
+		return false;
+	}
+
+	// Round to 53 bits
+	result += result & 1;
+	result >>= 1;
+
+	if (result >> 53) {
+		result >>= 1;
+		exp2++;
+	}
+
+	// Subnormal, infinite, or NaN
+	if (exp2 - 1 >= 0x7FF - 1) {
+		return false;
+	}
+
+	bits = (exp2 << 52) | (result & 0x000FFFFFFFFFFFFFULL);
+
+	if (negative) {
+		bits |= 0x8000000000000000ULL;
+	}
+
+	memcpy(value, &bits, sizeof(double));
+	return true;
+}
+
+
+/// Exact powers of ten that fit in a double
+static const double exact_powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/// Use strtod() for the rare numbers the fast paths can't handle.  Long
+/// numbers are copied to storage from `allocator`, and false is returned
+/// if that fails.
+static bool slow_parse_double(const tdp_allocator * allocator, const char * text, size_t len, double * value) {
+	char buffer[64];
+	char * copy = (len < sizeof(buffer)) ? buffer : tdp_malloc(allocator, len + 1);
+
+	if (copy == NULL) {
+		return false;
+	}
+
+	memcpy(copy, text, len);
+	copy[len] = '\0';
+	*value = strtod(copy, NULL);
+
+	if (copy != buffer) {
+		tdp_free(allocator, copy);
+	}
+
+	return true;
+}
+
+
+/// Parse a JSON number
+bool parse_double(const tdp_allocator * allocator, const char * text, size_t len, double * value) {
+	short type = classify_number(text, len);
+
+	if (type != TDP_TYPE_INT && type != TDP_TYPE_FLOAT) {
+		return false;
+	}
+
+	return parse_double_unchecked(allocator, text, len, value);
+}
+
+
+/// Parse a number that classify_number() has already validated
+bool parse_double_unchecked(const tdp_allocator * allocator, const char * text, size_t len, double * value) {
+	const char * start = text;
+	const char * stop = text + len;
+	bool negative = false;
+	uint64_t mantissa = 0;
+	size_t significant = 0;
+	int64_t exp10 = 0;
+	size_t digits;
+
+	if (*text == '-') {
+		negative = true;
+		text++;
+	}
+
+	// Integer part
+	digits = count_digits(text, stop - text);
+	mantissa = accumulate_digits(0, text, digits > 19 ? 19 : digits);
+	significant = digits;
+
+	if (digits > 19) {
+		// Too many digits to hold exactly
+		return slow_parse_double(allocator, start, len, value);
+	}
+
+	text += digits;
+
+	// Fraction
+	if (text < stop && *text == '.') {
+		text++;
+		digits = count_digits(text, stop - text);
+
+		// Leading zeros of a fraction are not significant when integer part is 0
+		const char * fraction = text;
+
+		if (mantissa == 0) {
+			while (fraction < text + digits && *fraction == '0') {
+				fraction++;
+			}
+
+			significant = 0;
+		}
+
+		size_t remaining = digits - (fraction - text);
+
+		if (significant + remaining > 19) {
+			return slow_parse_double(allocator, start, len, value);
+		}
+
+		mantissa = accumulate_digits(mantissa, fraction, remaining);
+		significant += remaining;
+		exp10 -= (int64_t) digits;
+		text += digits;
+	}
+
+	// Exponent
+	if (text < stop && (*text == 'e' || *text == 'E')) {
+		bool negative_exponent = false;
+		int64_t e = 0;
+
+		text++;
+
+		if (*text == '+' || *text == '-') {
+			negative_exponent = (*text == '-');
+			text++;
+		}
+
+		while (text < stop) {
+			if (e < 100000) {
+				e = e * 10 + (*text - '0');
+			}
+
+			text++;
+		}
+
+		exp10 += negative_exponent ? -e : e;
+	}
+
+	// Clinger's fast path -- both values exact, so one operation rounds correctly
+	if (mantissa <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+		double d = (double)mantissa;
+
+		if (exp10 < 0) {
+			d /= exact_powers_of_ten[-exp10];
+		} else {
+			d *= exact_powers_of_ten[exp10];
+		}
+
+		*value = negative ? -d : d;
+		return true;
+	}
+
+	if (exp10 >= INT32_MIN && exp10 <= INT32_MAX && eisel_lemire(mantissa, (int)exp10, negative, value)) {
+		return true;
+	}
+
+	return slow_parse_double(allocator, start, len, value);
+}
+
+
+#ifdef TEST
+void Test_classify_number(CuTest * tc) {
+	CuAssertIntEquals(tc, 0, count_digits("", 0));
+	CuAssertIntEquals(tc, 3, count_digits("123abc", 6));
+	CuAssertIntEquals(tc, 20, count_digits("12345678901234567890", 20));
+	CuAssertIntEquals(tc, 8, count_digits("12345678:2345678", 16));
+	CuAssertIntEquals(tc, 9, count_digits("123456789/", 10));
+
+	CuAssertIntEquals(tc, TDP_TYPE_INT, classify_number("0", 1));
+	CuAssertIntEquals(tc, TDP_TYPE_INT, classify_number("-42", 3));
+	CuAssertIntEquals(tc, TDP_TYPE_INT, classify_number("1234567890123", 13));
+	CuAssertIntEquals(tc, TDP_TYPE_FLOAT, classify_number("0.5", 3));
+	CuAssertIntEquals(tc, TDP_TYPE_FLOAT, classify_number("-102.25", 7));
+	CuAssertIntEquals(tc, TDP_TYPE_FLOAT, classify_number("1e10", 4));
+	CuAssertIntEquals(tc, TDP_TYPE_FLOAT, classify_number("2.5E-3", 6));
+	CuAssertIntEquals(tc, TDP_TYPE_BOOL, classify_number("true", 4));
+	CuAssertIntEquals(tc, TDP_TYPE_BOOL, classify_number("false", 5));
+
+	CuAssertIntEquals(tc, TDP_TYPE_INT, classify_number("9223372036854775807", 19));
+	CuAssertIntEquals(tc, TDP_TYPE_INT, classify_number("-9223372036854775808", 20));
+	CuAssertIntEquals(tc, TDP_TYPE_FLOAT, classify_number("9223372036854775808", 19));
+	CuAssertIntEquals(tc, TDP_TYPE_FLOAT, classify_number("99999999999999999999", 20));
+
+	CuAssertIntEquals(tc, TDP_TYPE_STRING, classify_number("08123", 5));
+	CuAssertIntEquals(tc, TDP_TYPE_STRING, classify_number("1.2.3", 5));
+	CuAssertIntEquals(tc, TDP_TYPE_STRING, classify_number(".", 1));
+	CuAssertIntEquals(tc, TDP_TYPE_STRING, classify_number(".5", 2));
+	CuAssertIntEquals(tc, TDP_TYPE_STRING, classify_number("5.", 2));
+	CuAssertIntEquals(tc, TDP_TYPE_STRING, classify_number("-", 1));
+	CuAssertIntEquals(tc, TDP_TYPE_STRING, classify_number("-05", 3));
+	CuAssertIntEquals(tc, TDP_TYPE_STRING, classify_number("1e", 2));
+	CuAssertIntEquals(tc, TDP_TYPE_STRING, classify_number("", 0));
+}
+
+
+void Test_parse_numbers(CuTest * tc) {
+	int64_t i = 0;
+	double d = 0;
+
+	CuAssertTrue(tc, parse_int64("0", 1, &i));
+	CuAssertTrue(tc, i == 0);
+	CuAssertTrue(tc, parse_int64("-42", 3, &i));
+	CuAssertTrue(tc, i == -42);
+	CuAssertTrue(tc, parse_int64("12345678901234", 14, &i));
+	CuAssertTrue(tc, i == 12345678901234LL);
+	CuAssertTrue(tc, parse_int64("9223372036854775807", 19, &i));
+	CuAssertTrue(tc, i == INT64_MAX);
+	CuAssertTrue(tc, parse_int64("-9223372036854775808", 20, &i));
+	CuAssertTrue(tc, i == INT64_MIN);
+
+	// Overflow and invalid input
+	CuAssertTrue(tc, !parse_int64("9223372036854775808", 19, &i));
+	CuAssertTrue(tc, !parse_int64("-9223372036854775809", 20, &i));
+	CuAssertTrue(tc, !parse_int64("99999999999999999999", 20, &i));
+	CuAssertTrue(tc, !parse_int64("08", 2, &i));
+	CuAssertTrue(tc, !parse_int64("-", 1, &i));
+	CuAssertTrue(tc, !parse_int64("1.5", 3, &i));
+	CuAssertTrue(tc, !parse_int64("", 0, &i));
+
+	CuAssertTrue(tc, !parse_double(NULL, "1.2.3", 5, &d));
+	CuAssertTrue(tc, !parse_double(NULL, "true", 4, &d));
+	CuAssertTrue(tc, !parse_double(NULL, ".5", 2, &d));
+
+	// Values already classified
+	CuAssertTrue(tc, parse_int64_unchecked("0", 1) == 0);
+	CuAssertTrue(tc, parse_int64_unchecked("-42", 3) == -42);
+	CuAssertTrue(tc, parse_int64_unchecked("9223372036854775807", 19) == INT64_MAX);
+	CuAssertTrue(tc, parse_int64_unchecked("-9223372036854775808", 20) == INT64_MIN);
+	CuAssertTrue(tc, parse_double_unchecked(NULL, "-102.25", 7, &d));
+	CuAssertTrue(tc, d == -102.25);
+
+	// Compare with strtod(), covering fast path, Eisel-Lemire, and fallback
+	const char * samples[] = {
+		"0", "-0", "1", "0.1", "0.3", "-102.25", "3.141592653589793",
+		"1e22", "1e23", "9007199254740993", "2.2250738585072014e-308",
+		"4.9e-324", "1.7976931348623157e308", "1e309", "1e-400",
+		"0.000000000000000000000000000001234", "123456789012345678901234567890",
+		"9999999999999999999", "7.038531e-26", "2.5E-3", "1E+2",
+		"8.988465674311579e307", "0.1e-1", "4503599627370496.5",
+		"12345678901234567890.5", "1.00000000000000011102230246251565404236316680908203125",
+		NULL
+	};
+
+	for (int j = 0; samples[j]; ++j) {
+		double expected = strtod(samples[j], NULL);
+		CuAssertTrue(tc, parse_double(NULL, samples[j], strlen(samples[j]), &d));
+		CuAssertTrue(tc, memcmp(&d, &expected, sizeof(double)) == 0);
+	}
+
+	// Long numbers are copied for strtod() with the allocator
+	const char * digits = "1234567890123456789012345678901234567890123456789012345678901234567890.5";
+	double exact = strtod(digits, NULL);
+	char scratch[32];
+	tdp_arena arena;
+
+	tdp_arena_init(&arena, scratch, sizeof(scratch));
+	CuAssertTrue(tc, !parse_double(&arena.allocator, digits, strlen(digits), &d));
+	CuAssertTrue(tc, parse_double(NULL, digits, strlen(digits), &d));
+	CuAssertTrue(tc, memcmp(&d, &exact, sizeof(double)) == 0);
+
+	// Random values
+	char buffer[64];
+	uint64_t seed = 0x9E3779B97F4A7C15ULL;
+
+	for (int j = 0; j < 20000; ++j) {
+		uint64_t bits;
+		double value;
+
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		bits = seed & 0x7FEFFFFFFFFFFFFFULL;
+		memcpy(&value, &bits, sizeof(double));
+
+		snprintf(buffer, sizeof(buffer), (j & 1) ? "%.17g" : "%.15g", value);
+
+		if (classify_number(buffer, strlen(buffer)) == TDP_TYPE_STRING) {
+			// Shouldn't happen, but skip anything that isn't valid JSON
+			continue;
+		}
+
+		double expected = strtod(buffer, NULL);
+		CuAssertTrue(tc, parse_double(NULL, buffer, strlen(buffer), &d));
+		CuAssertTrue(tc, memcmp(&d, &expected, sizeof(double)) == 0);
+	}
+}
+#endif
@@ -0,0 +1,126 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file number.h
+
+	@brief Validate and classify numeric text
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#ifndef NUMBER_TDP_PARSER_H
+#define NUMBER_TDP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+#include "allocator.h"
+
+
+/// Count leading ASCII digits in `text` (checked 8 bytes at a time)
+size_t count_digits(
+	const char * text,					//!< Text to scan
+	size_t len							//!< Number of bytes
+);
+
+
+/// Classify a value that the lexer tagged as numeric.  Returns
+/// TDP_TYPE_INT or TDP_TYPE_FLOAT if it is a valid JSON number (integers
+/// that do not fit in 64 bits are TDP_TYPE_FLOAT), TDP_TYPE_BOOL for `true` or `false`, and TDP_TYPE_STRING otherwise
+/// (e.g. `08123`, `1.2.3`, or `.`).
+short classify_number(
+	const char * text,					//!< Text to classify
+	size_t len							//!< Number of bytes
+);
+
+
+/// Parse a JSON integer.  Returns false if the text is not a valid
+/// integer, or does not fit in 64 bits.
+bool parse_int64(
+	const char * text,					//!< Text to parse
+	size_t len,							//!< Number of bytes
+	int64_t * value						//!< Result
+);
+
+
+/// Parse an integer that classify_number() has already found to be
+/// TDP_TYPE_INT, without checking it again
+int64_t parse_int64_unchecked(
+	const char * text,					//!< Text to parse
+	size_t len							//!< Number of bytes
+);
+
+
+/// Parse a JSON number, rounding correctly to the nearest double.
+/// Returns false if the text is not a valid JSON number, or a long number
+/// could not be copied for strtod().
+bool parse_double(
+	const tdp_allocator * allocator,	//!< Allocator for long numbers (NULL to use heap)
+	const char * text,					//!< Text to parse
+	size_t len,							//!< Number of bytes
+	double * value						//!< Result
+);
+
+
+/// Parse a number that classify_number() has already found to be
+/// TDP_TYPE_INT or TDP_TYPE_FLOAT, without checking it again.  Returns
+/// false if a long number could not be copied for strtod().
+bool parse_double_unchecked(
+	const tdp_allocator * allocator,	//!< Allocator for long numbers (NULL to use heap)
+	const char * text,					//!< Text to parse
+	size_t len,							//!< Number of bytes
+	double * value						//!< Result
+);
+
+
+#endif
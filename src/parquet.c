@@ -0,0 +1,918 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file parquet.c
+
+	@brief Write Apache Parquet files from Arrow column buffers.  Each
+	batch of rows becomes a row group, with one data page per column
+	chunk (preceded by a dictionary page for string columns with enough
+	repeated values).  Metadata uses the Thrift compact protocol.
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "libTDP.h"
+#include "compress.h"
+#include "parquet.h"
+#include "snappy.h"
+
+
+// Values from the Parquet format (parquet.thrift)
+#define kParquetBoolean			0
+#define kParquetInt64			2
+#define kParquetDouble			5
+#define kParquetByteArray		6
+
+#define kParquetOptional		1
+#define kParquetConvertedUTF8	0
+
+#define kParquetPlain			0
+#define kParquetRLE				3
+#define kParquetRLEDictionary	8
+
+#define kParquetDataPage		0
+#define kParquetDictionaryPage	2
+
+#define kParquetUncompressed	0
+#define kParquetSnappy			1
+#define kParquetGzip			2
+#define kParquetZstd			6
+
+// Thrift compact protocol types
+#define kThriftTrue				1
+#define kThriftFalse			2
+#define kThriftI32				5
+#define kThriftI64				6
+#define kThriftBinary			8
+#define kThriftList				9
+#define kThriftStruct			12
+
+#define kThriftDepth			8		//!< Deepest nesting of structs
+
+
+/// Thrift compact protocol encoder
+struct thrift {
+	DString		*	out;				//!< Destination
+	int16_t			last[kThriftDepth];	//!< Last field id written in each open struct
+	int				depth;				//!< Number of open structs
+};
+
+typedef struct thrift thrift;
+
+
+/// Smallest and largest values in a column chunk
+struct parquet_stats {
+	bool			has_value;			//!< Are there any non-null values?
+	size_t			min;				//!< Row with smallest value
+	size_t			max;				//!< Row with largest value
+};
+
+typedef struct parquet_stats parquet_stats;
+
+
+/// Get bit `i` of a bitmap
+#define get_bit(bitmap, i) (((bitmap)[(i) >> 3] >> ((i) & 7)) & 1)
+
+
+/// Is value at `row` of column `c` not null?
+#define is_valid(c, row) get_bit((c)->validity->str, row)
+
+
+/// Append single byte (which may be 0)
+static void append_byte(DString * s, uint8_t value) {
+	char c = (char) value;
+
+	d_string_append_c_array(s, &c, 1);
+}
+
+
+/// Append `bytes` bytes of `value`, little-endian
+static void append_le(DString * s, uint64_t value, int bytes) {
+	char buffer[8];
+
+	for (int i = 0; i < bytes; ++i) {
+		buffer[i] = (char) (value & 0xff);
+		value >>= 8;
+	}
+
+	d_string_append_c_array(s, buffer, bytes);
+}
+
+
+/// Read little-endian value
+static uint64_t read_le(const char * p, int bytes) {
+	uint64_t value = 0;
+
+	for (int i = bytes - 1; i >= 0; --i) {
+		value = (value << 8) | (unsigned char) p[i];
+	}
+
+	return value;
+}
+
+
+/// Append unsigned LEB128 varint
+static void append_varint(DString * s, uint64_t value) {
+	char buffer[10];
+	int n = 0;
+
+	while (value >= 0x80) {
+		buffer[n++] = (char) ((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+
+	buffer[n++] = (char) value;
+	d_string_append_c_array(s, buffer, n);
+}
+
+
+/// Map signed to unsigned so that small magnitudes have short varints
+static inline uint64_t zigzag(int64_t value) {
+	return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+
+static void thrift_init(thrift * t, DString * out) {
+	t->out = out;
+	t->depth = 0;
+	t->last[0] = 0;
+}
+
+
+/// Write field header
+static void thrift_field(thrift * t, int16_t id, uint8_t type) {
+	int delta = id - t->last[t->depth];
+
+	if (delta > 0 && delta <= 15) {
+		append_byte(t->out, (uint8_t) ((delta << 4) | type));
+	} else {
+		append_byte(t->out, type);
+		append_varint(t->out, zigzag(id));
+	}
+
+	t->last[t->depth] = id;
+}
+
+
+static void thrift_i32(thrift * t, int16_t id, int32_t value) {
+	thrift_field(t, id, kThriftI32);
+	append_varint(t->out, zigzag(value));
+}
+
+
+static void thrift_i64(thrift * t, int16_t id, int64_t value) {
+	thrift_field(t, id, kThriftI64);
+	append_varint(t->out, zigzag(value));
+}
+
+
+static void thrift_binary(thrift * t, int16_t id, const char * data, size_t len) {
+	thrift_field(t, id, kThriftBinary);
+	append_varint(t->out, len);
+	d_string_append_c_array(t->out, data, len);
+}
+
+
+/// Start a struct -- use `id` 0 for list elements and the top level struct
+static void thrift_begin(thrift * t, int16_t id) {
+	if (id) {
+		thrift_field(t, id, kThriftStruct);
+	}
+
+	t->last[++t->depth] = 0;
+}
+
+
+static void thrift_end(thrift * t) {
+	append_byte(t->out, 0);
+	t->depth--;
+}
+
+
+/// Start a list of `count` elements of `type`.  The caller writes the
+/// elements.
+static void thrift_list(thrift * t, int16_t id, uint8_t type, size_t count) {
+	thrift_field(t, id, kThriftList);
+
+	if (count < 15) {
+		append_byte(t->out, (uint8_t) ((count << 4) | type));
+	} else {
+		append_byte(t->out, 0xf0 | type);
+		append_varint(t->out, count);
+	}
+}
+
+
+/// Parquet physical type for column
+static int32_t physical_type(arrow_column * c) {
+	switch (c->type) {
+		case TDP_TYPE_INT:
+			return kParquetInt64;
+
+		case TDP_TYPE_FLOAT:
+			return kParquetDouble;
+
+		case TDP_TYPE_BOOL:
+			return kParquetBoolean;
+
+		default:
+			return kParquetByteArray;
+	}
+}
+
+
+/// Get string value at `row` of a string column
+static const char * string_value(arrow_column * c, size_t row, size_t * len) {
+	size_t start = read_le(c->offsets->str + 4 * row, 4);
+
+	*len = read_le(c->offsets->str + 4 * row + 4, 4) - start;
+	return c->values->str + start;
+}
+
+
+/// Compare values at rows `a` and `b` (strings are compared as unsigned
+/// bytes, as Parquet expects for UTF-8)
+static int compare_values(arrow_column * c, size_t a, size_t b) {
+	switch (c->type) {
+		case TDP_TYPE_INT: {
+			int64_t x = (int64_t) read_le(c->values->str + 8 * a, 8);
+			int64_t y = (int64_t) read_le(c->values->str + 8 * b, 8);
+			return (x > y) - (x < y);
+		}
+
+		case TDP_TYPE_FLOAT: {
+			uint64_t bits_x = read_le(c->values->str + 8 * a, 8);
+			uint64_t bits_y = read_le(c->values->str + 8 * b, 8);
+			double x;
+			double y;
+
+			memcpy(&x, &bits_x, sizeof(double));
+			memcpy(&y, &bits_y, sizeof(double));
+			return (x > y) - (x < y);
+		}
+
+		case TDP_TYPE_BOOL:
+			return (int) get_bit(c->values->str, a) - (int) get_bit(c->values->str, b);
+
+		default: {
+			size_t len_a;
+			size_t len_b;
+			const char * x = string_value(c, a, &len_a);
+			const char * y = string_value(c, b, &len_b);
+			int result = memcmp(x, y, (len_a < len_b) ? len_a : len_b);
+
+			return result ? result : (len_a > len_b) - (len_a < len_b);
+		}
+	}
+}
+
+
+/// Find smallest and largest values
+static void find_statistics(arrow_column * c, size_t rows, parquet_stats * s) {
+	s->has_value = false;
+
+	for (size_t i = 0; i < rows; ++i) {
+		if (!is_valid(c, i)) {
+			continue;
+		}
+
+		if (!s->has_value) {
+			s->has_value = true;
+			s->min = i;
+			s->max = i;
+		} else if (compare_values(c, i, s->min) < 0) {
+			s->min = i;
+		} else if (compare_values(c, i, s->max) > 0) {
+			s->max = i;
+		}
+	}
+}
+
+
+/// Write plain encoded value at `row` as a statistics field
+static void write_stat_value(thrift * t, int16_t id, arrow_column * c, size_t row) {
+	const char * data;
+	size_t len;
+	char bit;
+
+	switch (c->type) {
+		case TDP_TYPE_INT:
+		case TDP_TYPE_FLOAT:
+			data = c->values->str + 8 * row;
+			len = 8;
+			break;
+
+		case TDP_TYPE_BOOL:
+			bit = (char) get_bit(c->values->str, row);
+			data = &bit;
+			len = 1;
+			break;
+
+		default:
+			data = string_value(c, row, &len);
+			break;
+	}
+
+	thrift_binary(t, id, data, len);
+}
+
+
+/// Write Statistics struct
+static void write_statistics(thrift * t, int16_t id, arrow_column * c, parquet_stats * s) {
+	thrift_begin(t, id);
+	thrift_i64(t, 3, c->null_count);
+
+	if (s->has_value) {
+		write_stat_value(t, 5, c, s->max);
+		write_stat_value(t, 6, c, s->min);
+	}
+
+	thrift_end(t);
+}
+
+
+/// Append definition levels (1 for values, 0 for nulls) as RLE runs,
+/// preceded by their length
+static void append_levels(DString * page, arrow_column * c, size_t rows) {
+	size_t start = page->currentStringLength;
+	size_t run;
+	size_t len;
+
+	append_le(page, 0, 4);
+
+	for (size_t i = 0; i < rows; i += run) {
+		int level = is_valid(c, i);
+
+		for (run = 1; i + run < rows && is_valid(c, i + run) == level; ++run) {
+		}
+
+		append_varint(page, run << 1);
+		append_byte(page, (uint8_t) level);
+	}
+
+	len = page->currentStringLength - start - 4;
+
+	for (int i = 0; i < 4; ++i) {
+		page->str[start + i] = (char) ((len >> (8 * i)) & 0xff);
+	}
+}
+
+
+/// Append non-null values, plain encoded
+static void append_plain(DString * page, arrow_column * c, size_t rows) {
+	size_t count = 0;
+	const char * text;
+	size_t len;
+
+	switch (c->type) {
+		case TDP_TYPE_INT:
+		case TDP_TYPE_FLOAT:
+			if (c->null_count == 0) {
+				d_string_append_c_array(page, c->values->str, c->values->currentStringLength);
+				break;
+			}
+
+			for (size_t i = 0; i < rows; ++i) {
+				if (is_valid(c, i)) {
+					d_string_append_c_array(page, c->values->str + 8 * i, 8);
+				}
+			}
+
+			break;
+
+		case TDP_TYPE_BOOL:
+			// Bit-packed, least significant bit first
+			for (size_t i = 0; i < rows; ++i) {
+				if (is_valid(c, i)) {
+					if (count % 8 == 0) {
+						append_byte(page, 0);
+					}
+
+					if (get_bit(c->values->str, i)) {
+						page->str[page->currentStringLength - 1] |= (char) (1 << (count % 8));
+					}
+
+					count++;
+				}
+			}
+
+			break;
+
+		default:
+			for (size_t i = 0; i < rows; ++i) {
+				if (is_valid(c, i)) {
+					text = string_value(c, i, &len);
+					append_le(page, len, 4);
+					d_string_append_c_array(page, text, len);
+				}
+			}
+
+			break;
+	}
+}
+
+
+/// Build dictionary for a string column.  Returns number of entries (with
+/// the row of each entry in `entries`, and the dictionary index of each
+/// non-null value in `indices`), or 0 if values don't repeat enough for a
+/// dictionary to help.
+static size_t build_dictionary(arrow_writer * w, arrow_column * c, size_t rows, uint32_t ** entries, uint32_t ** indices) {
+	size_t capacity = 16;
+	size_t count = 0;
+	size_t values = 0;
+	uint32_t * slots;
+
+	while (capacity < rows * 2) {
+		capacity *= 2;
+	}
+
+	slots = tdp_malloc(w->allocator, capacity * sizeof(uint32_t));
+	*entries = tdp_malloc(w->allocator, rows * sizeof(uint32_t) + 1);
+	*indices = tdp_malloc(w->allocator, rows * sizeof(uint32_t) + 1);
+
+	if (!slots || !*entries || !*indices) {
+		goto plain;
+	}
+
+	memset(slots, 0, capacity * sizeof(uint32_t));
+
+	for (size_t i = 0; i < rows; ++i) {
+		if (!is_valid(c, i)) {
+			continue;
+		}
+
+		size_t len;
+		const char * text = string_value(c, i, &len);
+		uint32_t hash = 2166136261u;
+
+		// FNV-1a
+		for (size_t j = 0; j < len; ++j) {
+			hash = (hash ^ (unsigned char) text[j]) * 16777619u;
+		}
+
+		size_t slot = hash & (capacity - 1);
+
+		// Slots hold entry + 1, so that 0 is empty
+		while (slots[slot]) {
+			size_t entry_len;
+			const char * entry = string_value(c, (*entries)[slots[slot] - 1], &entry_len);
+
+			if (entry_len == len && memcmp(entry, text, len) == 0) {
+				break;
+			}
+
+			slot = (slot + 1) & (capacity - 1);
+		}
+
+		if (!slots[slot]) {
+			(*entries)[count++] = (uint32_t) i;
+			slots[slot] = (uint32_t) count;
+		}
+
+		(*indices)[values++] = slots[slot] - 1;
+	}
+
+	if (count && count * 2 <= values) {
+		tdp_free(w->allocator, slots);
+		return count;
+	}
+
+plain:
+	tdp_free(w->allocator, slots);
+	tdp_free(w->allocator, *entries);
+	tdp_free(w->allocator, *indices);
+	*entries = NULL;
+	*indices = NULL;
+
+	return 0;
+}
+
+
+/// Append `count` values of `width` bits as a single bit-packed run
+static void append_bit_packed(DString * page, const uint32_t * values, size_t count, int width) {
+	size_t groups = (count + 7) / 8;
+	uint64_t bits = 0;
+	int used = 0;
+
+	append_varint(page, (groups << 1) | 1);
+
+	// Runs are groups of 8 values -- pad with zeros
+	for (size_t i = 0; i < groups * 8; ++i) {
+		bits |= (uint64_t) ((i < count) ? values[i] : 0) << used;
+		used += width;
+
+		while (used >= 8) {
+			append_byte(page, (uint8_t) (bits & 0xff));
+			bits >>= 8;
+			used -= 8;
+		}
+	}
+}
+
+
+/// Parquet codec for compression (tdp_compression)
+static int32_t parquet_codec(short compression) {
+	switch (compression) {
+		case TDP_COMPRESSION_SNAPPY:
+			return kParquetSnappy;
+
+		case TDP_COMPRESSION_GZIP:
+			return kParquetGzip;
+
+		case TDP_COMPRESSION_ZSTD:
+			return kParquetZstd;
+
+		default:
+			return kParquetUncompressed;
+	}
+}
+
+
+/// Write the page in w->page, with its header
+static void write_page(arrow_writer * w, int32_t type, size_t values, int32_t encoding, arrow_column * c, parquet_stats * s, size_t * uncompressed, size_t * compressed) {
+	const char * data = w->page->str;
+	size_t len = w->page->currentStringLength;
+	thrift t;
+
+	if (w->compression != TDP_COMPRESSION_NONE) {
+		size_t needed = (w->compression == TDP_COMPRESSION_SNAPPY) ? snappy_max_compressed_length(len) : block_compress_bound(w->compression, len);
+
+		if (needed > w->compressed_size) {
+			char * buffer = tdp_realloc(w->allocator, w->compressed, needed);
+
+			if (buffer) {
+				w->compressed = buffer;
+				w->compressed_size = needed;
+			}
+		}
+
+		if ((w->compression != TDP_COMPRESSION_SNAPPY) && (w->codec == NULL)) {
+			w->codec = block_compressor_new(w->allocator, w->compression);
+		}
+
+		if (w->compression == TDP_COMPRESSION_SNAPPY && needed <= w->compressed_size) {
+			len = snappy_compress(data, len, w->compressed);
+			data = w->compressed;
+		} else if (w->codec && needed <= w->compressed_size && (len = block_compress(w->codec, data, len, w->compressed, w->compressed_size))) {
+			data = w->compressed;
+		} else {
+			// Out of memory, or compression failed
+			w->out->failed = true;
+		}
+	}
+
+	d_string_erase(w->metadata, 0, -1);
+	thrift_init(&t, w->metadata);
+	thrift_begin(&t, 0);
+	thrift_i32(&t, 1, type);
+	thrift_i32(&t, 2, (int32_t) w->page->currentStringLength);
+	thrift_i32(&t, 3, (int32_t) len);
+
+	if (type == kParquetDataPage) {
+		thrift_begin(&t, 5);
+		thrift_i32(&t, 1, (int32_t) values);
+		thrift_i32(&t, 2, encoding);
+		thrift_i32(&t, 3, kParquetRLE);
+		thrift_i32(&t, 4, kParquetRLE);
+		write_statistics(&t, 5, c, s);
+		thrift_end(&t);
+	} else {
+		thrift_begin(&t, 7);
+		thrift_i32(&t, 1, (int32_t) values);
+		thrift_i32(&t, 2, encoding);
+		thrift_end(&t);
+	}
+
+	thrift_end(&t);
+
+	sink_write(w->out, w->metadata->str, w->metadata->currentStringLength);
+	sink_write(w->out, data, len);
+
+	*uncompressed += w->metadata->currentStringLength + w->page->currentStringLength;
+	*compressed += w->metadata->currentStringLength + len;
+}
+
+
+/// Write column chunk for current rows, and add its ColumnChunk metadata
+/// to `t`.  Adds uncompressed size to `bytes`.
+static void write_column_chunk(arrow_writer * w, arrow_column * c, thrift * t, size_t * bytes) {
+	size_t rows = w->rows;
+	size_t start = w->out->total;
+	size_t uncompressed = 0;
+	size_t compressed = 0;
+	uint32_t * entries = NULL;
+	uint32_t * indices = NULL;
+	size_t count = 0;
+	int width = 1;
+	parquet_stats stats;
+
+	find_statistics(c, rows, &stats);
+
+	if (c->type == TDP_TYPE_STRING) {
+		count = build_dictionary(w, c, rows, &entries, &indices);
+	}
+
+	if (count) {
+		const char * text;
+		size_t len;
+
+		d_string_erase(w->page, 0, -1);
+
+		for (size_t i = 0; i < count; ++i) {
+			text = string_value(c, entries[i], &len);
+			append_le(w->page, len, 4);
+			d_string_append_c_array(w->page, text, len);
+		}
+
+		write_page(w, kParquetDictionaryPage, count, kParquetPlain, c, NULL, &uncompressed, &compressed);
+
+		while (((size_t) 1 << width) < count) {
+			width++;
+		}
+	}
+
+	size_t data_offset = w->out->total;
+
+	d_string_erase(w->page, 0, -1);
+	append_levels(w->page, c, rows);
+
+	if (count) {
+		append_byte(w->page, (uint8_t) width);
+
+		if (rows > c->null_count) {
+			append_bit_packed(w->page, indices, rows - c->null_count, width);
+		}
+	} else {
+		append_plain(w->page, c, rows);
+	}
+
+	write_page(w, kParquetDataPage, rows, count ? kParquetRLEDictionary : kParquetPlain, c, &stats, &uncompressed, &compressed);
+
+	tdp_free(w->allocator, entries);
+	tdp_free(w->allocator, indices);
+
+	// ColumnChunk
+	thrift_begin(t, 0);
+	thrift_i64(t, 2, start);
+
+	// ColumnMetaData
+	thrift_begin(t, 3);
+	thrift_i32(t, 1, physical_type(c));
+	thrift_list(t, 2, kThriftI32, count ? 3 : 2);
+	append_varint(t->out, zigzag(kParquetPlain));
+	append_varint(t->out, zigzag(kParquetRLE));
+
+	if (count) {
+		append_varint(t->out, zigzag(kParquetRLEDictionary));
+	}
+
+	thrift_list(t, 3, kThriftBinary, 1);
+	append_varint(t->out, c->name_len);
+	d_string_append_c_array(t->out, c->name, c->name_len);
+
+	thrift_i32(t, 4, parquet_codec(w->compression));
+	thrift_i64(t, 5, rows);
+	thrift_i64(t, 6, uncompressed);
+	thrift_i64(t, 7, compressed);
+	thrift_i64(t, 9, data_offset);
+
+	if (count) {
+		thrift_i64(t, 11, start);
+	}
+
+	write_statistics(t, 12, c, &stats);
+	thrift_end(t);
+
+	thrift_end(t);
+
+	*bytes += uncompressed;
+}
+
+
+/// Write file header
+void parquet_begin(arrow_writer * w) {
+	sink_write(w->out, "PAR1", 4);
+}
+
+
+/// Write current rows as a row group
+void parquet_write_row_group(arrow_writer * w) {
+	size_t start = w->out->total;
+	size_t bytes = 0;
+	thrift t;
+
+	// RowGroup
+	thrift_init(&t, w->blocks);
+	thrift_begin(&t, 0);
+	thrift_list(&t, 1, kThriftStruct, w->count);
+
+	for (size_t i = 0; i < w->count; ++i) {
+		write_column_chunk(w, &w->columns[i], &t, &bytes);
+	}
+
+	thrift_i64(&t, 2, bytes);
+	thrift_i64(&t, 3, w->rows);
+	thrift_i64(&t, 5, start);
+	thrift_i64(&t, 6, w->out->total - start);
+	thrift_end(&t);
+
+	w->block_count++;
+}
+
+
+/// Write file metadata and trailer
+void parquet_finish(arrow_writer * w) {
+	DString * b = w->metadata;
+	char len[4];
+	thrift t;
+
+	d_string_erase(b, 0, -1);
+	thrift_init(&t, b);
+
+	// FileMetaData
+	thrift_begin(&t, 0);
+	thrift_i32(&t, 1, 1);
+
+	// Schema is a flattened tree, with a root element
+	thrift_list(&t, 2, kThriftStruct, w->count + 1);
+	thrift_begin(&t, 0);
+	thrift_binary(&t, 4, "schema", 6);
+	thrift_i32(&t, 5, (int32_t) w->count);
+	thrift_end(&t);
+
+	for (size_t i = 0; i < w->count; ++i) {
+		arrow_column * c = &w->columns[i];
+
+		thrift_begin(&t, 0);
+		thrift_i32(&t, 1, physical_type(c));
+		thrift_i32(&t, 3, kParquetOptional);
+		thrift_binary(&t, 4, c->name, c->name_len);
+
+		if (c->type == TDP_TYPE_STRING) {
+			thrift_i32(&t, 6, kParquetConvertedUTF8);
+
+			// LogicalType with StringType
+			thrift_begin(&t, 10);
+			thrift_begin(&t, 1);
+			thrift_end(&t);
+			thrift_end(&t);
+		}
+
+		thrift_end(&t);
+	}
+
+	thrift_i64(&t, 3, w->total_rows);
+
+	// Row groups were encoded as they were written
+	thrift_list(&t, 4, kThriftStruct, w->block_count);
+	d_string_append_c_array(b, w->blocks->str, w->blocks->currentStringLength);
+
+	thrift_binary(&t, 6, "tdp", 3);
+
+	// ColumnOrder for each column, so that readers use min and max
+	// statistics
+	thrift_list(&t, 7, kThriftStruct, w->count);
+
+	for (size_t i = 0; i < w->count; ++i) {
+		thrift_begin(&t, 0);
+		thrift_begin(&t, 1);
+		thrift_end(&t);
+		thrift_end(&t);
+	}
+
+	thrift_end(&t);
+
+	sink_write(w->out, b->str, b->currentStringLength);
+
+	for (int i = 0; i < 4; ++i) {
+		len[i] = (char) ((b->currentStringLength >> (8 * i)) & 0xff);
+	}
+
+	sink_write(w->out, len, 4);
+	sink_write(w->out, "PAR1", 4);
+}
+
+
+#ifdef TEST
+/// Count occurrences of `text` in `s`
+static size_t count_occurrences(DString * s, const char * text) {
+	size_t len = strlen(text);
+	size_t count = 0;
+
+	for (size_t i = 0; i + len <= s->currentStringLength; ++i) {
+		if (memcmp(s->str + i, text, len) == 0) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+
+void Test_parquet_writer(CuTest * tc) {
+	DString * out = d_string_new("");
+	arrow_writer * w;
+	sink s;
+
+	sink_init_string(&s, out);
+	w = arrow_writer_new(NULL, &s, TDP_OUTPUT_PARQUET, 64);
+
+	CuAssertTrue(tc, arrow_writer_add_column(w, "n", 1, TDP_TYPE_INT));
+	CuAssertTrue(tc, arrow_writer_add_column(w, "city", 4, TDP_TYPE_STRING));
+	CuAssertTrue(tc, arrow_writer_add_column(w, "id", 2, TDP_TYPE_STRING));
+
+	arrow_writer_begin(w);
+
+	for (int i = 0; i < 100; ++i) {
+		char id[16];
+		sink * value;
+
+		if (i % 10) {
+			arrow_append_int(w, 0, i);
+		}
+
+		value = arrow_append_string(w, 1);
+		sink_write_string(value, (i % 2) ? "Springfield" : "Shelbyville");
+
+		value = arrow_append_string(w, 2);
+		snprintf(id, sizeof(id), "id-%03d", i);
+		sink_write_string(value, id);
+
+		arrow_writer_end_row(w);
+	}
+
+	CuAssertTrue(tc, arrow_writer_finish(w));
+
+	// Two row groups
+	CuAssertIntEquals(tc, 2, w->block_count);
+	CuAssertIntEquals(tc, 100, w->total_rows);
+
+	CuAssertTrue(tc, memcmp(out->str, "PAR1", 4) == 0);
+	CuAssertTrue(tc, memcmp(out->str + out->currentStringLength - 4, "PAR1", 4) == 0);
+
+	size_t footer = read_le(out->str + out->currentStringLength - 8, 4);
+	CuAssertTrue(tc, footer + 12 < out->currentStringLength);
+
+	// Repeated values are stored once per row group in the dictionary,
+	// plus min or max statistics for the page and column chunk
+	CuAssertIntEquals(tc, 2 * 3, count_occurrences(out, "Springfield"));
+	CuAssertIntEquals(tc, 2 * 3, count_occurrences(out, "Shelbyville"));
+
+	// Unique values are plain encoded
+	CuAssertIntEquals(tc, 1, count_occurrences(out, "id-050"));
+	CuAssertIntEquals(tc, 3, count_occurrences(out, "id-064"));
+
+	arrow_writer_free(w);
+	d_string_free(out, true);
+}
+#endif
@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "context.h"
 #include "parser.h"
 #include "reader.h"
 #include "simple_token.h"
@@ -101,10 +102,10 @@ typedef union {
 #ifndef YYSTACKDEPTH
 	#define YYSTACKDEPTH 100
 #endif
-#define TDPParseARG_SDECL  simple_token ** result ;
-#define TDPParseARG_PDECL , simple_token ** result
-#define TDPParseARG_FETCH  simple_token ** result  = yypParser->result
-#define TDPParseARG_STORE yypParser->result  = result
+#define TDPParseARG_SDECL  tdp_context * context ;
+#define TDPParseARG_PDECL , tdp_context * context
+#define TDPParseARG_FETCH  tdp_context * context  = yypParser->context
+#define TDPParseARG_STORE yypParser->context  = context
 #define YYFALLBACK 1
 #define YYNSTATE             9
 #define YYNRULE              25
@@ -880,18 +881,20 @@ static void yy_reduce(
 			YYMINORTYPE yylhsminor;
 
 		case 0: { /* doc ::= header records */
-			*result = yymsp[-1].minor.yy0;
+			context->root = yymsp[-1].minor.yy0;
 			simple_token_chain_append(yymsp[-1].minor.yy0, yymsp[0].minor.yy0);
 		}
 		break;
 
 		case 1: { /* doc ::= records */
-			*result = yymsp[0].minor.yy0;
+			context->root = yymsp[0].minor.yy0;
 		}
 		break;
 
 		case 2: { /* header ::= record */
-			yymsp[0].minor.yy0->type = TDP_HEADER;
+			if (yymsp[0].minor.yy0) {
+				yymsp[0].minor.yy0->type = TDP_HEADER;
+			}
 		}
 		break;
 
@@ -910,18 +913,18 @@ static void yy_reduce(
 			break;
 
 		case 4: { /* record ::= fields eol */
-			yylhsminor.yy0 = simple_token_new_parent(yymsp[-1].minor.yy0, TDP_RECORD);
-			simple_token_free(yymsp[0].minor.yy0);
+			yylhsminor.yy0 = simple_token_new_parent(context->pool, yymsp[-1].minor.yy0, TDP_RECORD);
+			simple_token_free(context->pool, yymsp[0].minor.yy0);
 		}
 
 		yymsp[-1].minor.yy0 = yylhsminor.yy0;
 		break;
 
 		case 6: { /* field ::= contents FIELD_DELIMITER */
-			yylhsminor.yy0 = simple_token_new_parent(yymsp[-1].minor.yy0, TDP_FIELD);
-			simple_token_free(yymsp[0].minor.yy0);
+			yylhsminor.yy0 = simple_token_new_parent(context->pool, yymsp[-1].minor.yy0, TDP_FIELD);
+			simple_token_free(context->pool, yymsp[0].minor.yy0);
 
-			if (yymsp[-1].minor.yy0->type == TEXT_NUMERIC && yymsp[-1].minor.yy0->next == NULL) {
+			if (yylhsminor.yy0 && yymsp[-1].minor.yy0->type == TEXT_NUMERIC && yymsp[-1].minor.yy0->next == NULL) {
 				yylhsminor.yy0->type = TDP_FIELD_NUMERIC;
 			}
 		}
@@ -930,9 +933,9 @@ static void yy_reduce(
 		break;
 
 		case 7: { /* field ::= contents */
-			yylhsminor.yy0 = simple_token_new_parent(yymsp[0].minor.yy0, TDP_FIELD);
+			yylhsminor.yy0 = simple_token_new_parent(context->pool, yymsp[0].minor.yy0, TDP_FIELD);
 
-			if (yymsp[0].minor.yy0->type == TEXT_NUMERIC && yymsp[0].minor.yy0->next == NULL) {
+			if (yylhsminor.yy0 && yymsp[0].minor.yy0->type == TEXT_NUMERIC && yymsp[0].minor.yy0->next == NULL) {
 				yylhsminor.yy0->type = TDP_FIELD_NUMERIC;
 			}
 		}
@@ -947,8 +950,8 @@ static void yy_reduce(
 
 		case 10: { /* content ::= ESCAPE escaped_contents ESCAPE */
 			yylhsminor.yy0 = yymsp[-1].minor.yy0;
-			simple_token_free(yymsp[-2].minor.yy0);
-			simple_token_free(yymsp[0].minor.yy0);
+			simple_token_free(context->pool, yymsp[-2].minor.yy0);
+			simple_token_free(context->pool, yymsp[0].minor.yy0);
 		}
 
 		yymsp[-2].minor.yy0 = yylhsminor.yy0;
@@ -1280,3 +1283,35 @@ void TDPParse(
 #endif
 	return;
 }
+
+/// Size of the parser state, so that callers can provide their own storage
+size_t TDPParseSize(void) {
+	return sizeof(yyParser);
+}
+
+
+/// Initialize parser state in storage provided by the caller (requires
+/// the default fixed size parser stack)
+void TDPParseInit(void * p) {
+	yyParser * pParser = (yyParser *)p;
+
+#ifdef YYTRACKMAXSTACKDEPTH
+	pParser->yyhwm = 0;
+#endif
+#ifndef YYNOERRORRECOVERY
+	pParser->yyerrcnt = -1;
+#endif
+	pParser->yytos = pParser->yystack;
+	pParser->yystack[0].stateno = 0;
+	pParser->yystack[0].major = 0;
+}
+
+
+/// Clear parser stack without freeing the storage for the parser
+void TDPParseFinalize(void * p) {
+	yyParser * pParser = (yyParser *)p;
+
+	while (pParser->yytos > pParser->yystack) {
+		yy_pop_parser_stack(pParser);
+	}
+}
@@ -60,30 +60,30 @@
 
 %token_type { simple_token * }
 
-%extra_argument { simple_token ** result }
+%extra_argument { tdp_context * context }
 
 %name TDPParse
 
 %fallback TEXT_PLAIN NEEDS_ESCAPE.
 
-doc					::= header(B) records(C).							{ *result = B; simple_token_chain_append(B,C); }		// Successful parse with header
-doc 				::= records(B).										{ *result = B; }										// Successful parse
+doc					::= header(B) records(C).							{ context->root = B; simple_token_chain_append(B,C); }		// Successful parse with header
+doc 				::= records(B).										{ context->root = B; }								// Successful parse
 
 eol					::= RECORD_DELIMITER.
 eol					::= TDP_EOF.
 
-header				::= record(B).										{ B->type = TDP_HEADER; }
+header				::= record(B).										{ if (B) { B->type = TDP_HEADER; } }
 
 records				::= records(B) record(C).							{ simple_token_chain_append(B, C); }
 records				::= record.
 
-record(A)			::= fields(B) eol(C).								{ A = simple_token_new_parent(B, TDP_RECORD); simple_token_free(C); }
+record(A)			::= fields(B) eol(C).								{ A = simple_token_new_parent(context->pool, B, TDP_RECORD); simple_token_free(context->pool, C); }
 
 fields				::= fields(B) field(C).								{ simple_token_chain_append(B, C); }
 fields				::= field.
 
-field(A)			::= contents(B) FIELD_DELIMITER(C).					{ A = simple_token_new_parent(B, TDP_FIELD); simple_token_free(C); if (B->type == TEXT_NUMERIC && B->next == NULL) { A->type = TDP_FIELD_NUMERIC; } }
-field(A)			::= contents(B).									{ A = simple_token_new_parent(B, TDP_FIELD); if (B->type == TEXT_NUMERIC && B->next == NULL) { A->type = TDP_FIELD_NUMERIC; } }
+field(A)			::= contents(B) FIELD_DELIMITER(C).					{ A = simple_token_new_parent(context->pool, B, TDP_FIELD); simple_token_free(context->pool, C); if (A && B->type == TEXT_NUMERIC && B->next == NULL) { A->type = TDP_FIELD_NUMERIC; } }
+field(A)			::= contents(B).									{ A = simple_token_new_parent(context->pool, B, TDP_FIELD); if (A && B->type == TEXT_NUMERIC && B->next == NULL) { A->type = TDP_FIELD_NUMERIC; } }
 
 contents			::= contents(B) content(C).							{ simple_token_chain_append(B, C); }
 contents			::= content.
@@ -91,7 +91,7 @@ contents			::= ESCAPED_ESCAPE(B).								{ B->type = TDP_EMPTY_STRING; }							/
 
 content				::= TEXT_PLAIN.
 content				::= TEXT_NUMERIC.
-content(A)			::= ESCAPE(B) escaped_contents(C) ESCAPE(D).		{ A = C; simple_token_free(B); simple_token_free(D); }
+content(A)			::= ESCAPE(B) escaped_contents(C) ESCAPE(D).		{ A = C; simple_token_free(context->pool, B); simple_token_free(context->pool, D); }
 
 escaped_contents	::= escaped_contents(B) escaped_content(C).			{ simple_token_chain_append(B, C); }
 escaped_contents	::= escaped_content.
@@ -114,6 +114,7 @@ escaped_content		::= ESCAPED_ESCAPE.
 	#include <stdio.h>
 	#include <stdlib.h>
 
+	#include "context.h"
 	#include "parser.h"
 	#include "reader.h"
 	#include "simple_token.h"
@@ -146,3 +147,41 @@ escaped_content		::= ESCAPED_ESCAPE.
 %parse_failure {
 	fprintf(stderr, "Parser failed to successfully parse.\n");
 }
+
+
+// Allow the parser to be stored in memory provided by the caller (e.g. using
+// a custom allocator)
+
+%code {
+	/// Size of the parser state, so that callers can provide their own storage
+	size_t TDPParseSize(void) {
+		return sizeof(yyParser);
+	}
+
+
+	/// Initialize parser state in storage provided by the caller (requires
+	/// the default fixed size parser stack)
+	void TDPParseInit(void * p) {
+		yyParser * pParser = (yyParser *)p;
+
+	#ifdef YYTRACKMAXSTACKDEPTH
+		pParser->yyhwm = 0;
+	#endif
+	#ifndef YYNOERRORRECOVERY
+		pParser->yyerrcnt = -1;
+	#endif
+		pParser->yytos = pParser->yystack;
+		pParser->yystack[0].stateno = 0;
+		pParser->yystack[0].major = 0;
+	}
+
+
+	/// Clear parser stack without freeing the storage for the parser
+	void TDPParseFinalize(void * p) {
+		yyParser * pParser = (yyParser *)p;
+
+		while (pParser->yytos > pParser->yystack) {
+			yy_pop_parser_stack(pParser);
+		}
+	}
+}
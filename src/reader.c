@@ -53,23 +53,40 @@
 */
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#ifdef HAVE_SQLITE3
+	#include <sqlite3.h>
+#endif
+
+#include "allocator.h"
+#include "arrow.h"
+#include "binary.h"
+#include "compress.h"
+#include "context.h"
 #include "d_string.h"
+#include "escape.h"
 #include "lexer.h"
 #include "libTDP.h"
+#include "mustache.h"
+#include "number.h"
 #include "parser.h"
 #include "reader.h"
+#include "record_index.h"
+#include "rope.h"
 #include "simple_token.h"
+#include "sink.h"
+#include "spill.h"
 #include "stack.h"
 
 
-#define print(x) d_string_append(out, x)
-#define print_const(x) d_string_append_c_array(out, x, sizeof(x) - 1)
-#define print_char(x) d_string_append_c(out, x)
-#define printf(...) d_string_append_printf(out, __VA_ARGS__)
-#define print_token(t) d_string_append_c_array(out, &(source[t->start]), t->len)
+#define print(x) sink_write_string(out, x)
+#define print_const(x) sink_write(out, x, sizeof(x) - 1)
+#define print_char(x) sink_write_c(out, x)
+#define print_token(t) sink_write_ref(out, &(source[t->start]), t->len)
 
 
 #ifdef TEST
@@ -77,14 +94,15 @@
 #endif
 
 
+#define kHeaderBufferSize 256			//!< Size of temporary buffer for rendering header strings
+
+
 // Basic parser function declarations
-void * TDPParseAlloc();
 void TDPParse();
-void TDPParseFree();
 void TDPParseTrace();
 
 
-simple_token * tokenize_text(const char * source, size_t start, size_t len, int format) {
+simple_token * tokenize_text(tdp_context * context, const char * source, size_t start, size_t len, int format) {
 
 	// Create re2c scanner
 	Scanner s;
@@ -93,7 +111,7 @@ simple_token * tokenize_text(const char * source, size_t start, size_t len, int
 
 	int type;						// TOKEN type
 	simple_token * t = NULL;		// Create token chain
-	simple_token * root = simple_token_new(0, start, len);
+	simple_token * root = simple_token_new(context->pool, 0, start, len);
 
 	// Where do we stop parsing?
 	const char * stop = s.start + len;
@@ -123,20 +141,20 @@ simple_token * tokenize_text(const char * source, size_t start, size_t len, int
 			// We skipped characters between tokens
 
 			if (type) {
-				t = simple_token_new(TEXT_PLAIN, (size_t)(last_stop - source), (size_t)(s.start - last_stop));
+				t = simple_token_new(context->pool, TEXT_PLAIN, (size_t)(last_stop - source), (size_t)(s.start - last_stop));
 				simple_token_chain_append(root, t);
 			} else {
 				if (stop > last_stop) {
 					// Source text ended without final token
 
-					t = simple_token_new(TEXT_PLAIN, (size_t)(last_stop - source), (size_t)(stop - last_stop));
+					t = simple_token_new(context->pool, TEXT_PLAIN, (size_t)(last_stop - source), (size_t)(stop - last_stop));
 					simple_token_chain_append(root, t);
 				}
 			}
 		} else if (type == 0 && stop > last_stop) {
 			// Source text ended without final token
 
-			t = simple_token_new(TEXT_PLAIN, (size_t)(last_stop - source), (size_t)(stop - last_stop));
+			t = simple_token_new(context->pool, TEXT_PLAIN, (size_t)(last_stop - source), (size_t)(stop - last_stop));
 			simple_token_chain_append(root, t);
 		}
 
@@ -145,14 +163,14 @@ simple_token * tokenize_text(const char * source, size_t start, size_t len, int
 
 				// Source finished
 				if (t && t->tail && (t->tail->type != TDP_EOF)) {
-					t = simple_token_new(TDP_EOF, (size_t)(s.start - source), (size_t)(s.cur - s.start));
+					t = simple_token_new(context->pool, TDP_EOF, (size_t)(s.start - source), (size_t)(s.cur - s.start));
 					simple_token_chain_append(root, t);
 				}
 
 				break;
 
 			default:
-				t = simple_token_new(type, (size_t)(s.start - source), (size_t)(s.cur - s.start));
+				t = simple_token_new(context->pool, type, (size_t)(s.start - source), (size_t)(s.cur - s.start));
 				simple_token_chain_append(root, t);
 				break;
 		}
@@ -165,14 +183,13 @@ simple_token * tokenize_text(const char * source, size_t start, size_t len, int
 }
 
 
-int parse_tdp_token_chain(simple_token * chain) {
+int parse_tdp_token_chain(tdp_context * context, simple_token * chain) {
 
-	// Parser
-	void * pParser = TDPParseAlloc (malloc);
+	// Parser is reused from context
 	simple_token * walker = chain->next;
 	simple_token * remainder;
 
-	simple_token * result = NULL;
+	context->root = NULL;
 
 #ifndef NDEBUG
 	fprintf(stderr, "\n");
@@ -190,20 +207,18 @@ int parse_tdp_token_chain(simple_token * chain) {
 			remainder->prev = NULL;
 		}
 
-		TDPParse(pParser, walker->type, walker, &result);
+		TDPParse(context->parser, walker->type, walker, context);
 
 		walker = remainder;
 	}
 
 	// Signal that we're done
-	TDPParse(pParser, 0, NULL, &result);
+	TDPParse(context->parser, 0, NULL, context);
 
-	TDPParseFree(pParser, free);
-
-	if (result) {
+	if (context->root) {
 		// Success
 		chain->next = NULL;
-		chain->child = result;
+		chain->child = context->root;
 		return 0;
 	} else {
 		// Failed
@@ -214,443 +229,3286 @@ int parse_tdp_token_chain(simple_token * chain) {
 
 #ifdef TEST
 void Test_parse_csv_token_chain(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
 	DString * test = d_string_new("foo,bar\none,two");
 	simple_token * t;
 	int result;
 
 	// Valid CSV
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
 	CuAssertIntEquals(tc, 0, result);
-	simple_token_tree_free(t);
+	simple_token_tree_free(c->pool, t);
 
 	// Valid CSV
 	d_string_erase(test, 0, -1);
 	d_string_append(test, "foo,\"foo,bar\"");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
 	CuAssertIntEquals(tc, 0, result);
-	simple_token_tree_free(t);
+	simple_token_tree_free(c->pool, t);
 
 	// Not Valid CSV
 	d_string_erase(test, 0, -1);
 	d_string_append(test, "foo,\"");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
 	CuAssertIntEquals(tc, -1, result);
-	simple_token_tree_free(t);
+	simple_token_tree_free(c->pool, t);
 
 	// Tests from https://github.com/maxogden/csv-spectrum
 
 	// comma_in_quotes.csv
 	d_string_erase(test, 0, -1);
 	d_string_append(test, "first,last,address,city,zip\nJohn,Doe,120 any st.,\"Anytown, WW\",08123");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
 	CuAssertIntEquals(tc, 0, result);
-	simple_token_tree_free(t);
+	simple_token_tree_free(c->pool, t);
 
 	// empty.csv
 	d_string_erase(test, 0, -1);
 	d_string_append(test, "a,b,c\n1,\"\",\"\"\n2,3,4");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
 	CuAssertIntEquals(tc, 0, result);
-	simple_token_tree_free(t);
+	simple_token_tree_free(c->pool, t);
 
 	// escaped_quotes.csv
 	d_string_erase(test, 0, -1);
 	d_string_append(test, "a,b\n1,\"ha \"\"ha\"\" ha\"\n3,4");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
 	CuAssertIntEquals(tc, 0, result);
-	simple_token_tree_free(t);
+	simple_token_tree_free(c->pool, t);
 
 	// json.csv
 	d_string_erase(test, 0, -1);
 	d_string_append(test, "key,val\n1,\"{\"\"type\"\": \"\"Point\"\", \"\"coordinates\"\": [102.0, 0.5]}\"");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
 	CuAssertIntEquals(tc, 0, result);
-	simple_token_tree_free(t);
+	simple_token_tree_free(c->pool, t);
 
 	// newlines_crlf.csv
 	d_string_erase(test, 0, -1);
 	d_string_append(test, "ka,b,c\r\n1,2,3\r\n\"Once upon \r\na time\",5,6\r\n7,8,9\r\n");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
 	CuAssertIntEquals(tc, 0, result);
-	simple_token_tree_free(t);
+	simple_token_tree_free(c->pool, t);
 
 	// quotes_and_newlines.csv
 	d_string_erase(test, 0, -1);
 	d_string_append(test, "a,b\n1,\"ha \n\"\"ha\"\" \nha\"\n3,4");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
 	CuAssertIntEquals(tc, 0, result);
-	simple_token_tree_free(t);
+	simple_token_tree_free(c->pool, t);
 
 	// utf8.csv
 	d_string_erase(test, 0, -1);
 	d_string_append(test, "a,b,c\n1,2,3\n4,5,ʤ");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
 	CuAssertIntEquals(tc, 0, result);
-	simple_token_tree_free(t);
+	simple_token_tree_free(c->pool, t);
+
+	d_string_free(test, true);
+	tdp_context_free(c);
 }
 #endif
 
 
-void indent(DString * out, int lev) {
-	for (int i = 0; i < lev; ++i) {
-		print_const("\t");
+/// Is this token copied from the source text (with escaping as needed)?
+#define is_raw_text(type) (((type) == TEXT_PLAIN) || ((type) == TEXT_NUMERIC) || ((type) == FIELD_DELIMITER) || ((type) == NEEDS_ESCAPE))
+
+
+/// Export a text token (part of a field value or header name)
+static void export_text_to_json(sink * out, simple_token * t, const char * source, bool ascii_only) {
+	switch (t->type) {
+		case TEXT_PLAIN:
+		case TEXT_NUMERIC:
+		case FIELD_DELIMITER:
+		case NEEDS_ESCAPE:
+			json_escape(out, &source[t->start], t->len, ascii_only);
+			break;
+
+		case RECORD_DELIMITER:
+			switch (source[t->start]) {
+				case '\n':
+				case '\r':
+					print_const("\\n");
+					break;
+			}
+
+			break;
+
+		case TDP_EMPTY_STRING:
+			break;
+
+		case ESCAPED_ESCAPE:
+			// TODO: Customize
+			print_const("\\\"");
+			break;
 	}
 }
 
 
-void export_token_tree_to_json(DString * out, simple_token * t, const char * source, int lev, stack * s, bool array_out);
+/// Export a chain of text tokens.  Adjacent raw tokens are escaped as a
+/// single slice of the source text.
+static void export_text_tree_to_json(sink * out, simple_token * t, const char * source, bool ascii_only) {
+	size_t start;
+	size_t stop;
+
+	while (t) {
+		if (is_raw_text(t->type)) {
+			start = t->start;
+			stop = t->start + t->len;
+
+			while (t->next && is_raw_text(t->next->type) && (t->next->start == stop)) {
+				t = t->next;
+				stop += t->len;
+			}
+
+			json_escape(out, &source[start], stop - start, ascii_only);
+		} else {
+			export_text_to_json(out, t, source, ascii_only);
+		}
+
+		t = t->next;
+	}
+}
 
 
-void export_token_to_json(DString * out, simple_token * t, const char * source, int lev, stack * s, bool array_out) {
-	DString * header;
-	int count = 0;
-	char * text;
-	simple_token * c;
+/// Length of a chain of text tokens once unescaped
+static size_t text_tree_length(simple_token * t) {
+	size_t len = 0;
 
-	if (t) {
+	for (; t; t = t->next) {
 		switch (t->type) {
-			case 0:
-				print_const("[\n");
-				export_token_tree_to_json(out, t->child, source, lev + 1, s, array_out);
-				print_const("]\n");
+			case RECORD_DELIMITER:
+			case ESCAPED_ESCAPE:
+				len++;
 				break;
 
-			case TDP_HEADER:
-				c = t->child;
-
-				while (c) {
-					header = d_string_new("");
-					export_token_tree_to_json(header, c->child, source, 0, s, array_out);
-					stack_push(s, header->str);
-					d_string_free(header, false);
-					c = c->next;
-				}
+			case TDP_EMPTY_STRING:
+				break;
 
-				if (!array_out) {
-					break;
-				}
+			default:
+				len += t->len;
+				break;
+		}
+	}
 
-			case TDP_RECORD:
-				indent(out, lev);
+	return len;
+}
 
-				if (array_out) {
-					print_const("[\n");
-				} else {
-					print_const("{\n");
-				}
 
-				c = t->child;
+/// Export a chain of text tokens without escaping (for binary formats)
+static void export_text_tree_raw(sink * out, simple_token * t, const char * source) {
+	for (; t; t = t->next) {
+		switch (t->type) {
+			case RECORD_DELIMITER:
+				// Line endings are normalized, as for JSON
+				print_char('\n');
+				break;
 
-				while (c) {
-					indent(out, lev + 1);
+			case ESCAPED_ESCAPE:
+				print_char('"');
+				break;
 
-					if (!array_out) {
-						print_const("\"");
-						text = stack_peek_index(s, count);
-						print(text);
-						print_const("\": ");
-					}
+			case TDP_EMPTY_STRING:
+				break;
 
-					export_token_to_json(out, c, source, lev, s, array_out);
+			default:
+				print_token(t);
+				break;
+		}
+	}
+}
 
-					count++;
-					c = c->next;
-				}
 
-				indent(out, lev);
+/// Export a chain of text tokens as a binary string
+static void export_text_tree_to_binary(sink * out, simple_token * t, const char * source, short format) {
+	binary_write_string_header(out, format, text_tree_length(t));
+	export_text_tree_raw(out, t, source);
+}
 
-				if (array_out) {
-					print_const("]");
-				} else {
-					print_const("}");
-				}
 
-				if (t->next && t->next->type == TDP_RECORD) {
-					print_const(",\n");
-				} else {
-					print_const("\n");
-				}
+/// Header name compiled into the exact bytes that precede a field value,
+/// e.g. `\t\t"name": ` (pretty), `,"name":` (compact), or an encoded
+/// string (binary formats)
+struct column_key {
+	size_t			len;				//!< Length of prefix
+	char			prefix[];			//!< Null-terminated prefix
+};
 
-				break;
+typedef struct column_key column_key;
 
-			case TDP_FIELD_NUMERIC:
-				export_token_tree_to_json(out, t->child, source, lev, s, array_out);
 
-				if (t->next && (t->next->type == TDP_FIELD || t->next->type == TDP_FIELD_NUMERIC)) {
-					print_const(",\n");
-				} else {
-					print_const("\n");
-				}
+/// How header keys are rendered
+enum key_styles {
+	KEY_PRETTY,							//!< Indented JSON
+	KEY_COMPACT,						//!< Compact JSON, with leading comma
+	KEY_BINARY							//!< String in context's binary output format
+};
 
-				break;
 
-			case TDP_FIELD:
-				print_const("\"");
-				export_token_tree_to_json(out, t->child, source, lev, s, array_out);
-				print_const("\"");
+/// Render key prefix for header field `c`
+static void render_key(sink * out, simple_token * c, const char * source, int lev, short style, tdp_context * context) {
+	switch (style) {
+		case KEY_COMPACT:
+			print_const(",\"");
+			export_text_tree_to_json(out, c->child, source, context->ascii_only);
+			print_const("\":");
+			break;
 
-				if (t->next && (t->next->type == TDP_FIELD || t->next->type == TDP_FIELD_NUMERIC)) {
-					print_const(",\n");
-				} else {
-					print_const("\n");
-				}
+		case KEY_BINARY:
+			export_text_tree_to_binary(out, c->child, source, context->output_format);
+			break;
 
-				break;
+		default:
+			for (int i = 0; i < lev; ++i) {
+				print_char('\t');
+			}
 
-			case TEXT_PLAIN:
-			case TEXT_NUMERIC:
-			case FIELD_DELIMITER:
-				print_token(t);
-				break;
+			print_char('"');
+			export_text_tree_to_json(out, c->child, source, context->ascii_only);
+			print_const("\": ");
+			break;
+	}
+}
 
-			case RECORD_DELIMITER:
-				switch (source[t->start]) {
-					case '\n':
-					case '\r':
-						print_const("\\n");
-						break;
-				}
 
-				break;
+/// Compile header names into key prefixes, and store them on the stack `s`
+static void export_headers(simple_token * t, const char * source, tdp_context * context, int lev, short style) {
+	sink header;
+	char buffer[kHeaderBufferSize];
+	column_key * key;
 
-			case NEEDS_ESCAPE:
-				switch (source[t->start]) {
-					case '\b':
-						print_const("\\b");
-						break;
+	for (simple_token * c = t->child; c; c = c->next) {
+		// Render key into a temporary buffer, then keep a copy
+		// that is exactly the right size
+		sink_init_buffer(&header, buffer, kHeaderBufferSize);
+		render_key(&header, c, source, lev, style, context);
 
-					case '\f':
-						print_const("\\f");
-						break;
+		key = tdp_malloc(context->allocator, sizeof(column_key) + header.total + 1);
 
-					case '\n':
-						print_const("\\n");
-						break;
+		if (key) {
+			key->len = header.total;
 
-					case '\r':
-						print_const("\\r");
-						break;
+			if (header.total < kHeaderBufferSize) {
+				memcpy(key->prefix, buffer, header.total);
+			} else {
+				// Too long for temporary buffer
+				sink_init_buffer(&header, key->prefix, header.total + 1);
+				render_key(&header, c, source, lev, style, context);
+			}
 
-					case '\t':
-						print_const("\\t");
-						break;
+			key->prefix[header.total] = '\0';
+		}
 
-					case '\"':
-						print_const("\\\"");
-						break;
+		if (key == NULL || !stack_push(context->header, key)) {
+			// Output would be missing keys
+			tdp_free(context->allocator, key);
+			context->failed = true;
+		}
+	}
+}
 
-					case '\\':
-						print_const("\\\\");
-						break;
 
-				}
+/// Determine the type of a single field value
+static short field_value_type(simple_token * field, const char * source) {
+	if (field->type == TDP_FIELD_NUMERIC) {
+		return classify_number(&source[field->child->start], field->child->len);
+	}
 
-				break;
+	if (field->child && (field->child->type == TDP_EMPTY_STRING) && (field->child->next == NULL)) {
+		return TDP_TYPE_NULL;
+	}
 
-			case TDP_EMPTY_STRING:
-				break;
+	return TDP_TYPE_STRING;
+}
 
-			case ESCAPED_ESCAPE:
-				// TODO: Customize
-				print_const("\\\"");
-				break;
 
-			default:
-				fprintf(stderr, "Error parsing token type %d\n", t->type);
+/// Combine the type of a column so far with the type of another value
+static short merge_column_type(short column, short value) {
+	if ((column == value) || (value == TDP_TYPE_NULL)) {
+		return column;
+	}
+
+	if (column == TDP_TYPE_NULL) {
+		return value;
+	}
+
+	if ((column == TDP_TYPE_INT || column == TDP_TYPE_FLOAT) && (value == TDP_TYPE_INT || value == TDP_TYPE_FLOAT)) {
+		return TDP_TYPE_FLOAT;
+	}
+
+	return TDP_TYPE_STRING;
+}
+
+
+/// Match header names to schema plans.  Returns number of columns with
+/// a plan.
+static size_t compile_column_plan(tdp_context * context, simple_token * root, const char * source) {
+	char buffer[kHeaderBufferSize];
+	size_t planned = 0;
+	size_t index = 0;
+	sink name;
+
+	for (simple_token * t = root->child; t; t = t->next) {
+		if (t->type != TDP_HEADER) {
+			continue;
+		}
+
+		for (simple_token * c = t->child; c; c = c->next) {
+			if (!tdp_context_add_column(context)) {
 				break;
+			}
+
+			sink_init_buffer(&name, buffer, kHeaderBufferSize);
+			export_text_tree_to_json(&name, c->child, source, false);
+
+			// Names too long for buffer are not matched
+			if (name.total <= kHeaderBufferSize) {
+				context->column_plan[index] = tdp_schema_lookup(context->schema, buffer, name.total);
+
+				if (context->column_plan[index]) {
+					planned++;
+				}
+			}
+
+			index++;
 		}
+
+		break;
 	}
+
+	return planned;
 }
 
 
-void export_token_tree_to_json(DString * out, simple_token * t, const char * source, int lev, stack * s, bool array_out) {
-	while (t) {
-		export_token_to_json(out, t, source, lev, s, array_out);
+/// Prepare per-column conversion: columns named in the schema use its plan,
+/// and the type of other columns is inferred from the first
+/// `context->type_sample` records (the header row is not included)
+static void prepare_columns(tdp_context * context, simple_token * root, const char * source) {
+	size_t records = 0;
+	size_t index;
 
-		t = t->next;
+	context->column_count = 0;
+
+	if (context->schema && (compile_column_plan(context, root, source) == context->column_count) && context->column_count) {
+		// Every column has a plan -- nothing to infer
+		return;
 	}
-}
 
+	if (context->type_sample == 0) {
+		// Each value is typed separately
+		return;
+	}
 
-DString * export_to_json(const char * source, simple_token * tree, bool array_out) {
-	DString * out = d_string_new("");
-	stack * s = stack_new(5);
+	for (simple_token * t = root->child; t && (records < context->type_sample); t = t->next) {
+		if (t->type != TDP_RECORD) {
+			continue;
+		}
 
-	export_token_tree_to_json(out, tree, source, 0, s, array_out);
+		index = 0;
 
-	return out;
+		for (simple_token * c = t->child; c; c = c->next) {
+			if (index == context->column_count) {
+				if (!tdp_context_add_column(context)) {
+					// Remaining columns are typed per value
+					break;
+				}
+			}
+
+			if (!context->column_plan[index]) {
+				context->column_types[index] = merge_column_type(context->column_types[index], field_value_type(c, source));
+			}
+
+			index++;
+		}
+
+		records++;
+	}
 }
 
 
-#ifdef TEST
-void Test_export_to_json(CuTest * tc) {
-	DString * test = d_string_new("foo,bar\none,two");
-	DString * out;
-	simple_token * t;
-	int result;
+/// Is field an empty string?
+#define field_is_empty(field) ((field)->child && ((field)->child->type == TDP_EMPTY_STRING) && ((field)->child->next == NULL))
 
-	// Valid CSV
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
-	out = export_to_json(test->str, t, false);
-	simple_token_tree_free(t);
-	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"foo\": \"one\",\n\t\t\"bar\": \"two\"\n\t}\n]\n", out->str);
-	d_string_free(out, true);
 
-	// Valid CSV
-	d_string_erase(test, 0, -1);
-	d_string_append(test, "a\n1");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
-	out = export_to_json(test->str, t, false);
-	simple_token_tree_free(t);
-	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": 1\n\t}\n]\n", out->str);
-	d_string_free(out, true);
+/// How a field value is written
+enum value_kinds {
+	VALUE_NULL,							//!< null
+	VALUE_EMPTY,						//!< Empty string
+	VALUE_STRING,						//!< String
+	VALUE_INT,							//!< Integer
+	VALUE_FLOAT,						//!< Float
+	VALUE_BOOL,							//!< true or false
+	VALUE_DEFAULT						//!< Default from schema plan
+};
 
-	// Boolean
-	d_string_erase(test, 0, -1);
-	d_string_append(test, "one,two\ntrue,false");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
-	out = export_to_json(test->str, t, false);
-	simple_token_tree_free(t);
-	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"one\": true,\n\t\t\"two\": false\n\t}\n]\n", out->str);
-	d_string_free(out, true);
 
-	// Boolean to array of arrays
-	d_string_erase(test, 0, -1);
-	d_string_append(test, "one,two\ntrue,false");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
-	out = export_to_json(test->str, t, true);
-	simple_token_tree_free(t);
-	CuAssertStrEquals(tc, "[\n\t[\n\t\t\"one\",\n\t\t\"two\"\n\t],\n\t[\n\t\ttrue,\n\t\tfalse\n\t]\n]\n", out->str);
-	d_string_free(out, true);
+/// Column index used when exporting the header row as a record
+#define kHeaderRow ((size_t) -1)
 
-	// Tests from https://github.com/maxogden/csv-spectrum
-	// JSON cross-validated with results from https://www.csvjson.com/csv2json
 
-	// comma_in_quotes.csv
-	d_string_erase(test, 0, -1);
-	d_string_append(test, "first,last,address,city,zip\nJohn,Doe,120 any st.,\"Anytown, WW\",08123");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
-	out = export_to_json(test->str, t, false);
-	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"first\": \"John\",\n\t\t\"last\": \"Doe\",\n\t\t\"address\": \"120 any st.\",\n\t\t\"city\": \"Anytown, WW\",\n\t\t\"zip\": 08123\n\t}\n]\n", out->str);
-	simple_token_tree_free(t);
-	d_string_free(out, true);
+/// Decide how to write a field value using its column type.  A value is
+/// only written as a number or boolean if it is valid and matches its
+/// column, so output is always valid.
+static short resolve_value(simple_token * field, const char * source, tdp_context * context, size_t column) {
+	const tdp_schema_column * plan;
+	short value;
 
-	// empty.csv
-	d_string_erase(test, 0, -1);
-	d_string_append(test, "a,b,c\n1,\"\",\"\"\n2,3,4");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	simple_token_tree_describe(t, test->str);
-	result = parse_tdp_token_chain(t);
-	out = export_to_json(test->str, t, false);
-	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": 1,\n\t\t\"b\": \"\",\n\t\t\"c\": \"\"\n\t},\n\t{\n\t\t\"a\": 2,\n\t\t\"b\": 3,\n\t\t\"c\": 4\n\t}\n]\n", out->str);
-	simple_token_tree_free(t);
-	d_string_free(out, true);
+	if (column == kHeaderRow) {
+		// Header names are always strings
+		return VALUE_STRING;
+	}
 
-	// escaped_quotes.csv
-	d_string_erase(test, 0, -1);
-	d_string_append(test, "a,b\n1,\"ha \"\"ha\"\" ha\"\n3,4");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
-	out = export_to_json(test->str, t, false);
-	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": 1,\n\t\t\"b\": \"ha \\\"ha\\\" ha\"\n\t},\n\t{\n\t\t\"a\": 3,\n\t\t\"b\": 4\n\t}\n]\n", out->str);
-	simple_token_tree_free(t);
-	d_string_free(out, true);
+	if (column < context->column_count && (plan = context->column_plan[column])) {
+		if (plan->type == TDP_TYPE_STRING) {
+			if (!field_is_empty(field)) {
+				return VALUE_STRING;
+			}
+		} else if (field->type == TDP_FIELD_NUMERIC) {
+			value = classify_number(&source[field->child->start], field->child->len);
 
-	// json.csv
-	d_string_erase(test, 0, -1);
-	d_string_append(test, "key,val\n1,\"{\"\"type\"\": \"\"Point\"\", \"\"coordinates\"\": [102.0, 0.5]}\"");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
-	out = export_to_json(test->str, t, false);
-	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"key\": 1,\n\t\t\"val\": \"{\\\"type\\\": \\\"Point\\\", \\\"coordinates\\\": [102.0, 0.5]}\"\n\t}\n]\n", out->str);
-	simple_token_tree_free(t);
-	d_string_free(out, true);
+			if (value == plan->type) {
+				return (value == TDP_TYPE_BOOL) ? VALUE_BOOL : (value == TDP_TYPE_INT) ? VALUE_INT : VALUE_FLOAT;
+			}
 
-	// newlines_crlf.csv
-	d_string_erase(test, 0, -1);
-	d_string_append(test, "a,b,c\r\n1,2,3\r\n\"Once upon \r\na time\",5,6\r\n7,8,9\r\n");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
-	out = export_to_json(test->str, t, false);
-	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": 1,\n\t\t\"b\": 2,\n\t\t\"c\": 3\n\t},\n\t{\n\t\t\"a\": \"Once upon \\na time\",\n\t\t\"b\": 5,\n\t\t\"c\": 6\n\t},\n\t{\n\t\t\"a\": 7,\n\t\t\"b\": 8,\n\t\t\"c\": 9\n\t}\n]\n", out->str);
-	simple_token_tree_free(t);
-	d_string_free(out, true);
+			if (plan->type == TDP_TYPE_FLOAT && value == TDP_TYPE_INT) {
+				return VALUE_FLOAT;
+			}
+		}
 
-	// quotes_and_newlines.csv
-	d_string_erase(test, 0, -1);
-	d_string_append(test, "a,b\n1,\"ha \n\"\"ha\"\" \nha\"\n3,4");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
-	out = export_to_json(test->str, t, false);
-	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": 1,\n\t\t\"b\": \"ha \\n\\\"ha\\\" \\nha\"\n\t},\n\t{\n\t\t\"a\": 3,\n\t\t\"b\": 4\n\t}\n]\n", out->str);
-	simple_token_tree_free(t);
-	d_string_free(out, true);
+		// Empty or invalid
+		return VALUE_DEFAULT;
+	}
 
-	// utf8.csv
-	d_string_erase(test, 0, -1);
-	d_string_append(test, "a,b,c\n1,2,3\n4,5,ʤ");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_CSV);
-	result = parse_tdp_token_chain(t);
-	out = export_to_json(test->str, t, false);
-	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": 1,\n\t\t\"b\": 2,\n\t\t\"c\": 3\n\t},\n\t{\n\t\t\"a\": 4,\n\t\t\"b\": 5,\n\t\t\"c\": \"ʤ\"\n\t}\n]\n", out->str);
-	simple_token_tree_free(t);
-	d_string_free(out, true);
+	value = field_value_type(field, source);
+	short type = (context->type_sample && column < context->column_count) ? context->column_types[column] : value;
+
+	switch (value) {
+		case TDP_TYPE_NULL:
+			if ((type == TDP_TYPE_NULL && context->type_sample) || (type != TDP_TYPE_NULL && type != TDP_TYPE_STRING)) {
+				return VALUE_NULL;
+			}
 
+			return VALUE_EMPTY;
 
-	// TSV
-	d_string_erase(test, 0, -1);
-	d_string_append(test, "a\tb\n\"foo\" \"bar\"\t\"foo\nbar\"\tbat");
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_TSV);
-	result = parse_tdp_token_chain(t);
-	out = export_to_json(test->str, t, false);
-	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": \"\\\"foo\\\" \\\"bar\\\"\",\n\t\t\"b\": \"\\\"foo\"\n\t},\n\t{\n\t\t\"a\": \"bar\\\"\",\n\t\t\"b\": \"bat\"\n\t}\n]\n", out->str);
-	simple_token_tree_free(t);
-	d_string_free(out, true);
+		case TDP_TYPE_INT:
+		case TDP_TYPE_FLOAT:
+			if (type == TDP_TYPE_INT || type == TDP_TYPE_FLOAT) {
+				return (type == TDP_TYPE_FLOAT || value == TDP_TYPE_FLOAT) ? VALUE_FLOAT : VALUE_INT;
+			}
 
+			break;
 
-	// Export to array of arrays
-	t = tokenize_text(test->str, 0, test->currentStringLength, FORMAT_TSV);
-	result = parse_tdp_token_chain(t);
-	out = export_to_json(test->str, t, true);
-	CuAssertStrEquals(tc, "[\n\t[\n\t\t\"a\",\n\t\t\"b\"\n\t],\n\t[\n\t\t\"\\\"foo\\\" \\\"bar\\\"\",\n\t\t\"\\\"foo\"\n\t],\n\t[\n\t\t\"bar\\\"\",\n\t\t\"bat\"\n\t]\n]\n", out->str);
-	simple_token_tree_free(t);
-	d_string_free(out, true);
+		case TDP_TYPE_BOOL:
+			if (type == TDP_TYPE_BOOL) {
+				return VALUE_BOOL;
+			}
 
-	d_string_free(test, true);
+			break;
+	}
+
+	return VALUE_STRING;
 }
-#endif
 
 
-/// Convert CSV text to JSON
-DString * csv_to_json(DString * source, bool array_out) {
-	simple_token * t = tokenize_text(source->str, 0, source->currentStringLength, FORMAT_CSV);
-	parse_tdp_token_chain(t);
-	DString * json = export_to_json(source->str, t, array_out);
+/// Export a field value as JSON
+static void export_value(sink * out, simple_token * field, const char * source, tdp_context * context, size_t column) {
+	switch (resolve_value(field, source, context, column)) {
+		case VALUE_NULL:
+			print_const("null");
+			return;
 
-	return json;
+		case VALUE_EMPTY:
+			print_const("\"\"");
+			return;
+
+		case VALUE_INT:
+		case VALUE_FLOAT:
+		case VALUE_BOOL:
+			print_token(field->child);
+			return;
+
+		case VALUE_DEFAULT:
+			sink_write(out, context->column_plan[column]->fallback, context->column_plan[column]->fallback_len);
+			return;
+	}
+
+	print_char('"');
+	export_text_tree_to_json(out, field->child, source, context->ascii_only);
+	print_char('"');
 }
 
 
-/// Convert TSV text to JSON
-DString * tsv_to_json(DString * source, bool array_out) {
-	simple_token * t = tokenize_text(source->str, 0, source->currentStringLength, FORMAT_TSV);
-	parse_tdp_token_chain(t);
-	DString * json = export_to_json(source->str, t, array_out);
+/// Note where a record starts in the output, if the context is writing a
+/// record index.  (Header rows are not indexed.)
+static void index_record(tdp_context * context, sink * out, simple_token * t) {
+	if (context->index && (t->type == TDP_RECORD)) {
+		record_index_add(context->index, out->total, t->start);
+	}
+}
 
-	return json;
+
+/// Export one field as JSON, preceded by its separator and key.  `key` is
+/// NULL for fields beyond the header row.  Pretty keys include their
+/// indentation, and compact keys include a leading comma.
+static inline void emit_field(sink * out, simple_token * c, const char * source, tdp_context * context, size_t column,
+	column_key * key, const bool first, const bool array_out, const bool pretty) {
+	if (pretty) {
+		if (!first) {
+			print_const(",\n");
+		}
+
+		if (array_out) {
+			print_const("\t\t");
+		} else if (key) {
+			// Indentation and key in one copy
+			sink_write(out, key->prefix, key->len);
+		} else {
+			// More fields than headers
+			print_const("\t\t\"\": ");
+		}
+	} else if (array_out) {
+		if (!first) {
+			print_char(',');
+		}
+	} else if (key) {
+		sink_write(out, key->prefix + first, key->len - first);
+	} else {
+		// More fields than headers
+		if (!first) {
+			print_char(',');
+		}
+
+		print_const("\"\":");
+	}
+
+	export_value(out, c, source, context, column);
+}
+
+
+/// Export a record (or header row) as JSON, without a trailing separator.
+/// This is the template for the emitters below -- each passes constants
+/// for `array_out`, `pretty` and `header_row`, and once this is inlined
+/// gets its own copy of the field loop with no layout checks left in it.
+/// That only happens in optimized builds; without optimization, every
+/// emitter calls this one generic body.  Pretty records are indented one
+/// level, inside the enclosing array.
+static inline void emit_record(sink * out, simple_token * t, const char * source, tdp_context * context,
+	const bool array_out, const bool pretty, const bool header_row) {
+	simple_token * c = t->child;
+	column_key ** keys = (column_key **) context->header->element;
+	size_t count = context->header->size;
+	size_t column = 0;
+
+	if (pretty) {
+		if (array_out) {
+			print_const("\t[\n");
+		} else {
+			print_const("\t{\n");
+		}
+	} else {
+		print_char(array_out ? '[' : '{');
+	}
+
+	// The first field has no separator; records always have one
+	emit_field(out, c, source, context, header_row ? kHeaderRow : column, (array_out || !count) ? NULL : keys[0],
+		true, array_out, pretty);
+
+	if (array_out) {
+		while ((c = c->next)) {
+			emit_field(out, c, source, context, header_row ? kHeaderRow : ++column, NULL, false, true, pretty);
+		}
+	} else {
+		// Fields with a key, then any beyond the header row
+		while ((c = c->next) && ++column < count) {
+			emit_field(out, c, source, context, column, keys[column], false, false, pretty);
+		}
+
+		for (; c; c = c->next) {
+			emit_field(out, c, source, context, column++, NULL, false, false, pretty);
+		}
+	}
+
+	if (pretty) {
+		if (array_out) {
+			print_const("\n\t]");
+		} else {
+			print_const("\n\t}");
+		}
+	} else {
+		print_char(array_out ? ']' : '}');
+	}
+}
+
+
+/// Emitter for one record in a particular JSON layout
+typedef void (*record_emitter)(sink * out, simple_token * t, const char * source, tdp_context * context);
+
+
+static void emit_pretty_object(sink * out, simple_token * t, const char * source, tdp_context * context) {
+	emit_record(out, t, source, context, false, true, false);
+}
+
+
+static void emit_pretty_array(sink * out, simple_token * t, const char * source, tdp_context * context) {
+	emit_record(out, t, source, context, true, true, false);
+}
+
+
+static void emit_pretty_header_row(sink * out, simple_token * t, const char * source, tdp_context * context) {
+	emit_record(out, t, source, context, true, true, true);
+}
+
+
+static void emit_compact_object(sink * out, simple_token * t, const char * source, tdp_context * context) {
+	emit_record(out, t, source, context, false, false, false);
+}
+
+
+static void emit_compact_array(sink * out, simple_token * t, const char * source, tdp_context * context) {
+	emit_record(out, t, source, context, true, false, false);
+}
+
+
+static void emit_compact_header_row(sink * out, simple_token * t, const char * source, tdp_context * context) {
+	emit_record(out, t, source, context, true, false, true);
+}
+
+
+/// Choose the emitter for records (or the header row) in a JSON layout
+static record_emitter select_emitter(bool pretty, bool array_out, bool header_row) {
+	if (pretty) {
+		return header_row ? emit_pretty_header_row : (array_out ? emit_pretty_array : emit_pretty_object);
+	}
+
+	return header_row ? emit_compact_header_row : (array_out ? emit_compact_array : emit_compact_object);
+}
+
+
+/// Export a record (or header row) as indented JSON, without a trailing
+/// separator
+static void export_record_to_pretty_json(sink * out, simple_token * t, const char * source, tdp_context * context, bool array_out) {
+	select_emitter(true, array_out, t->type == TDP_HEADER)(out, t, source, context);
+}
+
+
+/// Export a record (or header row) as compact JSON
+static void export_record_to_compact_json(sink * out, simple_token * t, const char * source, tdp_context * context, bool array_out) {
+	select_emitter(false, array_out, t->type == TDP_HEADER)(out, t, source, context);
+}
+
+
+/// Export the header row of a parsed document.  Object output compiles it
+/// into key prefixes in `style`; array output writes it with `emit` as the
+/// first row.  Returns the first record.
+static simple_token * export_header_row(sink * out, simple_token * root, const char * source, tdp_context * context, bool array_out,
+	short style, record_emitter emit) {
+	simple_token * t = root->child;
+
+	if (t && t->type == TDP_HEADER) {
+		if (array_out) {
+			emit(out, t, source, context);
+		} else {
+			export_headers(t, source, context, (style == KEY_PRETTY) ? 2 : 0, style);
+		}
+
+		return t->next;
+	}
+
+	return t;
+}
+
+
+/// Export parsed document as indented JSON
+static void export_tree_to_pretty_json(sink * out, simple_token * root, const char * source, tdp_context * context, bool array_out) {
+	record_emitter emit = select_emitter(true, array_out, false);
+	simple_token * t;
+	bool first;
+
+	print_const("[\n");
+
+	t = export_header_row(out, root, source, context, array_out, KEY_PRETTY, emit_pretty_header_row);
+	// A header row written as an array comes before the first record
+	first = (t == root->child) || !array_out;
+
+	for (; t; t = t->next) {
+		if (!first) {
+			print_const(",\n");
+		}
+
+		index_record(context, out, t);
+		emit(out, t, source, context);
+		first = false;
+	}
+
+	if (!first) {
+		print_char('\n');
+	}
+
+	print_const("]\n");
+
+	// The unparsed remainder of a document that failed to parse
+	for (t = root->next; t; t = t->next) {
+		export_text_to_json(out, t, source, context->ascii_only);
+	}
+}
+
+
+/// Export parsed document as compact JSON, without indentation or newlines
+static void export_tree_to_compact_json(sink * out, simple_token * root, const char * source, tdp_context * context, bool array_out) {
+	record_emitter emit = select_emitter(false, array_out, false);
+	simple_token * t;
+	bool first;
+
+	print_char('[');
+
+	t = export_header_row(out, root, source, context, array_out, KEY_COMPACT, emit_compact_header_row);
+	// A header row written as an array comes before the first record
+	first = (t == root->child) || !array_out;
+
+	for (; t; t = t->next) {
+		if (!first) {
+			print_char(',');
+		}
+
+		index_record(context, out, t);
+		emit(out, t, source, context);
+		first = false;
+	}
+
+	print_const("]\n");
+}
+
+
+/// Export parsed document as JSON Lines (NDJSON) -- one compact record per
+/// line, without an enclosing array
+static void export_tree_to_json_lines(sink * out, simple_token * root, const char * source, tdp_context * context, bool array_out) {
+	record_emitter emit = select_emitter(false, array_out, false);
+	simple_token * t = export_header_row(out, root, source, context, array_out, KEY_COMPACT, emit_compact_header_row);
+
+	if (t != root->child && array_out) {
+		print_char('\n');
+	}
+
+	for (; t; t = t->next) {
+		index_record(context, out, t);
+		emit(out, t, source, context);
+		print_char('\n');
+	}
+}
+
+
+#define kShardRoundRobin ((size_t) -1)	//!< Shard key column for round-robin sharding
+
+
+/// One output file of sharded JSON
+struct json_shard {
+	sink			out;				//!< Writer for this shard
+	size_t			records;			//!< Number of records written to shard
+};
+
+typedef struct json_shard json_shard;
+
+
+/// Find the column whose header name is `name`.  Returns kShardRoundRobin if
+/// there is none.
+static size_t find_shard_key(simple_token * root, const char * source, const char * name, DString * scratch) {
+	size_t column = 0;
+	sink s;
+
+	for (simple_token * t = root->child; t; t = t->next) {
+		if (t->type != TDP_HEADER) {
+			continue;
+		}
+
+		for (simple_token * c = t->child; c; c = c->next) {
+			d_string_erase(scratch, 0, -1);
+			sink_init_string(&s, scratch);
+			export_text_tree_raw(&s, c->child, source);
+
+			if (strcmp(scratch->str, name) == 0) {
+				return column;
+			}
+
+			column++;
+		}
+
+		break;
+	}
+
+	return kShardRoundRobin;
+}
+
+
+/// Hash the text of a field (FNV-1a), so that equal values (however they
+/// were quoted) go to the same shard
+static uint64_t hash_field(simple_token * field, const char * source) {
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (simple_token * t = field ? field->child : NULL; t; t = t->next) {
+		switch (t->type) {
+			case RECORD_DELIMITER:
+				hash = (hash ^ '\n') * 1099511628211ULL;
+				break;
+
+			case ESCAPED_ESCAPE:
+				hash = (hash ^ '"') * 1099511628211ULL;
+				break;
+
+			case TDP_EMPTY_STRING:
+				break;
+
+			default:
+				for (size_t i = t->start; i < t->start + t->len; ++i) {
+					hash = (hash ^ (unsigned char) source[i]) * 1099511628211ULL;
+				}
+
+				break;
+		}
+	}
+
+	return hash;
+}
+
+
+/// Write a record (or header row) to a shard, in the context's JSON style
+static void export_record_to_shard(json_shard * shard, simple_token * t, const char * source, tdp_context * context, bool array_out) {
+	sink * out = &shard->out;
+
+	switch (context->style) {
+		case TDP_JSON_COMPACT:
+			if (shard->records) {
+				print_char(',');
+			}
+
+			export_record_to_compact_json(out, t, source, context, array_out);
+			break;
+
+		case TDP_JSON_LINES:
+			export_record_to_compact_json(out, t, source, context, array_out);
+			print_char('\n');
+			break;
+
+		default:
+			if (shard->records) {
+				print_const(",\n");
+			}
+
+			export_record_to_pretty_json(out, t, source, context, array_out);
+			break;
+	}
+
+	shard->records++;
+}
+
+
+/// Export parsed document split across `count` shards, each of which is a
+/// complete JSON array (or JSON Lines file).  Records are dealt out in turn,
+/// or by the hash of column `key`.  If `array_out`, the header row starts
+/// every shard.
+static void export_tree_to_shards(json_shard * shards, size_t count, simple_token * root, const char * source,
+	tdp_context * context, bool array_out, size_t key) {
+	size_t next = 0;
+	size_t column;
+	simple_token * field;
+	sink * out;
+
+	for (size_t i = 0; i < count; ++i) {
+		out = &shards[i].out;
+
+		if (context->style == TDP_JSON_COMPACT) {
+			print_char('[');
+		} else if (context->style != TDP_JSON_LINES) {
+			print_const("[\n");
+		}
+	}
+
+	for (simple_token * t = root->child; t; t = t->next) {
+		switch (t->type) {
+			case TDP_HEADER:
+				if (!array_out) {
+					export_headers(t, source, context, (context->style == TDP_JSON_PRETTY) ? 2 : 0,
+						(context->style == TDP_JSON_PRETTY) ? KEY_PRETTY : KEY_COMPACT);
+					break;
+				}
+
+				for (size_t i = 0; i < count; ++i) {
+					export_record_to_shard(&shards[i], t, source, context, array_out);
+				}
+
+				break;
+
+			case TDP_RECORD:
+				if (key == kShardRoundRobin) {
+					export_record_to_shard(&shards[next], t, source, context, array_out);
+					next = (next + 1) % count;
+					break;
+				}
+
+				field = t->child;
+
+				for (column = 0; field && column < key; ++column) {
+					field = field->next;
+				}
+
+				export_record_to_shard(&shards[hash_field(field, source) % count], t, source, context, array_out);
+				break;
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		out = &shards[i].out;
+
+		if (context->style == TDP_JSON_COMPACT) {
+			print_const("]\n");
+		} else if (context->style != TDP_JSON_LINES) {
+			if (shards[i].records) {
+				print_char('\n');
+			}
+
+			print_const("]\n");
+		}
+	}
+}
+
+
+/// Start the next value in a column of columnar JSON
+static sink * begin_column_value(spill * s, size_t column) {
+	sink * value = spill_append(s, column);
+
+	if (s->columns[column].values > 1) {
+		sink_write(value, ", ", 2);
+	}
+
+	return value;
+}
+
+
+/// Export parsed document as columnar JSON -- an object with an array of
+/// values for each column (or an array of columns, each starting with its
+/// header name, if `array_out`).  Values are collected in one pass, in
+/// per-column buffers that spill to a temporary file as they grow.
+/// Records with missing fields are padded with null, so that every
+/// column has one value per record.
+static bool export_tree_to_columns(sink * out, simple_token * root, const char * source, tdp_context * context, bool array_out) {
+	spill * s = spill_new(context->allocator, 0);
+	size_t rows = 0;
+	size_t count;
+	column_key * key;
+	bool ok = true;
+
+	if (s == NULL) {
+		return false;
+	}
+
+	for (simple_token * t = root->child; t && ok; t = t->next) {
+		switch (t->type) {
+			case TDP_HEADER:
+				if (!array_out) {
+					export_headers(t, source, context, 1, KEY_PRETTY);
+
+					// Every named column is written, even if it has no values
+					while (ok && (s->count < context->header->size)) {
+						ok = spill_add_column(s);
+					}
+
+					break;
+				}
+
+			// fall through
+			case TDP_RECORD:
+				count = 0;
+
+				for (simple_token * c = t->child; c && ok; c = c->next) {
+					if (count == s->count) {
+						// New column -- earlier records have no value
+						ok = spill_add_column(s);
+
+						for (size_t i = 0; ok && (i < rows); ++i) {
+							sink_write(begin_column_value(s, count), "null", 4);
+						}
+					}
+
+					if (ok) {
+						export_value(begin_column_value(s, count), c, source, context, (t->type == TDP_HEADER) ? kHeaderRow : count);
+					}
+
+					count++;
+				}
+
+				for (; ok && (count < s->count); ++count) {
+					sink_write(begin_column_value(s, count), "null", 4);
+				}
+
+				rows++;
+				break;
+		}
+	}
+
+	if (array_out) {
+		print_const("[\n");
+	} else {
+		print_const("{\n");
+	}
+
+	for (size_t i = 0; ok && (i < s->count); ++i) {
+		if (array_out) {
+			print_const("\t[");
+		} else if ((key = stack_peek_index(context->header, i))) {
+			sink_write(out, key->prefix, key->len);
+			print_char('[');
+		} else {
+			// More fields than headers
+			print_const("\t\"\": [");
+		}
+
+		ok = spill_copy(s, i, out);
+
+		if (i + 1 < s->count) {
+			print_const("],\n");
+		} else {
+			print_const("]\n");
+		}
+	}
+
+	if (array_out) {
+		print_const("]\n");
+	} else {
+		print_const("}\n");
+	}
+
+	spill_free(s);
+	return ok;
+}
+
+
+/// Is the schema default for `plan` null?
+#define default_is_null(plan) (((plan)->fallback_len == 4) && (memcmp((plan)->fallback, "null", 4) == 0))
+
+
+/// Export schema default for `plan` in a binary format
+static void export_default_to_binary(sink * out, const tdp_allocator * allocator, const tdp_schema_column * plan, short format) {
+	int64_t i;
+	double d;
+
+	if (default_is_null(plan)) {
+		binary_write_nil(out, format);
+		return;
+	}
+
+	switch (plan->type) {
+		case TDP_TYPE_BOOL:
+			binary_write_bool(out, format, plan->fallback[0] == 't');
+			break;
+
+		case TDP_TYPE_INT:
+			if (parse_int64(plan->fallback, plan->fallback_len, &i)) {
+				binary_write_int(out, format, i);
+				break;
+			}
+
+		// fall through -- too large for int64
+		case TDP_TYPE_FLOAT:
+			parse_double(allocator, plan->fallback, plan->fallback_len, &d);
+			binary_write_double(out, format, d);
+			break;
+
+		default:
+			binary_write_string(out, format, plan->value, plan->value_len);
+			break;
+	}
+}
+
+
+/// Export a field value in a binary format, using native types
+static void export_value_to_binary(sink * out, simple_token * field, const char * source, tdp_context * context, size_t column) {
+	short format = context->output_format;
+	double d;
+
+	switch (resolve_value(field, source, context, column)) {
+		case VALUE_NULL:
+			binary_write_nil(out, format);
+			return;
+
+		case VALUE_EMPTY:
+			binary_write_string_header(out, format, 0);
+			return;
+
+		case VALUE_BOOL:
+			binary_write_bool(out, format, source[field->child->start] == 't');
+			return;
+
+		// Numbers were validated when resolving the value (integers too
+		// large for int64 are VALUE_FLOAT)
+		case VALUE_INT:
+			binary_write_int(out, format, parse_int64_unchecked(&source[field->child->start], field->child->len));
+			return;
+
+		case VALUE_FLOAT:
+			parse_double_unchecked(context->allocator, &source[field->child->start], field->child->len, &d);
+			binary_write_double(out, format, d);
+			return;
+
+		case VALUE_DEFAULT:
+			export_default_to_binary(out, context->allocator, context->column_plan[column], format);
+			return;
+	}
+
+	export_text_tree_to_binary(out, field->child, source, format);
+}
+
+
+/// Export a record (or header row) as a binary map or array
+static void export_record_to_binary(sink * out, simple_token * t, const char * source, tdp_context * context, bool array_out) {
+	short format = context->output_format;
+	size_t fields = 0;
+	size_t count = 0;
+	column_key * key;
+
+	for (simple_token * c = t->child; c; c = c->next) {
+		fields++;
+	}
+
+	if (array_out) {
+		binary_write_array(out, format, fields);
+	} else {
+		binary_write_map(out, format, fields);
+	}
+
+	for (simple_token * c = t->child; c; c = c->next) {
+		if (!array_out) {
+			if ((key = stack_peek_index(context->header, count))) {
+				sink_write(out, key->prefix, key->len);
+			} else {
+				// More fields than headers
+				binary_write_string_header(out, format, 0);
+			}
+		}
+
+		export_value_to_binary(out, c, source, context, (t->type == TDP_HEADER) ? kHeaderRow : count);
+
+		count++;
+	}
+}
+
+
+/// Export parsed document as MessagePack or CBOR.  The structure matches
+/// JSON output, with records written as maps (or arrays if `array_out`).
+static void export_tree_to_binary(sink * out, simple_token * root, const char * source, tdp_context * context, bool array_out) {
+	size_t records = 0;
+
+	if (context->style != TDP_JSON_LINES) {
+		// Binary arrays need a count up front
+		for (simple_token * t = root->child; t; t = t->next) {
+			if ((t->type == TDP_RECORD) || (t->type == TDP_HEADER && array_out)) {
+				records++;
+			}
+		}
+
+		binary_write_array(out, context->output_format, records);
+	}
+
+	for (simple_token * t = root->child; t; t = t->next) {
+		switch (t->type) {
+			case TDP_HEADER:
+				if (!array_out) {
+					export_headers(t, source, context, 0, KEY_BINARY);
+					break;
+				}
+
+			// fall through
+			case TDP_RECORD:
+				index_record(context, out, t);
+				export_record_to_binary(out, t, source, context, array_out);
+				break;
+		}
+	}
+}
+
+
+/// Append a field value to an Arrow column.  Values that don't match the
+/// column type are null.
+static void export_value_to_arrow(arrow_writer * w, simple_token * field, const char * source, tdp_context * context, size_t column) {
+	const tdp_schema_column * plan = NULL;
+	const char * text = NULL;
+	size_t len = 0;
+	short value = resolve_value(field, source, context, column);
+	int64_t i;
+	double d;
+
+	if (value == VALUE_DEFAULT) {
+		plan = context->column_plan[column];
+
+		if (default_is_null(plan)) {
+			arrow_append_null(w, column);
+			return;
+		}
+
+		text = plan->fallback;
+		len = plan->fallback_len;
+	} else if (value == VALUE_INT || value == VALUE_FLOAT || value == VALUE_BOOL) {
+		text = &source[field->child->start];
+		len = field->child->len;
+	}
+
+	switch (w->columns[column].type) {
+		// Field values were validated when resolving them; schema defaults
+		// are checked here
+		case TDP_TYPE_INT:
+			if (value == VALUE_INT) {
+				arrow_append_int(w, column, parse_int64_unchecked(text, len));
+				return;
+			}
+
+			if (value == VALUE_DEFAULT && parse_int64(text, len, &i)) {
+				arrow_append_int(w, column, i);
+				return;
+			}
+
+			break;
+
+		case TDP_TYPE_FLOAT:
+			if ((value == VALUE_INT || value == VALUE_FLOAT) && parse_double_unchecked(context->allocator, text, len, &d)) {
+				arrow_append_double(w, column, d);
+				return;
+			}
+
+			if (value == VALUE_DEFAULT && parse_double(context->allocator, text, len, &d)) {
+				arrow_append_double(w, column, d);
+				return;
+			}
+
+			break;
+
+		case TDP_TYPE_BOOL:
+			if (value == VALUE_BOOL || value == VALUE_DEFAULT) {
+				arrow_append_bool(w, column, text[0] == 't');
+				return;
+			}
+
+			break;
+
+		default:
+			switch (value) {
+				case VALUE_NULL:
+					break;
+
+				case VALUE_EMPTY:
+					arrow_append_string(w, column);
+					return;
+
+				case VALUE_DEFAULT:
+					sink_write(arrow_append_string(w, column), plan->value, plan->value_len);
+					return;
+
+				default:
+					export_text_tree_raw(arrow_append_string(w, column), field->child, source);
+					return;
+			}
+
+			break;
+	}
+
+	arrow_append_null(w, column);
+}
+
+
+/// Export parsed document as an Arrow IPC file or stream, or a Parquet
+/// file.  Columns are named by the header row.  Returns false if memory could not be allocated.
+static bool export_tree_to_arrow(sink * out, simple_token * root, const char * source, tdp_context * context) {
+	arrow_writer * w = arrow_writer_new(context->allocator, out, context->output_format, context->batch_size);
+	DString * name = d_string_new_with_allocator(context->allocator, "");
+	bool result = false;
+	size_t column;
+	short type;
+	sink s;
+
+	if (!w || !name) {
+		goto done;
+	}
+
+	w->compression = context->compression;
+
+	for (simple_token * t = root->child; t; t = t->next) {
+		if (t->type == TDP_HEADER) {
+			column = 0;
+
+			for (simple_token * c = t->child; c; c = c->next) {
+				d_string_erase(name, 0, -1);
+				sink_init_string(&s, name);
+				export_text_tree_raw(&s, c->child, source);
+
+				if (column >= context->column_count) {
+					type = TDP_TYPE_STRING;
+				} else if (context->column_plan[column]) {
+					type = context->column_plan[column]->type;
+				} else {
+					type = context->column_types[column];
+				}
+
+				if (!arrow_writer_add_column(w, name->str, name->currentStringLength, type)) {
+					goto done;
+				}
+
+				column++;
+			}
+
+			break;
+		}
+	}
+
+	arrow_writer_begin(w);
+
+	for (simple_token * t = root->child; t; t = t->next) {
+		if (t->type == TDP_RECORD) {
+			column = 0;
+
+			// Extra fields are ignored
+			for (simple_token * c = t->child; c && column < w->count; c = c->next) {
+				export_value_to_arrow(w, c, source, context, column);
+				column++;
+			}
+
+			arrow_writer_end_row(w);
+		}
+	}
+
+	result = arrow_writer_finish(w);
+
+done:
+	arrow_writer_free(w);
+	d_string_free(name, true);
+
+	return result;
+}
+
+
+/// Template tag names that are not columns
+#define kTemplateRecords ((size_t) -1)	//!< `records` -- loop over records
+#define kTemplateMissing ((size_t) -2)	//!< Unknown name -- empty and false
+
+
+/// State for rendering a template against a parsed document
+struct template_render {
+	sink		*	out;				//!< Destination
+	const tdp_template	*	view;		//!< Template being rendered
+	simple_token	*	root;			//!< Parsed document
+	const char	*	source;				//!< Source text
+	tdp_context	*	context;			//!< Context (for column types)
+
+	size_t		*	columns;			//!< Column (or kTemplateRecords/kTemplateMissing) for each node
+	simple_token	**	fields;			//!< Fields of the current record, by column
+	size_t			field_count;		//!< Number of columns
+	simple_token	*	record;			//!< Current record (NULL outside of a `records` section)
+	size_t			record_count;		//!< Number of records in document
+	DString		*	scratch;			//!< Buffer for values that need unescaping
+};
+
+typedef struct template_render template_render;
+
+
+/// Is a field true for a template section?  Missing, null, empty, and
+/// false values are not.
+static bool template_field_is_true(simple_token * field, const char * source, tdp_context * context, size_t column) {
+	const tdp_schema_column * plan;
+
+	if (field == NULL) {
+		return false;
+	}
+
+	switch (resolve_value(field, source, context, column)) {
+		case VALUE_NULL:
+		case VALUE_EMPTY:
+			return false;
+
+		case VALUE_BOOL:
+			return source[field->child->start] == 't';
+
+		case VALUE_DEFAULT:
+			plan = context->column_plan[column];
+
+			if (default_is_null(plan)) {
+				return false;
+			}
+
+			if (plan->type == TDP_TYPE_BOOL) {
+				return plan->fallback[0] == 't';
+			}
+
+			return (plan->type != TDP_TYPE_STRING) || plan->value_len;
+
+		default:
+			return true;
+	}
+}
+
+
+/// Export a field value as template text -- HTML escaped, unless `raw`
+static void export_value_to_template(sink * out, simple_token * field, const char * source, tdp_context * context, size_t column, bool raw, DString * scratch) {
+	const tdp_schema_column * plan;
+	const char * text;
+	size_t len;
+	sink s;
+
+	switch (resolve_value(field, source, context, column)) {
+		case VALUE_NULL:
+		case VALUE_EMPTY:
+			return;
+
+		case VALUE_DEFAULT:
+			plan = context->column_plan[column];
+
+			if (default_is_null(plan)) {
+				return;
+			}
+
+			if (plan->type == TDP_TYPE_STRING) {
+				text = plan->value;
+				len = plan->value_len;
+			} else {
+				text = plan->fallback;
+				len = plan->fallback_len;
+			}
+
+			break;
+
+		case VALUE_INT:
+		case VALUE_FLOAT:
+		case VALUE_BOOL:
+			text = &source[field->child->start];
+			len = field->child->len;
+			break;
+
+		default:
+			if (raw) {
+				export_text_tree_raw(out, field->child, source);
+				return;
+			}
+
+			if (field->child && !field->child->next && is_raw_text(field->child->type)) {
+				text = &source[field->child->start];
+				len = field->child->len;
+				break;
+			}
+
+			d_string_erase(scratch, 0, -1);
+			sink_init_string(&s, scratch);
+			export_text_tree_raw(&s, field->child, source);
+
+			text = scratch->str;
+			len = scratch->currentStringLength;
+			break;
+	}
+
+	if (raw) {
+		sink_write(out, text, len);
+	} else {
+		template_write_escaped(out, text, len);
+	}
+}
+
+
+/// Make `record` the current record for template lookups
+static void template_load_record(template_render * r, simple_token * record) {
+	simple_token * c = record ? record->child : NULL;
+
+	for (size_t i = 0; i < r->field_count; ++i) {
+		r->fields[i] = c;
+		c = c ? c->next : NULL;
+	}
+
+	r->record = record;
+}
+
+
+static void render_template_records(template_render * r, size_t from, size_t to);
+
+
+/// Render template nodes `from` up to (not including) `to`
+static void render_template_nodes(template_render * r, size_t from, size_t to) {
+	const tdp_template_node * n;
+	simple_token * field;
+	size_t column;
+
+	for (size_t i = from; i < to; ) {
+		n = &r->view->nodes[i];
+		column = r->columns[i];
+		field = (r->record && column < r->field_count) ? r->fields[column] : NULL;
+
+		switch (n->type) {
+			case TEMPLATE_TEXT:
+				sink_write_ref(r->out, n->text, n->len);
+				break;
+
+			case TEMPLATE_VARIABLE:
+			case TEMPLATE_RAW:
+				if (field) {
+					export_value_to_template(r->out, field, r->source, r->context, column, n->type == TEMPLATE_RAW, r->scratch);
+				}
+
+				break;
+
+			case TEMPLATE_SECTION:
+			case TEMPLATE_INVERTED:
+				if (column == kTemplateRecords) {
+					if (n->type == TEMPLATE_SECTION) {
+						render_template_records(r, i + 1, n->end);
+					} else if (r->record_count == 0) {
+						render_template_nodes(r, i + 1, n->end);
+					}
+				} else if (template_field_is_true(field, r->source, r->context, column) == (n->type == TEMPLATE_SECTION)) {
+					render_template_nodes(r, i + 1, n->end);
+				}
+
+				i = n->end;
+				continue;
+		}
+
+		i++;
+	}
+}
+
+
+/// Render template nodes `from` up to `to` once for each record
+static void render_template_records(template_render * r, size_t from, size_t to) {
+	simple_token * outer = r->record;
+
+	for (simple_token * t = r->root->child; t; t = t->next) {
+		if (t->type == TDP_RECORD) {
+			template_load_record(r, t);
+			render_template_nodes(r, from, to);
+		}
+	}
+
+	template_load_record(r, outer);
+}
+
+
+/// Render `context->mustache` against the parsed document.  Tag names
+/// are matched to header names; `records` loops over the records (if the
+/// template has no `records` section, it is rendered once per record).
+/// Returns false if there is no template, or memory could not be
+/// allocated.
+static bool export_tree_to_template(sink * out, simple_token * root, const char * source, tdp_context * context) {
+	const tdp_template * view = context->mustache;
+	simple_token * header = NULL;
+	template_render r;
+	bool result = false;
+	sink s;
+
+	if (view == NULL) {
+		return false;
+	}
+
+	r.out = out;
+	r.view = view;
+	r.root = root;
+	r.source = source;
+	r.context = context;
+	r.field_count = 0;
+	r.record = NULL;
+	r.record_count = 0;
+
+	for (simple_token * t = root->child; t; t = t->next) {
+		if (t->type == TDP_RECORD) {
+			r.record_count++;
+		} else if (t->type == TDP_HEADER && !header) {
+			header = t;
+
+			for (simple_token * c = t->child; c; c = c->next) {
+				r.field_count++;
+			}
+		}
+	}
+
+	r.columns = tdp_malloc(context->allocator, (view->count + 1) * sizeof(size_t));
+	r.fields = tdp_malloc(context->allocator, (r.field_count + 1) * sizeof(simple_token *));
+	r.scratch = d_string_new_with_allocator(context->allocator, "");
+
+	if (!r.columns || !r.fields || !r.scratch) {
+		goto done;
+	}
+
+	// Match tag names to columns
+	for (size_t i = 0; i < view->count; ++i) {
+		r.columns[i] = tdp_template_node_is(&view->nodes[i], "records") ? kTemplateRecords : kTemplateMissing;
+	}
+
+	size_t column = 0;
+
+	for (simple_token * c = header ? header->child : NULL; c; c = c->next) {
+		d_string_erase(r.scratch, 0, -1);
+		sink_init_string(&s, r.scratch);
+		export_text_tree_raw(&s, c->child, source);
+
+		for (size_t i = 0; i < view->count; ++i) {
+			if ((view->nodes[i].type != TEMPLATE_TEXT) && (r.columns[i] == kTemplateMissing) &&
+					(view->nodes[i].len == r.scratch->currentStringLength) &&
+					(memcmp(view->nodes[i].text, r.scratch->str, view->nodes[i].len) == 0)) {
+				r.columns[i] = column;
+			}
+		}
+
+		column++;
+	}
+
+	if (view->has_records) {
+		render_template_nodes(&r, 0, view->count);
+	} else {
+		render_template_records(&r, 0, view->count);
+	}
+
+	result = true;
+
+done:
+	tdp_free(context->allocator, r.columns);
+	tdp_free(context->allocator, r.fields);
+	d_string_free(r.scratch, true);
+
+	return result;
+}
+
+
+#ifdef HAVE_SQLITE3
+/// Declared SQLite type for a column type
+static const char * sqlite_column_type(short type) {
+	switch (type) {
+		case TDP_TYPE_BOOL:
+		case TDP_TYPE_INT:
+			return " INTEGER";
+
+		case TDP_TYPE_FLOAT:
+			return " REAL";
+
+		case TDP_TYPE_STRING:
+			return " TEXT";
+
+		default:
+			// No values seen -- no type affinity
+			return "";
+	}
+}
+
+
+/// Append `len` bytes of `name` to `sql` as a quoted SQL identifier
+static void append_sql_identifier(DString * sql, const char * name, size_t len) {
+	d_string_append_c(sql, '"');
+
+	for (size_t i = 0; i < len; ++i) {
+		if (name[i] == '"') {
+			d_string_append_c(sql, '"');
+		}
+
+		d_string_append_c(sql, name[i]);
+	}
+
+	d_string_append_c(sql, '"');
+}
+
+
+/// Bind a field value to parameter `index` of `statement`, using native
+/// SQLite types.  Strings stored in `source` without escapes are bound
+/// without being copied.
+static int bind_value_to_sqlite(sqlite3_stmt * statement, int index, simple_token * field, const char * source, tdp_context * context, size_t column, DString * scratch) {
+	const tdp_schema_column * plan;
+	const char * text;
+	size_t len;
+	int64_t i;
+	double d;
+	sink s;
+
+	switch (resolve_value(field, source, context, column)) {
+		case VALUE_NULL:
+			return sqlite3_bind_null(statement, index);
+
+		case VALUE_EMPTY:
+			return sqlite3_bind_text(statement, index, "", 0, SQLITE_STATIC);
+
+		case VALUE_BOOL:
+			return sqlite3_bind_int(statement, index, source[field->child->start] == 't');
+
+		case VALUE_INT:
+		case VALUE_FLOAT:
+			text = &source[field->child->start];
+			len = field->child->len;
+			break;
+
+		case VALUE_DEFAULT:
+			plan = context->column_plan[column];
+
+			if (default_is_null(plan)) {
+				return sqlite3_bind_null(statement, index);
+			}
+
+			switch (plan->type) {
+				case TDP_TYPE_BOOL:
+					return sqlite3_bind_int(statement, index, plan->fallback[0] == 't');
+
+				case TDP_TYPE_INT:
+				case TDP_TYPE_FLOAT:
+					text = plan->fallback;
+					len = plan->fallback_len;
+					break;
+
+				default:
+					return sqlite3_bind_text(statement, index, plan->value, (int) plan->value_len, SQLITE_STATIC);
+			}
+
+			break;
+
+		default:
+			if (field->child && !field->child->next && is_raw_text(field->child->type)) {
+				return sqlite3_bind_text(statement, index, &source[field->child->start], (int) field->child->len, SQLITE_STATIC);
+			}
+
+			d_string_erase(scratch, 0, -1);
+			sink_init_string(&s, scratch);
+			export_text_tree_raw(&s, field->child, source);
+
+			return sqlite3_bind_text(statement, index, scratch->str, (int) scratch->currentStringLength, SQLITE_TRANSIENT);
+	}
+
+	// Numbers too large for int64 are stored as REAL
+	if (parse_int64(text, len, &i)) {
+		return sqlite3_bind_int64(statement, index, i);
+	}
+
+	parse_double(context->allocator, text, len, &d);
+	return sqlite3_bind_double(statement, index, d);
+}
+
+
+/// Load parsed document into `table`.  The table is created from the
+/// header row if it does not exist, and records are inserted by a single
+/// prepared statement, committing every `context->batch_size` records
+/// (unless the caller already started a transaction).
+static bool export_tree_to_sqlite(simple_token * root, const char * source, tdp_context * context, sqlite3 * db, const char * table) {
+	DString * create = d_string_new_with_allocator(context->allocator, "CREATE TABLE IF NOT EXISTS ");
+	DString * insert = d_string_new_with_allocator(context->allocator, "INSERT INTO ");
+	DString * name = d_string_new_with_allocator(context->allocator, "");
+	sqlite3_stmt * statement = NULL;
+	bool transaction = sqlite3_get_autocommit(db);
+	bool result = false;
+	size_t pending = 0;
+	size_t column = 0;
+	short type;
+	sink s;
+
+	if (!create || !insert || !name) {
+		goto done;
+	}
+
+	append_sql_identifier(create, table, strlen(table));
+	append_sql_identifier(insert, table, strlen(table));
+	d_string_append(create, " (");
+	d_string_append(insert, " (");
+
+	for (simple_token * t = root->child; t; t = t->next) {
+		if (t->type == TDP_HEADER) {
+			for (simple_token * c = t->child; c; c = c->next) {
+				d_string_erase(name, 0, -1);
+				sink_init_string(&s, name);
+				export_text_tree_raw(&s, c->child, source);
+
+				if (name->currentStringLength == 0) {
+					d_string_append_printf(name, "column%lu", (unsigned long) column + 1);
+				}
+
+				if (column >= context->column_count) {
+					type = TDP_TYPE_NULL;
+				} else if (context->column_plan[column]) {
+					type = context->column_plan[column]->type;
+				} else {
+					type = context->column_types[column];
+				}
+
+				if (column) {
+					d_string_append(create, ", ");
+					d_string_append(insert, ", ");
+				}
+
+				append_sql_identifier(create, name->str, name->currentStringLength);
+				d_string_append(create, sqlite_column_type(type));
+				append_sql_identifier(insert, name->str, name->currentStringLength);
+
+				column++;
+			}
+
+			break;
+		}
+	}
+
+	if (column == 0) {
+		goto done;
+	}
+
+	d_string_append(create, ")");
+	d_string_append(insert, ") VALUES (?");
+
+	for (size_t i = 1; i < column; ++i) {
+		d_string_append(insert, ", ?");
+	}
+
+	d_string_append(insert, ")");
+
+	if ((sqlite3_exec(db, create->str, NULL, NULL, NULL) != SQLITE_OK) ||
+			(sqlite3_prepare_v2(db, insert->str, (int) insert->currentStringLength, &statement, NULL) != SQLITE_OK)) {
+		goto done;
+	}
+
+	if (transaction && (sqlite3_exec(db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)) {
+		goto done;
+	}
+
+	for (simple_token * t = root->child; t; t = t->next) {
+		if (t->type != TDP_RECORD) {
+			continue;
+		}
+
+		simple_token * c = t->child;
+
+		// Extra fields are ignored, and missing fields are null
+		for (size_t i = 0; i < column; ++i) {
+			if ((c ? bind_value_to_sqlite(statement, (int) i + 1, c, source, context, i, name) : sqlite3_bind_null(statement, (int) i + 1)) != SQLITE_OK) {
+				goto rollback;
+			}
+
+			c = c ? c->next : NULL;
+		}
+
+		if (sqlite3_step(statement) != SQLITE_DONE) {
+			goto rollback;
+		}
+
+		sqlite3_reset(statement);
+
+		if (transaction && (++pending == context->batch_size)) {
+			if ((sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) ||
+					(sqlite3_exec(db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)) {
+				goto rollback;
+			}
+
+			pending = 0;
+		}
+	}
+
+	result = !transaction || (sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) == SQLITE_OK);
+
+rollback:
+
+	if (!result && transaction && !sqlite3_get_autocommit(db)) {
+		sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+
+		// Restore the error message from the failed statement
+		sqlite3_reset(statement);
+	}
+
+done:
+	sqlite3_finalize(statement);
+	d_string_free(create, true);
+	d_string_free(insert, true);
+	d_string_free(name, true);
+
+	return result;
+}
+#endif
+
+
+/// Export a token tree as pretty printed JSON, collected in a rope of fixed
+/// size pages rather than a single string, so large documents are never
+/// moved while growing.
+tdp_rope * export_to_rope(const char * source, simple_token * tree, bool array_out) {
+	tdp_context * context = tdp_context_new();
+	char * buffer = context ? tdp_context_flush_buffer(context) : NULL;
+	tdp_rope * r = buffer ? tdp_rope_new(0) : NULL;
+	sink sink;
+
+	if (r == NULL) {
+		tdp_context_free(context);
+		return NULL;
+	}
+
+	sink_init_callback(&sink, buffer, kFlushBufferSize, tdp_rope_write, r);
+	prepare_columns(context, tree, source);
+	export_tree_to_pretty_json(&sink, tree, source, context, array_out);
+
+	if (!sink_finish(&sink) || context->failed) {
+		tdp_rope_free(r);
+		r = NULL;
+	}
+
+	// Context owns header keys
+	tdp_context_free(context);
+
+	return r;
+}
+
+
+/// Flush callback that grows the DString in `user` by exactly `len`, so
+/// that it never holds more than the output so far
+static bool append_page_to_string(const char * data, size_t len, void * user) {
+	DString * out = user;
+
+	d_string_reserve(out, out->currentStringLength + len);
+	d_string_append_c_array(out, data, len);
+	return !out->failed;
+}
+
+
+/// Join the pages of a rope into a string.  Each page is released as soon
+/// as it has been appended, so that the peak is the output plus one page
+/// (large blocks can usually be grown in place by realloc()).
+static DString * rope_to_string(tdp_rope * r) {
+	DString * out = r ? d_string_new("") : NULL;
+
+	if (out) {
+		if (!tdp_rope_drain(r, append_page_to_string, out)) {
+			// Out of memory
+			d_string_free(out, true);
+			out = NULL;
+		}
+	}
+
+	tdp_rope_free(r);
+	return out;
+}
+
+
+/// Export a token tree as pretty printed JSON.  Documents larger than a
+/// rope page are collected in a rope first, and joined a page at a time,
+/// so that the string is not doubled each time it outgrows its buffer.
+DString * export_to_json(const char * source, simple_token * tree, bool array_out) {
+	// The root token spans the source
+	if (tree->start + tree->len > kRopePageSize) {
+		return rope_to_string(export_to_rope(source, tree, array_out));
+	}
+
+	tdp_context * context = tdp_context_new();
+	DString * out = context ? d_string_new("") : NULL;
+	sink sink;
+
+	if (out == NULL) {
+		tdp_context_free(context);
+		return NULL;
+	}
+
+	sink_init_string(&sink, out);
+	prepare_columns(context, tree, source);
+	export_tree_to_pretty_json(&sink, tree, source, context, array_out);
+
+	if (!sink_finish(&sink) || context->failed) {
+		d_string_free(out, true);
+		out = NULL;
+	}
+
+	// Context owns header keys
+	tdp_context_free(context);
+
+	return out;
+}
+
+
+#ifdef TEST
+void Test_export_to_json(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("foo,bar\none,two");
+	DString * out;
+	simple_token * t;
+	int result;
+
+	// Valid CSV
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
+	out = export_to_json(test->str, t, false);
+	simple_token_tree_free(c->pool, t);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"foo\": \"one\",\n\t\t\"bar\": \"two\"\n\t}\n]\n", out->str);
+	d_string_free(out, true);
+
+	// Valid CSV
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "a\n1");
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
+	out = export_to_json(test->str, t, false);
+	simple_token_tree_free(c->pool, t);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": 1\n\t}\n]\n", out->str);
+	d_string_free(out, true);
+
+	// Boolean
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "one,two\ntrue,false");
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
+	out = export_to_json(test->str, t, false);
+	simple_token_tree_free(c->pool, t);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"one\": true,\n\t\t\"two\": false\n\t}\n]\n", out->str);
+	d_string_free(out, true);
+
+	// Boolean to array of arrays
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "one,two\ntrue,false");
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
+	out = export_to_json(test->str, t, true);
+	simple_token_tree_free(c->pool, t);
+	CuAssertStrEquals(tc, "[\n\t[\n\t\t\"one\",\n\t\t\"two\"\n\t],\n\t[\n\t\ttrue,\n\t\tfalse\n\t]\n]\n", out->str);
+	d_string_free(out, true);
+
+	// Tests from https://github.com/maxogden/csv-spectrum
+	// JSON cross-validated with results from https://www.csvjson.com/csv2json
+
+	// comma_in_quotes.csv
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "first,last,address,city,zip\nJohn,Doe,120 any st.,\"Anytown, WW\",08123");
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
+	out = export_to_json(test->str, t, false);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"first\": \"John\",\n\t\t\"last\": \"Doe\",\n\t\t\"address\": \"120 any st.\",\n\t\t\"city\": \"Anytown, WW\",\n\t\t\"zip\": \"08123\"\n\t}\n]\n", out->str);
+	simple_token_tree_free(c->pool, t);
+	d_string_free(out, true);
+
+	// empty.csv
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "a,b,c\n1,\"\",\"\"\n2,3,4");
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	simple_token_tree_describe(t, test->str);
+	result = parse_tdp_token_chain(c, t);
+	out = export_to_json(test->str, t, false);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": 1,\n\t\t\"b\": null,\n\t\t\"c\": null\n\t},\n\t{\n\t\t\"a\": 2,\n\t\t\"b\": 3,\n\t\t\"c\": 4\n\t}\n]\n", out->str);
+	simple_token_tree_free(c->pool, t);
+	d_string_free(out, true);
+
+	// escaped_quotes.csv
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "a,b\n1,\"ha \"\"ha\"\" ha\"\n3,4");
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
+	out = export_to_json(test->str, t, false);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": 1,\n\t\t\"b\": \"ha \\\"ha\\\" ha\"\n\t},\n\t{\n\t\t\"a\": 3,\n\t\t\"b\": \"4\"\n\t}\n]\n", out->str);
+	simple_token_tree_free(c->pool, t);
+	d_string_free(out, true);
+
+	// json.csv
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "key,val\n1,\"{\"\"type\"\": \"\"Point\"\", \"\"coordinates\"\": [102.0, 0.5]}\"");
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
+	out = export_to_json(test->str, t, false);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"key\": 1,\n\t\t\"val\": \"{\\\"type\\\": \\\"Point\\\", \\\"coordinates\\\": [102.0, 0.5]}\"\n\t}\n]\n", out->str);
+	simple_token_tree_free(c->pool, t);
+	d_string_free(out, true);
+
+	// newlines_crlf.csv
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "a,b,c\r\n1,2,3\r\n\"Once upon \r\na time\",5,6\r\n7,8,9\r\n");
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
+	out = export_to_json(test->str, t, false);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": \"1\",\n\t\t\"b\": 2,\n\t\t\"c\": 3\n\t},\n\t{\n\t\t\"a\": \"Once upon \\na time\",\n\t\t\"b\": 5,\n\t\t\"c\": 6\n\t},\n\t{\n\t\t\"a\": \"7\",\n\t\t\"b\": 8,\n\t\t\"c\": 9\n\t}\n]\n", out->str);
+	simple_token_tree_free(c->pool, t);
+	d_string_free(out, true);
+
+	// quotes_and_newlines.csv
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "a,b\n1,\"ha \n\"\"ha\"\" \nha\"\n3,4");
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
+	out = export_to_json(test->str, t, false);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": 1,\n\t\t\"b\": \"ha \\n\\\"ha\\\" \\nha\"\n\t},\n\t{\n\t\t\"a\": 3,\n\t\t\"b\": \"4\"\n\t}\n]\n", out->str);
+	simple_token_tree_free(c->pool, t);
+	d_string_free(out, true);
+
+	// utf8.csv
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "a,b,c\n1,2,3\n4,5,ʤ");
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_CSV);
+	result = parse_tdp_token_chain(c, t);
+	out = export_to_json(test->str, t, false);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": 1,\n\t\t\"b\": 2,\n\t\t\"c\": \"3\"\n\t},\n\t{\n\t\t\"a\": 4,\n\t\t\"b\": 5,\n\t\t\"c\": \"ʤ\"\n\t}\n]\n", out->str);
+	simple_token_tree_free(c->pool, t);
+	d_string_free(out, true);
+
+
+	// TSV
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "a\tb\n\"foo\" \"bar\"\t\"foo\nbar\"\tbat");
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_TSV);
+	result = parse_tdp_token_chain(c, t);
+	out = export_to_json(test->str, t, false);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": \"\\\"foo\\\" \\\"bar\\\"\",\n\t\t\"b\": \"\\\"foo\"\n\t},\n\t{\n\t\t\"a\": \"bar\\\"\",\n\t\t\"b\": \"bat\"\n\t}\n]\n", out->str);
+	simple_token_tree_free(c->pool, t);
+	d_string_free(out, true);
+
+
+	// Export to array of arrays
+	t = tokenize_text(c, test->str, 0, test->currentStringLength, FORMAT_TSV);
+	result = parse_tdp_token_chain(c, t);
+	out = export_to_json(test->str, t, true);
+	CuAssertStrEquals(tc, "[\n\t[\n\t\t\"a\",\n\t\t\"b\"\n\t],\n\t[\n\t\t\"\\\"foo\\\" \\\"bar\\\"\",\n\t\t\"\\\"foo\"\n\t],\n\t[\n\t\t\"bar\\\"\",\n\t\t\"bat\"\n\t]\n]\n", out->str);
+
+	// Same output collected in a rope
+	tdp_rope * r = export_to_rope(test->str, t, true);
+	size_t len;
+	CuAssertIntEquals(tc, 1, tdp_rope_page_count(r));
+	CuAssertIntEquals(tc, out->currentStringLength, tdp_rope_length(r));
+	CuAssertIntEquals(tc, 0, memcmp(out->str, tdp_rope_page(r, 0, &len), out->currentStringLength));
+	tdp_rope_free(r);
+
+	// Pages of a rope are joined in order
+	r = tdp_rope_new(16);
+	tdp_rope_write(out->str, out->currentStringLength, r);
+	CuAssertTrue(tc, tdp_rope_page_count(r) > 1);
+	DString * joined = rope_to_string(r);
+	CuAssertStrEquals(tc, out->str, joined->str);
+	d_string_free(joined, true);
+
+	simple_token_tree_free(c->pool, t);
+	d_string_free(out, true);
+
+	d_string_free(test, true);
+	tdp_context_free(c);
+}
+#endif
+
+
+/// Parse source text using `context` for storage, and prepare column
+/// types.  Returns the root token, or NULL if the source could not be
+/// tokenized.
+static simple_token * parse_document(tdp_context * context, DString * source, short format) {
+	tdp_context_reset(context);
+
+	simple_token * t = tokenize_text(context, source->str, 0, source->currentStringLength, format);
+
+	if (t == NULL || context->pool->missing) {
+		// Tokens that could not be allocated would be silently dropped
+		return NULL;
+	}
+
+	parse_tdp_token_chain(context, t);
+
+	if (context->pool->missing) {
+		return NULL;
+	}
+
+	prepare_columns(context, t, source->str);
+
+	return t;
+}
+
+
+/// Export parsed document to `out` in the context's output format
+static bool export_tree(tdp_context * context, simple_token * t, const char * source, bool array_out, sink * out) {
+	switch (context->output_format) {
+		case TDP_OUTPUT_MSGPACK:
+		case TDP_OUTPUT_CBOR:
+			export_tree_to_binary(out, t, source, context, array_out);
+			return sink_finish(out);
+
+		case TDP_OUTPUT_ARROW:
+		case TDP_OUTPUT_ARROW_STREAM:
+		case TDP_OUTPUT_PARQUET:
+			return export_tree_to_arrow(out, t, source, context) && sink_finish(out);
+
+		case TDP_OUTPUT_MUSTACHE:
+			return export_tree_to_template(out, t, source, context) && sink_finish(out);
+	}
+
+	switch (context->style) {
+		case TDP_JSON_COMPACT:
+			export_tree_to_compact_json(out, t, source, context, array_out);
+			break;
+
+		case TDP_JSON_LINES:
+			export_tree_to_json_lines(out, t, source, context, array_out);
+			break;
+
+		case TDP_JSON_COLUMNS:
+			return export_tree_to_columns(out, t, source, context, array_out) && sink_finish(out);
+
+		default:
+			export_tree_to_pretty_json(out, t, source, context, array_out);
+			break;
+	}
+
+	return sink_finish(out);
+}
+
+
+/// Estimate the size of JSON output: the source text, plus the keys and
+/// punctuation added to each record, plus 1/16 for quotes and escapes
+static size_t estimate_json_size(tdp_context * context, simple_token * root, size_t len, bool array_out) {
+	bool pretty = (context->style == TDP_JSON_PRETTY);
+	size_t records = 0;
+	size_t fields = 0;
+	size_t keys = 0;
+
+	for (simple_token * t = root->child; t; t = t->next) {
+		if (t->type == TDP_RECORD) {
+			records++;
+		} else if (t->type == TDP_HEADER) {
+			for (simple_token * c = t->child; c; c = c->next) {
+				keys += c->len;
+				fields++;
+			}
+		}
+	}
+
+	len += len / 16;
+
+	// Brackets and indentation for each record, less the line ending
+	if (array_out) {
+		// Header row is output once, as a record
+		return len + (records + 1) * (fields * (pretty ? 3 : 0) + (pretty ? 6 : 2));
+	}
+
+	// Each key, with its quotes and separator, replaces a delimiter
+	return len + records * (keys + fields * (pretty ? 7 : 3) + (pretty ? 6 : 2));
+}
+
+
+/// Parse source text and export it to `out`, using `context` for storage
+static bool export_document(tdp_context * context, DString * source, short format, bool array_out, sink * out) {
+	simple_token * t;
+	bool result;
+
+	if ((context->compression == TDP_COMPRESSION_SNAPPY) && (context->output_format != TDP_OUTPUT_PARQUET)) {
+		// Output format was changed after choosing Snappy
+		return false;
+	}
+
+	t = parse_document(context, source, format);
+
+	if (t == NULL) {
+		return false;
+	}
+
+	if (out->string && (context->output_format == TDP_OUTPUT_JSON) && (context->style != TDP_JSON_COLUMNS)) {
+		// Size output buffer once
+		d_string_reserve(out->string, out->string->currentStringLength + estimate_json_size(context, t, source->currentStringLength, array_out));
+	}
+
+	if (context->index) {
+		record_index_begin(context->index);
+	}
+
+	result = export_tree(context, t, source->str, array_out, out) && !context->failed;
+
+	if (context->index) {
+		result = record_index_finish(context->index, out->total, source->currentStringLength) && result;
+	}
+
+	return result;
+}
+
+
+/// Is the output compressed as a whole?  (Parquet compresses its pages.)
+#define compress_output(context) (((context)->compression == TDP_COMPRESSION_GZIP || (context)->compression == TDP_COMPRESSION_ZSTD) && \
+	((context)->output_format != TDP_OUTPUT_PARQUET))
+
+
+/// Parse source text and export it compressed, passing compressed blocks
+/// to `write`.  Blocks are compressed by a pool of threads while the rest
+/// of the document is being exported.
+static bool export_compressed_document(tdp_context * context, DString * source, short format, bool array_out,
+	sink_flush_callback write, void * user) {
+	char * buffer = tdp_context_flush_buffer(context);
+	compressor * z;
+	bool result;
+	sink in;
+
+	if (buffer == NULL || (z = compressor_new(context->allocator, context->compression, context->threads, write, user)) == NULL) {
+		return false;
+	}
+
+	sink_init_callback(&in, buffer, kFlushBufferSize, compressor_write, z);
+
+	result = export_document(context, source, format, array_out, &in);
+	result = compressor_finish(z) && result;
+
+	compressor_free(z);
+	return result;
+}
+
+
+/// Flush callback that appends to the DString in `user`
+static bool append_to_string(const char * data, size_t len, void * user) {
+	DString * out = user;
+
+	d_string_append_c_array(out, data, len);
+	return !out->failed;
+}
+
+
+/// Convert tabular data to JSON, reusing the parser and buffers stored in
+/// `context`.  The resulting DString belongs to the context, and is only
+/// valid until the context is used again.
+DString * tdp_context_to_json(tdp_context * context, DString * source, short format, bool array_out) {
+	if (context->out == NULL) {
+		context->out = d_string_new_with_allocator(context->allocator, "");
+
+		if (context->out == NULL) {
+			return NULL;
+		}
+	}
+
+	if (compress_output(context)) {
+		return export_compressed_document(context, source, format, array_out, append_to_string, context->out) ? context->out : NULL;
+	}
+
+	sink out;
+	sink_init_string(&out, context->out);
+
+	if (!export_document(context, source, format, array_out, &out)) {
+		return NULL;
+	}
+
+	return context->out;
+}
+
+
+/// Convert tabular data to JSON in a rope of fixed size pages
+tdp_rope * tdp_context_to_rope(tdp_context * context, DString * source, short format, bool array_out) {
+	tdp_rope * r = tdp_rope_new_with_allocator(context->allocator, 0);
+
+	if (r && !tdp_context_write_json(context, source, format, array_out, tdp_rope_write, r)) {
+		tdp_rope_free(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+
+/// Convert tabular data to JSON, passing output to a callback in chunks
+bool tdp_context_write_json(tdp_context * context, DString * source, short format, bool array_out,
+	tdp_write_callback write, void * user) {
+	if (compress_output(context)) {
+		return export_compressed_document(context, source, format, array_out, write, user);
+	}
+
+	char * buffer = tdp_context_flush_buffer(context);
+
+	if (buffer == NULL) {
+		return false;
+	}
+
+	sink out;
+	sink_init_callback(&out, buffer, kFlushBufferSize, write, user);
+
+	return export_document(context, source, format, array_out, &out);
+}
+
+
+/// Convert tabular data to JSON, writing output to a file descriptor
+bool tdp_context_write_json_fd(tdp_context * context, DString * source, short format, bool array_out, int fd) {
+	if (compress_output(context)) {
+		return export_compressed_document(context, source, format, array_out, sink_write_to_fd, (void *)(intptr_t) fd);
+	}
+
+	char * buffer = tdp_context_flush_buffer(context);
+
+	if (buffer == NULL) {
+		return false;
+	}
+
+	sink out;
+	sink_init_gather(&out, buffer, kFlushBufferSize, tdp_context_gather_vectors(context), fd);
+
+	return export_document(context, source, format, array_out, &out);
+}
+
+
+/// Convert tabular data to JSON, split across several file descriptors
+bool tdp_context_write_json_shards(tdp_context * context, DString * source, short format, bool array_out,
+	const int * fds, size_t count, const char * key) {
+	if ((count == 0) || (context->output_format != TDP_OUTPUT_JSON) || (context->style == TDP_JSON_COLUMNS) ||
+			(context->compression != TDP_COMPRESSION_NONE)) {
+		return false;
+	}
+
+	simple_token * t = parse_document(context, source, format);
+	size_t column = kShardRoundRobin;
+	bool result = true;
+
+	if (t == NULL) {
+		return false;
+	}
+
+	if (key) {
+		DString * scratch = d_string_new_with_allocator(context->allocator, "");
+
+		if (scratch) {
+			column = find_shard_key(t, source->str, key, scratch);
+			d_string_free(scratch, true);
+		}
+
+		if (column == kShardRoundRobin) {
+			return false;
+		}
+	}
+
+	// Each shard has its own buffer
+	json_shard * shards = tdp_malloc(context->allocator, count * sizeof(json_shard));
+	char * buffers = tdp_malloc(context->allocator, count * kFlushBufferSize);
+
+	if (shards && buffers) {
+		for (size_t i = 0; i < count; ++i) {
+			sink_init_fd(&shards[i].out, buffers + i * kFlushBufferSize, kFlushBufferSize, fds[i]);
+			shards[i].records = 0;
+		}
+
+		export_tree_to_shards(shards, count, t, source->str, context, array_out, column);
+		result = !context->failed;
+
+		for (size_t i = 0; i < count; ++i) {
+			result = sink_finish(&shards[i].out) && result;
+		}
+	} else {
+		result = false;
+	}
+
+	tdp_free(context->allocator, shards);
+	tdp_free(context->allocator, buffers);
+
+	return result;
+}
+
+
+/// Load tabular data into a SQLite table
+bool tdp_context_load_sqlite(tdp_context * context, DString * source, short format, sqlite3 * db, const char * table) {
+#ifdef HAVE_SQLITE3
+	simple_token * t = parse_document(context, source, format);
+
+	if (t == NULL) {
+		return false;
+	}
+
+	return export_tree_to_sqlite(t, source->str, context, db, table);
+#else
+	return false;
+#endif
+}
+
+
+#ifdef TEST
+void Test_tdp_context_to_json(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("foo,bar\none,two");
+	DString * out;
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"foo\": \"one\",\n\t\t\"bar\": \"two\"\n\t}\n]\n", out->str);
+
+	// Second document reuses the same buffers, without leftover headers
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "a\tb\n1\t2");
+	out = tdp_context_to_json(c, test, FORMAT_TSV, false);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": 1,\n\t\t\"b\": 2\n\t}\n]\n", out->str);
+	CuAssertIntEquals(tc, 2, c->header->size);
+
+	tdp_context_reset(c);
+	CuAssertIntEquals(tc, 0, c->header->size);
+	CuAssertIntEquals(tc, 0, c->out->currentStringLength);
+
+	d_string_free(test, true);
+	tdp_context_free(c);
+}
+
+
+void Test_tdp_context_compact(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("a,b,c\n1,\"\",\"x \"\"y\"\"\"\n2,3,4");
+	DString * out;
+
+	// Type each value separately
+	tdp_context_set_type_sample(c, 0);
+	tdp_context_set_json_style(c, TDP_JSON_COMPACT);
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "[{\"a\":1,\"b\":\"\",\"c\":\"x \\\"y\\\"\"},{\"a\":2,\"b\":3,\"c\":4}]\n", out->str);
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, true);
+	CuAssertStrEquals(tc, "[[\"a\",\"b\",\"c\"],[1,\"\",\"x \\\"y\\\"\"],[2,3,4]]\n", out->str);
+
+	tdp_context_set_json_style(c, TDP_JSON_LINES);
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "{\"a\":1,\"b\":\"\",\"c\":\"x \\\"y\\\"\"}\n{\"a\":2,\"b\":3,\"c\":4}\n", out->str);
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, true);
+	CuAssertStrEquals(tc, "[\"a\",\"b\",\"c\"]\n[1,\"\",\"x \\\"y\\\"\"]\n[2,3,4]\n", out->str);
+
+	tdp_context_set_json_style(c, TDP_JSON_PRETTY);
+	out = tdp_context_to_json(c, test, FORMAT_CSV, true);
+	CuAssertStrEquals(tc, "[\n\t[\n\t\t\"a\",\n\t\t\"b\",\n\t\t\"c\"\n\t],\n\t[\n\t\t1,\n\t\t\"\",\n\t\t\"x \\\"y\\\"\"\n\t],\n\t[\n\t\t2,\n\t\t3,\n\t\t4\n\t]\n]\n", out->str);
+
+	d_string_free(test, true);
+	tdp_context_free(c);
+}
+
+
+void Test_tdp_context_ragged(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("a,b\n1,2,3\n4");
+	DString * out;
+
+	// Extra fields get an empty key, and short records end early
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"a\": 1,\n\t\t\"b\": 2,\n\t\t\"\": 3\n\t},\n\t{\n\t\t\"a\": 4\n\t}\n]\n", out->str);
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, true);
+	CuAssertStrEquals(tc, "[\n\t[\n\t\t\"a\",\n\t\t\"b\"\n\t],\n\t[\n\t\t1,\n\t\t2,\n\t\t3\n\t],\n\t[\n\t\t4\n\t]\n]\n", out->str);
+
+	tdp_context_set_json_style(c, TDP_JSON_COMPACT);
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "[{\"a\":1,\"b\":2,\"\":3},{\"a\":4}]\n", out->str);
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, true);
+	CuAssertStrEquals(tc, "[[\"a\",\"b\"],[1,2,3],[4]]\n", out->str);
+
+	tdp_context_set_json_style(c, TDP_JSON_LINES);
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "{\"a\":1,\"b\":2,\"\":3}\n{\"a\":4}\n", out->str);
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, true);
+	CuAssertStrEquals(tc, "[\"a\",\"b\"]\n[1,2,3]\n[4]\n", out->str);
+
+	d_string_free(test, true);
+	tdp_context_free(c);
+}
+
+
+void Test_tdp_context_columns(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("a,b,c\n1,\"\",\"x \"\"y\"\"\"\n2,3,4,5\n6");
+	DString * out;
+
+	tdp_context_set_type_sample(c, 0);
+	tdp_context_set_json_style(c, TDP_JSON_COLUMNS);
+
+	// Extra and missing fields are padded with null
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "{\n\t\"a\": [1, 2, 6],\n\t\"b\": [\"\", 3, null],\n\t\"c\": [\"x \\\"y\\\"\", 4, null],\n\t\"\": [null, 5, null]\n}\n", out->str);
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, true);
+	CuAssertStrEquals(tc, "[\n\t[\"a\", 1, 2, 6],\n\t[\"b\", \"\", 3, null],\n\t[\"c\", \"x \\\"y\\\"\", 4, null],\n\t[null, null, 5, null]\n]\n", out->str);
+
+	// Columns larger than the spill threshold
+	d_string_erase(test, 0, test->currentStringLength);
+	d_string_append(test, "n,s\n");
+
+	for (int i = 0; i < 20000; ++i) {
+		d_string_append_printf(test, "%d,v%d\n", i, i);
+	}
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertTrue(tc, strncmp(out->str, "{\n\t\"n\": [0, 1, 2, ", 17) == 0);
+	CuAssertPtrNotNull(tc, strstr(out->str, ", 19999],\n\t\"s\": [\"v0\", \"v1\", "));
+	CuAssertPtrNotNull(tc, strstr(out->str, "\"v19998\", \"v19999\"]\n}\n"));
+
+	d_string_free(test, true);
+	tdp_context_free(c);
+}
+
+
+void Test_tdp_context_template(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("name,amount,overdue\n\"Smith & \"\"Sons\"\"\",12.50,true\nJones,3,false\n<b>,\"\",\"\"");
+	const char * text = "Dear {{name}},\n{{#overdue}}\nPay {{amount}} now.\n{{/overdue}}\n{{^amount}}Nothing due.\n{{/amount}}";
+	tdp_template * view = tdp_template_parse(text, strlen(text));
+	DString * out;
+
+	tdp_context_set_template(c, view);
+	tdp_context_set_output_format(c, TDP_OUTPUT_MUSTACHE);
+
+	// Rendered once per record
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "Dear Smith &amp; &quot;Sons&quot;,\nPay 12.50 now.\nDear Jones,\nDear &lt;b&gt;,\nNothing due.\n", out->str);
+	tdp_template_free(view);
+
+	// Loop over records, with unescaped values
+	text = "<ul>\n{{#records}}\n  <li>{{{name}}}{{#missing}}!{{/missing}}</li>\n{{/records}}\n</ul>\n{{^records}}empty{{/records}}";
+	view = tdp_template_parse(text, strlen(text));
+	tdp_context_set_template(c, view);
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "<ul>\n  <li>Smith & \"Sons\"</li>\n  <li>Jones</li>\n  <li><b></li>\n</ul>\n", out->str);
+
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "name,amount\n");
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "<ul>\n</ul>\nempty", out->str);
+
+	// No template
+	tdp_context_set_template(c, NULL);
+	CuAssertPtrEquals(tc, NULL, tdp_context_to_json(c, test, FORMAT_CSV, false));
+
+	tdp_template_free(view);
+	d_string_free(test, true);
+	tdp_context_free(c);
+}
+
+
+void Test_tdp_context_types(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("zip,n,x,b,e\n08123,1,1,true,\"\"\n10001,2.5,1.2.3,false,\"\"\n90210,\"\",3,true,\"\"");
+	DString * out;
+
+	tdp_context_set_json_style(c, TDP_JSON_LINES);
+
+	// Whole column
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "{\"zip\":\"08123\",\"n\":1,\"x\":\"1\",\"b\":true,\"e\":null}\n"
+					  "{\"zip\":\"10001\",\"n\":2.5,\"x\":\"1.2.3\",\"b\":false,\"e\":null}\n"
+					  "{\"zip\":\"90210\",\"n\":null,\"x\":\"3\",\"b\":true,\"e\":null}\n", out->str);
+	CuAssertIntEquals(tc, TDP_TYPE_STRING, c->column_types[0]);
+	CuAssertIntEquals(tc, TDP_TYPE_FLOAT, c->column_types[1]);
+	CuAssertIntEquals(tc, TDP_TYPE_STRING, c->column_types[2]);
+	CuAssertIntEquals(tc, TDP_TYPE_BOOL, c->column_types[3]);
+	CuAssertIntEquals(tc, TDP_TYPE_NULL, c->column_types[4]);
+
+	// Sample of first record -- invalid numbers are still strings
+	tdp_context_set_type_sample(c, 1);
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "{\"zip\":\"08123\",\"n\":1,\"x\":1,\"b\":true,\"e\":null}\n"
+					  "{\"zip\":\"10001\",\"n\":2.5,\"x\":\"1.2.3\",\"b\":false,\"e\":null}\n"
+					  "{\"zip\":\"90210\",\"n\":null,\"x\":3,\"b\":true,\"e\":null}\n", out->str);
+	d_string_free(test, true);
+
+	// Integers that overflow int64 make the column FLOAT, so binary
+	// formats can still store them
+	tdp_context_set_type_sample(c, TDP_SAMPLE_ALL);
+	test = d_string_new("big\n1\n99999999999999999999\n");
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "{\"big\":1}\n{\"big\":99999999999999999999}\n", out->str);
+	CuAssertIntEquals(tc, TDP_TYPE_FLOAT, c->column_types[0]);
+
+	d_string_free(test, true);
+	tdp_context_free(c);
+}
+
+
+void Test_tdp_context_schema(CuTest * tc) {
+	const char * text = "zip string\nn int nullable\nx float default=-1\nok bool\n";
+	tdp_schema * schema = tdp_schema_parse(text, strlen(text));
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("zip,n,x,ok,other\n08123,1,2,true,3\n10001,\"\",abc,yes,4.5\n7,2.5,3.25,false,\"\"");
+	DString * out;
+
+	tdp_context_set_schema(c, schema);
+	tdp_context_set_json_style(c, TDP_JSON_LINES);
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "{\"zip\":\"08123\",\"n\":1,\"x\":2,\"ok\":true,\"other\":3}\n"
+					  "{\"zip\":\"10001\",\"n\":null,\"x\":-1,\"ok\":false,\"other\":4.5}\n"
+					  "{\"zip\":\"7\",\"n\":null,\"x\":3.25,\"ok\":false,\"other\":null}\n", out->str);
+
+	// Header row is still written as strings
+	out = tdp_context_to_json(c, test, FORMAT_CSV, true);
+	CuAssertStrEquals(tc, "[\"zip\",\"n\",\"x\",\"ok\",\"other\"]\n"
+					  "[\"08123\",1,2,true,3]\n"
+					  "[\"10001\",null,-1,false,4.5]\n"
+					  "[\"7\",null,3.25,false,null]\n", out->str);
+
+	d_string_free(test, true);
+	tdp_context_free(c);
+	tdp_schema_free(schema);
+}
+
+
+void Test_tdp_context_escape(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("a,b\n\"x\x01y\",caf\xc3\xa9\n\"\\\"\"\",\xf0\x9f\x98\x80");
+	DString * out;
+
+	tdp_context_set_json_style(c, TDP_JSON_LINES);
+
+	// Control characters are always escaped
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "{\"a\":\"x\\u0001y\",\"b\":\"caf\xc3\xa9\"}\n{\"a\":\"\\\\\\\"\",\"b\":\"\xf0\x9f\x98\x80\"}\n", out->str);
+
+	// ASCII only
+	tdp_context_set_ascii_only(c, true);
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, "{\"a\":\"x\\u0001y\",\"b\":\"caf\\u00e9\"}\n{\"a\":\"\\\\\\\"\",\"b\":\"\\ud83d\\ude00\"}\n", out->str);
+
+	d_string_free(test, true);
+	tdp_context_free(c);
+}
+
+
+void Test_tdp_context_binary(CuTest * tc) {
+	const char * text = "x float default=-1\n";
+	tdp_schema * schema = tdp_schema_parse(text, strlen(text));
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("n,x,s,ok\n1,2.5,\"a\"\"b\",true\n-300,\"\",caf\xc3\xa9,false\n");
+	DString * out;
+
+	tdp_context_set_output_format(c, TDP_OUTPUT_MSGPACK);
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+
+	const char msgpack[] = "\x92"
+		"\x84\xa1n\x01\xa1x\xcb\x40\x04\x00\x00\x00\x00\x00\x00\xa1s\xa3" "a\"b" "\xa2ok\xc3"
+		"\x84\xa1n\xd1\xfe\xd4\xa1x\xc0\xa1s\xa5" "caf\xc3\xa9" "\xa2ok\xc2";
+	CuAssertIntEquals(tc, sizeof(msgpack) - 1, out->currentStringLength);
+	CuAssertTrue(tc, memcmp(msgpack, out->str, sizeof(msgpack) - 1) == 0);
+
+	// Header row as an array of strings
+	tdp_context_set_output_format(c, TDP_OUTPUT_CBOR);
+	out = tdp_context_to_json(c, test, FORMAT_CSV, true);
+
+	const char cbor[] = "\x83"
+		"\x84\x61n\x61x\x61s\x62ok"
+		"\x84\x01\xfb\x40\x04\x00\x00\x00\x00\x00\x00\x63" "a\"b" "\xf5"
+		"\x84\x39\x01\x2b\xf6\x65" "caf\xc3\xa9" "\xf4";
+	CuAssertIntEquals(tc, sizeof(cbor) - 1, out->currentStringLength);
+	CuAssertTrue(tc, memcmp(cbor, out->str, sizeof(cbor) - 1) == 0);
+
+	// Schema default, and records without an enclosing array
+	tdp_context_set_output_format(c, TDP_OUTPUT_MSGPACK);
+	tdp_context_set_json_style(c, TDP_JSON_LINES);
+	tdp_context_set_schema(c, schema);
+	tdp_context_set_type_sample(c, 0);
+	out = tdp_context_to_json(c, test, FORMAT_CSV, true);
+
+	const char lines[] = "\x94\xa1n\xa1x\xa1s\xa2ok"
+		"\x94\x01\xcb\x40\x04\x00\x00\x00\x00\x00\x00\xa3" "a\"b" "\xc3"
+		"\x94\xd1\xfe\xd4\xcb\xbf\xf0\x00\x00\x00\x00\x00\x00\xa5" "caf\xc3\xa9" "\xc2";
+	CuAssertIntEquals(tc, sizeof(lines) - 1, out->currentStringLength);
+	CuAssertTrue(tc, memcmp(lines, out->str, sizeof(lines) - 1) == 0);
+
+	d_string_free(test, true);
+	tdp_context_free(c);
+	tdp_schema_free(schema);
+}
+
+
+static bool count_flush(const char * data, size_t len, void * user) {
+	DString * out = user;
+
+	// Remember number of flushes in the first byte
+	out->str[0]++;
+	d_string_append_c_array(out, data, len);
+	return true;
+}
+
+
+void Test_tdp_context_write_json(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("a,b,c\n");
+	DString * streamed = d_string_new("*");
+
+	// Large enough to require several flushes
+	for (int i = 0; i < 3000; ++i) {
+		d_string_append_printf(test, "%d,\"text %d\",two\n", i, i);
+	}
+
+	d_string_append(test, "end,of,file");
+
+	CuAssertIntEquals(tc, true, tdp_context_write_json(c, test, FORMAT_CSV, false, count_flush, streamed));
+	CuAssertTrue(tc, streamed->str[0] > '*' + 2);
+
+	DString * out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertStrEquals(tc, out->str, &streamed->str[1]);
+
+	d_string_free(streamed, true);
+	d_string_free(test, true);
+	tdp_context_free(c);
+}
+
+
+void Test_tdp_context_rope(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("id,name\n");
+	DString * joined = d_string_new("");
+	DString * out;
+	tdp_rope * r;
+	size_t len;
+
+	for (int i = 0; i < 1000; ++i) {
+		d_string_append_printf(test, "%d,\"name %d\"\n", i, i);
+	}
+
+	r = tdp_context_to_rope(c, test, FORMAT_CSV, false);
+	CuAssertPtrNotNull(tc, r);
+	CuAssertIntEquals(tc, 1, tdp_rope_page_count(r));
+	tdp_rope_free(r);
+
+	// Several pages
+	r = tdp_rope_new(4096);
+	CuAssertIntEquals(tc, true, tdp_context_write_json(c, test, FORMAT_CSV, false, tdp_rope_write, r));
+	CuAssertTrue(tc, tdp_rope_page_count(r) > 1);
+
+	for (size_t i = 0; i < tdp_rope_page_count(r); ++i) {
+		const char * page = tdp_rope_page(r, i, &len);
+		d_string_append_c_array(joined, page, len);
+	}
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertIntEquals(tc, out->currentStringLength, tdp_rope_length(r));
+	CuAssertStrEquals(tc, out->str, joined->str);
+
+	tdp_rope_free(r);
+	d_string_free(joined, true);
+	d_string_free(test, true);
+	tdp_context_free(c);
+}
+
+
+/// Read 64-bit little-endian value from record index
+static size_t index_value(DString * index, size_t pos) {
+	size_t value = 0;
+
+	for (int i = 7; i >= 0; --i) {
+		value = (value << 8) | (unsigned char) index->str[pos + i];
+	}
+
+	return value;
+}
+
+
+void Test_tdp_context_index(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("id,name\n1,a\n2,\"b\"\n3,c");
+	DString * index = d_string_new("");
+	DString * out;
+
+	CuAssertIntEquals(tc, true, tdp_context_set_index(c, 2, append_to_string, index));
+
+	out = tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertIntEquals(tc, 40 + 2 * 16, index->currentStringLength);
+	CuAssertIntEquals(tc, 2, index_value(index, 8));
+
+	// Records 0 and 2
+	CuAssertIntEquals(tc, 0, strncmp(&out->str[index_value(index, 16)], "\t{\n\t\t\"id\": 1,", 13));
+	CuAssertIntEquals(tc, 8, index_value(index, 24));
+	CuAssertIntEquals(tc, 0, strncmp(&out->str[index_value(index, 32)], "\t{\n\t\t\"id\": 3,", 13));
+	CuAssertIntEquals(tc, 18, index_value(index, 40));
+
+	// Lengths and record count
+	CuAssertIntEquals(tc, out->currentStringLength, index_value(index, 48));
+	CuAssertIntEquals(tc, test->currentStringLength, index_value(index, 56));
+	CuAssertIntEquals(tc, 3, index_value(index, 64));
+
+	// Each document has its own index
+	d_string_erase(index, 0, -1);
+	tdp_context_set_json_style(c, TDP_JSON_LINES);
+	out = tdp_context_to_json(c, test, FORMAT_CSV, true);
+	CuAssertIntEquals(tc, 40 + 2 * 16, index->currentStringLength);
+	CuAssertIntEquals(tc, 0, strncmp(&out->str[index_value(index, 32)], "[3,\"c\"]\n", 8));
+
+	// Stop indexing
+	d_string_erase(index, 0, -1);
+	tdp_context_set_index(c, 0, NULL, NULL);
+	tdp_context_to_json(c, test, FORMAT_CSV, false);
+	CuAssertIntEquals(tc, 0, index->currentStringLength);
+
+	d_string_free(index, true);
+	d_string_free(test, true);
+	tdp_context_free(c);
+}
+
+
+/// Read the contents of a temporary file
+static DString * read_shard(FILE * file) {
+	DString * result = d_string_new("");
+	char buffer[256];
+	size_t len;
+
+	rewind(file);
+
+	while ((len = fread(buffer, 1, sizeof(buffer), file))) {
+		d_string_append_c_array(result, buffer, len);
+	}
+
+	return result;
+}
+
+
+/// Shard `test` into three temporary files and return them, concatenated
+/// with `|` between them
+static DString * write_shards(tdp_context * c, DString * test, bool array_out, const char * key) {
+	DString * result = d_string_new("");
+	FILE * files[3];
+	int fds[3];
+
+	for (int i = 0; i < 3; ++i) {
+		files[i] = tmpfile();
+		fds[i] = fileno(files[i]);
+	}
+
+	if (!tdp_context_write_json_shards(c, test, FORMAT_CSV, array_out, fds, 3, key)) {
+		d_string_append(result, "failed");
+	}
+
+	for (int i = 0; i < 3; ++i) {
+		DString * shard = read_shard(files[i]);
+
+		if (i) {
+			d_string_append_c(result, '|');
+		}
+
+		d_string_append(result, shard->str);
+		d_string_free(shard, true);
+		fclose(files[i]);
+	}
+
+	return result;
+}
+
+
+void Test_tdp_context_shards(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("id,name\n1,a\n2,b\n3,c\n4,a\n5,\"a\"");
+	DString * out;
+
+	// Round-robin
+	tdp_context_set_json_style(c, TDP_JSON_COMPACT);
+	out = write_shards(c, test, false, NULL);
+	CuAssertStrEquals(tc, "[{\"id\":1,\"name\":\"a\"},{\"id\":4,\"name\":\"a\"}]\n|[{\"id\":2,\"name\":\"b\"},{\"id\":5,\"name\":\"a\"}]\n|[{\"id\":3,\"name\":\"c\"}]\n", out->str);
+	d_string_free(out, true);
+
+	// By key -- every "a" in one shard
+	tdp_context_set_json_style(c, TDP_JSON_LINES);
+	out = write_shards(c, test, false, "name");
+	CuAssertTrue(tc, strncmp(out->str, "failed", 6) != 0);
+
+	char * first = strstr(out->str, "{\"id\":1,\"name\":\"a\"}\n");
+	char * end = first ? strchr(first, '|') : NULL;
+
+	CuAssertPtrNotNull(tc, first);
+	end = end ? end : first + strlen(first);
+	CuAssertPtrNotNull(tc, strstr(first, "{\"id\":4,\"name\":\"a\"}\n"));
+	CuAssertPtrNotNull(tc, strstr(first, "{\"id\":5,\"name\":\"a\"}\n"));
+	CuAssertTrue(tc, strstr(first, "{\"id\":4,\"name\":\"a\"}\n") < end);
+	CuAssertTrue(tc, strstr(first, "{\"id\":5,\"name\":\"a\"}\n") < end);
+	d_string_free(out, true);
+
+	// Header row starts each shard; empty shards are still valid
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "id\n1");
+	tdp_context_set_json_style(c, TDP_JSON_PRETTY);
+	out = write_shards(c, test, true, NULL);
+	CuAssertStrEquals(tc, "[\n\t[\n\t\t\"id\"\n\t],\n\t[\n\t\t1\n\t]\n]\n|[\n\t[\n\t\t\"id\"\n\t]\n]\n|[\n\t[\n\t\t\"id\"\n\t]\n]\n", out->str);
+	d_string_free(out, true);
+
+	out = write_shards(c, test, false, NULL);
+	CuAssertStrEquals(tc, "[\n\t{\n\t\t\"id\": 1\n\t}\n]\n|[\n]\n|[\n]\n", out->str);
+	d_string_free(out, true);
+
+	// Unknown key, or a style that can't be sharded
+	out = write_shards(c, test, false, "missing");
+	CuAssertStrEquals(tc, "failed||", out->str);
+	d_string_free(out, true);
+
+	tdp_context_set_json_style(c, TDP_JSON_COLUMNS);
+	out = write_shards(c, test, false, NULL);
+	CuAssertStrEquals(tc, "failed||", out->str);
+	d_string_free(out, true);
+
+	d_string_free(test, true);
+	tdp_context_free(c);
+}
+
+
+#ifdef HAVE_SQLITE3
+/// Run `sql` and return the first column of the first row as text
+static DString * query_text(sqlite3 * db, const char * sql) {
+	DString * result = d_string_new("");
+	sqlite3_stmt * statement;
+
+	if (sqlite3_prepare_v2(db, sql, -1, &statement, NULL) == SQLITE_OK) {
+		if (sqlite3_step(statement) == SQLITE_ROW && sqlite3_column_text(statement, 0)) {
+			d_string_append(result, (const char *) sqlite3_column_text(statement, 0));
+		}
+
+		sqlite3_finalize(statement);
+	}
+
+	return result;
+}
+#endif
+
+
+void Test_tdp_context_sqlite(CuTest * tc) {
+	tdp_context * c = tdp_context_new();
+	DString * test = d_string_new("id,name,score,flag,\"odd \"\"name\"\"\"\n1,\"a, b\",1.5,true,x\n2,\"x \"\"y\"\"\",2,false,\"\"\n3,plain,\"\",true");
+#ifdef HAVE_SQLITE3
+	DString * result;
+	sqlite3 * db;
+
+	CuAssertIntEquals(tc, SQLITE_OK, sqlite3_open(":memory:", &db));
+
+	// Commit after every record
+	tdp_context_set_batch_size(c, 1);
+
+	CuAssertTrue(tc, tdp_context_load_sqlite(c, test, FORMAT_CSV, db, "my table"));
+	CuAssertTrue(tc, sqlite3_get_autocommit(db));
+
+	result = query_text(db, "SELECT sql FROM sqlite_master");
+	CuAssertStrEquals(tc, "CREATE TABLE \"my table\" (\"id\" INTEGER, \"name\" TEXT, \"score\" REAL, \"flag\" INTEGER, \"odd \"\"name\"\"\" TEXT)", result->str);
+	d_string_free(result, true);
+
+	result = query_text(db, "SELECT group_concat(id || ':' || typeof(id) || ':' || name || ':' || coalesce(score, 'null') || ':' || flag, '|') FROM \"my table\"");
+	CuAssertStrEquals(tc, "1:integer:a, b:1.5:1|2:integer:x \"y\":2.0:0|3:integer:plain:null:1", result->str);
+	d_string_free(result, true);
+
+	// Appending to the same table, in the caller's transaction
+	sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+	CuAssertTrue(tc, tdp_context_load_sqlite(c, test, FORMAT_CSV, db, "my table"));
+	CuAssertTrue(tc, !sqlite3_get_autocommit(db));
+	sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+
+	result = query_text(db, "SELECT count(*) FROM \"my table\"");
+	CuAssertStrEquals(tc, "6", result->str);
+	d_string_free(result, true);
+
+	// Constraint violation rolls back the current transaction
+	sqlite3_exec(db, "CREATE TABLE strict (id INTEGER PRIMARY KEY, name TEXT NOT NULL)", NULL, NULL, NULL);
+	d_string_erase(test, 0, -1);
+	d_string_append(test, "id,name\n1,one\n2,two\n2,again");
+	tdp_context_set_batch_size(c, 0);
+
+	CuAssertTrue(tc, !tdp_context_load_sqlite(c, test, FORMAT_CSV, db, "strict"));
+	CuAssertTrue(tc, sqlite3_get_autocommit(db));
+	CuAssertPtrNotNull(tc, strstr(sqlite3_errmsg(db), "UNIQUE"));
+
+	result = query_text(db, "SELECT count(*) FROM strict");
+	CuAssertStrEquals(tc, "0", result->str);
+	d_string_free(result, true);
+
+	sqlite3_close(db);
+#else
+	// Built without SQLite
+	CuAssertTrue(tc, !tdp_context_load_sqlite(c, test, FORMAT_CSV, NULL, "data"));
+#endif
+
+	d_string_free(test, true);
+	tdp_context_free(c);
+}
+#endif
+
+
+/// What converting a document needs, found by scanning it without creating
+/// any tokens
+struct scan_counts {
+	size_t			tokens;				//!< Most tokens in use at once
+	size_t			columns;			//!< Most fields in a record (quoted delimiters included)
+	size_t			header_len;			//!< Length of first record
+};
+
+
+/// Scan `source` the way tokenize_text() does, counting the tokens it
+/// creates.  While parsing, each field and record gets a token, but each
+/// delimiter is freed (and reused) when its field is reduced -- which
+/// leaves one extra token per record, plus one in flight.
+static void count_tokens(const char * source, size_t len, short format, struct scan_counts * counts) {
+	Scanner s;
+	const char * stop = source + len;
+	const char * last_stop = source;
+	size_t records = 1;
+	size_t fields = 1;
+	bool quoted = false;
+	int type;
+
+	s.start = source;
+	s.cur = source;
+
+	counts->tokens = 2;					// Root and end of file
+	counts->columns = 1;
+	counts->header_len = len;
+
+	do {
+		type = (format == FORMAT_TSV) ? scan_tsv(&s, stop) : scan_csv(&s, stop);
+
+		if ((s.start != last_stop) || ((type == 0) && (stop > last_stop))) {
+			// Skipped text
+			counts->tokens++;
+		}
+
+		if (type) {
+			counts->tokens++;
+		}
+
+		switch (type) {
+			case ESCAPE:
+				quoted = !quoted;
+				break;
+
+			case FIELD_DELIMITER:
+				if (++fields > counts->columns) {
+					counts->columns = fields;
+				}
+
+				break;
+
+			case RECORD_DELIMITER:
+				if (quoted) {
+					break;
+				}
+
+				if (records == 1) {
+					counts->header_len = (size_t)(s.start - source);
+				}
+
+				records++;
+				fields = 1;
+				break;
+		}
+
+		last_stop = s.cur;
+	} while (type != 0);
+
+	counts->tokens += records + 1;
+}
+
+
+/// Upper bound on the scratch memory used for header keys, which can only
+/// be counted exactly once there is room for the tokens
+static size_t estimate_key_scratch(const struct scan_counts * counts) {
+	// Each key is indentation, quotes and separator, and the name escaped
+	// (at most 6 bytes for each byte)
+	return counts->columns * (tdp_arena_cost(sizeof(column_key) + 8) + tdp_arena_cost(0)) + 6 * counts->header_len;
+}
+
+
+/// Convert tabular data to JSON using only caller provided memory
+enum tdp_status tdp_to_json_buffer(const char * source, size_t len, short format, bool array_out,
+	char * out, size_t out_size, void * scratch, size_t scratch_size, size_t * needed) {
+	struct scan_counts counts;
+	tdp_arena arena;
+	tdp_context * context;
+	simple_token * t;
+	sink s;
+
+	if ((format != FORMAT_CSV) && (format != FORMAT_TSV)) {
+		return TDP_INVALID_FORMAT;
+	}
+
+	count_tokens(source, len, format, &counts);
+	sink_init_buffer(&s, out, out_size);
+
+	// Everything is allocated from the scratch buffer, so nothing needs to
+	// be freed afterwards
+	tdp_arena_init(&arena, scratch, scratch_size);
+
+	context = tdp_context_new_with_allocator(&arena.allocator);
+
+	if (context) {
+		tdp_context_reserve_columns(context, counts.columns);
+	}
+
+	if (context && token_pool_reserve(context->pool, counts.tokens)) {
+		// Every token fits, so the conversion runs to the end even if the
+		// arena runs short, and counts everything else it needs
+		t = tokenize_text(context, source, 0, len, format);
+		parse_tdp_token_chain(context, t);
+		prepare_columns(context, t, source);
+		export_tree_to_pretty_json(&s, t, source, context, array_out);
+	} else {
+		// Add what could not be requested
+		if (context == NULL) {
+			arena.shortfall += tdp_arena_cost(counts.columns * sizeof(short)) + 2 * tdp_arena_cost(counts.columns * sizeof(void *)) +
+				tdp_arena_cost(sizeof(struct token_pool_block) + counts.tokens * sizeof(simple_token));
+		}
+
+		arena.shortfall += estimate_key_scratch(&counts);
+	}
+
+	if (arena.shortfall) {
+		if (needed) {
+			*needed = tdp_arena_needed(&arena);
+		}
+
+		return TDP_SCRATCH_TOO_SMALL;
+	}
+
+	if (!sink_finish(&s)) {
+		if (needed) {
+			*needed = s.total + 1;
+		}
+
+		return TDP_OUTPUT_TOO_SMALL;
+	}
+
+	if (needed) {
+		*needed = s.total + 1;
+	}
+
+	return TDP_SUCCESS;
+}
+
+
+#ifdef TEST
+void Test_tdp_to_json_buffer(CuTest * tc) {
+	const char * source = "foo,bar\none,two\n1,2";
+	const char * expected = "[\n\t{\n\t\t\"foo\": \"one\",\n\t\t\"bar\": \"two\"\n\t},\n\t{\n\t\t\"foo\": \"1\",\n\t\t\"bar\": \"2\"\n\t}\n]\n";
+	char out[256];
+	char small[8];
+	static char scratch[64 * 1024];
+	size_t needed = 0;
+
+	CuAssertIntEquals(tc, TDP_SUCCESS, tdp_to_json_buffer(source, strlen(source), FORMAT_CSV, false, out, sizeof(out), scratch, sizeof(scratch), &needed));
+	CuAssertStrEquals(tc, expected, out);
+	CuAssertIntEquals(tc, strlen(expected) + 1, needed);
+
+	// Output buffer too small
+	CuAssertIntEquals(tc, TDP_OUTPUT_TOO_SMALL, tdp_to_json_buffer(source, strlen(source), FORMAT_CSV, false, small, sizeof(small), scratch, sizeof(scratch), &needed));
+	CuAssertIntEquals(tc, strlen(expected) + 1, needed);
+
+	// Scratch buffer too small
+	CuAssertIntEquals(tc, TDP_SCRATCH_TOO_SMALL, tdp_to_json_buffer(source, strlen(source), FORMAT_CSV, false, out, sizeof(out), scratch, 512, &needed));
+	CuAssertTrue(tc, needed > 512);
+
+	// One retry with the size reported is enough, however short the
+	// scratch buffer was
+	for (size_t size = 0; size < 8192; size += 64) {
+		if (tdp_to_json_buffer(source, strlen(source), FORMAT_CSV, false, out, sizeof(out), scratch, size, &needed) == TDP_SCRATCH_TOO_SMALL) {
+			CuAssertTrue(tc, needed > size);
+			CuAssertIntEquals(tc, TDP_SUCCESS, tdp_to_json_buffer(source, strlen(source), FORMAT_CSV, false, out, sizeof(out), scratch, needed, &needed));
+		}
+	}
+
+	CuAssertIntEquals(tc, TDP_INVALID_FORMAT, tdp_to_json_buffer(source, strlen(source), 99, false, out, sizeof(out), scratch, sizeof(scratch), NULL));
+}
+#endif
+
+
+/// Convert tabular data to JSON using a temporary context
+static DString * convert_to_json(DString * source, short format, bool array_out) {
+	tdp_context * context = tdp_context_new();
+	DString * json = NULL;
+
+	if (context) {
+		if (tdp_context_to_json(context, source, format, array_out)) {
+			json = tdp_context_take_output(context);
+		}
+
+		tdp_context_free(context);
+	}
+
+	return json;
+}
+
+
+/// Convert CSV text to JSON
+DString * csv_to_json(DString * source, bool array_out) {
+	return convert_to_json(source, FORMAT_CSV, array_out);
+}
+
+
+/// Convert TSV text to JSON
+DString * tsv_to_json(DString * source, bool array_out) {
+	return convert_to_json(source, FORMAT_TSV, array_out);
 }
@@ -0,0 +1,187 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file record_index.c
+
+	@brief Per-column output buffers that spill to a temporary file.  All
+	columns share one file; each column keeps a list of its chunks, which
+	are read back in order when the column is copied.
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+
+#include <string.h>
+
+#include "record_index.h"
+
+
+/// Write `value` as 64-bit little-endian
+static void write_u64(sink * out, uint64_t value) {
+	char bytes[8];
+
+	for (int i = 0; i < 8; ++i) {
+		bytes[i] = (char)(value >> (8 * i));
+	}
+
+	sink_write(out, bytes, 8);
+}
+
+
+/// Create an index writer
+record_index * record_index_new(const tdp_allocator * allocator, size_t stride, sink_flush_callback write, void * user) {
+	record_index * x = tdp_malloc(allocator, sizeof(record_index));
+
+	if (x) {
+		x->allocator = allocator;
+		x->stride = stride ? stride : 1;
+		x->records = 0;
+
+		sink_init_callback(&x->out, x->buffer, kRecordIndexBufferSize, write, user);
+	}
+
+	return x;
+}
+
+
+/// Free index writer
+void record_index_free(record_index * x) {
+	if (x) {
+		tdp_free(x->allocator, x);
+	}
+}
+
+
+/// Start the index for a new document
+void record_index_begin(record_index * x) {
+	char version[4] = { kRecordIndexVersion, 0, 0, 0 };
+
+	x->records = 0;
+	sink_init_callback(&x->out, x->buffer, kRecordIndexBufferSize, x->out.flush, x->out.user);
+
+	sink_write(&x->out, kRecordIndexMagic, 4);
+	sink_write(&x->out, version, 4);
+	write_u64(&x->out, x->stride);
+}
+
+
+/// Note where a record starts
+void record_index_add(record_index * x, uint64_t output, uint64_t input) {
+	if (x->records % x->stride == 0) {
+		write_u64(&x->out, output);
+		write_u64(&x->out, input);
+	}
+
+	x->records++;
+}
+
+
+/// Finish the index for the current document
+bool record_index_finish(record_index * x, uint64_t output, uint64_t input) {
+	write_u64(&x->out, output);
+	write_u64(&x->out, input);
+	write_u64(&x->out, x->records);
+
+	return sink_finish(&x->out);
+}
+
+
+#ifdef TEST
+#include "d_string.h"
+
+static bool append_index(const char * data, size_t len, void * user) {
+	d_string_append_c_array(user, data, len);
+	return true;
+}
+
+
+/// Read 64-bit little-endian value at `pos`
+static uint64_t read_u64(DString * d, size_t pos) {
+	uint64_t value = 0;
+
+	for (int i = 7; i >= 0; --i) {
+		value = (value << 8) | (unsigned char) d->str[pos + i];
+	}
+
+	return value;
+}
+
+
+void Test_record_index(CuTest * tc) {
+	DString * d = d_string_new("");
+	record_index * x = record_index_new(NULL, 1000, append_index, d);
+
+	// Enough entries to flush the buffer more than once
+	for (int document = 0; document < 2; ++document) {
+		d_string_erase(d, 0, -1);
+		record_index_begin(x);
+
+		for (uint64_t i = 0; i < 500000; ++i) {
+			record_index_add(x, i * 10, i * 7 + 1);
+		}
+
+		CuAssertIntEquals(tc, true, record_index_finish(x, 5000000, 3500001));
+
+		CuAssertIntEquals(tc, 40 + 500 * 16, d->currentStringLength);
+		CuAssertIntEquals(tc, 0, memcmp(d->str, "TDPI\x01\0\0\0", 8));
+		CuAssertIntEquals(tc, 1000, read_u64(d, 8));
+
+		// Record 2000
+		CuAssertIntEquals(tc, 20000, read_u64(d, 16 + 2 * 16));
+		CuAssertIntEquals(tc, 14001, read_u64(d, 16 + 2 * 16 + 8));
+
+		// Trailer
+		CuAssertIntEquals(tc, 5000000, read_u64(d, d->currentStringLength - 24));
+		CuAssertIntEquals(tc, 3500001, read_u64(d, d->currentStringLength - 16));
+		CuAssertIntEquals(tc, 500000, read_u64(d, d->currentStringLength - 8));
+	}
+
+	record_index_free(x);
+	d_string_free(d, true);
+}
+#endif
@@ -0,0 +1,137 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file record_index.h
+
+	@brief Sidecar index of the byte offset of each record in the output, so
+	that readers can seek to a record without parsing everything before it.
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#ifndef RECORD_INDEX_TDP_PARSER_H
+#define RECORD_INDEX_TDP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+#include "allocator.h"
+#include "sink.h"
+
+
+#define kRecordIndexMagic "TDPI"		//!< First bytes of an index
+#define kRecordIndexVersion 1			//!< Index format version
+#define kRecordIndexBufferSize 4096		//!< Size of buffer used for index output
+
+
+/// Writes an index of where records start, as they are exported.  All
+/// numbers are unsigned 64-bit little-endian, except the version:
+///
+///	"TDPI" magic, version (32-bit), stride
+///	output offset, input offset		-- for records 0, stride, 2 * stride, ...
+///	output length, input length, record count
+///
+/// Records are numbered from 0, not counting the header row.  The number
+/// of entries is (file size - 40) / 16.
+struct record_index {
+	const tdp_allocator	*	allocator;	//!< Allocator used for all storage
+	size_t			stride;				//!< Index every `stride`th record
+
+	sink			out;				//!< Index output
+	char			buffer[kRecordIndexBufferSize];	//!< Buffer for index output
+	size_t			records;			//!< Records seen in current document
+};
+
+typedef struct record_index record_index;
+
+
+/// Create an index writer that passes index output to `write`
+record_index * record_index_new(
+	const tdp_allocator * allocator,	//!< Allocator to use (NULL to use heap)
+	size_t stride,						//!< Index every `stride`th record (0 for every record)
+	sink_flush_callback write,			//!< Receives index output
+	void * user							//!< Passed to `write`
+);
+
+
+/// Free index writer
+void record_index_free(
+	record_index * x					//!< Index writer to be freed
+);
+
+
+/// Start the index for a new document
+void record_index_begin(
+	record_index * x					//!< Index writer
+);
+
+
+/// Note that a record starts at `output` bytes into the output, and
+/// `input` bytes into the source text
+void record_index_add(
+	record_index * x,					//!< Index writer
+	uint64_t output,					//!< Output offset
+	uint64_t input						//!< Input offset
+);
+
+
+/// Finish the index for the current document.  Returns false if index
+/// output could not be written.
+bool record_index_finish(
+	record_index * x,					//!< Index writer
+	uint64_t output,					//!< Output length
+	uint64_t input						//!< Input length
+);
+
+
+#endif
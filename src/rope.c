@@ -0,0 +1,375 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file rope.c
+
+	@brief Output buffer made of fixed size pages, so that large output can
+	be built without ever moving it to a larger contiguous buffer.
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(__WIN32)
+	#include <sys/uio.h>
+#endif
+
+#include "rope.h"
+#include "sink.h"
+
+
+/// Create an empty rope
+tdp_rope * tdp_rope_new(size_t page_size) {
+	return tdp_rope_new_with_allocator(NULL, page_size);
+}
+
+
+/// Create an empty rope using the specified allocator
+tdp_rope * tdp_rope_new_with_allocator(const tdp_allocator * allocator, size_t page_size) {
+	tdp_rope * r = tdp_malloc(allocator, sizeof(tdp_rope));
+
+	if (r) {
+		r->allocator = allocator;
+		r->page_size = page_size ? page_size : kRopePageSize;
+
+		r->pages = NULL;
+		r->count = 0;
+		r->capacity = 0;
+		r->last_len = 0;
+
+		r->length = 0;
+		r->fd = -1;
+		r->failed = false;
+	}
+
+	return r;
+}
+
+
+/// Free rope
+void tdp_rope_free(tdp_rope * r) {
+	if (r) {
+		for (size_t i = 0; i < r->count; ++i) {
+			tdp_free(r->allocator, r->pages[i]);
+		}
+
+		tdp_free(r->allocator, r->pages);
+		tdp_free(r->allocator, r);
+	}
+}
+
+
+/// Write a page to the rope's file descriptor
+static void write_page(tdp_rope * r, const char * page, size_t len) {
+	if (!r->failed && !sink_write_to_fd(page, len, (void *)(intptr_t) r->fd)) {
+		r->failed = true;
+	}
+}
+
+
+/// Write full pages to the rope's file descriptor.  The last page is kept
+/// (and emptied, if it was full) so that it can be reused.
+static void stream_full_pages(tdp_rope * r) {
+	if (r->count == 0) {
+		return;
+	}
+
+	for (size_t i = 0; i + 1 < r->count; ++i) {
+		write_page(r, r->pages[i], r->page_size);
+		tdp_free(r->allocator, r->pages[i]);
+	}
+
+	r->pages[0] = r->pages[r->count - 1];
+	r->count = 1;
+
+	if (r->last_len == r->page_size) {
+		write_page(r, r->pages[0], r->page_size);
+		r->last_len = 0;
+	}
+}
+
+
+/// Add an empty page to the end of the rope
+static bool add_page(tdp_rope * r) {
+	if (r->count == r->capacity) {
+		size_t capacity = r->capacity ? r->capacity * 2 : 16;
+		char ** pages = tdp_realloc(r->allocator, r->pages, capacity * sizeof(char *));
+
+		if (!pages) {
+			return false;
+		}
+
+		r->pages = pages;
+		r->capacity = capacity;
+	}
+
+	if ((r->pages[r->count] = tdp_malloc(r->allocator, r->page_size)) == NULL) {
+		return false;
+	}
+
+	r->count++;
+	r->last_len = 0;
+	return true;
+}
+
+
+/// Append bytes to rope
+bool tdp_rope_write(const char * data, size_t len, void * user) {
+	tdp_rope * r = user;
+	size_t room;
+
+	while (len && !r->failed) {
+		if ((r->count == 0) || (r->last_len == r->page_size)) {
+			if ((r->fd != -1) && r->count) {
+				// Write the full page and reuse it
+				stream_full_pages(r);
+			} else if (!add_page(r)) {
+				r->failed = true;
+				break;
+			}
+		}
+
+		room = r->page_size - r->last_len;
+
+		if (room > len) {
+			room = len;
+		}
+
+		memcpy(r->pages[r->count - 1] + r->last_len, data, room);
+		r->last_len += room;
+		r->length += room;
+		data += room;
+		len -= room;
+	}
+
+	return !r->failed;
+}
+
+
+/// Write pages to `fd` as they fill
+bool tdp_rope_stream_fd(tdp_rope * r, int fd) {
+	r->fd = fd;
+	stream_full_pages(r);
+
+	return !r->failed;
+}
+
+
+/// Write all pages still in the rope to `fd`
+bool tdp_rope_write_fd(const tdp_rope * r, int fd) {
+	size_t len;
+
+#if !defined(__WIN32)
+	struct iovec vectors[kSinkGatherVectors];
+	size_t count = 0;
+
+	for (size_t i = 0; i < r->count; ++i) {
+		vectors[count].iov_base = (void *) tdp_rope_page(r, i, &len);
+		vectors[count].iov_len = len;
+		count++;
+
+		if ((count == kSinkGatherVectors) || (i + 1 == r->count)) {
+			if (!sink_write_vectors_to_fd(fd, vectors, count)) {
+				return false;
+			}
+
+			count = 0;
+		}
+	}
+
+#else
+
+	for (size_t i = 0; i < r->count; ++i) {
+		const char * page = tdp_rope_page(r, i, &len);
+
+		if (!sink_write_to_fd(page, len, (void *)(intptr_t) fd)) {
+			return false;
+		}
+	}
+
+#endif
+
+	return true;
+}
+
+
+/// Pass pages to `write`, releasing each one afterwards
+bool tdp_rope_drain(tdp_rope * r, sink_flush_callback write, void * user) {
+	bool result = true;
+	size_t len;
+
+	for (size_t i = 0; i < r->count; ++i) {
+		tdp_rope_page(r, i, &len);
+
+		// Remaining pages are released even if a write fails
+		result = result && write(r->pages[i], len, user);
+		tdp_free(r->allocator, r->pages[i]);
+	}
+
+	r->count = 0;
+	r->last_len = 0;
+
+	return result;
+}
+
+
+/// Total bytes appended to rope
+size_t tdp_rope_length(const tdp_rope * r) {
+	return r->length;
+}
+
+
+/// Number of pages in rope
+size_t tdp_rope_page_count(const tdp_rope * r) {
+	return r->count;
+}
+
+
+/// Get page `index` of rope, and its length
+const char * tdp_rope_page(const tdp_rope * r, size_t index, size_t * len) {
+	if (index >= r->count) {
+		return NULL;
+	}
+
+	if (len) {
+		*len = (index + 1 == r->count) ? r->last_len : r->page_size;
+	}
+
+	return r->pages[index];
+}
+
+
+#ifdef TEST
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "d_string.h"
+
+static bool append_to_dstring(const char * data, size_t len, void * user) {
+	d_string_append_c_array(user, data, len);
+	return true;
+}
+
+
+void Test_rope(CuTest * tc) {
+	tdp_rope * r = tdp_rope_new(16);
+	DString * expected = d_string_new("");
+	char text[40];
+	size_t len;
+
+	// Writes that span pages
+	for (int i = 0; i < 100; ++i) {
+		snprintf(text, sizeof(text), "record %d,", i);
+		d_string_append(expected, text);
+		CuAssertIntEquals(tc, true, tdp_rope_write(text, strlen(text), r));
+	}
+
+	CuAssertIntEquals(tc, expected->currentStringLength, tdp_rope_length(r));
+	CuAssertIntEquals(tc, (expected->currentStringLength + 15) / 16, tdp_rope_page_count(r));
+	CuAssertPtrEquals(tc, NULL, (void *) tdp_rope_page(r, tdp_rope_page_count(r), &len));
+
+	// Pages in order
+	DString * joined = d_string_new("");
+
+	for (size_t i = 0; i < tdp_rope_page_count(r); ++i) {
+		const char * page = tdp_rope_page(r, i, &len);
+		CuAssertTrue(tc, len > 0 && len <= 16);
+		d_string_append_c_array(joined, page, len);
+	}
+
+	CuAssertStrEquals(tc, expected->str, joined->str);
+
+	// Drained into a copy, leaving the rope empty
+	tdp_rope * copy = tdp_rope_new(16);
+	tdp_rope_write(expected->str, expected->currentStringLength, copy);
+	d_string_erase(joined, 0, -1);
+
+	CuAssertIntEquals(tc, true, tdp_rope_drain(copy, append_to_dstring, joined));
+	CuAssertStrEquals(tc, expected->str, joined->str);
+	CuAssertIntEquals(tc, 0, tdp_rope_page_count(copy));
+	CuAssertIntEquals(tc, expected->currentStringLength, tdp_rope_length(copy));
+	tdp_rope_free(copy);
+
+	// All at once
+	FILE * file = tmpfile();
+	char * result = malloc(expected->currentStringLength + 1);
+
+	CuAssertIntEquals(tc, true, tdp_rope_write_fd(r, fileno(file)));
+	rewind(file);
+	CuAssertIntEquals(tc, expected->currentStringLength, fread(result, 1, expected->currentStringLength + 1, file));
+	CuAssertIntEquals(tc, 0, memcmp(expected->str, result, expected->currentStringLength));
+	fclose(file);
+
+	// Streamed as pages fill, keeping one page
+	file = tmpfile();
+	CuAssertIntEquals(tc, true, tdp_rope_stream_fd(r, fileno(file)));
+	CuAssertIntEquals(tc, 1, tdp_rope_page_count(r));
+
+	for (int i = 100; i < 200; ++i) {
+		snprintf(text, sizeof(text), "record %d,", i);
+		d_string_append(expected, text);
+		tdp_rope_write(text, strlen(text), r);
+		CuAssertIntEquals(tc, 1, tdp_rope_page_count(r));
+	}
+
+	CuAssertIntEquals(tc, true, tdp_rope_write_fd(r, fileno(file)));
+
+	result = realloc(result, expected->currentStringLength + 1);
+	rewind(file);
+	CuAssertIntEquals(tc, expected->currentStringLength, fread(result, 1, expected->currentStringLength + 1, file));
+	CuAssertIntEquals(tc, 0, memcmp(expected->str, result, expected->currentStringLength));
+	fclose(file);
+
+	free(result);
+	d_string_free(joined, true);
+	d_string_free(expected, true);
+	tdp_rope_free(r);
+}
+#endif
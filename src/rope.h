@@ -0,0 +1,175 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file rope.h
+
+	@brief Output buffer made of fixed size pages, so that large output can
+	be built without ever moving it to a larger contiguous buffer.
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#ifndef ROPE_TDP_PARSER_H
+#define ROPE_TDP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+#include "allocator.h"
+#include "sink.h"
+
+
+#define kRopePageSize (1024 * 1024)		//!< Default size of each page
+
+
+/// Append-only output buffer, stored as a list of fixed size pages.
+/// Growing never copies what has already been written, and memory is
+/// allocated one page at a time.  Pages can be written to a file
+/// descriptor as they fill (so that only one is kept in memory), or all at
+/// once at the end with `writev()`.
+struct tdp_rope {
+	const tdp_allocator	*	allocator;	//!< Allocator used for all storage
+	size_t			page_size;			//!< Size of each page
+
+	char		**	pages;				//!< Pages, in order -- all full except the last
+	size_t			count;				//!< Number of pages
+	size_t			capacity;			//!< Size of pages array
+	size_t			last_len;			//!< Bytes used in last page
+
+	size_t			length;				//!< Total bytes appended
+	int				fd;					//!< Write pages here as they fill (if not -1)
+	bool			failed;				//!< Out of memory, or a write failed
+};
+
+typedef struct tdp_rope tdp_rope;
+
+
+/// Create an empty rope
+tdp_rope * tdp_rope_new(
+	size_t page_size					//!< Size of each page (0 for kRopePageSize)
+);
+
+
+/// Create an empty rope using the specified allocator
+tdp_rope * tdp_rope_new_with_allocator(
+	const tdp_allocator * allocator,	//!< Allocator to use (NULL to use heap)
+	size_t page_size					//!< Size of each page (0 for kRopePageSize)
+);
+
+
+/// Free rope
+void tdp_rope_free(
+	tdp_rope * r						//!< Rope to be freed
+);
+
+
+/// Append bytes to rope.  Has the same signature as sink_flush_callback,
+/// so that a rope can receive streamed output.  Returns false if memory
+/// could not be allocated, or a page could not be written.
+bool tdp_rope_write(
+	const char * data,					//!< Bytes to append
+	size_t len,							//!< Number of bytes
+	void * r							//!< Rope to append to
+);
+
+
+/// From now on, write each page to `fd` as soon as it fills and then reuse
+/// it, rather than keeping it.  Full pages already in the rope are written
+/// immediately.  Returns false if a write failed.
+bool tdp_rope_stream_fd(
+	tdp_rope * r,						//!< Rope
+	int fd								//!< File descriptor to write to
+);
+
+
+/// Write all pages still in the rope to `fd` (with a single `writev()`
+/// where possible).  Returns false if a write failed.
+bool tdp_rope_write_fd(
+	const tdp_rope * r,					//!< Rope
+	int fd								//!< File descriptor to write to
+);
+
+
+/// Pass each page to `write` in order, releasing it as soon as `write`
+/// returns, so that the pages are never all kept alongside a copy of them.
+/// The rope is left empty (but can be appended to).  Returns false if
+/// `write` failed.
+bool tdp_rope_drain(
+	tdp_rope * r,						//!< Rope
+	sink_flush_callback write,			//!< Receives each page
+	void * user							//!< Passed to `write`
+);
+
+
+/// Total bytes appended to rope (including any already written to a file
+/// descriptor or drained)
+size_t tdp_rope_length(
+	const tdp_rope * r					//!< Rope
+);
+
+
+/// Number of pages in rope
+size_t tdp_rope_page_count(
+	const tdp_rope * r					//!< Rope
+);
+
+
+/// Get page `index` of rope, and its length.  Returns NULL if there is no
+/// such page.
+const char * tdp_rope_page(
+	const tdp_rope * r,					//!< Rope
+	size_t index,						//!< Page number
+	size_t * len						//!< Receives length of page
+);
+
+
+#endif
@@ -0,0 +1,434 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file schema.c
+
+	@brief Column schema -- force the type of named columns, so that values
+	are converted by a precompiled plan rather than inferred
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "d_string.h"
+#include "escape.h"
+#include "libTDP.h"
+#include "number.h"
+#include "schema.h"
+#include "sink.h"
+
+
+#define kSchemaStartingSize 16			//!< Initial capacity for column plans
+
+
+/// Read next word from line, handling double quotes.  Returns false if
+/// there are no more words.
+static bool next_word(const char ** cur, const char * stop, const char ** word, size_t * len) {
+	const char * p = *cur;
+
+	while (p < stop && (*p == ' ' || *p == '\t')) {
+		p++;
+	}
+
+	if (p == stop) {
+		*cur = p;
+		return false;
+	}
+
+	if (*p == '"') {
+		*word = ++p;
+
+		while (p < stop && *p != '"') {
+			p++;
+		}
+
+		*len = p - *word;
+
+		if (p < stop) {
+			p++;
+		}
+	} else {
+		*word = p;
+
+		while (p < stop && *p != ' ' && *p != '\t') {
+			// Allow default="quoted value"
+			if (*p == '"') {
+				p++;
+
+				while (p < stop && *p != '"') {
+					p++;
+				}
+			}
+
+			if (p < stop) {
+				p++;
+			}
+		}
+
+		*len = p - *word;
+	}
+
+	*cur = p;
+	return true;
+}
+
+
+/// Does word match keyword?
+#define word_is(word, len, keyword) (((len) == sizeof(keyword) - 1) && (memcmp(word, keyword, len) == 0))
+
+
+/// Convert type name to tdp_column_type, or -1
+static short parse_type(const char * word, size_t len) {
+	if (word_is(word, len, "string")) {
+		return TDP_TYPE_STRING;
+	}
+
+	if (word_is(word, len, "int") || word_is(word, len, "integer")) {
+		return TDP_TYPE_INT;
+	}
+
+	if (word_is(word, len, "float") || word_is(word, len, "number")) {
+		return TDP_TYPE_FLOAT;
+	}
+
+	if (word_is(word, len, "bool") || word_is(word, len, "boolean")) {
+		return TDP_TYPE_BOOL;
+	}
+
+	return -1;
+}
+
+
+/// Copy `len` bytes into a new null-terminated string
+static char * copy_text(const tdp_allocator * allocator, const char * text, size_t len) {
+	char * result = tdp_malloc(allocator, len + 1);
+
+	if (result) {
+		memcpy(result, text, len);
+		result[len] = '\0';
+	}
+
+	return result;
+}
+
+
+/// Compile the JSON written in place of empty or invalid values.  Returns
+/// NULL if `value` is not valid for the column type.
+static char * compile_fallback(const tdp_allocator * allocator, tdp_schema_column * column, const char * value, size_t len, bool has_default) {
+	if (!has_default) {
+		if (column->nullable) {
+			return copy_text(allocator, "null", 4);
+		}
+
+		switch (column->type) {
+			case TDP_TYPE_STRING:
+				return copy_text(allocator, "\"\"", 2);
+
+			case TDP_TYPE_BOOL:
+				return copy_text(allocator, "false", 5);
+
+			default:
+				return copy_text(allocator, "0", 1);
+		}
+	}
+
+	if (len >= 2 && value[0] == '"' && value[len - 1] == '"') {
+		value++;
+		len -= 2;
+	}
+
+	if (word_is(value, len, "null")) {
+		return copy_text(allocator, "null", 4);
+	}
+
+	switch (column->type) {
+		case TDP_TYPE_STRING: {
+			DString * text = d_string_new_with_allocator(allocator, "\"");
+			sink out;
+
+			column->value = copy_text(allocator, value, len);
+			column->value_len = len;
+
+			sink_init_string(&out, text);
+			json_escape(&out, value, len, false);
+			d_string_append_c(text, '"');
+
+			return d_string_free(text, false);
+		}
+
+		case TDP_TYPE_INT:
+			if (classify_number(value, len) != TDP_TYPE_INT) {
+				return NULL;
+			}
+
+			break;
+
+		case TDP_TYPE_FLOAT:
+			switch (classify_number(value, len)) {
+				case TDP_TYPE_INT:
+				case TDP_TYPE_FLOAT:
+					break;
+
+				default:
+					return NULL;
+			}
+
+			break;
+
+		case TDP_TYPE_BOOL:
+			if (classify_number(value, len) != TDP_TYPE_BOOL) {
+				return NULL;
+			}
+
+			break;
+	}
+
+	return copy_text(allocator, value, len);
+}
+
+
+/// Parse one schema line into `column`.  Returns false on error.
+static bool parse_line(const tdp_allocator * allocator, tdp_schema_column * column, const char * line, const char * stop) {
+	const char * word;
+	size_t len;
+	const char * value = NULL;
+	size_t value_len = 0;
+	bool has_default = false;
+
+	if (!next_word(&line, stop, &word, &len)) {
+		return false;
+	}
+
+	// Store name as it is rendered in the header row
+	DString * name = d_string_new_with_allocator(allocator, "");
+	sink out;
+
+	sink_init_string(&out, name);
+	json_escape(&out, word, len, false);
+	column->name_len = name->currentStringLength;
+	column->name = d_string_free(name, false);
+
+	if (!next_word(&line, stop, &word, &len) || (column->type = parse_type(word, len)) < 0) {
+		return false;
+	}
+
+	column->nullable = false;
+
+	while (next_word(&line, stop, &word, &len)) {
+		if (word_is(word, len, "nullable")) {
+			column->nullable = true;
+		} else if (len >= 8 && memcmp(word, "default=", 8) == 0) {
+			value = word + 8;
+			value_len = len - 8;
+			has_default = true;
+		} else {
+			return false;
+		}
+	}
+
+	column->fallback = compile_fallback(allocator, column, value, value_len, has_default);
+
+	if (column->fallback == NULL) {
+		return false;
+	}
+
+	column->fallback_len = strlen(column->fallback);
+	return true;
+}
+
+
+/// Parse schema text
+tdp_schema * tdp_schema_parse(const char * text, size_t len) {
+	return tdp_schema_parse_with_allocator(NULL, text, len);
+}
+
+
+/// Parse schema text, allocating the schema with `allocator`
+tdp_schema * tdp_schema_parse_with_allocator(const tdp_allocator * allocator, const char * text, size_t len) {
+	tdp_schema * schema = tdp_malloc(allocator, sizeof(tdp_schema));
+	const char * stop = text + len;
+	const char * line = text;
+	const char * eol;
+	const char * p;
+	size_t line_number = 0;
+
+	if (!schema) {
+		return NULL;
+	}
+
+	memset(schema, 0, sizeof(tdp_schema));
+	schema->allocator = allocator;
+
+	while (line < stop) {
+		eol = memchr(line, '\n', stop - line);
+
+		if (eol == NULL) {
+			eol = stop;
+		}
+
+		line_number++;
+
+		// Skip blank lines and comments
+		p = line;
+
+		while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r')) {
+			p++;
+		}
+
+		if (p < eol && *p != '#') {
+			if (schema->count == schema->capacity) {
+				size_t capacity = schema->capacity ? schema->capacity * 2 : kSchemaStartingSize;
+				tdp_schema_column * columns = tdp_realloc(allocator, schema->columns, capacity * sizeof(tdp_schema_column));
+
+				if (!columns) {
+					tdp_schema_free(schema);
+					return NULL;
+				}
+
+				schema->columns = columns;
+				schema->capacity = capacity;
+			}
+
+			tdp_schema_column * column = &schema->columns[schema->count++];
+			memset(column, 0, sizeof(tdp_schema_column));
+
+			const char * end = eol;
+
+			if (end > line && end[-1] == '\r') {
+				end--;
+			}
+
+			if (!parse_line(allocator, column, line, end)) {
+				fprintf(stderr, "ERROR.  Invalid schema on line %zu.\n", line_number);
+				tdp_schema_free(schema);
+				return NULL;
+			}
+		}
+
+		line = eol + 1;
+	}
+
+	return schema;
+}
+
+
+/// Free schema
+void tdp_schema_free(tdp_schema * schema) {
+	if (schema) {
+		for (size_t i = 0; i < schema->count; ++i) {
+			tdp_free(schema->allocator, schema->columns[i].name);
+			tdp_free(schema->allocator, schema->columns[i].fallback);
+			tdp_free(schema->allocator, schema->columns[i].value);
+		}
+
+		tdp_free(schema->allocator, schema->columns);
+		tdp_free(schema->allocator, schema);
+	}
+}
+
+
+/// Find plan for column `name`
+const tdp_schema_column * tdp_schema_lookup(const tdp_schema * schema, const char * name, size_t len) {
+	for (size_t i = 0; i < schema->count; ++i) {
+		if ((schema->columns[i].name_len == len) && (memcmp(schema->columns[i].name, name, len) == 0)) {
+			return &schema->columns[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+#ifdef TEST
+void Test_tdp_schema(CuTest * tc) {
+	const char * text = "# Feed schema\n"
+						"zip\tstring\n"
+						"\n"
+						"amount  float  nullable\r\n"
+						"count int default=0\n"
+						"\"full name\" string default=\"n/a\"\n"
+						"ok bool";
+	tdp_schema * schema = tdp_schema_parse(text, strlen(text));
+	const tdp_schema_column * c;
+
+	CuAssertPtrNotNull(tc, schema);
+	CuAssertIntEquals(tc, 5, schema->count);
+
+	c = tdp_schema_lookup(schema, "zip", 3);
+	CuAssertIntEquals(tc, TDP_TYPE_STRING, c->type);
+	CuAssertStrEquals(tc, "\"\"", c->fallback);
+
+	c = tdp_schema_lookup(schema, "amount", 6);
+	CuAssertIntEquals(tc, TDP_TYPE_FLOAT, c->type);
+	CuAssertIntEquals(tc, true, c->nullable);
+	CuAssertStrEquals(tc, "null", c->fallback);
+
+	c = tdp_schema_lookup(schema, "count", 5);
+	CuAssertIntEquals(tc, TDP_TYPE_INT, c->type);
+	CuAssertStrEquals(tc, "0", c->fallback);
+
+	c = tdp_schema_lookup(schema, "full name", 9);
+	CuAssertStrEquals(tc, "\"n/a\"", c->fallback);
+	CuAssertStrEquals(tc, "n/a", c->value);
+
+	c = tdp_schema_lookup(schema, "ok", 2);
+	CuAssertIntEquals(tc, TDP_TYPE_BOOL, c->type);
+	CuAssertStrEquals(tc, "false", c->fallback);
+
+	CuAssertPtrEquals(tc, NULL, (void *)tdp_schema_lookup(schema, "missing", 7));
+	tdp_schema_free(schema);
+
+	// Errors
+	CuAssertPtrEquals(tc, NULL, tdp_schema_parse("a date", 6));
+	CuAssertPtrEquals(tc, NULL, tdp_schema_parse("a int default=1.5", 17));
+	CuAssertPtrEquals(tc, NULL, tdp_schema_parse("a int bogus", 11));
+}
+#endif
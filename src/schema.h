@@ -0,0 +1,132 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file schema.h
+
+	@brief Column schema -- force the type of named columns
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#ifndef SCHEMA_TDP_PARSER_H
+#define SCHEMA_TDP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+#include "allocator.h"
+
+
+/// Conversion plan for a single named column
+struct tdp_schema_column {
+	char		*	name;				//!< Column name (JSON escaped, as rendered from the header row)
+	size_t			name_len;			//!< Length of name
+	short			type;				//!< Output type (tdp_column_type)
+	bool			nullable;			//!< Empty values may be written as null
+
+	char		*	fallback;			//!< JSON written for empty or invalid values
+	size_t			fallback_len;		//!< Length of fallback
+
+	char		*	value;				//!< Unescaped default for string columns (or NULL)
+	size_t			value_len;			//!< Length of value
+};
+
+typedef struct tdp_schema_column tdp_schema_column;
+
+
+/// Collection of column plans
+struct tdp_schema {
+	const tdp_allocator	*	allocator;	//!< Allocator for columns and their strings
+	tdp_schema_column	*	columns;	//!< Column plans
+	size_t			count;				//!< Number of columns
+	size_t			capacity;			//!< Size of columns array
+};
+
+typedef struct tdp_schema tdp_schema;
+
+
+/// Parse schema text.  Each line describes one column:
+///
+///	name  type  [nullable]  [default=VALUE]
+///
+/// `type` is one of `string`, `int`, `float`, or `bool`.  Names and
+/// default values containing spaces can be double-quoted.  Blank lines and
+/// lines starting with `#` are ignored.  Returns NULL on error.
+tdp_schema * tdp_schema_parse(
+	const char * text,					//!< Schema text
+	size_t len							//!< Number of bytes
+);
+
+
+/// Parse schema text, allocating the schema with `allocator`
+tdp_schema * tdp_schema_parse_with_allocator(
+	const tdp_allocator * allocator,	//!< Allocator to use (NULL to use heap)
+	const char * text,					//!< Schema text
+	size_t len							//!< Number of bytes
+);
+
+
+/// Free schema
+void tdp_schema_free(
+	tdp_schema * schema					//!< Schema to be freed
+);
+
+
+/// Find plan for column `name`, or NULL
+const tdp_schema_column * tdp_schema_lookup(
+	const tdp_schema * schema,			//!< Schema to search
+	const char * name,					//!< Column name
+	size_t len							//!< Length of name
+);
+
+
+#endif
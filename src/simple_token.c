@@ -56,13 +56,197 @@
 
 #include "simple_token.h"
 
-/// Get pointer to a new token
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+
+#define kTokenPoolFirstBlockSize 64	//!< Number of tokens in first block allocated by a pool
+#define kTokenPoolBlockSize 1024		//!< Maximum number of tokens in subsequent blocks
+
+
+/// Create a new token pool
+token_pool * token_pool_new(const tdp_allocator * allocator) {
+	token_pool * pool = tdp_malloc(allocator, sizeof(token_pool));
+
+	if (pool) {
+		pool->allocator = allocator;
+		pool->first = NULL;
+		pool->current = NULL;
+		pool->used = 0;
+		pool->recycled = NULL;
+		pool->unmet = 0;
+		pool->missing = 0;
+	}
+
+	return pool;
+}
+
+
+/// Make all tokens in the pool available again, keeping allocated blocks
+void token_pool_drain(token_pool * pool) {
+	if (pool) {
+		pool->current = pool->first;
+		pool->used = 0;
+		pool->recycled = NULL;
+		pool->unmet = 0;
+		pool->missing = 0;
+	}
+}
+
+
+/// Free token pool, and all tokens allocated from it
+void token_pool_free(token_pool * pool) {
+	if (pool) {
+		struct token_pool_block * b = pool->first;
+		struct token_pool_block * n;
+
+		while (b) {
+			n = b->next;
+			tdp_free(pool->allocator, b);
+			b = n;
+		}
+
+		tdp_free(pool->allocator, pool);
+	}
+}
+
+
+/// Add a new block to the end of the pool
+static struct token_pool_block * token_pool_add_block(token_pool * pool, size_t size) {
+	struct token_pool_block * b = tdp_malloc(pool->allocator, sizeof(struct token_pool_block) + size * sizeof(simple_token));
+
+	if (b) {
+		b->next = NULL;
+		b->size = size;
+
+		if (pool->first == NULL) {
+			pool->first = b;
+		} else {
+			struct token_pool_block * last = pool->current ? pool->current : pool->first;
+
+			while (last->next) {
+				last = last->next;
+			}
+
+			last->next = b;
+		}
+	}
+
+	return b;
+}
+
+
+/// Add a block of `size` tokens to the end of the pool.  If it can not be
+/// allocated, the tokens it would have held are handed out as NULL before
+/// another block is requested, so that each missing block is asked for
+/// (and counted by an arena) only once.
+static bool token_pool_grow(token_pool * pool, size_t size) {
+	if (pool->unmet == 0) {
+		if (token_pool_add_block(pool, size)) {
+			return true;
+		}
+
+		pool->unmet = size;
+	}
+
+	pool->unmet--;
+	pool->missing++;
+	return false;
+}
+
+
+/// Ensure that at least `count` more tokens can be allocated from the pool
+/// without requesting more memory.  Returns false if memory could not be
+/// allocated.
+bool token_pool_reserve(token_pool * pool, size_t count) {
+	size_t available = 0;
+	struct token_pool_block * b;
+
+	if (pool->current) {
+		available = pool->current->size - pool->used;
+		b = pool->current->next;
+	} else {
+		b = pool->first;
+	}
+
+	while (b) {
+		available += b->size;
+		b = b->next;
+	}
+
+	if (available >= count) {
+		return true;
+	}
+
+	if (token_pool_add_block(pool, count - available)) {
+		return true;
+	}
+
+	// Tokens that would have been reserved are missing
+	pool->unmet = count - available;
+	return false;
+}
+
+
+/// Get storage for a token from the pool
+static simple_token * token_pool_allocate(token_pool * pool) {
+	simple_token * t;
+
+	if (pool->recycled) {
+		// Reuse a token that was previously freed
+		t = pool->recycled;
+		pool->recycled = t->next;
+		return t;
+	}
+
+	if (pool->current == NULL) {
+		// First block
+		if (pool->first == NULL && !token_pool_grow(pool, kTokenPoolFirstBlockSize)) {
+			return NULL;
+		}
+
+		pool->current = pool->first;
+		pool->used = 0;
+	}
+
+	while (pool->used == pool->current->size) {
+		// Move on to the next block, allocating a larger one if necessary
+		if (pool->current->next == NULL) {
+			size_t size = pool->current->size * 2;
+
+			if (size > kTokenPoolBlockSize) {
+				size = kTokenPoolBlockSize;
+			}
+
+			if (!token_pool_grow(pool, size)) {
+				return NULL;
+			}
+		}
+
+		pool->current = pool->current->next;
+		pool->used = 0;
+	}
+
+	return &(pool->current->tokens[pool->used++]);
+}
+
+
+/// Get pointer to a new token.  If `pool` is NULL, the token is
+/// allocated on the heap.
 simple_token * simple_token_new(
+	token_pool * pool,					//!< Pool to allocate from (or NULL)
 	unsigned short type,				//!< Type for new token
 	size_t start,						//!< Starting offset for token
 	size_t len							//!< Len of token
 ) {
-	simple_token * t = malloc(sizeof(simple_token));
+	simple_token * t;
+
+	if (pool) {
+		t = token_pool_allocate(pool);
+	} else {
+		t = malloc(sizeof(simple_token));
+	}
 
 	if (t) {
 		t->type = type;
@@ -80,6 +264,62 @@ simple_token * simple_token_new(
 }
 
 
+#ifdef TEST
+void Test_token_pool(CuTest * tc) {
+	token_pool * pool = token_pool_new(NULL);
+	simple_token * first = NULL;
+	simple_token * t;
+
+	// Allocate enough tokens to require additional blocks
+	for (int i = 0; i < kTokenPoolFirstBlockSize * 3 + 10; ++i) {
+		t = simple_token_new(pool, 1, i, 1);
+		CuAssertPtrNotNull(tc, t);
+		CuAssertIntEquals(tc, i, t->start);
+
+		if (first == NULL) {
+			first = t;
+		}
+	}
+
+	CuAssertIntEquals(tc, kTokenPoolFirstBlockSize, pool->first->size);
+	CuAssertIntEquals(tc, kTokenPoolFirstBlockSize * 2, pool->first->next->size);
+	CuAssertPtrEquals(tc, pool->first->next->next, pool->current);
+
+	// Freed tokens are recycled
+	simple_token_free(pool, t);
+	CuAssertPtrEquals(tc, t, simple_token_new(pool, 1, 0, 0));
+
+	// Draining reuses existing blocks
+	token_pool_drain(pool);
+	t = simple_token_new(pool, 2, 5, 5);
+	CuAssertPtrEquals(tc, first, t);
+	CuAssertIntEquals(tc, 2, t->type);
+	CuAssertPtrEquals(tc, NULL, t->next);
+
+	// Reserving only allocates what is missing
+	CuAssertIntEquals(tc, true, token_pool_reserve(pool, 100));
+	CuAssertPtrEquals(tc, NULL, pool->first->next->next->next);
+	CuAssertIntEquals(tc, true, token_pool_reserve(pool, 10000));
+	CuAssertIntEquals(tc, 10000 - (kTokenPoolFirstBlockSize * 7 - 1), pool->first->next->next->next->size);
+
+	token_pool_free(pool);
+
+	// A block that does not fit is requested once for all of its tokens
+	char buffer[256];
+	tdp_arena arena;
+	tdp_arena_init(&arena, buffer, sizeof(buffer));
+	pool = token_pool_new(&arena.allocator);
+
+	for (int i = 0; i < 3; ++i) {
+		CuAssertPtrEquals(tc, NULL, simple_token_new(pool, 1, i, 1));
+	}
+
+	CuAssertIntEquals(tc, 3, pool->missing);
+	CuAssertIntEquals(tc, tdp_arena_cost(sizeof(struct token_pool_block) + kTokenPoolFirstBlockSize * sizeof(simple_token)), arena.shortfall);
+}
+#endif
+
+
 /// Add a new token to the end of a token chain.  The new token
 /// may or may not also be the start of a chain
 void simple_token_chain_append(
@@ -100,27 +340,34 @@ void simple_token_chain_append(
 }
 
 
-/// Free token
+/// Free token (must use the same pool it was allocated from)
 void simple_token_free(
+	token_pool * pool,							//!< Pool token came from (or NULL)
 	simple_token * t							//!< Pointer to token to be freed
 ) {
 	if (t != NULL) {
-		simple_token_tree_free(t->child);
+		simple_token_tree_free(pool, t->child);
 
-		free(t);
+		if (pool) {
+			t->next = pool->recycled;
+			pool->recycled = t;
+		} else {
+			free(t);
+		}
 	}
 }
 
 
-/// Free token tree
+/// Free token tree (must use the same pool it was allocated from)
 void simple_token_tree_free(
+	token_pool * pool,							//!< Pool tokens came from (or NULL)
 	simple_token * t							//!< Pointer to token to be freed
 ) {
 	simple_token * n;
 
 	while (t != NULL) {
 		n = t->next;
-		simple_token_free(t);
+		simple_token_free(pool, t);
 
 		t = n;
 	}
@@ -128,12 +375,17 @@ void simple_token_tree_free(
 
 
 /// Create a parent for a chain of tokens
-simple_token * simple_token_new_parent(simple_token * child, unsigned short type) {
+simple_token * simple_token_new_parent(token_pool * pool, simple_token * child, unsigned short type) {
 	if (child == NULL) {
-		return simple_token_new(type, 0, 0);
+		return simple_token_new(pool, type, 0, 0);
+	}
+
+	simple_token * t = simple_token_new(pool, type, child->start, 0);
+
+	if (t == NULL) {
+		return NULL;
 	}
 
-	simple_token * t = simple_token_new(type, child->start, 0);
 	t->child = child;
 	child->prev = NULL;
 
@@ -56,8 +56,11 @@
 #ifndef SIMPLE_TOKEN_TDP_PARSER_H
 #define SIMPLE_TOKEN_TDP_PARSER_H
 
+#include <stdbool.h>
 #include <stdlib.h>
 
+#include "allocator.h"
+
 struct simple_token {
 	unsigned short				type;			//!< Type for the token
 
@@ -74,13 +77,68 @@ struct simple_token {
 typedef struct simple_token simple_token;
 
 
-/// Get pointer to a new token
+/// Block of tokens allocated at once by a token_pool
+struct token_pool_block {
+	struct token_pool_block	*	next;			//!< Next block in the pool
+	size_t						size;			//!< Number of tokens in block
+	simple_token				tokens[];		//!< Storage for tokens
+};
+
+
+/// Pool of tokens that are allocated in blocks and recycled, rather than
+/// individually allocated and freed.  Draining the pool makes every token
+/// available again while keeping the blocks for the next document.
+struct token_pool {
+	struct token_pool_block	*	first;			//!< First block in the pool
+	struct token_pool_block	*	current;		//!< Block currently being used
+	size_t						used;			//!< Number of tokens used in current block
+	simple_token			*	recycled;		//!< Chain of freed tokens available for reuse
+	size_t						unmet;			//!< Tokens left in a block that could not be allocated
+	size_t						missing;		//!< Number of tokens that could not be allocated
+
+	const tdp_allocator		*	allocator;		//!< Allocator for blocks (NULL to use heap)
+};
+
+typedef struct token_pool token_pool;
+
+
+/// Create a new token pool
+token_pool * token_pool_new(
+	const tdp_allocator * allocator				//!< Allocator to use (NULL to use heap)
+);
+
+
+/// Make all tokens in the pool available again, keeping allocated blocks
+void token_pool_drain(
+	token_pool * pool							//!< Pool to be drained
+);
+
+
+/// Ensure that at least `count` more tokens can be allocated from the pool
+/// without requesting more memory.  Returns false if memory could not be
+/// allocated.
+bool token_pool_reserve(
+	token_pool * pool,							//!< Pool to use
+	size_t count								//!< Number of tokens needed
+);
+
+
+/// Free token pool, and all tokens allocated from it
+void token_pool_free(
+	token_pool * pool							//!< Pool to be freed
+);
+
+
+/// Get pointer to a new token.  If `pool` is NULL, the token is
+/// allocated on the heap.
 simple_token * simple_token_new(
+	token_pool * pool,							//!< Pool to allocate from (or NULL)
 	unsigned short type,						//!< Type for new token
 	size_t start,								//!< Starting offset for token
 	size_t len									//!< Len of token
 );
 
+
 /// Add a new token to the end of a token chain.  The new token
 /// may or may not also be the start of a chain
 void simple_token_chain_append(
@@ -88,18 +146,24 @@ void simple_token_chain_append(
 	simple_token * t							//!< Pointer to token to append
 );
 
-/// Free token
+
+/// Free token (must use the same pool it was allocated from)
 void simple_token_free(
+	token_pool * pool,							//!< Pool token came from (or NULL)
 	simple_token * t							//!< Pointer to token to be freed
 );
 
-/// Free token tree
+
+/// Free token tree (must use the same pool it was allocated from)
 void simple_token_tree_free(
+	token_pool * pool,							//!< Pool tokens came from (or NULL)
 	simple_token * t							//!< Pointer to token to be freed
 );
 
+
 /// Create a parent for a chain of tokens
 simple_token * simple_token_new_parent(
+	token_pool * pool,							//!< Pool to allocate from (or NULL)
 	simple_token * child,						//!< Pointer to child token chain
 	unsigned short type							//!< Type for new token
 );
@@ -0,0 +1,422 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file sink.c
+
+	@brief Destination for exported output
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__WIN32)
+	#include <io.h>
+#else
+	#include <sys/uio.h>
+	#include <unistd.h>
+#endif
+
+#ifndef IOV_MAX
+	#define IOV_MAX 16
+#endif
+
+#include "d_string.h"
+#include "sink.h"
+
+
+/// Initialize sink that appends to a DString
+void sink_init_string(sink * s, DString * string) {
+	s->string = string;
+	s->buffer = NULL;
+	s->capacity = 0;
+	s->len = 0;
+	s->flush = NULL;
+	s->user = NULL;
+	s->failed = false;
+	s->vectors = NULL;
+	s->vector_count = 0;
+	s->mark = 0;
+	s->total = 0;
+}
+
+
+/// Initialize sink that writes into a fixed size buffer
+void sink_init_buffer(sink * s, char * buffer, size_t capacity) {
+	s->string = NULL;
+	s->buffer = buffer;
+	s->capacity = capacity;
+	s->len = 0;
+	s->flush = NULL;
+	s->user = NULL;
+	s->failed = false;
+	s->vectors = NULL;
+	s->vector_count = 0;
+	s->mark = 0;
+	s->total = 0;
+}
+
+
+/// Initialize sink that flushes its buffer to a callback
+void sink_init_callback(sink * s, char * buffer, size_t capacity, sink_flush_callback flush, void * user) {
+	sink_init_buffer(s, buffer, capacity);
+	s->flush = flush;
+	s->user = user;
+}
+
+
+/// Write all of `data` to the file descriptor stored in `user`
+bool sink_write_to_fd(const char * data, size_t len, void * user) {
+	int fd = (int)(intptr_t)user;
+
+	while (len) {
+		ssize_t written = write(fd, data, len);
+
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return false;
+		}
+
+		data += written;
+		len -= written;
+	}
+
+	return true;
+}
+
+
+/// Initialize sink that flushes its buffer to a file descriptor
+void sink_init_fd(sink * s, char * buffer, size_t capacity, int fd) {
+	sink_init_callback(s, buffer, capacity, sink_write_to_fd, (void *)(intptr_t)fd);
+}
+
+
+/// Initialize sink that writes to a file descriptor with writev()
+void sink_init_gather(sink * s, char * buffer, size_t capacity, struct iovec * vectors, int fd) {
+	sink_init_fd(s, buffer, capacity, fd);
+#if !defined(__WIN32)
+	s->vectors = vectors;
+#endif
+}
+
+
+#if !defined(__WIN32)
+/// Add vector for buffered bytes that are not yet in the list
+static void close_fragment(sink * s) {
+	if (s->len > s->mark) {
+		s->vectors[s->vector_count].iov_base = s->buffer + s->mark;
+		s->vectors[s->vector_count].iov_len = s->len - s->mark;
+		s->vector_count++;
+		s->mark = s->len;
+	}
+}
+
+
+/// Write all of the bytes in `count` vectors to `fd`
+bool sink_write_vectors_to_fd(int fd, struct iovec * v, size_t count) {
+	while (count) {
+		ssize_t written = writev(fd, v, (count < IOV_MAX) ? (int) count : IOV_MAX);
+
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return false;
+		}
+
+		// Skip past what was written (which may end partway through a vector)
+		while (count && ((size_t) written >= v->iov_len)) {
+			written -= v->iov_len;
+			v++;
+			count--;
+		}
+
+		if (count) {
+			v->iov_base = (char *) v->iov_base + written;
+			v->iov_len -= written;
+		}
+	}
+
+	return true;
+}
+#endif
+
+
+/// Send any buffered output to the flush callback
+void sink_flush(sink * s) {
+#if !defined(__WIN32)
+
+	if (s->vector_count) {
+		close_fragment(s);
+
+		if (!s->failed && !sink_write_vectors_to_fd((int)(intptr_t)s->user, s->vectors, s->vector_count)) {
+			s->failed = true;
+		}
+
+		s->vector_count = 0;
+		s->len = 0;
+		s->mark = 0;
+		return;
+	}
+
+#endif
+
+	if (s->flush && s->len) {
+		if (!s->failed && !s->flush(s->buffer, s->len, s->user)) {
+			s->failed = true;
+		}
+
+		s->len = 0;
+	}
+}
+
+
+/// Write bytes to sink
+void sink_write(sink * s, const char * data, size_t len) {
+	s->total += len;
+
+	if (s->string) {
+		d_string_append_c_array(s->string, data, len);
+	} else if (s->len + len <= s->capacity) {
+		memcpy(s->buffer + s->len, data, len);
+		s->len += len;
+	} else if (s->flush) {
+		sink_flush(s);
+
+		if (len < s->capacity) {
+			memcpy(s->buffer, data, len);
+			s->len = len;
+		} else if (!s->failed && !s->flush(data, len, s->user)) {
+			// Larger than buffer -- pass it along directly
+			s->failed = true;
+		}
+	} else {
+		// Keep what fits, but we will report failure
+		memcpy(s->buffer + s->len, data, s->capacity - s->len);
+		s->len = s->capacity;
+	}
+}
+
+
+/// Write bytes that remain valid until the sink is finished
+void sink_write_ref(sink * s, const char * data, size_t len) {
+#if !defined(__WIN32)
+
+	if (s->vectors && (len >= kSinkMinReference)) {
+		// Leave room for the buffered bytes on either side
+		if (s->vector_count + 3 > kSinkGatherVectors) {
+			sink_flush(s);
+		}
+
+		close_fragment(s);
+
+		s->vectors[s->vector_count].iov_base = (void *) data;
+		s->vectors[s->vector_count].iov_len = len;
+		s->vector_count++;
+		s->total += len;
+		return;
+	}
+
+#endif
+
+	sink_write(s, data, len);
+}
+
+
+/// Write null-terminated string to sink
+void sink_write_string(sink * s, const char * str) {
+	if (str) {
+		sink_write(s, str, strlen(str));
+	}
+}
+
+
+/// Write single character to sink
+void sink_write_c(sink * s, char c) {
+	s->total++;
+
+	if (s->string) {
+		d_string_append_c(s->string, c);
+	} else if (s->len < s->capacity) {
+		s->buffer[s->len++] = c;
+	} else if (s->flush) {
+		sink_flush(s);
+		s->buffer[s->len++] = c;
+	}
+}
+
+
+/// Finish writing.  A fixed buffer is null-terminated if there is room.
+/// Returns false if output (including the terminator) did not fit, or a
+/// DString could not grow to hold it.
+bool sink_finish(sink * s) {
+	if (s->string) {
+		return !s->string->failed;
+	}
+
+	if (s->flush) {
+		sink_flush(s);
+		return !s->failed;
+	}
+
+	if (s->total < s->capacity) {
+		s->buffer[s->total] = '\0';
+		return true;
+	}
+
+	return false;
+}
+
+
+#ifdef TEST
+static bool append_to_dstring(const char * data, size_t len, void * user) {
+	d_string_append_c_array(user, data, len);
+	return true;
+}
+
+
+void Test_sink(CuTest * tc) {
+	sink s;
+	char buffer[8];
+
+	// Fits
+	sink_init_buffer(&s, buffer, sizeof(buffer));
+	sink_write_string(&s, "foo");
+	sink_write_c(&s, ',');
+	sink_write(&s, "bar", 3);
+	CuAssertIntEquals(tc, true, sink_finish(&s));
+	CuAssertStrEquals(tc, "foo,bar", buffer);
+	CuAssertIntEquals(tc, 7, s.total);
+
+	// Too large, but still counted
+	sink_init_buffer(&s, buffer, sizeof(buffer));
+	sink_write_string(&s, "foo,bar,baz");
+	sink_write_c(&s, '!');
+	CuAssertIntEquals(tc, false, sink_finish(&s));
+	CuAssertIntEquals(tc, 12, s.total);
+	CuAssertIntEquals(tc, 8, s.len);
+
+	// DString
+	DString * d = d_string_new("");
+	sink_init_string(&s, d);
+	sink_write_string(&s, "foo");
+	sink_write_c(&s, ',');
+	sink_write(&s, "bar", 3);
+	CuAssertIntEquals(tc, true, sink_finish(&s));
+	CuAssertStrEquals(tc, "foo,bar", d->str);
+
+	// Flushing through a small buffer
+	d_string_erase(d, 0, -1);
+	sink_init_callback(&s, buffer, 4, append_to_dstring, d);
+	sink_write_string(&s, "foo,");
+	CuAssertIntEquals(tc, 0, d->currentStringLength);
+	sink_write_c(&s, 'b');
+	CuAssertStrEquals(tc, "foo,", d->str);
+	sink_write_string(&s, "ar,and a longer string");
+	sink_write_c(&s, '!');
+	CuAssertIntEquals(tc, true, sink_finish(&s));
+	CuAssertStrEquals(tc, "foo,bar,and a longer string!", d->str);
+	CuAssertIntEquals(tc, 28, s.total);
+
+	d_string_free(d, true);
+}
+
+
+void Test_sink_gather(CuTest * tc) {
+#if !defined(__WIN32)
+	struct iovec vectors[kSinkGatherVectors];
+	char buffer[16];
+	char slice[kSinkMinReference * 2];
+	DString * expected = d_string_new("");
+	FILE * file = tmpfile();
+	sink s;
+
+	memset(slice, 'x', sizeof(slice));
+
+	// Enough references to fill the list several times, with short writes
+	// (and a buffer that fills up) in between
+	sink_init_gather(&s, buffer, sizeof(buffer), vectors, fileno(file));
+
+	for (int i = 0; i < kSinkGatherVectors * 2; ++i) {
+		sink_write_c(&s, 'a' + (i % 26));
+		d_string_append_c(expected, 'a' + (i % 26));
+
+		sink_write_ref(&s, slice, (i % 2) ? sizeof(slice) : kSinkMinReference - 1);
+		d_string_append_c_array(expected, slice, (i % 2) ? sizeof(slice) : kSinkMinReference - 1);
+
+		if (i % 5 == 0) {
+			sink_write_string(&s, "0123456789");
+			d_string_append(expected, "0123456789");
+		}
+	}
+
+	sink_write_string(&s, "end");
+	d_string_append(expected, "end");
+
+	CuAssertIntEquals(tc, true, sink_finish(&s));
+	CuAssertIntEquals(tc, expected->currentStringLength, s.total);
+
+	char * result = malloc(expected->currentStringLength + 1);
+	rewind(file);
+	CuAssertIntEquals(tc, expected->currentStringLength, fread(result, 1, expected->currentStringLength + 1, file));
+	CuAssertTrue(tc, memcmp(expected->str, result, expected->currentStringLength) == 0);
+
+	free(result);
+	fclose(file);
+	d_string_free(expected, true);
+#endif
+}
+#endif
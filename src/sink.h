@@ -0,0 +1,228 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file sink.h
+
+	@brief Destination for exported output
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#ifndef SINK_TDP_PARSER_H
+#define SINK_TDP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+/// From d_string.h:
+typedef struct DString DString;
+
+/// From sys/uio.h:
+struct iovec;
+
+
+#define kSinkGatherVectors 256			//!< Size of scatter-gather list used by sink_init_gather()
+#define kSinkMinReference 64			//!< Shorter slices are copied rather than referenced
+
+
+/// Called to pass buffered output along.  Returns false on error.
+typedef bool (*sink_flush_callback)(const char * data, size_t len, void * user);
+
+
+/// Destination for exported text.  A sink either appends to a DString,
+/// or fills a fixed size buffer.  When a fixed buffer is full, it is
+/// passed to the flush callback (if any) and reused; otherwise output is
+/// discarded but still counted, so that the caller can find out how much
+/// space would have been needed.
+///
+/// A gathering sink also writes to a file descriptor, but long slices
+/// passed to sink_write_ref() are not copied -- they are added to a list
+/// of `iovec`s alongside the buffered bytes around them, and everything
+/// is written with a single `writev()` when the buffer or list is full.
+struct sink {
+	DString		*	string;				//!< Append to this DString (if not NULL)
+
+	char		*	buffer;				//!< Otherwise, write into this buffer
+	size_t			capacity;			//!< Size of buffer
+	size_t			len;				//!< Number of bytes stored in buffer
+
+	sink_flush_callback	flush;			//!< Send full buffer here (if not NULL)
+	void		*	user;				//!< Passed to flush callback
+	bool			failed;				//!< Flush callback reported an error
+
+	struct iovec	*	vectors;		//!< Scatter-gather list (if not NULL)
+	size_t			vector_count;		//!< Number of vectors in use
+	size_t			mark;				//!< Start of buffered bytes not yet in a vector
+
+	size_t			total;				//!< Total bytes written to sink (including any that did not fit)
+};
+
+typedef struct sink sink;
+
+
+/// Initialize sink that appends to a DString
+void sink_init_string(
+	sink * s,							//!< Sink to initialize
+	DString * string					//!< DString to append to
+);
+
+
+/// Initialize sink that writes into a fixed size buffer
+void sink_init_buffer(
+	sink * s,							//!< Sink to initialize
+	char * buffer,						//!< Buffer to write into
+	size_t capacity						//!< Size of buffer
+);
+
+
+/// Initialize sink that collects output in `buffer`, and passes it to
+/// `flush` whenever the buffer is full (and when finished)
+void sink_init_callback(
+	sink * s,							//!< Sink to initialize
+	char * buffer,						//!< Buffer to collect output
+	size_t capacity,					//!< Size of buffer
+	sink_flush_callback flush,			//!< Callback to receive output
+	void * user							//!< Passed to callback
+);
+
+
+/// Initialize sink that collects output in `buffer`, and writes it to
+/// file descriptor `fd` whenever the buffer is full (and when finished)
+void sink_init_fd(
+	sink * s,							//!< Sink to initialize
+	char * buffer,						//!< Buffer to collect output
+	size_t capacity,					//!< Size of buffer
+	int fd								//!< File descriptor to write to
+);
+
+
+/// Initialize sink that writes to file descriptor `fd` with `writev()`,
+/// referencing long slices passed to sink_write_ref() instead of copying
+/// them into `buffer`.  `vectors` must have room for kSinkGatherVectors
+/// entries.  (Where `writev()` is not available, this is the same as
+/// sink_init_fd().)
+void sink_init_gather(
+	sink * s,							//!< Sink to initialize
+	char * buffer,						//!< Buffer to collect short output
+	size_t capacity,					//!< Size of buffer
+	struct iovec * vectors,				//!< Scatter-gather list
+	int fd								//!< File descriptor to write to
+);
+
+
+/// Flush callback that writes all of `data` to the file descriptor stored
+/// in `user` (as an intptr_t)
+bool sink_write_to_fd(
+	const char * data,					//!< Bytes to write
+	size_t len,							//!< Number of bytes
+	void * user							//!< File descriptor
+);
+
+
+/// Write all of the bytes in `count` vectors to file descriptor `fd`, with
+/// as few `writev()` calls as possible.  (Not available where `writev()`
+/// is not.)  Vectors are modified to track partial writes.
+bool sink_write_vectors_to_fd(
+	int fd,								//!< File descriptor to write to
+	struct iovec * vectors,				//!< Bytes to write
+	size_t count						//!< Number of vectors
+);
+
+
+/// Send any buffered output to the flush callback
+void sink_flush(
+	sink * s							//!< Sink to flush
+);
+
+
+/// Write bytes to sink
+void sink_write(
+	sink * s,							//!< Sink to write to
+	const char * data,					//!< Bytes to write
+	size_t len							//!< Number of bytes
+);
+
+
+/// Write bytes that will remain valid and unchanged until the sink is
+/// finished (e.g. a slice of the source text).  A gathering sink records
+/// a reference to them rather than copying them.
+void sink_write_ref(
+	sink * s,							//!< Sink to write to
+	const char * data,					//!< Bytes to write
+	size_t len							//!< Number of bytes
+);
+
+
+/// Write null-terminated string to sink
+void sink_write_string(
+	sink * s,							//!< Sink to write to
+	const char * str					//!< String to write
+);
+
+
+/// Write single character to sink
+void sink_write_c(
+	sink * s,							//!< Sink to write to
+	char c								//!< Character to write
+);
+
+
+/// Finish writing.  A fixed buffer is null-terminated if there is room,
+/// and a flushing sink passes along the rest of its output.  Returns false
+/// if output (including the terminator) did not fit, or could not be
+/// written (including a DString that could not grow).
+bool sink_finish(
+	sink * s							//!< Sink to finish
+);
+
+
+#endif
@@ -0,0 +1,311 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file snappy.c
+
+	@brief Snappy compression (raw format, without framing).  Input is
+	compressed in 64 KiB blocks, finding matches with a hash table of
+	4 byte sequences.  Output can be read by any Snappy decoder.
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include "snappy.h"
+
+
+#define kSnappyBlockSize	65536		//!< Matches never cross a block boundary
+#define kSnappyHashBits		14			//!< Size of match table (log2)
+#define kSnappyMinMatch		4			//!< Shortest match that is worth a copy
+
+#define kSnappyLiteral		0x00
+#define kSnappyCopy2		0x02		//!< Copy with 2 byte offset
+
+
+/// Largest possible compressed size
+size_t snappy_max_compressed_length(size_t len) {
+	return 32 + len + len / 6;
+}
+
+
+/// Read 4 bytes
+static inline uint32_t load32(const char * p) {
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+
+/// Hash 4 bytes into match table index
+static inline uint32_t hash32(uint32_t v) {
+	return (v * 0x1e35a7bd) >> (32 - kSnappyHashBits);
+}
+
+
+/// Write a literal run
+static char * emit_literal(char * out, const char * text, size_t len) {
+	size_t n = len - 1;
+
+	if (n < 60) {
+		*out++ = (char) (kSnappyLiteral | (n << 2));
+	} else {
+		// Length follows in 1-4 bytes
+		char * tag = out++;
+		int bytes = 0;
+
+		while (n) {
+			*out++ = (char) (n & 0xff);
+			n >>= 8;
+			bytes++;
+		}
+
+		*tag = (char) (kSnappyLiteral | ((59 + bytes) << 2));
+	}
+
+	memcpy(out, text, len);
+	return out + len;
+}
+
+
+/// Write a copy of `len` bytes from `offset` bytes back
+static char * emit_copy(char * out, size_t offset, size_t len) {
+	// Each copy element holds at most 64 bytes.  Keep at least 4 for the
+	// last element.
+	while (len >= 68) {
+		*out++ = (char) (kSnappyCopy2 | (63 << 2));
+		*out++ = (char) (offset & 0xff);
+		*out++ = (char) (offset >> 8);
+		len -= 64;
+	}
+
+	if (len > 64) {
+		*out++ = (char) (kSnappyCopy2 | (59 << 2));
+		*out++ = (char) (offset & 0xff);
+		*out++ = (char) (offset >> 8);
+		len -= 60;
+	}
+
+	*out++ = (char) (kSnappyCopy2 | ((len - 1) << 2));
+	*out++ = (char) (offset & 0xff);
+	*out++ = (char) (offset >> 8);
+
+	return out;
+}
+
+
+/// Compress one block
+static char * compress_block(const char * in, size_t len, char * out, uint16_t * table) {
+	const char * p = in;
+	const char * literal = in;
+	const char * stop = in + len;
+
+	memset(table, 0, sizeof(uint16_t) << kSnappyHashBits);
+
+	if (len >= kSnappyMinMatch + 4) {
+		// Leave room to read 4 bytes at every candidate
+		const char * limit = stop - kSnappyMinMatch;
+
+		while (p < limit) {
+			uint32_t bytes = load32(p);
+			uint32_t h = hash32(bytes);
+			const char * candidate = in + table[h];
+
+			table[h] = (uint16_t) (p - in);
+
+			if (candidate < p && load32(candidate) == bytes) {
+				const char * match = p + kSnappyMinMatch;
+				const char * from = candidate + kSnappyMinMatch;
+
+				while (match < stop && *match == *from) {
+					match++;
+					from++;
+				}
+
+				if (literal < p) {
+					out = emit_literal(out, literal, p - literal);
+				}
+
+				out = emit_copy(out, p - candidate, match - p);
+				p = match;
+				literal = p;
+			} else {
+				p++;
+			}
+		}
+	}
+
+	if (literal < stop) {
+		out = emit_literal(out, literal, stop - literal);
+	}
+
+	return out;
+}
+
+
+/// Compress data
+size_t snappy_compress(const char * in, size_t len, char * out) {
+	uint16_t table[1 << kSnappyHashBits];
+	char * start = out;
+	size_t n = len;
+
+	// Uncompressed length as varint
+	while (n >= 0x80) {
+		*out++ = (char) ((n & 0x7f) | 0x80);
+		n >>= 7;
+	}
+
+	*out++ = (char) n;
+
+	for (size_t offset = 0; offset < len; offset += kSnappyBlockSize) {
+		size_t block = (len - offset < kSnappyBlockSize) ? len - offset : kSnappyBlockSize;
+		out = compress_block(in + offset, block, out, table);
+	}
+
+	return out - start;
+}
+
+
+#ifdef TEST
+/// Minimal decoder, for testing
+static size_t snappy_decompress(const unsigned char * in, size_t len, char * out) {
+	const unsigned char * stop = in + len;
+	size_t size = 0;
+	size_t pos = 0;
+	int shift = 0;
+
+	while (*in & 0x80) {
+		size |= (size_t) (*in++ & 0x7f) << shift;
+		shift += 7;
+	}
+
+	size |= (size_t) (*in++) << shift;
+
+	while (in < stop) {
+		unsigned char tag = *in++;
+		size_t n;
+
+		if ((tag & 3) == kSnappyLiteral) {
+			n = tag >> 2;
+
+			if (n >= 60) {
+				int bytes = (int) n - 59;
+				n = 0;
+
+				for (int i = 0; i < bytes; ++i) {
+					n |= (size_t) (*in++) << (8 * i);
+				}
+			}
+
+			n++;
+			memcpy(out + pos, in, n);
+			in += n;
+			pos += n;
+		} else {
+			size_t offset = in[0] | (in[1] << 8);
+			n = (tag >> 2) + 1;
+			in += 2;
+
+			for (size_t i = 0; i < n; ++i, ++pos) {
+				out[pos] = out[pos - offset];
+			}
+		}
+	}
+
+	return (pos == size) ? size : 0;
+}
+
+
+void Test_snappy(CuTest * tc) {
+	static char text[200000];
+	static char compressed[250000];
+	static char result[200000];
+	size_t len;
+
+	// Repetitive
+	for (size_t i = 0; i < sizeof(text); ++i) {
+		text[i] = "abcdefgh"[i % 8];
+	}
+
+	len = snappy_compress(text, sizeof(text), compressed);
+	CuAssertTrue(tc, len < sizeof(text) / 10);
+	CuAssertIntEquals(tc, sizeof(text), snappy_decompress((unsigned char *) compressed, len, result));
+	CuAssertTrue(tc, memcmp(text, result, sizeof(text)) == 0);
+
+	// Random
+	uint32_t seed = 12345;
+
+	for (size_t i = 0; i < sizeof(text); ++i) {
+		seed = seed * 1103515245 + 12345;
+		text[i] = (char) (seed >> 16);
+	}
+
+	len = snappy_compress(text, sizeof(text), compressed);
+	CuAssertTrue(tc, len <= snappy_max_compressed_length(sizeof(text)));
+	CuAssertIntEquals(tc, sizeof(text), snappy_decompress((unsigned char *) compressed, len, result));
+	CuAssertTrue(tc, memcmp(text, result, sizeof(text)) == 0);
+
+	// Mixed, with long literals and matches
+	for (size_t i = 0; i < sizeof(text); ++i) {
+		text[i] = ((i / 1000) % 2) ? 'x' : text[i];
+	}
+
+	len = snappy_compress(text, sizeof(text), compressed);
+	CuAssertIntEquals(tc, sizeof(text), snappy_decompress((unsigned char *) compressed, len, result));
+	CuAssertTrue(tc, memcmp(text, result, sizeof(text)) == 0);
+
+	// Short and empty
+	len = snappy_compress("abc", 3, compressed);
+	CuAssertIntEquals(tc, 5, len);
+	CuAssertIntEquals(tc, 3, snappy_decompress((unsigned char *) compressed, len, result));
+	CuAssertIntEquals(tc, 1, snappy_compress("", 0, compressed));
+}
+#endif
@@ -0,0 +1,264 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file spill.c
+
+	@brief Per-column output buffers that spill to a temporary file.  All
+	columns share one file; each column keeps a list of its chunks, which
+	are read back in order when the column is copied.
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#include <string.h>
+
+#include "spill.h"
+
+
+#define kSpillCopySize 8192				//!< Size of buffer used to read back spilled chunks
+
+
+/// Create a set of column buffers
+spill * spill_new(const tdp_allocator * allocator, size_t threshold) {
+	spill * s = tdp_malloc(allocator, sizeof(spill));
+
+	if (s) {
+		s->allocator = allocator;
+		s->threshold = threshold ? threshold : kSpillThreshold;
+
+		s->columns = NULL;
+		s->count = 0;
+		s->capacity = 0;
+
+		s->file = NULL;						// Created when needed
+		s->file_size = 0;
+		s->failed = false;
+	}
+
+	return s;
+}
+
+
+/// Free column buffers
+void spill_free(spill * s) {
+	if (s) {
+		for (size_t i = 0; i < s->count; ++i) {
+			d_string_free(s->columns[i].buffer, true);
+			d_string_free(s->columns[i].chunks, true);
+		}
+
+		if (s->file) {
+			// Temporary file is removed when closed
+			fclose(s->file);
+		}
+
+		tdp_free(s->allocator, s->columns);
+		tdp_free(s->allocator, s);
+	}
+}
+
+
+/// Add a column
+bool spill_add_column(spill * s) {
+	if (s->count == s->capacity) {
+		size_t capacity = s->capacity ? s->capacity * 2 : 16;
+		spill_column * columns = tdp_realloc(s->allocator, s->columns, capacity * sizeof(spill_column));
+
+		if (!columns) {
+			return false;
+		}
+
+		s->columns = columns;
+		s->capacity = capacity;
+	}
+
+	spill_column * c = &s->columns[s->count];
+
+	c->buffer = d_string_new_with_allocator(s->allocator, "");
+	c->chunks = d_string_new_with_allocator(s->allocator, "");
+	c->values = 0;
+
+	// Count column first so that it is freed if incomplete
+	s->count++;
+
+	return c->buffer && c->chunks;
+}
+
+
+/// Move buffered output for column `c` to the end of the temporary file.
+/// If that is not possible, output stays in memory.
+static void spill_column_out(spill * s, spill_column * c) {
+	size_t chunk[2];
+
+	if (s->file == NULL) {
+		s->file = tmpfile();
+
+		if (s->file == NULL) {
+			s->failed = true;
+			return;
+		}
+	}
+
+	chunk[0] = s->file_size;
+	chunk[1] = c->buffer->currentStringLength;
+
+	if ((fseek(s->file, (long) s->file_size, SEEK_SET) != 0) ||
+			(fwrite(c->buffer->str, 1, chunk[1], s->file) != chunk[1])) {
+		s->failed = true;
+		return;
+	}
+
+	d_string_append_c_array(c->chunks, (const char *) chunk, sizeof(chunk));
+	s->file_size += chunk[1];
+
+	d_string_erase(c->buffer, 0, chunk[1]);
+}
+
+
+/// Start another value for `column`
+sink * spill_append(spill * s, size_t column) {
+	spill_column * c = &s->columns[column];
+
+	if ((c->buffer->currentStringLength >= s->threshold) && !s->failed) {
+		spill_column_out(s, c);
+	}
+
+	c->values++;
+
+	sink_init_string(&s->string, c->buffer);
+	return &s->string;
+}
+
+
+/// Write everything appended to `column` to `out`
+bool spill_copy(spill * s, size_t column, sink * out) {
+	spill_column * c = &s->columns[column];
+	char buffer[kSpillCopySize];
+	const size_t * chunk = (const size_t *) c->chunks->str;
+	size_t chunk_count = c->chunks->currentStringLength / (2 * sizeof(size_t));
+	size_t remaining;
+	size_t len;
+
+	if (c->buffer->failed || c->chunks->failed) {
+		// Values were dropped when memory could not be allocated
+		return false;
+	}
+
+	for (size_t i = 0; i < chunk_count; ++i) {
+		if (fseek(s->file, (long) chunk[2 * i], SEEK_SET) != 0) {
+			s->failed = true;
+			return false;
+		}
+
+		for (remaining = chunk[2 * i + 1]; remaining; remaining -= len) {
+			len = (remaining < kSpillCopySize) ? remaining : kSpillCopySize;
+
+			if (fread(buffer, 1, len, s->file) != len) {
+				s->failed = true;
+				return false;
+			}
+
+			sink_write(out, buffer, len);
+		}
+	}
+
+	sink_write(out, c->buffer->str, c->buffer->currentStringLength);
+	return true;
+}
+
+
+#ifdef TEST
+void Test_spill(CuTest * tc) {
+	spill * s = spill_new(NULL, 16);
+	DString * expected[2];
+	DString * result = d_string_new("");
+	char value[16];
+	sink out;
+
+	CuAssertTrue(tc, spill_add_column(s));
+	CuAssertTrue(tc, spill_add_column(s));
+
+	expected[0] = d_string_new("");
+	expected[1] = d_string_new("");
+
+	for (int i = 0; i < 100; ++i) {
+		for (size_t column = 0; column < 2; ++column) {
+			snprintf(value, sizeof(value), "%c%d,", (column) ? 'b' : 'a', i);
+			sink_write_string(spill_append(s, column), value);
+			d_string_append(expected[column], value);
+		}
+	}
+
+	// Columns were spilled, and only a little is still buffered
+	CuAssertPtrNotNull(tc, s->file);
+	CuAssertTrue(tc, s->columns[0].buffer->currentStringLength < 32);
+	CuAssertIntEquals(tc, 100, s->columns[1].values);
+
+	for (size_t column = 0; column < 2; ++column) {
+		d_string_erase(result, 0, result->currentStringLength);
+		sink_init_string(&out, result);
+
+		CuAssertTrue(tc, spill_copy(s, column, &out));
+		CuAssertStrEquals(tc, expected[column]->str, result->str);
+	}
+
+	// Values can still be appended after copying
+	sink_write_string(spill_append(s, 0), "end");
+	d_string_append(expected[0], "end");
+
+	d_string_erase(result, 0, result->currentStringLength);
+	sink_init_string(&out, result);
+	CuAssertTrue(tc, spill_copy(s, 0, &out));
+	CuAssertStrEquals(tc, expected[0]->str, result->str);
+
+	spill_free(s);
+	d_string_free(expected[0], true);
+	d_string_free(expected[1], true);
+	d_string_free(result, true);
+}
+#endif
@@ -0,0 +1,143 @@
+/**
+
+	TDP-Parser -- Parse CSV (and other tabular data) and export to JSON
+
+	@file spill.h
+
+	@brief Per-column output buffers that spill to a temporary file, so that
+	column-oriented output can be built in one pass over the records.
+
+
+	@author	Fletcher T. Penney
+	@bug
+
+**/
+
+/*
+
+	Copyright © 2018 Fletcher T. Penney.
+
+
+	The `c-template` project is released under the MIT License.
+
+	GLibFacade.c and GLibFacade.h are from the MultiMarkdown v4 project:
+
+		https://github.com/fletcher/MultiMarkdown-4/
+
+	MMD 4 is released under both the MIT License and GPL.
+
+
+	CuTest is released under the zlib/libpng license. See CuTest.c for the text
+	of the license.
+
+
+	## The MIT License ##
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+
+*/
+
+
+#ifndef SPILL_TDP_PARSER_H
+#define SPILL_TDP_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef TEST
+	#include "CuTest.h"
+#endif
+
+#include "allocator.h"
+#include "d_string.h"
+#include "sink.h"
+
+
+#define kSpillThreshold 65536			//!< Default bytes buffered per column before spilling
+
+
+/// Output for one column
+struct spill_column {
+	DString		*	buffer;				//!< Output not yet spilled
+	DString		*	chunks;				//!< Offset and length (size_t pairs) of each spilled chunk
+	size_t			values;				//!< Number of values appended
+};
+
+typedef struct spill_column spill_column;
+
+
+/// A set of column buffers.  When a column buffer grows past the
+/// threshold it is appended to a shared temporary file, so memory use
+/// is bounded by the number of columns rather than columns times rows.
+struct spill {
+	const tdp_allocator	*	allocator;	//!< Allocator used for all storage
+	size_t			threshold;			//!< Bytes buffered per column before spilling
+
+	spill_column	*	columns;		//!< Columns
+	size_t			count;				//!< Number of columns
+	size_t			capacity;			//!< Size of columns array
+
+	FILE		*	file;				//!< Temporary file (created when needed)
+	size_t			file_size;			//!< Bytes written to temporary file
+	bool			failed;				//!< Temporary file could not be created or read
+	sink			string;				//!< Destination for current value
+};
+
+typedef struct spill spill;
+
+
+/// Create a set of column buffers
+spill * spill_new(
+	const tdp_allocator * allocator,	//!< Allocator to use (NULL to use heap)
+	size_t threshold					//!< Bytes buffered per column (0 for kSpillThreshold)
+);
+
+
+/// Free column buffers, and remove the temporary file
+void spill_free(
+	spill * s							//!< Column buffers to be freed
+);
+
+
+/// Add a column.  Returns false if memory could not be allocated.
+bool spill_add_column(
+	spill * s							//!< Column buffers
+);
+
+
+/// Start another value for `column`.  The returned sink receives the
+/// value, and is valid until the next call.
+sink * spill_append(
+	spill * s,							//!< Column buffers
+	size_t column						//!< Column index
+);
+
+
+/// Write everything appended to `column` to `out`, in order.  Returns
+/// false if spilled output could not be read back, or values were dropped
+/// because memory could not be allocated.
+bool spill_copy(
+	spill * s,							//!< Column buffers
+	size_t column,						//!< Column index
+	sink * out							//!< Destination
+);
+
+
+#endif
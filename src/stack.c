@@ -63,24 +63,32 @@
 /// Create a new stack with dynamic storage with an
 /// initial capacity (0 to use default capacity)
 stack * stack_new(int startingSize) {
-	stack * s = malloc(sizeof(stack));
+	return stack_new_with_allocator(NULL, startingSize);
+}
 
-	if (s) {
-		if (startingSize <= 0) {
-			startingSize = kStackStartingSize;
-		}
 
-		s->element = malloc(sizeof(void *) * startingSize);
+/// Create a new stack using the specified allocator
+stack * stack_new_with_allocator(const tdp_allocator * allocator, int startingSize) {
+	if (startingSize <= 0) {
+		startingSize = kStackStartingSize;
+	}
 
-		if (!s->element) {
-			free(s);
-			return NULL;
-		}
+	// Request both, so that an arena that is too small counts both
+	void ** element = tdp_malloc(allocator, sizeof(void *) * startingSize);
+	stack * s = tdp_malloc(allocator, sizeof(stack));
 
-		s->size = 0;
-		s->capacity = startingSize;
+	if (!s || !element) {
+		tdp_free(allocator, s);
+		tdp_free(allocator, element);
+		return NULL;
 	}
 
+	s->element = element;
+	s->allocator = allocator;
+
+	s->size = 0;
+	s->capacity = startingSize;
+
 	return s;
 }
 
@@ -88,20 +96,27 @@ stack * stack_new(int startingSize) {
 /// Free the stack
 void stack_free(stack * s) {
 	if (s) {
-		free(s->element);
-		free(s);
+		tdp_free(s->allocator, s->element);
+		tdp_free(s->allocator, s);
 	}
 }
 
 
 /// Add a new pointer to the stack
-void stack_push(stack * s, void * element) {
+bool stack_push(stack * s, void * element) {
 	if (s->size == s->capacity) {
+		void ** temp = tdp_realloc(s->allocator, s->element, s->capacity * 2 * sizeof(void *));
+
+		if (temp == NULL) {
+			return false;
+		}
+
+		s->element = temp;
 		s->capacity *= 2;
-		s->element = realloc(s->element, s->capacity * sizeof(void *));
 	}
 
 	s->element[s->size++] = element;
+	return true;
 }
 
 
@@ -127,6 +142,23 @@ void * stack_peek(stack * s) {
 }
 
 
+/// Ensure that the stack can hold `capacity` pointers without growing
+bool stack_reserve(stack * s, size_t capacity) {
+	if (capacity > s->capacity) {
+		void ** temp = tdp_realloc(s->allocator, s->element, capacity * sizeof(void *));
+
+		if (temp == NULL) {
+			return false;
+		}
+
+		s->element = temp;
+		s->capacity = capacity;
+	}
+
+	return true;
+}
+
+
 /// Peek at a specific index in the stack
 void * stack_peek_index(stack * s, size_t index) {
 	if (index >= s->size) {
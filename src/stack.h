@@ -56,13 +56,17 @@
 #ifndef STACK_SMART_STRING_H
 #define STACK_SMART_STRING_H
 
+#include <stdbool.h>
 #include <stdlib.h>
 
+#include "allocator.h"
+
 /// Structure for a stack
 struct stack {
 	size_t		size;				//!< Number of objects currently in stack
 	size_t		capacity;			//!< Total current capacity for stack
 	void 	**	element;			//!< Array of pointers to objects in stack
+	const tdp_allocator * allocator;	//!< Allocator for storage (NULL to use heap)
 };
 
 typedef struct stack stack;
@@ -75,19 +79,35 @@ stack * stack_new(
 );
 
 
+/// Create a new stack using the specified allocator
+stack * stack_new_with_allocator(
+	const tdp_allocator * allocator,	//!< Allocator to use (NULL to use heap)
+	int startingSize				//!< Default capacity for stack
+);
+
+
 /// Free the stack
 void stack_free(
 	stack * s						//!< Stack to be freed
 );
 
 
-/// Add a new pointer to the stack
-void stack_push(
+/// Add a new pointer to the stack.  Returns false if memory could not be
+/// allocated.
+bool stack_push(
 	stack * s,						//!< Stack to use
 	void * element					//!< Pointer to push onto stack
 );
 
 
+/// Ensure that the stack can hold `capacity` pointers without growing.
+/// Returns false if memory could not be allocated.
+bool stack_reserve(
+	stack * s,						//!< Stack to use
+	size_t capacity					//!< Number of pointers needed
+);
+
+
 /// Pop the top pointer off the stack and return it
 void * stack_pop(
 	stack * s						//!< Stack to examine